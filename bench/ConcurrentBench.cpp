@@ -0,0 +1,75 @@
+#include <benchmark/benchmark.h>
+#include "hyperloglog_concurrent.hpp"
+#include <mutex>
+
+using namespace hll;
+
+namespace {
+
+static const size_t BATCH = 4096;
+
+static ConcurrentHyperLogLog shared(16);
+
+static HyperLogLog merged(16);
+static std::mutex mergedLock;
+
+// every thread adds to one shared counter
+static void BM_ConcurrentAdd(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        shared.clear();
+    }
+    uint64_t keys[BATCH];
+    uint64_t next = uint64_t(state.thread_index()) << 40;
+    for (auto _ : state) {
+        for (size_t i = 0; i < BATCH; ++i) {
+            keys[i] = next++;
+        }
+        shared.addBatch((const char*)keys, sizeof(keys[0]), BATCH);
+    }
+    state.SetItemsProcessed(state.iterations() * BATCH);
+}
+
+// every thread adds to its own counter and merges it when done
+static void BM_PerThreadAddAndMerge(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        merged.clear();
+    }
+    HyperLogLog local(16);
+    uint64_t keys[BATCH];
+    uint64_t next = uint64_t(state.thread_index()) << 40;
+    for (auto _ : state) {
+        for (size_t i = 0; i < BATCH; ++i) {
+            keys[i] = next++;
+        }
+        local.addBatch((const char*)keys, sizeof(keys[0]), BATCH);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mergedLock);
+        merged.merge(local);
+    }
+    state.SetItemsProcessed(state.iterations() * BATCH);
+}
+
+// estimate() of the shared counter while the other threads add to it
+static void BM_EstimateDuringAdd(benchmark::State& state) {
+    uint64_t keys[BATCH];
+    uint64_t next = uint64_t(state.thread_index()) << 40;
+    for (auto _ : state) {
+        if (state.thread_index() == 0) {
+            benchmark::DoNotOptimize(shared.estimate());
+        } else {
+            for (size_t i = 0; i < BATCH; ++i) {
+                keys[i] = next++;
+            }
+            shared.addBatch((const char*)keys, sizeof(keys[0]), BATCH);
+        }
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_ConcurrentAdd)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_PerThreadAddAndMerge)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_EstimateDuringAdd)->ThreadRange(2, 16)->UseRealTime();
+
+BENCHMARK_MAIN();
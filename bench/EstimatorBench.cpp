@@ -0,0 +1,68 @@
+#include <benchmark/benchmark.h>
+#include "hyperloglog.hpp"
+#include <cmath>
+#include <vector>
+
+using namespace hll;
+
+namespace {
+
+static const uint8_t kBits = 12;
+static const size_t kTrials = 200;
+
+static uint64_t splitmix64(uint64_t& x) {
+    uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static HyperLogLog filled(size_t n, uint64_t seed) {
+    HyperLogLog hll(kBits, HASH_PREHASHED_64);
+    for (size_t i = 0; i < n; ++i) {
+        hll.addHash(splitmix64(seed));
+    }
+    return hll;
+}
+
+// argument 0: cardinality, argument 1: EstimatorType
+// Times one estimate and reports the relative bias, standard deviation and
+// RMSE of the estimator over kTrials independent counters.
+static void BM_Estimate(benchmark::State& state) {
+    const size_t n = state.range(0);
+    const EstimatorType estimator = static_cast<EstimatorType>(state.range(1));
+    std::vector<HyperLogLog> counters;
+    for (size_t t = 0; t < kTrials; ++t) {
+        counters.push_back(filled(n, t * 0x100000001B3ULL));
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(counters[0].estimate(estimator));
+    }
+    double sum = 0.0;
+    double sq = 0.0;
+    for (size_t t = 0; t < kTrials; ++t) {
+        const double err = counters[t].estimate(estimator) / n - 1.0;
+        sum += err;
+        sq += err * err;
+    }
+    const double bias = sum / kTrials;
+    state.counters["bias"] = bias;
+    state.counters["stddev"] = std::sqrt(sq / kTrials - bias * bias);
+    state.counters["rmse"] = std::sqrt(sq / kTrials);
+}
+
+static void estimatorArgs(benchmark::internal::Benchmark* b) {
+    // the classic estimator switches from linear counting at 2.5m = 10240
+    const int64_t counts[] = {10, 100, 1000, 5000, 8000, 10000, 12000, 20000, 50000, 100000, 1000000};
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        for (int64_t e = ESTIMATOR_CLASSIC; e <= ESTIMATOR_ML; ++e) {
+            b->Args({counts[c], e});
+        }
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_Estimate)->Apply(estimatorArgs);
+
+BENCHMARK_MAIN();
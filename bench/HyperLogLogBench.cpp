@@ -0,0 +1,206 @@
+#include <benchmark/benchmark.h>
+#include "hyperloglog.hpp"
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace hll;
+
+namespace {
+
+/**
+ * Counts the last level cache misses of the benchmark loop through
+ * perf_event_open(), and reports them per operation as "cache_misses".
+ * Without a PMU (most VMs) or permission (kernel.perf_event_paranoid) the
+ * counter is left out of the report.
+ */
+class CacheMisses {
+public:
+    CacheMisses() : fd_(-1) {
+#if defined(__linux__)
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fd_ >= 0) {
+            ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    ~CacheMisses() {
+#if defined(__linux__)
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+#endif
+    }
+
+    void report(benchmark::State& state) {
+#if defined(__linux__)
+        uint64_t misses = 0;
+        if (fd_ >= 0) {
+            ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd_, &misses, sizeof(misses)) == sizeof(misses)) {
+                state.counters["cache_misses"] = benchmark::Counter(misses, benchmark::Counter::kAvgIterations);
+            }
+        }
+#endif
+    }
+
+private:
+    int fd_;
+};
+
+static const size_t kKeys = 1 << 16; ///< distinct keys cycled through by the add benchmarks
+
+// kKeys keys of 'len' bytes stored back to back
+static std::vector<char> makeKeys(size_t len) {
+    std::vector<char> keys(kKeys * len);
+    uint64_t x = 88172645463325252ULL;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        keys[i] = (char) x;
+    }
+    return keys;
+}
+
+template<typename Counter>
+static Counter filled(uint8_t b, uint64_t n, uint64_t offset = 0) {
+    Counter hll(b);
+    for (uint64_t i = 0; i < n; ++i) {
+        const uint64_t v = offset + i;
+        hll.add((const char*)&v, sizeof(v));
+    }
+    return hll;
+}
+
+// args: b, key length
+template<typename Counter>
+static void BM_Add(benchmark::State& state) {
+    const uint8_t b = state.range(0);
+    const uint32_t len = state.range(1);
+    const std::vector<char> keys = makeKeys(len);
+    Counter hll(b);
+    size_t i = 0;
+    CacheMisses misses;
+    for (auto _ : state) {
+        hll.add(&keys[i * len], len);
+        i = (i + 1) & (kKeys - 1);
+    }
+    misses.report(state);
+    benchmark::DoNotOptimize(hll.estimate());
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * len);
+}
+
+// args: b
+template<typename Counter>
+static void BM_Merge(benchmark::State& state) {
+    const uint8_t b = state.range(0);
+    const Counter src = filled<Counter>(b, 100000, 0);
+    const Counter base = filled<Counter>(b, 100000, 50000);
+    Counter dst(base);
+    CacheMisses misses;
+    for (auto _ : state) {
+        dst.merge(src);
+        benchmark::ClobberMemory();
+    }
+    misses.report(state);
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * (int64_t(1) << b));
+}
+
+// args: b
+template<typename Counter>
+static void BM_Estimate(benchmark::State& state) {
+    const uint8_t b = state.range(0);
+    const Counter hll = filled<Counter>(b, 100000);
+    CacheMisses misses;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hll.estimate());
+    }
+    misses.report(state);
+    state.SetItemsProcessed(state.iterations());
+}
+
+// args: b, estimator; the improved and ML estimators scan the registers
+static void BM_EstimateWith(benchmark::State& state) {
+    const uint8_t b = state.range(0);
+    const EstimatorType estimator = static_cast<EstimatorType>(state.range(1));
+    const HyperLogLog hll = filled<HyperLogLog>(b, 100000);
+    CacheMisses misses;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hll.estimate(estimator));
+    }
+    misses.report(state);
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * (int64_t(1) << b));
+}
+
+// args: b
+template<typename Counter>
+static void BM_Dump(benchmark::State& state) {
+    const uint8_t b = state.range(0);
+    const Counter hll = filled<Counter>(b, 100000);
+    std::stringstream ss;
+    CacheMisses misses;
+    for (auto _ : state) {
+        ss.str(std::string());
+        hll.dump(ss);
+    }
+    misses.report(state);
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * ss.str().size());
+}
+
+// args: b
+template<typename Counter>
+static void BM_Restore(benchmark::State& state) {
+    const uint8_t b = state.range(0);
+    std::stringstream image;
+    filled<Counter>(b, 100000).dump(image);
+    const std::string bytes = image.str();
+    Counter hll(b);
+    CacheMisses misses;
+    for (auto _ : state) {
+        std::stringstream ss(bytes);
+        hll.restore(ss);
+    }
+    misses.report(state);
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+
+}
+
+#define HLL_BENCH_BITS benchmark::CreateDenseRange(4, 18, 2)
+
+BENCHMARK_TEMPLATE(BM_Add, HyperLogLog)->ArgsProduct({HLL_BENCH_BITS, {8, 64, 512}})->ArgNames({"b", "len"});
+BENCHMARK_TEMPLATE(BM_Add, HyperLogLogHIP)->ArgsProduct({HLL_BENCH_BITS, {8, 64, 512}})->ArgNames({"b", "len"});
+BENCHMARK_TEMPLATE(BM_Merge, HyperLogLog)->ArgsProduct({HLL_BENCH_BITS})->ArgNames({"b"});
+BENCHMARK_TEMPLATE(BM_Merge, HyperLogLogHIP)->ArgsProduct({HLL_BENCH_BITS})->ArgNames({"b"});
+BENCHMARK_TEMPLATE(BM_Estimate, HyperLogLog)->ArgsProduct({HLL_BENCH_BITS})->ArgNames({"b"});
+BENCHMARK_TEMPLATE(BM_Estimate, HyperLogLogHIP)->ArgsProduct({HLL_BENCH_BITS})->ArgNames({"b"});
+BENCHMARK(BM_EstimateWith)->ArgsProduct({HLL_BENCH_BITS, {ESTIMATOR_IMPROVED, ESTIMATOR_ML}})->ArgNames({"b", "estimator"});
+BENCHMARK_TEMPLATE(BM_Dump, HyperLogLog)->ArgsProduct({HLL_BENCH_BITS})->ArgNames({"b"});
+BENCHMARK_TEMPLATE(BM_Dump, HyperLogLogHIP)->ArgsProduct({HLL_BENCH_BITS})->ArgNames({"b"});
+BENCHMARK_TEMPLATE(BM_Restore, HyperLogLog)->ArgsProduct({HLL_BENCH_BITS})->ArgNames({"b"});
+BENCHMARK_TEMPLATE(BM_Restore, HyperLogLogHIP)->ArgsProduct({HLL_BENCH_BITS})->ArgNames({"b"});
+
+BENCHMARK_MAIN();
@@ -0,0 +1,68 @@
+#include <benchmark/benchmark.h>
+#include "hyperloglog.hpp"
+#include <vector>
+
+using namespace hll;
+
+namespace {
+
+// 64 "hourly" counters with partly overlapping elements
+static const std::vector<HyperLogLog>& sources() {
+    static std::vector<HyperLogLog> parts;
+    if (parts.empty()) {
+        for (uint64_t p = 0; p < 64; ++p) {
+            parts.push_back(HyperLogLog(16));
+            for (uint64_t i = 0; i < 200000; ++i) {
+                const uint64_t v = p * 100000 + i;
+                parts[p].add((const char*)&v, sizeof(v));
+            }
+        }
+    }
+    return parts;
+}
+
+static void setCounters(benchmark::State& state, size_t n) {
+    state.SetItemsProcessed(state.iterations() * n * (1 << 16));
+    state.SetBytesProcessed(state.iterations() * n * (1 << 16));
+}
+
+// merge() called once per source, as before mergeMany()
+static void BM_MergeLoop(benchmark::State& state) {
+    const std::vector<HyperLogLog>& parts = sources();
+    simd::setIsa(static_cast<simd::Isa>(state.range(0)));
+    HyperLogLog dst(16);
+    for (auto _ : state) {
+        dst.clear();
+        for (size_t p = 0; p < parts.size(); ++p) {
+            dst.merge(parts[p]);
+        }
+        benchmark::DoNotOptimize(dst.estimate());
+    }
+    setCounters(state, parts.size());
+    simd::setIsa(simd::detectIsa());
+}
+
+static void BM_MergeMany(benchmark::State& state) {
+    const std::vector<HyperLogLog>& parts = sources();
+    std::vector<const HyperLogLog*> ptrs;
+    for (size_t p = 0; p < parts.size(); ++p) {
+        ptrs.push_back(&parts[p]);
+    }
+    simd::setIsa(static_cast<simd::Isa>(state.range(0)));
+    HyperLogLog dst(16);
+    for (auto _ : state) {
+        dst.clear();
+        dst.mergeMany(&ptrs[0], ptrs.size());
+        benchmark::DoNotOptimize(dst.estimate());
+    }
+    setCounters(state, parts.size());
+    simd::setIsa(simd::detectIsa());
+}
+
+} // namespace
+
+// argument: instruction set level (0: scalar, 1: AVX2, 2: AVX-512)
+BENCHMARK(BM_MergeLoop)->DenseRange(simd::ISA_SCALAR, simd::ISA_AVX512);
+BENCHMARK(BM_MergeMany)->DenseRange(simd::ISA_SCALAR, simd::ISA_AVX512);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,81 @@
+#include <benchmark/benchmark.h>
+#include "hyperloglog_parallel.hpp"
+
+using namespace hll;
+
+namespace {
+
+static const uint8_t kBits = 24; ///< 16 MiB of registers
+
+static HyperLogLog filled(uint64_t n, uint64_t offset) {
+    HyperLogLog hll(kBits, HASH_WYHASH_64);
+    for (uint64_t i = 0; i < n; ++i) {
+        hll.addHash((offset + i) * 0x9E3779B97F4A7C15ULL);
+    }
+    return hll;
+}
+
+// args: threads (0: the serial member function)
+static void BM_Merge(benchmark::State& state) {
+    const HyperLogLog src = filled(1 << 24, 0);
+    HyperLogLog dst = filled(1 << 24, 1 << 23);
+    ThreadPool pool(state.range(0));
+    for (auto _ : state) {
+        if (state.range(0) == 0) {
+            dst.merge(src);
+        } else {
+            HyperLogLogParallel::merge(dst, src, std::ref(pool));
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(state.iterations() * (int64_t(1) << kBits));
+}
+
+static void BM_EstimateExact(benchmark::State& state) {
+    const HyperLogLog hll = filled(1 << 24, 0);
+    ThreadPool pool(state.range(0));
+    for (auto _ : state) {
+        if (state.range(0) == 0) {
+            benchmark::DoNotOptimize(hll.estimateExact());
+        } else {
+            benchmark::DoNotOptimize(HyperLogLogParallel::estimateExact(hll, std::ref(pool)));
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * (int64_t(1) << kBits));
+}
+
+static void BM_EstimateML(benchmark::State& state) {
+    const HyperLogLog hll = filled(1 << 24, 0);
+    ThreadPool pool(state.range(0));
+    for (auto _ : state) {
+        if (state.range(0) == 0) {
+            benchmark::DoNotOptimize(hll.estimate(ESTIMATOR_ML));
+        } else {
+            benchmark::DoNotOptimize(HyperLogLogParallel::estimate(hll, ESTIMATOR_ML, std::ref(pool)));
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * (int64_t(1) << kBits));
+}
+
+static void BM_Clear(benchmark::State& state) {
+    HyperLogLog hll = filled(1 << 20, 0);
+    ThreadPool pool(state.range(0));
+    for (auto _ : state) {
+        if (state.range(0) == 0) {
+            hll.clear();
+        } else {
+            HyperLogLogParallel::clear(hll, std::ref(pool));
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(state.iterations() * (int64_t(1) << kBits));
+}
+
+}
+
+BENCHMARK(BM_Merge)->Arg(0)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->ArgName("threads")->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_EstimateExact)->Arg(0)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->ArgName("threads")->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_EstimateML)->Arg(0)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->ArgName("threads")->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Clear)->Arg(0)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->ArgName("threads")->UseRealTime()->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
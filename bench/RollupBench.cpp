@@ -0,0 +1,111 @@
+#include <benchmark/benchmark.h>
+#include "hyperloglog_rollup.hpp"
+
+using namespace hll;
+
+namespace {
+
+static const uint8_t kBits = 12;
+static const uint64_t kMonth = 30 * 24 * 60; ///< minutes
+
+// per-minute counters with 200 distinct users each, a quarter shared across minutes
+static const std::vector<HyperLogLog>& minutes() {
+    static std::vector<HyperLogLog> sketches;
+    if (sketches.empty()) {
+        sketches.reserve(kMonth);
+        for (uint64_t t = 0; t < kMonth; ++t) {
+            HyperLogLog hll(kBits, HASH_WYHASH_64, true);
+            for (uint64_t i = 0; i < 200; ++i) {
+                const uint64_t user = (i < 150) ? t * 1000 + i : i * 7919;
+                hll.addHash(hashElement(HASH_WYHASH_64, (const char*)&user, sizeof(user)));
+            }
+            sketches.push_back(hll);
+        }
+    }
+    return sketches;
+}
+
+static const RollupHyperLogLog& rollup() {
+    static RollupHyperLogLog r(kBits, HASH_WYHASH_64);
+    if (r.nodeCount(0) == 0) {
+        const std::vector<HyperLogLog>& m = minutes();
+        for (uint64_t t = 0; t < kMonth; ++t) {
+            r.insert(m[t], t);
+        }
+    }
+    return r;
+}
+
+// args: range length in minutes; ranges start 7 minutes past an hour
+static void BM_RollupQuery(benchmark::State& state) {
+    const RollupHyperLogLog& r = rollup();
+    const uint64_t len = state.range(0);
+    const uint64_t from = std::min<uint64_t>(7, kMonth - len);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(r.estimate(from, from + len));
+    }
+    std::vector<const HyperLogLog*> nodes;
+    r.cover(from, from + len, nodes);
+    state.counters["merges"] = nodes.size();
+}
+
+static void BM_NaiveQuery(benchmark::State& state) {
+    const std::vector<HyperLogLog>& m = minutes();
+    const uint64_t len = state.range(0);
+    const uint64_t from = std::min<uint64_t>(7, kMonth - len);
+    std::vector<const HyperLogLog*> nodes(len);
+    for (uint64_t t = 0; t < len; ++t) {
+        nodes[t] = &m[from + t];
+    }
+    for (auto _ : state) {
+        HyperLogLog hll(kBits, HASH_WYHASH_64, true);
+        hll.mergeMany(&nodes[0], nodes.size());
+        benchmark::DoNotOptimize(hll.estimate());
+    }
+    state.counters["merges"] = len;
+}
+
+// cost of sealing one minute: a merge into the minute and each ancestor
+static void BM_RollupInsert(benchmark::State& state) {
+    const std::vector<HyperLogLog>& m = minutes();
+    RollupHyperLogLog r(kBits, HASH_WYHASH_64);
+    uint64_t t = 0;
+    for (auto _ : state) {
+        if (t == kMonth) {
+            state.PauseTiming();
+            r.clear();
+            t = 0;
+            state.ResumeTiming();
+        }
+        r.insert(m[t], t);
+        t++;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// the same minutes kept in a flat map, as a naive store would
+static void BM_NaiveInsert(benchmark::State& state) {
+    const std::vector<HyperLogLog>& m = minutes();
+    std::map<uint64_t, HyperLogLog> flat;
+    uint64_t t = 0;
+    for (auto _ : state) {
+        if (t == kMonth) {
+            state.PauseTiming();
+            flat.clear();
+            t = 0;
+            state.ResumeTiming();
+        }
+        flat[t] = m[t];
+        t++;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+}
+
+BENCHMARK(BM_RollupQuery)->Arg(60)->Arg(24 * 60)->Arg(7 * 24 * 60)->Arg(kMonth - 7)->ArgName("minutes")->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_NaiveQuery)->Arg(60)->Arg(24 * 60)->Arg(7 * 24 * 60)->Arg(kMonth - 7)->ArgName("minutes")->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_RollupInsert);
+BENCHMARK(BM_NaiveInsert);
+
+BENCHMARK_MAIN();
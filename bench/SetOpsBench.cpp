@@ -0,0 +1,86 @@
+#include <benchmark/benchmark.h>
+#include "hyperloglog_setops.hpp"
+#include <vector>
+
+using namespace hll;
+
+namespace {
+
+static std::vector<HyperLogLog> segments(size_t count, uint8_t b) {
+    std::vector<HyperLogLog> parts;
+    for (size_t p = 0; p < count; ++p) {
+        parts.push_back(HyperLogLog(b, HASH_WYHASH_64));
+        for (uint64_t i = 0; i < 100000; ++i) {
+            const uint64_t v = p * 50000 + i;
+            parts[p].add((const char*)&v, sizeof(v));
+        }
+    }
+    return parts;
+}
+
+// copy, merge and estimate, for comparison; argument 0: b
+static void BM_UnionByMerge(benchmark::State& state) {
+    const std::vector<HyperLogLog> parts = segments(2, state.range(0));
+    for (auto _ : state) {
+        HyperLogLog u(parts[0]);
+        u.merge(parts[1]);
+        benchmark::DoNotOptimize(u.estimate());
+    }
+    state.SetBytesProcessed(state.iterations() * 2 * parts[0].registerSize());
+}
+
+static void BM_UnionEstimate(benchmark::State& state) {
+    const std::vector<HyperLogLog> parts = segments(2, state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(HyperLogLogSetOps::unionEstimate(parts[0], parts[1]));
+    }
+    state.SetBytesProcessed(state.iterations() * 2 * parts[0].registerSize());
+}
+
+static void BM_JointEstimate(benchmark::State& state) {
+    const std::vector<HyperLogLog> parts = segments(2, state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(HyperLogLogSetOps::jointEstimate(parts[0], parts[1]).both);
+    }
+}
+
+// all pairs of argument 0 counters with b = argument 1, one pair at a time
+static void BM_PairsByUnionEstimate(benchmark::State& state) {
+    const size_t n = state.range(0);
+    const std::vector<HyperLogLog> parts = segments(n, state.range(1));
+    std::vector<double> out(n * n);
+    for (auto _ : state) {
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = i + 1; j < n; ++j) {
+                out[i * n + j] = HyperLogLogSetOps::unionEstimate(parts[i], parts[j]);
+            }
+        }
+        benchmark::DoNotOptimize(&out[0]);
+    }
+    state.counters["pairs/s"] = benchmark::Counter(n * (n - 1) / 2, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+static void BM_PairwiseMatrix(benchmark::State& state) {
+    const size_t n = state.range(0);
+    const std::vector<HyperLogLog> parts = segments(n, state.range(1));
+    std::vector<const HyperLogLog*> ptrs;
+    for (size_t i = 0; i < n; ++i) {
+        ptrs.push_back(&parts[i]);
+    }
+    std::vector<double> out(n * n);
+    for (auto _ : state) {
+        HyperLogLogSetOps::pairwise(&ptrs[0], n, SET_UNION, &out[0]);
+        benchmark::DoNotOptimize(&out[0]);
+    }
+    state.counters["pairs/s"] = benchmark::Counter(n * (n - 1) / 2, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+} // namespace
+
+BENCHMARK(BM_UnionByMerge)->Arg(10)->Arg(14)->Arg(18);
+BENCHMARK(BM_UnionEstimate)->Arg(10)->Arg(14)->Arg(18);
+BENCHMARK(BM_JointEstimate)->Arg(10)->Arg(14);
+BENCHMARK(BM_PairsByUnionEstimate)->Args({64, 14})->Args({32, 18});
+BENCHMARK(BM_PairwiseMatrix)->Args({64, 14})->Args({32, 18});
+
+BENCHMARK_MAIN();
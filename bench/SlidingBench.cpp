@@ -0,0 +1,74 @@
+#include <benchmark/benchmark.h>
+#include "hyperloglog_sliding.hpp"
+#include <vector>
+
+using namespace hll;
+
+namespace {
+
+static const uint64_t kPerSecond = 10000; ///< elements per time unit
+static const uint64_t kHour = 3600;
+
+// plain add(), for comparison
+static void BM_Add(benchmark::State& state) {
+    HyperLogLog hll(12, HASH_WYHASH_64);
+    uint64_t i = 0;
+    for (auto _ : state) {
+        hll.add((const char*)&i, sizeof(i));
+        ++i;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_SlidingAdd(benchmark::State& state) {
+    SlidingHyperLogLog sliding(12, kHour, HASH_WYHASH_64);
+    uint64_t i = 0;
+    for (auto _ : state) {
+        sliding.add((const char*)&i, sizeof(i), i / kPerSecond);
+        ++i;
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["entries"] = sliding.entryCount();
+    state.counters["memory_bytes"] = sliding.memoryUsage();
+}
+
+// the last hour from a ring of 60 one-minute counters merged on query, for comparison
+static void BM_RingEstimate(benchmark::State& state) {
+    std::vector<HyperLogLog> ring(60, HyperLogLog(12, HASH_WYHASH_64));
+    for (uint64_t i = 0; i < 2 * kHour * kPerSecond / 10; ++i) {
+        const uint64_t v = i * 10;
+        ring[(v / kPerSecond / 60) % 60].add((const char*)&v, sizeof(v));
+    }
+    for (auto _ : state) {
+        HyperLogLog hll(ring[0]);
+        for (size_t r = 1; r < ring.size(); ++r) {
+            hll.merge(ring[r]);
+        }
+        benchmark::DoNotOptimize(hll.estimate());
+    }
+}
+
+// argument 0: window
+static void BM_SlidingEstimate(benchmark::State& state) {
+    SlidingHyperLogLog sliding(12, kHour, HASH_WYHASH_64);
+    uint64_t now = 0;
+    for (uint64_t i = 0; i < 2 * kHour * kPerSecond / 10; ++i) {
+        const uint64_t v = i * 10;
+        now = v / kPerSecond;
+        sliding.add((const char*)&v, sizeof(v), now);
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sliding.estimate(state.range(0), now));
+    }
+    state.counters["entries"] = sliding.entryCount();
+    state.counters["memory_bytes"] = sliding.memoryUsage();
+}
+
+} // namespace
+
+BENCHMARK(BM_Add);
+BENCHMARK(BM_SlidingAdd);
+BENCHMARK(BM_RingEstimate);
+BENCHMARK(BM_SlidingEstimate)->Arg(300)->Arg(kHour);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,78 @@
+#include <benchmark/benchmark.h>
+#include "hyperloglog_store.hpp"
+#include <unordered_map>
+#include <vector>
+
+using namespace hll;
+
+namespace {
+
+static const size_t kEvents = 1 << 20; ///< (key, element) pairs per iteration, 4 iterations so memory compares
+
+// keys drawn from state.range(0) keys, Zipf-like: a few heavy keys and a long tail
+static std::vector<uint64_t> makeKeys(size_t keyCount) {
+    std::vector<uint64_t> keys(kEvents);
+    uint64_t x = 88172645463325252ULL;
+    for (size_t i = 0; i < kEvents; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        const uint64_t r = x % keyCount;
+        keys[i] = (i & 1) ? r : r * r / keyCount;
+    }
+    return keys;
+}
+
+// one sparse HyperLogLog per key in a hash map, for comparison
+static void BM_UnorderedMap(benchmark::State& state) {
+    const std::vector<uint64_t> keys = makeKeys(state.range(0));
+    std::unordered_map<uint64_t, HyperLogLog> map;
+    uint64_t v = 0;
+    for (auto _ : state) {
+        for (size_t i = 0; i < kEvents; ++i, ++v) {
+            map.emplace(keys[i], HyperLogLog(12, HASH_WYHASH_64, true)).first->second.addHash(v * 0x9E3779B97F4A7C15ULL);
+        }
+    }
+    size_t bytes = map.bucket_count() * sizeof(void*);
+    for (std::unordered_map<uint64_t, HyperLogLog>::const_iterator it = map.begin(); it != map.end(); ++it) {
+        bytes += sizeof(*it) + sizeof(void*) + it->second.memoryUsage();
+    }
+    state.SetItemsProcessed(state.iterations() * kEvents);
+    state.counters["bytes_per_key"] = double(bytes) / map.size();
+}
+
+static void BM_StoreAdd(benchmark::State& state) {
+    const std::vector<uint64_t> keys = makeKeys(state.range(0));
+    SketchStore<uint64_t> store(12, HASH_WYHASH_64);
+    uint64_t v = 0;
+    for (auto _ : state) {
+        for (size_t i = 0; i < kEvents; ++i, ++v) {
+            store.addHash(keys[i], v * 0x9E3779B97F4A7C15ULL);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * kEvents);
+    state.counters["bytes_per_key"] = double(store.memoryUsage()) / store.size();
+}
+
+static void BM_StoreAddHashes(benchmark::State& state) {
+    const std::vector<uint64_t> keys = makeKeys(state.range(0));
+    SketchStore<uint64_t> store(12, HASH_WYHASH_64);
+    std::vector<uint64_t> values(kEvents);
+    uint64_t v = 0;
+    for (auto _ : state) {
+        for (size_t i = 0; i < kEvents; ++i, ++v) {
+            values[i] = v * 0x9E3779B97F4A7C15ULL;
+        }
+        store.addHashes(&keys[0], &values[0], kEvents);
+    }
+    state.SetItemsProcessed(state.iterations() * kEvents);
+    state.counters["bytes_per_key"] = double(store.memoryUsage()) / store.size();
+}
+
+}
+
+BENCHMARK(BM_UnorderedMap)->Arg(10000)->Arg(1000000)->Iterations(4)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_StoreAdd)->Arg(10000)->Arg(1000000)->Iterations(4)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_StoreAddHashes)->Arg(10000)->Arg(1000000)->Iterations(4)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,81 @@
+#include <benchmark/benchmark.h>
+#include "hyperloglog_wire.hpp"
+#include <sstream>
+#include <vector>
+
+using namespace hll;
+
+namespace {
+
+static HyperLogLog filled(size_t n) {
+    HyperLogLog hll(16);
+    for (uint64_t i = 0; i < n; ++i) {
+        hll.add((const char*)&i, sizeof(i));
+    }
+    return hll;
+}
+
+static void setCounters(benchmark::State& state, const HyperLogLog& hll, size_t size) {
+    std::stringstream ss;
+    hll.dump(ss);
+    state.counters["wire_bytes"] = size;
+    state.counters["dump_bytes"] = ss.str().size();
+    state.SetBytesProcessed(state.iterations() * hll.registerSize());
+}
+
+// argument 0: cardinality, argument 1: WireEncoding
+static void BM_Encode(benchmark::State& state) {
+    const HyperLogLog hll = filled(state.range(0));
+    const WireEncoding encoding = static_cast<WireEncoding>(state.range(1));
+    std::vector<uint8_t> buf(HyperLogLogWire::encodedSize(hll, encoding));
+    size_t size = 0;
+    for (auto _ : state) {
+        size = HyperLogLogWire::encode(hll, &buf[0], buf.size(), encoding);
+        benchmark::DoNotOptimize(&buf[0]);
+    }
+    setCounters(state, hll, size);
+}
+
+static void BM_DecodeMerge(benchmark::State& state) {
+    const HyperLogLog hll = filled(state.range(0));
+    const WireEncoding encoding = static_cast<WireEncoding>(state.range(1));
+    std::vector<uint8_t> buf(HyperLogLogWire::encodedSize(hll, encoding));
+    const size_t size = HyperLogLogWire::encode(hll, &buf[0], buf.size(), encoding);
+    HyperLogLog dst(16);
+    for (auto _ : state) {
+        dst.clear();
+        HyperLogLogWire::decodeMerge(&buf[0], size, dst);
+        benchmark::DoNotOptimize(dst.estimate());
+    }
+    setCounters(state, hll, size);
+}
+
+// dump() and restore() through a stringstream, for comparison
+static void BM_DumpRestore(benchmark::State& state) {
+    const HyperLogLog hll = filled(state.range(0));
+    HyperLogLog dst(16);
+    for (auto _ : state) {
+        std::stringstream ss;
+        hll.dump(ss);
+        dst.restore(ss);
+        benchmark::DoNotOptimize(dst.estimate());
+    }
+    setCounters(state, hll, 0);
+}
+
+static void wireArgs(benchmark::internal::Benchmark* b) {
+    const int64_t counts[] = {1000, 100000, 10000000};
+    for (size_t c = 0; c < 3; ++c) {
+        for (int64_t e = WIRE_AUTO; e <= WIRE_NIBBLE; ++e) {
+            b->Args({counts[c], e});
+        }
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_Encode)->Apply(wireArgs);
+BENCHMARK(BM_DecodeMerge)->Apply(wireArgs);
+BENCHMARK(BM_DumpRestore)->Arg(1000)->Arg(100000)->Arg(10000000);
+
+BENCHMARK_MAIN();
@@ -10,16 +10,20 @@
 
 #include <vector>
 #include <cmath>
+#include <limits>
 #include <sstream>
 #include <stdexcept>
 #include <algorithm>
+#include <cstring>
 #include "murmur3.h"
+#include "wyhash.h"
 
 #define HLL_HASH_SEED 313
 
 #if defined(__has_builtin) && (defined(__GNUC__) || defined(__clang__))
 
-#define _GET_CLZ(x, b) (uint8_t)std::min(b, ::__builtin_clz(x)) + 1
+#define _GET_CLZ(x, b) (uint8_t)std::min(b, (x) ? ::__builtin_clz(x) : 32) + 1
+#define _GET_CLZ64(x, b) (uint8_t)std::min(b, (x) ? ::__builtin_clzll(x) : 64) + 1
 
 #else
 
@@ -41,17 +45,506 @@ inline uint8_t _get_leading_zero_count(uint32_t x, uint8_t b) {
 
 }
 #define _GET_CLZ(x, b) _get_leading_zero_count(x, b)
+
+inline uint8_t _get_leading_zero_count64(uint64_t x, uint8_t b) {
+    uint8_t v = 1;
+    while (v <= b && !(x & 0x8000000000000000ULL)) {
+        v++;
+        x <<= 1;
+    }
+    return v;
+}
+#define _GET_CLZ64(x, b) _get_leading_zero_count64(x, b)
 #endif /* defined(__GNUC__) */
 
+#include "hyperloglog_simd.hpp"
+#include "hyperloglog_stats.hpp"
+
+#define HLL_BATCH_SIZE 256
+
+#define HLL_MERGE_BLOCK_SIZE 8192 ///< registers merged from every source at a time by mergeMany()
+
+#define HLL_SPARSE_MAX_BIT_WIDTH 26 ///< sparse entries keep the index above a 6 bit rank
+#define HLL_SPARSE_MAX_ENTRIES 8192 ///< upper bound of sparse entries before converting to dense
+
 namespace hll {
 
 static const double pow_2_32 = 4294967296.0; ///< 2^32
 static const double neg_pow_2_32 = -4294967296.0; ///< -(2^32)
 
+/**
+ * Hash functions a counter can be built with.
+ * The hash function is recorded by dump(), and counters built with
+ * different hash functions can't be merged.
+ */
+enum HashType {
+    HASH_MURMUR3_X86_32 = 0, ///< MurmurHash3_x86_32 (default)
+    HASH_MURMUR3_X64_128 = 1, ///< lower 64 bits of MurmurHash3_x64_128
+    HASH_WYHASH_64 = 2, ///< wyhash, faster than MurmurHash3 on short keys
+    HASH_PREHASHED_64 = 3 ///< none: elements are 64 bit hash values computed by the caller
+};
+
+/**
+ * Returns whether a value read from a header is a HashType.
+ */
+inline bool isHashType(unsigned hash) {
+    return hash <= HASH_PREHASHED_64;
+}
+
+/**
+ * Returns the number of bits of the values of a hash function.
+ */
+inline uint8_t hashBits(HashType hash) {
+    return hash == HASH_MURMUR3_X86_32 ? 32 : 64;
+}
+
+/**
+ * Returns the largest register value of a counter: the rank of a hash whose
+ * bits below the index are all zero.
+ *
+ * @param[in] b register bit width
+ * @param[in] hash hash function
+ *
+ * @return Largest register value
+ */
+inline uint8_t maxRank(uint8_t b, HashType hash) {
+    return hashBits(hash) - b + 1;
+}
+
+/**
+ * Hashes an element. Adding the element to a counter is the same as
+ * adding this value with addHash().
+ *
+ * @param[in] hash hash function
+ * @param[in] str element
+ * @param[in] len length of the element
+ *
+ * @return Hash value; with HASH_MURMUR3_X86_32 only the lower 32 bits are set,
+ *         with HASH_PREHASHED_64 the first 8 bytes of the element (zero padded)
+ */
+inline uint64_t hashElement(HashType hash, const char* str, uint32_t len) {
+    switch (hash) {
+        case HASH_MURMUR3_X86_32: {
+            uint32_t value;
+            MurmurHash3_x86_32(str, len, HLL_HASH_SEED, (void*) &value);
+            return value;
+        }
+        case HASH_MURMUR3_X64_128: {
+            uint64_t value[2];
+            MurmurHash3_x64_128(str, len, HLL_HASH_SEED, (void*) value);
+            return value[0];
+        }
+        case HASH_WYHASH_64:
+            return wyhash64(str, len, HLL_HASH_SEED);
+        default: {
+            uint64_t value = 0;
+            std::memcpy(&value, str, std::min(len, (uint32_t) sizeof(value)));
+            return value;
+        }
+    }
+}
+
+/**
+ * Splits a hash value into register index and rank.
+ *
+ * @param[in] hash hash function the value comes from
+ * @param[in] b register bit width
+ * @param[in] value hash value (the lower 32 bits with HASH_MURMUR3_X86_32)
+ * @param[out] index register index
+ * @param[out] rank position of the leftmost 1-bit after the index bits
+ */
+inline void indexRankHash(HashType hash, uint8_t b, uint64_t value, uint32_t& index, uint8_t& rank) {
+    if (hash == HASH_MURMUR3_X86_32) {
+        simd::indexRank32((uint32_t) value, b, index, rank);
+    } else {
+        simd::indexRank64(value, b, index, rank);
+    }
+}
+
+/**
+ * Hashes a string and splits the hash value into register index and rank.
+ *
+ * @param[in] hash hash function
+ * @param[in] b register bit width
+ * @param[in] str string to hash
+ * @param[in] len length of string
+ * @param[out] index register index
+ * @param[out] rank position of the leftmost 1-bit after the index bits
+ */
+inline void indexRank(HashType hash, uint8_t b, const char* str, uint32_t len, uint32_t& index, uint8_t& rank) {
+    indexRankHash(hash, b, hashElement(hash, str, len), index, rank);
+}
+
+/**
+ * indexRankHash() of up to HLL_BATCH_SIZE hash values.
+ */
+inline void indexRankHashes(HashType hash, uint8_t b, const uint64_t* values, size_t n,
+        uint32_t* index, uint8_t* rank) {
+    if (hash == HASH_MURMUR3_X86_32) {
+        uint32_t hashes[HLL_BATCH_SIZE];
+        for (size_t i = 0; i < n; ++i) {
+            hashes[i] = (uint32_t) values[i];
+        }
+        simd::indexRank32(hashes, n, b, index, rank);
+    } else {
+        simd::indexRank64(values, n, b, index, rank);
+    }
+}
+
+/**
+ * indexRank() of up to HLL_BATCH_SIZE strings.
+ */
+inline void indexRankBatch(HashType hash, uint8_t b, const char* const* strs, const uint32_t* lens, size_t n,
+        uint32_t* index, uint8_t* rank) {
+    if (hash == HASH_MURMUR3_X86_32) {
+        uint32_t hashes[HLL_BATCH_SIZE];
+        for (size_t i = 0; i < n; ++i) {
+            MurmurHash3_x86_32(strs[i], lens[i], HLL_HASH_SEED, (void*) &hashes[i]);
+        }
+        simd::indexRank32(hashes, n, b, index, rank);
+    } else {
+        uint64_t hashes[HLL_BATCH_SIZE];
+        for (size_t i = 0; i < n; ++i) {
+            hashes[i] = hashElement(hash, strs[i], lens[i]);
+        }
+        simd::indexRank64(hashes, n, b, index, rank);
+    }
+}
+
+/**
+ * indexRank() of up to HLL_BATCH_SIZE fixed-width strings stored back to back.
+ */
+inline void indexRankBatch(HashType hash, uint8_t b, const char* keys, uint32_t len, size_t n,
+        uint32_t* index, uint8_t* rank) {
+    if (hash == HASH_MURMUR3_X86_32) {
+        uint32_t hashes[HLL_BATCH_SIZE];
+        simd::murmur3Fixed(keys, len, n, HLL_HASH_SEED, hashes);
+        simd::indexRank32(hashes, n, b, index, rank);
+    } else {
+        uint64_t hashes[HLL_BATCH_SIZE];
+        for (size_t i = 0; i < n; ++i) {
+            hashes[i] = hashElement(hash, keys + i * len, len);
+        }
+        simd::indexRank64(hashes, n, b, index, rank);
+    }
+}
+
+/**
+ * Returns the rank of a register after its index lost the low 'd' bits
+ * 'low', i.e. after lowering the bit width by 'd' (see HyperLogLog::fold()).
+ * The dropped index bits become the leading bits of the rank part of the hash.
+ *
+ * @param[in] low low d bits of the index
+ * @param[in] rank rank at the higher bit width, not 0
+ * @param[in] d number of bits dropped, in [1, 26]
+ *
+ * @return Rank at the lower bit width
+ */
+inline uint8_t foldRank(uint32_t low, uint8_t rank, uint8_t d) {
+    return low != 0 ? _GET_CLZ(low << (32 - d), (int) d) : d + rank;
+}
+
+/**
+ * Returns the register that the 2^d registers at 'registers' fold into when
+ * the bit width is lowered by 'd'. Register 0 of the group gives the highest
+ * rank if it is set; otherwise the first set register does.
+ *
+ * @param[in] registers 2^d consecutive registers, the first index a multiple of 2^d
+ * @param[in] d number of bits dropped, in [1, 26]
+ *
+ * @return Folded register
+ */
+inline uint8_t foldRegisters(const uint8_t* registers, uint8_t d) {
+    if (registers[0] != 0) {
+        return d + registers[0];
+    }
+    const uint32_t n = uint32_t(1) << d;
+    for (uint32_t j = 1; j < n; ++j) {
+        if (registers[j] != 0) {
+            return foldRank(j, registers[j], d);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Returns alpha * m^2, the bias correction constant of the raw estimate.
+ * Evaluated at compile time when m is a constant.
+ *
+ * @param[in] m number of registers
+ */
+constexpr double alphaMM(uint32_t m) {
+    return (m == 16 ? 0.673 : m == 32 ? 0.697 : m == 64 ? 0.709 : 0.7213 / (1.0 + 1.079 / m)) * m * m;
+}
+
+/**
+ * Computes the cardinality estimate from the register sum.
+ * Applies linear counting in the small range and, for 32 bit hashes,
+ * the large range correction.
+ *
+ * @param[in] hash hash function
+ * @param[in] m number of registers
+ * @param[in] alphaMM alpha * m^2
+ * @param[in] sum sum of 2^-M[i] over all registers
+ * @param[in] zeros number of registers equal to 0
+ *
+ * @return Estimated cardinality value.
+ */
+inline double estimateFromSum(HashType hash, uint32_t m, double alphaMM, double sum, uint32_t zeros) {
+    double estimate = alphaMM / sum; // E in the original paper
+    if (estimate <= 2.5 * m) {
+        if (zeros != 0) {
+            estimate = m * std::log(static_cast<double>(m)/ zeros);
+        }
+    } else if (hash == HASH_MURMUR3_X86_32 && estimate > (1.0 / 30.0) * pow_2_32) {
+        estimate = neg_pow_2_32 * log(1.0 - (estimate / pow_2_32));
+    }
+    return estimate;
+}
+
+/**
+ * Sum of 2^-M[i] over registers, kept in fixed point so that adding and
+ * removing terms is exact and the result doesn't depend on their order.
+ * Ranks up to 32 are counted in units of 2^-32 and higher ranks (64 bit
+ * hash only) in units of 2^-64; neither part can overflow for b <= 30.
+ */
+struct RegisterSum {
+    uint64_t hi; ///< sum of 2^(32 - r) for r <= 32
+    uint64_t lo; ///< sum of 2^(64 - r) for r > 32
+
+    RegisterSum() : hi(0), lo(0) {
+    }
+
+    void add(uint8_t r) {
+        if (r <= 32) {
+            hi += uint64_t(1) << (32 - r);
+        } else {
+            lo += uint64_t(1) << (64 - r);
+        }
+    }
+
+    void sub(uint8_t r) {
+        if (r <= 32) {
+            hi -= uint64_t(1) << (32 - r);
+        } else {
+            lo -= uint64_t(1) << (64 - r);
+        }
+    }
+
+    double value() const {
+        return std::ldexp(static_cast<double>(hi), -32) + std::ldexp(static_cast<double>(lo), -64);
+    }
+};
+
+/**
+ * Estimators a counter can compute its cardinality estimate with.
+ */
+enum EstimatorType {
+    ESTIMATOR_CLASSIC = 0, ///< raw estimate with linear counting and the large range correction (estimate())
+    ESTIMATOR_IMPROVED = 1, ///< Ertl's improved raw estimator, without a bias bump where linear counting stops
+    ESTIMATOR_ML = 2 ///< Ertl's maximum likelihood estimator
+};
+
+/**
+ * sigma() of the improved estimator: the contribution of the zero registers.
+ */
+inline double ertlSigma(double x) {
+    if (x == 1.0) {
+        return std::numeric_limits<double>::infinity();
+    }
+    double y = 1.0;
+    double z = x;
+    double zPrev;
+    do {
+        x *= x;
+        zPrev = z;
+        z += x * y;
+        y += y;
+    } while (z != zPrev);
+    return z;
+}
+
+/**
+ * tau() of the improved estimator: the contribution of the saturated registers.
+ */
+inline double ertlTau(double x) {
+    if (x == 0.0 || x == 1.0) {
+        return 0.0;
+    }
+    double y = 1.0;
+    double z = 1.0 - x;
+    double zPrev;
+    do {
+        x = std::sqrt(x);
+        zPrev = z;
+        y *= 0.5;
+        z -= (1.0 - x) * (1.0 - x) * y;
+    } while (z != zPrev);
+    return z / 3.0;
+}
+
+/**
+ * Computes Ertl's improved raw estimate from the register histogram
+ * ("New cardinality estimation algorithms for HyperLogLog sketches", 2017).
+ * It treats the zero and the saturated registers exactly instead of
+ * switching to linear counting or correcting the large range, so it has
+ * no bias bump and needs no empirical bias tables.
+ *
+ * @param[in] hist number of registers of each value 0..q+1
+ * @param[in] m number of registers
+ * @param[in] q number of hash bits after the index bits
+ *
+ * @return Estimated cardinality value.
+ */
+inline double estimateImproved(const uint32_t* hist, uint32_t m, uint8_t q) {
+    double z = m * ertlTau(1.0 - static_cast<double>(hist[q + 1]) / m);
+    for (int k = q; k >= 1; --k) {
+        z += hist[k];
+        z *= 0.5;
+    }
+    z += m * ertlSigma(static_cast<double>(hist[0]) / m);
+    return m / (2.0 * std::log(2.0)) * m / z;
+}
+
+/**
+ * y / (e^y - 1) and its derivative, the terms of the likelihood equation.
+ */
+inline void ertlLikelihoodTerm(double y, double& h, double& dh) {
+    if (y < 1e-2) {
+        h = 1.0 - y / 2.0 + y * y / 12.0;
+        dh = -0.5 + y / 6.0;
+    } else if (y > 500.0) {
+        h = 0.0;
+        dh = 0.0;
+    } else {
+        const double e = std::expm1(y);
+        h = y / e;
+        dh = (e - y * (e + 1.0)) / (e * e);
+    }
+}
+
+/**
+ * Computes Ertl's maximum likelihood estimate from the register histogram.
+ * Under the Poisson model the likelihood is maximized where
+ * sum_k hist[k] h(x / 2^k) = a x with h(y) = y / (e^y - 1); the left side
+ * falls and the right side grows with x, so the root is unique and found by
+ * Newton steps kept inside a shrinking bracket, starting from the improved
+ * estimate.
+ *
+ * @param[in] hist number of registers of each value 0..q+1
+ * @param[in] m number of registers
+ * @param[in] q number of hash bits after the index bits
+ *
+ * @return Estimated cardinality value.
+ */
+inline double estimateML(const uint32_t* hist, uint32_t m, uint8_t q) {
+    if (hist[0] == m) {
+        return 0.0;
+    }
+    if (hist[q + 1] == m) {
+        return std::numeric_limits<double>::infinity();
+    }
+    int kmin = 1;
+    while (hist[kmin] == 0) {
+        kmin++;
+    }
+    int kmax = q + 1;
+    while (hist[kmax] == 0) {
+        kmax--;
+    }
+    double a = hist[0];
+    for (int k = std::min(kmax, (int) q); k >= kmin; --k) {
+        a += std::ldexp(static_cast<double>(hist[k]), -k);
+    }
+    double x = estimateImproved(hist, m, q) / m;
+    double lo = 0.0;
+    double hi = std::numeric_limits<double>::infinity();
+    for (int iter = 0; iter < 100; ++iter) {
+        double g = -a * x;
+        double dg = -a;
+        for (int k = kmin; k <= kmax; ++k) {
+            if (hist[k] != 0) {
+                const int e = std::min(k, (int) q);
+                double h;
+                double dh;
+                ertlLikelihoodTerm(std::ldexp(x, -e), h, dh);
+                g += hist[k] * h;
+                dg += std::ldexp(hist[k] * dh, -e);
+            }
+        }
+        if (g > 0) {
+            lo = x;
+        } else {
+            hi = x;
+        }
+        double next = x - g / dg;
+        if (!(next > lo && next < hi)) {
+            next = hi == std::numeric_limits<double>::infinity() ? 2.0 * x : 0.5 * (lo + hi);
+        }
+        if (std::abs(next - x) <= 1e-12 * x) {
+            x = next;
+            break;
+        }
+        x = next;
+    }
+    return m * x;
+}
+
+/**
+ * Computes the cardinality estimate from the register histogram.
+ *
+ * @param[in] estimator estimator to use
+ * @param[in] hash hash function
+ * @param[in] b register bit width
+ * @param[in] hist number of registers of each value (at least hashBits(hash) - b + 2 elements)
+ *
+ * @return Estimated cardinality value.
+ */
+inline double estimateFromHistogram(EstimatorType estimator, HashType hash, uint8_t b, const uint32_t* hist) {
+    const uint32_t m = uint32_t(1) << b;
+    const uint8_t q = hashBits(hash) - b;
+    switch (estimator) {
+        case ESTIMATOR_IMPROVED:
+            return estimateImproved(hist, m, q);
+        case ESTIMATOR_ML:
+            return estimateML(hist, m, q);
+        default: {
+            // the same fixed point sum as the cached one, so the result is identical
+            RegisterSum sum;
+            for (int k = 0; k <= q + 1; ++k) {
+                if (k <= 32) {
+                    sum.hi += uint64_t(hist[k]) << (32 - k);
+                } else {
+                    sum.lo += uint64_t(hist[k]) << (64 - k);
+                }
+            }
+            return estimateFromSum(hash, m, alphaMM(m), sum.value(), hist[0]);
+        }
+    }
+}
+
+class PackedHyperLogLog;
+class HyperLogLogView;
+class HyperLogLogWire;
+class HyperLogLogSetOps;
+class HyperLogLogParallel;
+class SlidingHyperLogLog;
+class ShardedHyperLogLogHIP;
+template<uint8_t B> class FixedHyperLogLog;
+template<typename Key, typename KeyHash> class SketchStore;
+
 /** @class HyperLogLog
  *  @brief Implement of 'HyperLogLog' estimate cardinality algorithm
  */
 class HyperLogLog {
+    friend class PackedHyperLogLog;
+    friend class HyperLogLogView;
+    friend class HyperLogLogWire;
+    friend class HyperLogLogSetOps;
+    friend class HyperLogLogParallel;
+    friend class SlidingHyperLogLog;
+    template<uint8_t B> friend class FixedHyperLogLog;
+    template<typename Key, typename KeyHash> friend class SketchStore;
 public:
 
     /**
@@ -59,32 +552,25 @@ public:
      *
      * @param[in] b bit width (register size will be 2 to the b power).
      *            This value must be in the range[4,30].Default value is 4.
+     * @param[in] hash hash function. With a 64 bit hash function the estimate
+     *            needs no large range correction near 2^32.
+     * @param[in] sparse start in the sparse representation, which keeps only
+     *            the non-zero registers until there are too many of them.
+     *            Ignored when b is greater than 26.
      *
      * @exception std::invalid_argument the argument is out of range.
      */
-    HyperLogLog(uint8_t b = 4) throw (std::invalid_argument) :
-            b_(b), m_(1 << b), M_(m_, 0) {
+    HyperLogLog(uint8_t b = 4, HashType hash = HASH_MURMUR3_X86_32, bool sparse = false) throw (std::invalid_argument) :
+            b_(b), m_(1 << b), hash_(hash), M_(sparse && b <= HLL_SPARSE_MAX_BIT_WIDTH ? 0 : m_, 0) {
 
         if (b < 4 || 30 < b) {
             throw std::invalid_argument("bit width must be in the range [4,30]");
         }
-
-        double alpha;
-        switch (m_) {
-            case 16:
-                alpha = 0.673;
-                break;
-            case 32:
-                alpha = 0.697;
-                break;
-            case 64:
-                alpha = 0.709;
-                break;
-            default:
-                alpha = 0.7213 / (1.0 + 1.079 / m_);
-                break;
+        if (!isHashType(hash)) {
+            throw std::invalid_argument("unknown hash type");
         }
-        alphaMM_ = alpha * m_ * m_;
+        alphaMM_ = alphaMM(m_);
+        resetCache();
     }
 
     /**
@@ -94,69 +580,352 @@ public:
      * @param[in] len length of string
      */
     void add(const char* str, uint32_t len) {
-        uint32_t hash;
-        MurmurHash3_x86_32(str, len, HLL_HASH_SEED, (void*) &hash);
-        uint32_t index = hash >> (32 - b_);
-        uint8_t rank = _GET_CLZ((hash << b_), 32 - b_);
-        if (rank > M_[index]) {
-            M_[index] = rank;
+        uint32_t index;
+        uint8_t rank;
+        indexRank(hash_, b_, str, len, index, rank);
+        HLL_STATS_COUNT(adds, 1);
+        updateRegister(index, rank);
+    }
+
+    /**
+     * Adds a batch of elements to the estimator.
+     * The registers end up exactly as if add() was called for each element.
+     *
+     * @param[in] strs strings to add
+     * @param[in] lens lengths of the strings
+     * @param[in] n number of strings
+     */
+    void addBatch(const char* const* strs, const uint32_t* lens, size_t n) {
+        HLL_STATS_COUNT(adds, n);
+        uint32_t index[HLL_BATCH_SIZE];
+        uint8_t rank[HLL_BATCH_SIZE];
+        for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+            const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+            indexRankBatch(hash_, b_, strs + off, lens + off, cnt, index, rank);
+            for (size_t i = 0; i < cnt; ++i) {
+                updateRegister(index[i], rank[i]);
+            }
+        }
+    }
+
+    /**
+     * Adds a batch of fixed-width elements stored back to back.
+     * The registers end up exactly as if add() was called for each element.
+     *
+     * @param[in] keys pointer to the first element
+     * @param[in] len length of each element
+     * @param[in] n number of elements
+     */
+    void addBatch(const char* keys, uint32_t len, size_t n) {
+        HLL_STATS_COUNT(adds, n);
+        uint32_t index[HLL_BATCH_SIZE];
+        uint8_t rank[HLL_BATCH_SIZE];
+        for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+            const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+            indexRankBatch(hash_, b_, keys + off * len, len, cnt, index, rank);
+            for (size_t i = 0; i < cnt; ++i) {
+                updateRegister(index[i], rank[i]);
+            }
+        }
+    }
+
+    /**
+     * Adds an element by its hash value, skipping the hash function.
+     * The value must be that of the hash function of the counter, see
+     * hashElement(); with HASH_PREHASHED_64 any well mixed 64 bit hash.
+     *
+     * @param[in] value hash value of the element
+     */
+    void addHash(uint64_t value) {
+        uint32_t index;
+        uint8_t rank;
+        indexRankHash(hash_, b_, value, index, rank);
+        HLL_STATS_COUNT(adds, 1);
+        updateRegister(index, rank);
+    }
+
+    /**
+     * Adds a batch of elements by their hash values.
+     * The registers end up exactly as if addHash() was called for each of them.
+     *
+     * @param[in] values hash values of the elements
+     * @param[in] n number of hash values
+     */
+    void addHashes(const uint64_t* values, size_t n) {
+        HLL_STATS_COUNT(adds, n);
+        uint32_t index[HLL_BATCH_SIZE];
+        uint8_t rank[HLL_BATCH_SIZE];
+        for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+            const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+            indexRankHashes(hash_, b_, values + off, cnt, index, rank);
+            for (size_t i = 0; i < cnt; ++i) {
+                updateRegister(index[i], rank[i]);
+            }
         }
     }
 
     /**
      * Estimates cardinality value.
+     * The register sum and the number of zero registers are kept up to date
+     * by every register change, so this takes constant time.
      *
      * @return Estimated cardinality value.
      */
     double estimate() const {
-        double estimate;
-        double sum = 0.0;
-        for (uint32_t i = 0; i < m_; i++) {
-            sum += 1.0 / (1 << M_[i]);
-        }
-        estimate = alphaMM_ / sum; // E in the original paper
-        if (estimate <= 2.5 * m_) {
-            uint32_t zeros = 0;
-            for (uint32_t i = 0; i < m_; i++) {
-                if (M_[i] == 0) {
-                    zeros++;
-                }
-            }
-            if (zeros != 0) {
-                estimate = m_ * std::log(static_cast<double>(m_)/ zeros);
-            }
-        } else if (estimate > (1.0 / 30.0) * pow_2_32) {
-            estimate = neg_pow_2_32 * log(1.0 - (estimate / pow_2_32));
+        HLL_STATS_SCOPE(OP_ESTIMATE);
+        return estimateFromSum(hash_, m_, alphaMM_, sum_.value(), zeros_);
+    }
+
+    /**
+     * Estimates cardinality value by scanning all registers.
+     * Always equal to estimate(); useful to check the cached sum.
+     *
+     * @return Estimated cardinality value.
+     */
+    double estimateExact() const {
+        RegisterSum sum;
+        uint32_t zeros = 0;
+        scanRegisters(sum, zeros);
+        return estimateFromSum(hash_, m_, alphaMM_, sum.value(), zeros);
+    }
+
+    /**
+     * Estimates cardinality value with the given estimator.
+     * ESTIMATOR_CLASSIC returns estimate(); the others need the register
+     * histogram, which takes one vectorized pass over the registers.
+     *
+     * @param[in] estimator estimator to use
+     *
+     * @return Estimated cardinality value.
+     */
+    double estimate(EstimatorType estimator) const {
+        HLL_STATS_SCOPE(OP_ESTIMATE);
+        if (estimator == ESTIMATOR_CLASSIC) {
+            return estimate();
         }
-        return estimate;
+        uint32_t hist[64];
+        fillHistogram(hist);
+        return estimateFromHistogram(estimator, hash_, b_, hist);
+    }
+
+    /**
+     * Returns the number of registers of each value.
+     * Element k is the number of registers equal to k, for k in [0, q+1]
+     * where q = hashBits(hashType()) - b; the counts add up to registerSize().
+     * Takes one vectorized pass over the registers unless the histogram is
+     * tracked (see trackHistogram()).
+     *
+     * @return Register histogram
+     */
+    std::vector<uint32_t> histogram() const {
+        uint32_t hist[64];
+        fillHistogram(hist);
+        return std::vector<uint32_t>(hist, hist + hashBits(hash_) - b_ + 2);
+    }
+
+    /**
+     * Keeps the register histogram up to date on every register change, so
+     * that histogram() and estimate(EstimatorType) take O(q) time instead of
+     * a pass over the registers. Tracking costs 256 bytes and two counter
+     * updates per register change; it is off by default.
+     *
+     * @param[in] enable true to track the histogram, false to stop
+     */
+    void trackHistogram(bool enable) {
+        if (!enable) {
+            std::vector<uint32_t>().swap(hist_);
+        } else if (hist_.empty()) {
+            hist_.resize(64);
+            scanHistogram(&hist_[0]);
+        }
+    }
+
+    /**
+     * Returns whether the register histogram is tracked.
+     *
+     * @return true if tracked
+     */
+    bool tracksHistogram() const {
+        return !hist_.empty();
     }
 
     /**
      * Merges the estimate from 'other' into this object, returning the estimate of their union.
-     * The number of registers in each must be the same.
+     * The hash function of each must be the same. If the bit widths differ,
+     * the result has the smaller one: this object is folded down first
+     * (see fold()), or the registers of 'other' are folded while merging.
      *
      * @param[in] other HyperLogLog instance to be merged
      * 
-     * @exception std::invalid_argument number of registers doesn't match.
+     * @exception std::invalid_argument hash function doesn't match.
      */
     void merge(const HyperLogLog& other) throw (std::invalid_argument) {
-        if (m_ != other.m_) {
+        checkHash(other.hash_);
+        HLL_STATS_SCOPE(OP_MERGE);
+        if (other.b_ < b_) {
+            fold(other.b_);
+        } else if (other.b_ > b_) {
+            mergeFolded(other);
+            return;
+        }
+        if (other.M_.empty()) {
+            for (size_t i = 0; i < other.sparse_.size(); ++i) {
+                updateRegister(other.sparse_[i] >> 6, other.sparse_[i] & 0x3F);
+            }
+            return;
+        }
+        mergeDense(&other.M_[0]);
+    }
+
+    /**
+     * Merges the registers of a read-only view (see hyperloglog_view.hpp)
+     * into this object without copying them first.
+     * The number of registers and the hash function of each must be the same.
+     *
+     * @param[in] view HyperLogLogView to be merged
+     *
+     * @exception std::invalid_argument number of registers or hash function doesn't match.
+     */
+    void merge(const HyperLogLogView& view) throw (std::invalid_argument);
+
+    /**
+     * Merges the estimates from 'n' other counters into this object at once.
+     * Dense registers are merged block by block from every source, so the
+     * block being updated stays in cache. The result is the same as
+     * calling merge() for each of them, so it has the smallest bit width.
+     *
+     * @param[in] others HyperLogLog instances to be merged
+     * @param[in] n number of instances
+     *
+     * @exception std::invalid_argument hash function doesn't match.
+     *            Nothing is merged in that case.
+     */
+    void mergeMany(const HyperLogLog* const* others, size_t n) throw (std::invalid_argument) {
+        uint8_t b = b_;
+        for (size_t i = 0; i < n; ++i) {
+            checkHash(others[i]->hash_);
+            b = std::min(b, others[i]->b_);
+        }
+        HLL_STATS_SCOPE(OP_MERGE);
+        fold(b);
+        std::vector<const uint8_t*> dense;
+        for (size_t i = 0; i < n; ++i) {
+            if (others[i]->b_ > b_) {
+                mergeFolded(*others[i]);
+            } else if (!others[i]->M_.empty()) {
+                dense.push_back(&others[i]->M_[0]);
+            }
+        }
+        if (!dense.empty()) {
+            toDense();
+            CacheRaise raise(*this);
+            for (uint32_t off = 0; off < m_; off += HLL_MERGE_BLOCK_SIZE) {
+                const uint32_t len = std::min(m_ - off, (uint32_t) HLL_MERGE_BLOCK_SIZE);
+                for (size_t i = 0; i < dense.size(); ++i) {
+                    simd::maxBytes(&M_[off], dense[i] + off, len, raise);
+                }
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            if (others[i]->b_ > b_) {
+                continue;
+            }
+            const std::vector<uint32_t>& entries = others[i]->sparse_;
+            for (size_t j = 0; j < entries.size(); ++j) {
+                updateRegister(entries[j] >> 6, entries[j] & 0x3F);
+            }
+        }
+    }
+
+    /**
+     * Lowers the bit width to 'b', combining each group of 2^(old b - b)
+     * registers into one. The registers end up exactly as if every element
+     * had been added at bit width 'b', so a folded copy answers coarse
+     * queries from a fraction of the memory. The representation is kept
+     * unless the folded sparse entries are too many for the new width.
+     *
+     * @param[in] b new bit width, in the range [4, current bit width]
+     *
+     * @exception std::invalid_argument the argument is out of range.
+     */
+    void fold(uint8_t b) throw (std::invalid_argument) {
+        if (b < 4 || b > b_) {
             std::stringstream ss;
-            ss << "number of registers doesn't match: " << m_ << " != " << other.m_;
+            ss << "bit width must be in the range [4," << (unsigned) b_ << "]";
             throw std::invalid_argument(ss.str().c_str());
         }
-        for (uint32_t r = 0; r < m_; ++r) {
-            if (M_[r] < other.M_[r]) {
-                M_[r] |= other.M_[r];
+        if (b == b_) {
+            return;
+        }
+        const uint8_t d = b_ - b;
+        HyperLogLog folded(b, hash_, M_.empty());
+        if (M_.empty()) {
+            // folded indexes keep the entries sorted; equal ones keep the highest rank
+            const uint32_t mask = (uint32_t(1) << d) - 1;
+            for (size_t i = 0; i < sparse_.size(); ++i) {
+                const uint32_t index = sparse_[i] >> 6;
+                const uint32_t entry = ((index >> d) << 6) | foldRank(index & mask, sparse_[i] & 0x3F, d);
+                if (!folded.sparse_.empty() && (folded.sparse_.back() >> 6) == (entry >> 6)) {
+                    folded.sparse_.back() = std::max(folded.sparse_.back(), entry);
+                } else {
+                    folded.sparse_.push_back(entry);
+                }
+            }
+            if (folded.sparse_.size() > std::min(folded.m_ / 8, (uint32_t) HLL_SPARSE_MAX_ENTRIES)) {
+                folded.toDense();
+            }
+        } else {
+            for (uint32_t i = 0; i < folded.m_; ++i) {
+                folded.M_[i] = foldRegisters(&M_[size_t(i) << d], d);
             }
         }
+        folded.hist_.resize(hist_.size());
+        folded.recomputeCache();
+        swap(folded);
     }
 
     /**
      * Clears all internal registers.
+     * The representation (sparse or dense) is kept.
      */
     void clear() {
+        sparse_.clear();
         std::fill(M_.begin(), M_.end(), 0);
+        resetCache();
+    }
+
+    /**
+     * Returns whether the registers are in the sparse representation.
+     *
+     * @return true if sparse
+     */
+    bool isSparse() const {
+        return M_.empty();
+    }
+
+    /**
+     * Converts the registers to the dense representation.
+     * Does nothing if they are already dense.
+     */
+    void toDense() {
+        if (!M_.empty()) {
+            return;
+        }
+        HLL_STATS_COUNT(denseConversions, 1);
+        M_.assign(m_, 0);
+        for (size_t i = 0; i < sparse_.size(); ++i) {
+            M_[sparse_[i] >> 6] = sparse_[i] & 0x3F;
+        }
+        std::vector<uint32_t>().swap(sparse_);
+    }
+
+    /**
+     * Returns the heap memory held by the registers.
+     *
+     * @return Size in bytes
+     */
+    size_t memoryUsage() const {
+        return M_.capacity() * sizeof(M_[0]) + sparse_.capacity() * sizeof(sparse_[0]) + hist_.capacity() * sizeof(hist_[0]);
     }
 
     /**
@@ -168,6 +937,15 @@ public:
         return m_;
     }
 
+    /**
+     * Returns the hash function of the counter.
+     *
+     * @return Hash function
+     */
+    HashType hashType() const {
+        return hash_;
+    }
+
     /**
      * Exchanges the content of the instance
      *
@@ -176,20 +954,34 @@ public:
     void swap(HyperLogLog& rhs) {
         std::swap(b_, rhs.b_);
         std::swap(m_, rhs.m_);
+        std::swap(hash_, rhs.hash_);
         std::swap(alphaMM_, rhs.alphaMM_);
         M_.swap(rhs.M_);       
+        sparse_.swap(rhs.sparse_);
+        std::swap(sum_, rhs.sum_);
+        std::swap(zeros_, rhs.zeros_);
+        hist_.swap(rhs.hist_);
     }
 
     /**
      * Dump the current status to a stream
+     * A sparse counter writes its entries instead of all registers.
      *
      * @param[out] os The output stream where the data is saved
      *
      * @exception std::runtime_error When failed to dump.
      */
     void dump(std::ostream& os) const throw(std::runtime_error){
-        os.write((char*)&b_, sizeof(b_));
-        os.write((char*)&M_[0], sizeof(M_[0]) * M_.size());
+        dumpHeader(os);
+        if (M_.empty()) {
+            const uint32_t n = sparse_.size();
+            os.write((char*)&n, sizeof(n));
+            if (n != 0) {
+                os.write((char*)&sparse_[0], sizeof(sparse_[0]) * n);
+            }
+        } else {
+            os.write((char*)&M_[0], sizeof(M_[0]) * M_.size());
+        }
         if(os.fail()){
             throw std::runtime_error("Failed to dump");
         }
@@ -204,26 +996,278 @@ public:
      */
     void restore(std::istream& is) throw(std::runtime_error){
         uint8_t b = 0;
-        is.read((char*)&b, sizeof(b));
-        HyperLogLog tempHLL(b);
-        is.read((char*)&(tempHLL.M_[0]), sizeof(M_[0]) * tempHLL.m_);
+        HashType hash = HASH_MURMUR3_X86_32;
+        bool sparse = false;
+        restoreHeader(is, b, hash, sparse);
+        HyperLogLog tempHLL(b, hash, sparse);
+        if (sparse) {
+            tempHLL.restoreSparse(is);
+        } else {
+            is.read((char*)&(tempHLL.M_[0]), sizeof(M_[0]) * tempHLL.m_);
+        }
         if(is.fail()){
            throw std::runtime_error("Failed to restore");
         }       
+        tempHLL.hist_.resize(hist_.size());
+        tempHLL.recomputeCache();
         swap(tempHLL);
     }
 
 protected:
+    /**
+     * Raises register 'index' to 'rank' in either representation.
+     */
+    void updateRegister(uint32_t index, uint8_t rank) {
+        if (!M_.empty()) {
+            if (rank > M_[index]) {
+                raiseCache(M_[index], rank);
+                M_[index] = rank;
+            }
+            return;
+        }
+        const uint32_t entry = (index << 6) | rank;
+        std::vector<uint32_t>::iterator it = std::lower_bound(sparse_.begin(), sparse_.end(), index << 6);
+        if (it != sparse_.end() && (*it >> 6) == index) {
+            if (entry > *it) {
+                raiseCache(*it & 0x3F, rank);
+                *it = entry;
+            }
+            return;
+        }
+        raiseCache(0, rank);
+        sparse_.insert(it, entry);
+        if (sparse_.size() > std::min(m_ / 8, (uint32_t) HLL_SPARSE_MAX_ENTRIES)) {
+            toDense();
+        }
+    }
+
+    /**
+     * Reads the sparse entries written by dump().
+     */
+    void restoreSparse(std::istream& is) throw(std::runtime_error) {
+        uint32_t n = 0;
+        is.read((char*)&n, sizeof(n));
+        if (is.fail() || n > m_) {
+            throw std::runtime_error("Failed to restore");
+        }
+        std::vector<uint32_t> entries(n);
+        if (n != 0) {
+            is.read((char*)&entries[0], sizeof(entries[0]) * n);
+        }
+        const uint8_t maxRank = hashBits(hash_) - b_ + 1;
+        for (size_t i = 0; i < n; ++i) {
+            const uint32_t index = entries[i] >> 6;
+            const uint8_t rank = entries[i] & 0x3F;
+            if (index >= m_ || rank == 0 || rank > maxRank || (i > 0 && index <= (entries[i - 1] >> 6))) {
+                throw std::runtime_error("Failed to restore");
+            }
+        }
+        sparse_.swap(entries);
+        if (sparse_.size() > std::min(m_ / 8, (uint32_t) HLL_SPARSE_MAX_ENTRIES)) {
+            toDense();
+        }
+    }
+
+    /**
+     * Accounts for a register raised from 'old' to 'rank' in the cached sum.
+     */
+    void raiseCache(uint8_t old, uint8_t rank) {
+        HLL_STATS_COUNT(addRaises, 1);
+        sum_.sub(old);
+        sum_.add(rank);
+        if (old == 0) {
+            zeros_--;
+        }
+        if (!hist_.empty()) {
+            hist_[old]--;
+            hist_[rank]++;
+        }
+    }
+
+    /**
+     * Passes register raises found by the merge kernels to raiseCache().
+     */
+    struct CacheRaise {
+        explicit CacheRaise(HyperLogLog& hll) : hll_(hll) {
+        }
+        void operator()(uint8_t old, uint8_t rank) {
+            hll_.raiseCache(old, rank);
+        }
+        HyperLogLog& hll_;
+    };
+
+    /**
+     * Sets the cached sum to that of all-zero registers.
+     */
+    void resetCache() {
+        sum_ = RegisterSum();
+        sum_.hi = uint64_t(m_) << 32;
+        zeros_ = m_;
+        if (!hist_.empty()) {
+            std::fill(hist_.begin(), hist_.end(), 0);
+            hist_[0] = m_;
+        }
+    }
+
+    /**
+     * Rebuilds the cached sum and the tracked histogram after the registers
+     * were written directly.
+     */
+    void recomputeCache() {
+        scanRegisters(sum_, zeros_);
+        if (!hist_.empty()) {
+            scanHistogram(&hist_[0]);
+        }
+    }
+
+    /**
+     * Computes the register sum and the number of zero registers from scratch.
+     */
+    void scanRegisters(RegisterSum& sum, uint32_t& zeros) const {
+        sum = RegisterSum();
+        zeros = 0;
+        if (M_.empty()) {
+            zeros = m_ - sparse_.size();
+            sum.hi = uint64_t(zeros) << 32;
+            for (size_t i = 0; i < sparse_.size(); i++) {
+                sum.add(sparse_[i] & 0x3F);
+            }
+        } else {
+            simd::registerSum(&M_[0], m_, sum.hi, sum.lo, zeros);
+        }
+    }
+
+    /**
+     * Counts the registers of each value into hist (64 elements).
+     */
+    void scanHistogram(uint32_t* hist) const {
+        std::fill(hist, hist + 64, 0);
+        if (M_.empty()) {
+            hist[0] = m_ - sparse_.size();
+            for (size_t i = 0; i < sparse_.size(); i++) {
+                hist[sparse_[i] & 0x3F]++;
+            }
+        } else {
+            simd::registerHistogram(&M_[0], m_, hist);
+        }
+    }
+
+    /**
+     * Copies the tracked histogram into hist (64 elements), or counts the
+     * registers if it isn't tracked.
+     */
+    void fillHistogram(uint32_t* hist) const {
+        if (hist_.empty()) {
+            scanHistogram(hist);
+        } else {
+            std::copy(hist_.begin(), hist_.end(), hist);
+        }
+    }
+
+    /**
+     * Raises the registers to the m_ dense registers at 'registers'.
+     */
+    void mergeDense(const uint8_t* registers) {
+        if (M_.empty()) {
+            toDense();
+        }
+        CacheRaise raise(*this);
+        simd::maxBytes(&M_[0], registers, m_, raise);
+    }
+
+    /**
+     * Merges 'other', which has a larger bit width, folding its registers
+     * down to ours on the way.
+     */
+    void mergeFolded(const HyperLogLog& other) {
+        const uint8_t d = other.b_ - b_;
+        if (other.M_.empty()) {
+            const uint32_t mask = (uint32_t(1) << d) - 1;
+            for (size_t i = 0; i < other.sparse_.size(); ++i) {
+                const uint32_t index = other.sparse_[i] >> 6;
+                updateRegister(index >> d, foldRank(index & mask, other.sparse_[i] & 0x3F, d));
+            }
+            return;
+        }
+        for (uint32_t i = 0; i < m_; ++i) {
+            const uint8_t rank = foldRegisters(&other.M_[size_t(i) << d], d);
+            if (rank != 0) {
+                updateRegister(i, rank);
+            }
+        }
+    }
+
+    /**
+     * Throws unless 'other' has the same number of registers and hash function.
+     */
+    void checkCompatible(const HyperLogLog& other) const throw (std::invalid_argument) {
+        checkCompatible(other.m_, other.hash_);
+    }
+
+    /**
+     * Throws unless the counter has 'm' registers and the hash function 'hash'.
+     */
+    void checkCompatible(uint32_t m, HashType hash) const throw (std::invalid_argument) {
+        if (m_ != m) {
+            std::stringstream ss;
+            ss << "number of registers doesn't match: " << m_ << " != " << m;
+            throw std::invalid_argument(ss.str().c_str());
+        }
+        checkHash(hash);
+    }
+
+    /**
+     * Throws unless the counter uses the hash function 'hash'.
+     */
+    void checkHash(HashType hash) const throw (std::invalid_argument) {
+        if (hash_ != hash) {
+            std::stringstream ss;
+            ss << "hash function doesn't match: " << hash_ << " != " << hash;
+            throw std::invalid_argument(ss.str().c_str());
+        }
+    }
+
+    /**
+     * Writes the header byte: the bit width in the low 5 bits, the sparse
+     * flag in bit 5 and the hash function in the top two bits. Dense counters
+     * using the default hash produce the same byte as before these were recorded.
+     */
+    void dumpHeader(std::ostream& os) const {
+        const uint8_t header = b_ | (M_.empty() ? 0x20 : 0) | (hash_ << 6);
+        os.write((const char*)&header, sizeof(header));
+    }
+
+    /**
+     * Reads the header byte written by dumpHeader().
+     */
+    static void restoreHeader(std::istream& is, uint8_t& b, HashType& hash, bool& sparse) throw(std::runtime_error) {
+        uint8_t header = 0;
+        is.read((char*)&header, sizeof(header));
+        b = header & 0x1F;
+        sparse = (header & 0x20) != 0;
+        hash = static_cast<HashType>(header >> 6);
+        if (is.fail() || b < 4 || 30 < b || !isHashType(hash) || (sparse && b > HLL_SPARSE_MAX_BIT_WIDTH)) {
+            throw std::runtime_error("Failed to restore");
+        }
+    }
+
     uint8_t b_; ///< register bit width
     uint32_t m_; ///< register size
+    HashType hash_; ///< hash function
     double alphaMM_; ///< alpha * m^2
-    std::vector<uint8_t> M_; ///< registers
+    std::vector<uint8_t> M_; ///< registers (empty while sparse)
+    std::vector<uint32_t> sparse_; ///< sorted (index << 6 | rank) of non-zero registers while sparse
+    RegisterSum sum_; ///< sum of 2^-M[i], kept up to date by every register change
+    uint32_t zeros_; ///< number of registers equal to 0
+    std::vector<uint32_t> hist_; ///< number of registers of each value while tracked, else empty
 };
 
 /**
  * @brief HIP estimator on HyperLogLog counter.
  */
 class HyperLogLogHIP : public HyperLogLog {
+    friend class ShardedHyperLogLogHIP;
+    friend class HyperLogLogParallel;
 public:
 
     /**
@@ -234,7 +1278,9 @@ public:
      *
      * @exception std::invalid_argument the argument is out of range.
      */
-    HyperLogLogHIP(uint8_t b = 4) throw (std::invalid_argument) : HyperLogLog(b), register_limit_((1 << 5) - 1), c_(0.0), p_(1 << b) {
+    HyperLogLogHIP(uint8_t b = 4, HashType hash = HASH_MURMUR3_X86_32) throw (std::invalid_argument) :
+            HyperLogLog(b, hash), register_limit_(hash == HASH_MURMUR3_X86_32 ? (1 << 5) - 1 : (1 << 6) - 1),
+            c_(0.0), p_(1 << b) {
     }
 
     /**
@@ -244,18 +1290,86 @@ public:
      * @param[in] len length of string
      */
     void add(const char* str, uint32_t len) {
-        uint32_t hash;
-        MurmurHash3_x86_32(str, len, HLL_HASH_SEED, (void*) &hash);
-        uint32_t index = hash >> (32 - b_);
-        uint8_t rank = _GET_CLZ((hash << b_), 32 - b_);
-        rank = rank == 0 ? register_limit_ : std::min(register_limit_, rank);
-        const uint8_t old = M_[index];
-        if (rank > old) {
-            c_ += 1.0 / (p_/m_);
-            p_ -= 1.0/(1 << old);
-            M_[index] = rank;
-            if(rank < 31){
-                p_ += 1.0/(uint32_t(1) << rank);
+        uint32_t index;
+        uint8_t rank;
+        indexRank(hash_, b_, str, len, index, rank);
+        HLL_STATS_COUNT(adds, 1);
+        update(index, rank);
+    }
+
+    /**
+     * Adds a batch of elements to the estimator.
+     * The state ends up exactly as if add() was called for each element in order.
+     *
+     * @param[in] strs strings to add
+     * @param[in] lens lengths of the strings
+     * @param[in] n number of strings
+     */
+    void addBatch(const char* const* strs, const uint32_t* lens, size_t n) {
+        HLL_STATS_COUNT(adds, n);
+        uint32_t index[HLL_BATCH_SIZE];
+        uint8_t rank[HLL_BATCH_SIZE];
+        for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+            const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+            indexRankBatch(hash_, b_, strs + off, lens + off, cnt, index, rank);
+            for (size_t i = 0; i < cnt; ++i) {
+                update(index[i], rank[i]);
+            }
+        }
+    }
+
+    /**
+     * Adds a batch of fixed-width elements stored back to back.
+     * The state ends up exactly as if add() was called for each element in order.
+     *
+     * @param[in] keys pointer to the first element
+     * @param[in] len length of each element
+     * @param[in] n number of elements
+     */
+    void addBatch(const char* keys, uint32_t len, size_t n) {
+        HLL_STATS_COUNT(adds, n);
+        uint32_t index[HLL_BATCH_SIZE];
+        uint8_t rank[HLL_BATCH_SIZE];
+        for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+            const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+            indexRankBatch(hash_, b_, keys + off * len, len, cnt, index, rank);
+            for (size_t i = 0; i < cnt; ++i) {
+                update(index[i], rank[i]);
+            }
+        }
+    }
+
+    /**
+     * Adds an element by its hash value, skipping the hash function.
+     * The value must be that of the hash function of the counter, see
+     * hashElement(); with HASH_PREHASHED_64 any well mixed 64 bit hash.
+     *
+     * @param[in] value hash value of the element
+     */
+    void addHash(uint64_t value) {
+        uint32_t index;
+        uint8_t rank;
+        indexRankHash(hash_, b_, value, index, rank);
+        HLL_STATS_COUNT(adds, 1);
+        update(index, rank);
+    }
+
+    /**
+     * Adds a batch of elements by their hash values.
+     * The state end up exactly as if addHash() was called for each of them.
+     *
+     * @param[in] values hash values of the elements
+     * @param[in] n number of hash values
+     */
+    void addHashes(const uint64_t* values, size_t n) {
+        HLL_STATS_COUNT(adds, n);
+        uint32_t index[HLL_BATCH_SIZE];
+        uint8_t rank[HLL_BATCH_SIZE];
+        for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+            const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+            indexRankHashes(hash_, b_, values + off, cnt, index, rank);
+            for (size_t i = 0; i < cnt; ++i) {
+                update(index[i], rank[i]);
             }
         }
     }
@@ -266,33 +1380,65 @@ public:
      * @return Estimated cardinality value.
      */
     double estimate() const {
+        HLL_STATS_SCOPE(OP_ESTIMATE);
         return c_;
     }
 
     /**
      * Merges the estimate from 'other' into this object, returning the estimate of their union.
-     * The number of registers in each must be the same.
+     * The hash function of each must be the same. If the bit widths differ,
+     * the result has the smaller one, as with HyperLogLog::merge().
      *
      * @param[in] other HyperLogLog instance to be merged
      * 
-     * @exception std::invalid_argument number of registers doesn't match.
+     * @exception std::invalid_argument hash function doesn't match.
      */
     void merge(const HyperLogLogHIP& other) throw (std::invalid_argument) {
-        if (m_ != other.m_) {
-            std::stringstream ss;
-            ss << "number of registers doesn't match: " << m_ << " != " << other.m_;
-            throw std::invalid_argument(ss.str().c_str());
+        checkHash(other.hash_);
+        HLL_STATS_SCOPE(OP_MERGE);
+        if (other.b_ < b_) {
+            fold(other.b_);
         }
+        const uint8_t d = other.b_ - b_;
         for (uint32_t r = 0; r < m_; ++r) {
-            const uint8_t b = M_[r];
-            const uint8_t b_other = other.M_[r];
-            if (b < b_other) {
-                c_ += 1.0 / (p_/m_);
-                p_ -= 1.0/(1 << b);
-                M_[r] |= b_other;
-                if(b_other < register_limit_){
-                    p_ += 1.0/(1 << b_other);
-                }
+            mergeRegister(r, d == 0 ? other.M_[r] : foldRegisters(&other.M_[size_t(r) << d], d));
+        }
+    }
+
+    /**
+     * Merges 'n' other counters into this object, as merge() with each of
+     * them in turn. Hides HyperLogLog::mergeMany(), which would raise the
+     * registers without updating the HIP estimate.
+     *
+     * @param[in] others HyperLogLogHIP instances to be merged
+     * @param[in] n number of instances
+     *
+     * @exception std::invalid_argument hash function doesn't match.
+     *            Nothing is merged in that case.
+     */
+    void mergeMany(const HyperLogLogHIP* const* others, size_t n) throw (std::invalid_argument) {
+        for (size_t i = 0; i < n; ++i) {
+            checkHash(others[i]->hash_);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            merge(*others[i]);
+        }
+    }
+
+    /**
+     * Lowers the bit width to 'b' like HyperLogLog::fold(). The HIP estimate
+     * is kept; later updates use the probability of the folded registers.
+     *
+     * @param[in] b new bit width, in the range [4, current bit width]
+     *
+     * @exception std::invalid_argument the argument is out of range.
+     */
+    void fold(uint8_t b) throw (std::invalid_argument) {
+        HyperLogLog::fold(b);
+        p_ = 0.0;
+        for (uint32_t r = 0; r < m_; ++r) {
+            if (M_[r] < register_limit_) {
+                p_ += 1.0 / (uint64_t(1) << M_[r]);
             }
         }
     }
@@ -301,7 +1447,7 @@ public:
      * Clears all internal registers.
      */
     void clear() {
-        std::fill(M_.begin(), M_.end(), 0);
+        HyperLogLog::clear();
         c_ = 0.0;
         p_ = 1 << b_;
     }
@@ -321,10 +1467,10 @@ public:
      * @param[in,out] rhs Another HyperLogLog instance
      */
     void swap(HyperLogLogHIP& rhs) {
-        std::swap(b_, rhs.b_);
-        std::swap(m_, rhs.m_);
+        HyperLogLog::swap(rhs);
+        std::swap(register_limit_, rhs.register_limit_);
         std::swap(c_, rhs.c_);
-        M_.swap(rhs.M_);       
+        std::swap(p_, rhs.p_);
     }
 
     /**
@@ -335,7 +1481,7 @@ public:
      * @exception std::runtime_error When failed to dump.
      */
     void dump(std::ostream& os) const throw(std::runtime_error){
-        os.write((char*)&b_, sizeof(b_));
+        dumpHeader(os);
         os.write((char*)&M_[0], sizeof(M_[0]) * M_.size());
         os.write((char*)&c_, sizeof(c_));
         os.write((char*)&p_, sizeof(p_));
@@ -353,18 +1499,52 @@ public:
      */
     void restore(std::istream& is) throw(std::runtime_error){
         uint8_t b = 0;
-        is.read((char*)&b, sizeof(b));
-        HyperLogLogHIP tempHLL(b);
+        HashType hash = HASH_MURMUR3_X86_32;
+        bool sparse = false;
+        restoreHeader(is, b, hash, sparse);
+        if (sparse) {
+            throw std::runtime_error("Failed to restore");
+        }
+        HyperLogLogHIP tempHLL(b, hash);
         is.read((char*)&(tempHLL.M_[0]), sizeof(M_[0]) * tempHLL.m_);
         is.read((char*)&(tempHLL.c_), sizeof(double));
         is.read((char*)&(tempHLL.p_), sizeof(double));
         if(is.fail()){
            throw std::runtime_error("Failed to restore");
         }       
+        tempHLL.hist_.resize(hist_.size());
+        tempHLL.recomputeCache();
         swap(tempHLL);
     }
 private: 
-    const uint8_t register_limit_;
+    void mergeRegister(uint32_t r, uint8_t b_other) {
+        const uint8_t b = M_[r];
+        if (b < b_other) {
+            c_ += 1.0 / (p_/m_);
+            p_ -= 1.0/(uint64_t(1) << b);
+            raiseCache(b, b_other);
+            M_[r] = b_other;
+            if(b_other < register_limit_){
+                p_ += 1.0/(uint64_t(1) << b_other);
+            }
+        }
+    }
+
+    void update(uint32_t index, uint8_t rank) {
+        rank = rank == 0 ? register_limit_ : std::min(register_limit_, rank);
+        const uint8_t old = M_[index];
+        if (rank > old) {
+            c_ += 1.0 / (p_/m_);
+            p_ -= 1.0/(uint64_t(1) << old);
+            raiseCache(old, rank);
+            M_[index] = rank;
+            if(rank < register_limit_){
+                p_ += 1.0/(uint64_t(1) << rank);
+            }
+        }
+    }
+
+    uint8_t register_limit_;
     double c_;
     double p_;
 };
@@ -0,0 +1,333 @@
+#if !defined(HYPERLOGLOG_CONCURRENT_HPP)
+#define HYPERLOGLOG_CONCURRENT_HPP
+
+/**
+ * @file hyperloglog_concurrent.hpp
+ * @brief HyperLogLog counter that can be updated from many threads at once
+ */
+
+#include <atomic>
+#include <memory>
+#include "hyperloglog_packed.hpp"
+
+namespace hll {
+
+/** @class ConcurrentHyperLogLog
+ *  @brief HyperLogLog counter with lock-free register updates.
+ *
+ * The registers are packed like PackedHyperLogLog into atomic 64 bit words
+ * and raised with a relaxed compare-and-swap loop (atomic fetch-max of one
+ * field). An update that doesn't raise its register returns after a
+ * single load, without writing to the word, so a saturated counter is
+ * read-mostly and its cache lines stay shared between cores.
+ *
+ * add(), addBatch(), merge() and estimate() may be called from any number
+ * of threads at the same time. Registers only grow, so estimate() running
+ * concurrently with writers sees every register at a value it had at some
+ * point during the call. clear() is not atomic with respect to writers.
+ */
+class ConcurrentHyperLogLog {
+public:
+
+    /**
+     * Constructor
+     *
+     * @param[in] b bit width (register size will be 2 to the b power).
+     *            This value must be in the range[4,30].Default value is 4.
+     * @param[in] hash hash function
+     *
+     * @exception std::invalid_argument the argument is out of range.
+     */
+    ConcurrentHyperLogLog(uint8_t b = 4, HashType hash = HASH_MURMUR3_X86_32) throw (std::invalid_argument) :
+            b_(b), m_(1 << b), hash_(hash) {
+        const PackedHyperLogLog::Layout layout = PackedHyperLogLog::layout(b, hash);
+        width_ = layout.width;
+        perWord_ = layout.perWord;
+        fieldMask_ = layout.fieldMask;
+        divMagic_ = layout.divMagic;
+        alphaMM_ = alphaMM(m_);
+        nWords_ = layout.words;
+        words_.reset(new std::atomic<uint64_t>[nWords_]);
+        clear();
+    }
+
+    /**
+     * Adds element to the estimator
+     *
+     * @param[in] str string to add
+     * @param[in] len length of string
+     */
+    void add(const char* str, uint32_t len) {
+        uint32_t index;
+        uint8_t rank;
+        indexRank(hash_, b_, str, len, index, rank);
+        setMax(index, rank);
+    }
+
+    /**
+     * Adds a batch of elements to the estimator.
+     *
+     * @param[in] strs strings to add
+     * @param[in] lens lengths of the strings
+     * @param[in] n number of strings
+     */
+    void addBatch(const char* const* strs, const uint32_t* lens, size_t n) {
+        uint32_t index[HLL_BATCH_SIZE];
+        uint8_t rank[HLL_BATCH_SIZE];
+        for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+            const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+            indexRankBatch(hash_, b_, strs + off, lens + off, cnt, index, rank);
+            for (size_t i = 0; i < cnt; ++i) {
+                setMax(index[i], rank[i]);
+            }
+        }
+    }
+
+    /**
+     * Adds a batch of fixed-width elements stored back to back.
+     *
+     * @param[in] keys pointer to the first element
+     * @param[in] len length of each element
+     * @param[in] n number of elements
+     */
+    void addBatch(const char* keys, uint32_t len, size_t n) {
+        uint32_t index[HLL_BATCH_SIZE];
+        uint8_t rank[HLL_BATCH_SIZE];
+        for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+            const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+            indexRankBatch(hash_, b_, keys + off * len, len, cnt, index, rank);
+            for (size_t i = 0; i < cnt; ++i) {
+                setMax(index[i], rank[i]);
+            }
+        }
+    }
+
+    /**
+     * Adds an element by its hash value, skipping the hash function.
+     * The value must be that of the hash function of the counter, see
+     * hashElement(); with HASH_PREHASHED_64 any well mixed 64 bit hash.
+     *
+     * @param[in] value hash value of the element
+     */
+    void addHash(uint64_t value) {
+        uint32_t index;
+        uint8_t rank;
+        indexRankHash(hash_, b_, value, index, rank);
+        setMax(index, rank);
+    }
+
+    /**
+     * Adds a batch of elements by their hash values.
+     * The registers end up exactly as if addHash() was called for each of them.
+     *
+     * @param[in] values hash values of the elements
+     * @param[in] n number of hash values
+     */
+    void addHashes(const uint64_t* values, size_t n) {
+        uint32_t index[HLL_BATCH_SIZE];
+        uint8_t rank[HLL_BATCH_SIZE];
+        for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+            const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+            indexRankHashes(hash_, b_, values + off, cnt, index, rank);
+            for (size_t i = 0; i < cnt; ++i) {
+                setMax(index[i], rank[i]);
+            }
+        }
+    }
+
+    /**
+     * Returns the value of a register.
+     *
+     * @param[in] index register index
+     *
+     * @return Register value
+     */
+    uint8_t getRegister(uint32_t index) const {
+        const uint32_t word = wordOf(index);
+        const uint32_t shift = (index - word * perWord_) * width_;
+        return (words_[word].load(std::memory_order_relaxed) >> shift) & fieldMask_;
+    }
+
+    /**
+     * Raises a register to 'rank' if it is lower.
+     *
+     * @param[in] index register index
+     * @param[in] rank new register value
+     *
+     * @return true if this call changed the register
+     */
+    bool setMax(uint32_t index, uint8_t rank) {
+        const uint32_t word = wordOf(index);
+        const uint32_t shift = (index - word * perWord_) * width_;
+        uint64_t cur = words_[word].load(std::memory_order_relaxed);
+        for (;;) {
+            const uint8_t old = (cur >> shift) & fieldMask_;
+            if (rank <= old) {
+                return false;
+            }
+            // on failure cur is reloaded and the register compared again
+            if (words_[word].compare_exchange_weak(cur, cur + (uint64_t(rank - old) << shift),
+                    std::memory_order_relaxed, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+    /**
+     * Estimates cardinality value.
+     * Safe to call while other threads add elements.
+     *
+     * @return Estimated cardinality value.
+     */
+    double estimate() const {
+        uint64_t buf[HLL_PACKED_UNPACK_WORDS];
+        RegisterSum sum;
+        uint32_t zeros = 0;
+        for (size_t w = 0; w < nWords_; w += HLL_PACKED_UNPACK_WORDS) {
+            const size_t n = std::min(nWords_ - w, (size_t) HLL_PACKED_UNPACK_WORDS);
+            for (size_t k = 0; k < n; ++k) {
+                buf[k] = words_[w + k].load(std::memory_order_relaxed);
+            }
+            packedRegisterSum(buf, n, m_ - w * perWord_, width_, sum, zeros);
+        }
+        return estimateFromSum(hash_, m_, alphaMM_, sum.value(), zeros);
+    }
+
+    /**
+     * Merges the registers of 'other' into this object.
+     * The number of registers and the hash function of each must be the same.
+     *
+     * @param[in] other PackedHyperLogLog instance to be merged
+     *
+     * @exception std::invalid_argument number of registers or hash function doesn't match.
+     */
+    void merge(const PackedHyperLogLog& other) throw (std::invalid_argument) {
+        checkCompatible(other.m_, other.hash_);
+        uint64_t even;
+        uint64_t guard;
+        simd::packedMasks(width_, even, guard);
+        for (size_t w = 0; w < nWords_; ++w) {
+            mergeWord(w, other.words_[w], even, guard);
+        }
+    }
+
+    /**
+     * Merges the registers of 'other' into this object.
+     * 'other' may be updated by other threads during the merge.
+     * The number of registers and the hash function of each must be the same.
+     *
+     * @param[in] other ConcurrentHyperLogLog instance to be merged
+     *
+     * @exception std::invalid_argument number of registers or hash function doesn't match.
+     */
+    void merge(const ConcurrentHyperLogLog& other) throw (std::invalid_argument) {
+        checkCompatible(other.m_, other.hash_);
+        uint64_t even;
+        uint64_t guard;
+        simd::packedMasks(width_, even, guard);
+        for (size_t w = 0; w < nWords_; ++w) {
+            mergeWord(w, other.words_[w].load(std::memory_order_relaxed), even, guard);
+        }
+    }
+
+    /**
+     * Copies the registers into a PackedHyperLogLog counter,
+     * e.g. to dump them or convert them with toHyperLogLog().
+     *
+     * @return PackedHyperLogLog instance with the same registers
+     */
+    PackedHyperLogLog toPacked() const {
+        PackedHyperLogLog packed(b_, hash_);
+        for (size_t w = 0; w < packed.words_.size(); ++w) {
+            packed.words_[w] = words_[w].load(std::memory_order_relaxed);
+        }
+        return packed;
+    }
+
+    /**
+     * Clears all internal registers.
+     * Elements added by other threads during the call may or may not be kept.
+     */
+    void clear() {
+        for (size_t w = 0; w < nWords_; ++w) {
+            words_[w].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Returns size of register.
+     *
+     * @return Register size
+     */
+    uint32_t registerSize() const {
+        return m_;
+    }
+
+    /**
+     * Returns the hash function of the counter.
+     *
+     * @return Hash function
+     */
+    HashType hashType() const {
+        return hash_;
+    }
+
+    /**
+     * Returns the heap memory held by the registers.
+     *
+     * @return Size in bytes
+     */
+    size_t memoryUsage() const {
+        return nWords_ * sizeof(words_[0]);
+    }
+
+private:
+    ConcurrentHyperLogLog(const ConcurrentHyperLogLog&);
+    ConcurrentHyperLogLog& operator=(const ConcurrentHyperLogLog&);
+
+    void checkCompatible(uint32_t m, HashType hash) const throw (std::invalid_argument) {
+        if (m_ != m) {
+            std::stringstream ss;
+            ss << "number of registers doesn't match: " << m_ << " != " << m;
+            throw std::invalid_argument(ss.str().c_str());
+        }
+        if (hash_ != hash) {
+            std::stringstream ss;
+            ss << "hash function doesn't match: " << hash_ << " != " << hash;
+            throw std::invalid_argument(ss.str().c_str());
+        }
+    }
+
+    /**
+     * Field-wise maximum of word 'w' and 'src', skipping the write when no field grows.
+     */
+    void mergeWord(size_t w, uint64_t src, uint64_t even, uint64_t guard) {
+        uint64_t cur = words_[w].load(std::memory_order_relaxed);
+        for (;;) {
+            const uint64_t merged = simd::maxPacked(cur, src, width_, even, guard);
+            if (merged == cur || words_[w].compare_exchange_weak(cur, merged,
+                    std::memory_order_relaxed, std::memory_order_relaxed)) {
+                return;
+            }
+        }
+    }
+
+    uint32_t wordOf(uint32_t index) const {
+        return (uint32_t) ((index * divMagic_) >> 35);
+    }
+
+    uint8_t b_; ///< register bit width
+    uint32_t m_; ///< register size
+    HashType hash_; ///< hash function
+    uint8_t width_; ///< bits per register
+    uint32_t perWord_; ///< registers per word
+    uint8_t fieldMask_; ///< (1 << width_) - 1
+    uint64_t divMagic_; ///< reciprocal of perWord_ scaled by 2^35
+    double alphaMM_; ///< alpha * m^2
+    size_t nWords_; ///< number of words
+    std::unique_ptr<std::atomic<uint64_t>[]> words_; ///< packed registers
+};
+
+} // namespace hll
+
+#endif // !defined(HYPERLOGLOG_CONCURRENT_HPP)
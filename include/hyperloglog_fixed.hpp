@@ -0,0 +1,349 @@
+#if !defined(HYPERLOGLOG_FIXED_HPP)
+#define HYPERLOGLOG_FIXED_HPP
+
+/**
+ * @file hyperloglog_fixed.hpp
+ * @brief HyperLogLog counter with the bit width fixed at compile time
+ */
+
+#include <array>
+#include "hyperloglog.hpp"
+
+namespace hll {
+
+/** @class FixedHyperLogLog
+ *  @brief HyperLogLog counter whose bit width is a template parameter.
+ *
+ * The registers are a std::array inside the object, and the bit width,
+ * the number of registers and alpha * m^2 are constants, so add() shifts
+ * by constants and the register loops have a fixed trip count. The
+ * registers, estimates and dumps are the same as those of a HyperLogLog
+ * counter with the same bit width; convert with the HyperLogLog
+ * constructor and toHyperLogLog() where the bit width is only known at
+ * run time.
+ *
+ * The object holds 2^B bytes of registers; allocate it on the heap for
+ * large B.
+ *
+ * @tparam B bit width (register size will be 2 to the B power), in the range [4,30]
+ */
+template<uint8_t B>
+class FixedHyperLogLog {
+    static_assert(4 <= B && B <= 30, "bit width must be in the range [4,30]");
+public:
+
+    /**
+     * Constructor
+     *
+     * @param[in] hash hash function
+     *
+     * @exception std::invalid_argument the argument is out of range.
+     */
+    explicit FixedHyperLogLog(HashType hash = HASH_MURMUR3_X86_32) throw (std::invalid_argument) : hash_(hash) {
+        if (!isHashType(hash)) {
+            throw std::invalid_argument("unknown hash type");
+        }
+        clear();
+    }
+
+    /**
+     * Copies the registers of a HyperLogLog counter.
+     *
+     * @param[in] other HyperLogLog instance with 2^B registers
+     *
+     * @exception std::invalid_argument number of registers doesn't match.
+     */
+    explicit FixedHyperLogLog(const HyperLogLog& other) throw (std::invalid_argument) : hash_(other.hash_) {
+        if (other.m_ != registerSize()) {
+            std::stringstream ss;
+            ss << "number of registers doesn't match: " << registerSize() << " != " << other.m_;
+            throw std::invalid_argument(ss.str().c_str());
+        }
+        assign(other);
+    }
+
+    /**
+     * Copies the registers into a HyperLogLog counter.
+     *
+     * @return HyperLogLog instance with the same registers
+     */
+    HyperLogLog toHyperLogLog() const {
+        HyperLogLog hll(B, hash_);
+        std::copy(M_.begin(), M_.end(), hll.M_.begin());
+        hll.sum_ = sum_;
+        hll.zeros_ = zeros_;
+        return hll;
+    }
+
+    /**
+     * Adds element to the estimator
+     *
+     * @param[in] str string to add
+     * @param[in] len length of string
+     */
+    void add(const char* str, uint32_t len) {
+        uint32_t index;
+        uint8_t rank;
+        indexRank(hash_, B, str, len, index, rank);
+        updateRegister(index, rank);
+    }
+
+    /**
+     * Adds a batch of elements to the estimator.
+     * The registers end up exactly as if add() was called for each element.
+     *
+     * @param[in] strs strings to add
+     * @param[in] lens lengths of the strings
+     * @param[in] n number of strings
+     */
+    void addBatch(const char* const* strs, const uint32_t* lens, size_t n) {
+        uint32_t index[HLL_BATCH_SIZE];
+        uint8_t rank[HLL_BATCH_SIZE];
+        for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+            const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+            indexRankBatch(hash_, B, strs + off, lens + off, cnt, index, rank);
+            for (size_t i = 0; i < cnt; ++i) {
+                updateRegister(index[i], rank[i]);
+            }
+        }
+    }
+
+    /**
+     * Adds a batch of fixed-width elements stored back to back.
+     * The registers end up exactly as if add() was called for each element.
+     *
+     * @param[in] keys pointer to the first element
+     * @param[in] len length of each element
+     * @param[in] n number of elements
+     */
+    void addBatch(const char* keys, uint32_t len, size_t n) {
+        uint32_t index[HLL_BATCH_SIZE];
+        uint8_t rank[HLL_BATCH_SIZE];
+        for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+            const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+            indexRankBatch(hash_, B, keys + off * len, len, cnt, index, rank);
+            for (size_t i = 0; i < cnt; ++i) {
+                updateRegister(index[i], rank[i]);
+            }
+        }
+    }
+
+    /**
+     * Adds an element by its hash value, skipping the hash function.
+     * The value must be that of the hash function of the counter, see
+     * hashElement(); with HASH_PREHASHED_64 any well mixed 64 bit hash.
+     *
+     * @param[in] value hash value of the element
+     */
+    void addHash(uint64_t value) {
+        uint32_t index;
+        uint8_t rank;
+        indexRankHash(hash_, B, value, index, rank);
+        updateRegister(index, rank);
+    }
+
+    /**
+     * Adds a batch of elements by their hash values.
+     * The registers end up exactly as if addHash() was called for each of them.
+     *
+     * @param[in] values hash values of the elements
+     * @param[in] n number of hash values
+     */
+    void addHashes(const uint64_t* values, size_t n) {
+        uint32_t index[HLL_BATCH_SIZE];
+        uint8_t rank[HLL_BATCH_SIZE];
+        for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+            const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+            indexRankHashes(hash_, B, values + off, cnt, index, rank);
+            for (size_t i = 0; i < cnt; ++i) {
+                updateRegister(index[i], rank[i]);
+            }
+        }
+    }
+
+    /**
+     * Estimates cardinality value in constant time from the cached register sum.
+     *
+     * @return Estimated cardinality value.
+     */
+    double estimate() const {
+        return estimateFromSum(hash_, registerSize(), alphaMM(registerSize()), sum_.value(), zeros_);
+    }
+
+    /**
+     * Estimates cardinality value by scanning all registers.
+     * Always equal to estimate().
+     *
+     * @return Estimated cardinality value.
+     */
+    double estimateExact() const {
+        RegisterSum sum;
+        uint32_t zeros = 0;
+        simd::registerSum(&M_[0], registerSize(), sum.hi, sum.lo, zeros);
+        return estimateFromSum(hash_, registerSize(), alphaMM(registerSize()), sum.value(), zeros);
+    }
+
+    /**
+     * Estimates cardinality value with the given estimator
+     * (see HyperLogLog::estimate(EstimatorType)).
+     *
+     * @param[in] estimator estimator to use
+     *
+     * @return Estimated cardinality value.
+     */
+    double estimate(EstimatorType estimator) const {
+        if (estimator == ESTIMATOR_CLASSIC) {
+            return estimate();
+        }
+        uint32_t hist[64] = {0};
+        simd::registerHistogram(&M_[0], registerSize(), hist);
+        return estimateFromHistogram(estimator, hash_, B, hist);
+    }
+
+    /**
+     * Returns the number of registers of each value
+     * (see HyperLogLog::histogram()).
+     *
+     * @return Register histogram
+     */
+    std::vector<uint32_t> histogram() const {
+        uint32_t hist[64] = {0};
+        simd::registerHistogram(&M_[0], registerSize(), hist);
+        return std::vector<uint32_t>(hist, hist + hashBits(hash_) - B + 2);
+    }
+
+    /**
+     * Merges the estimate from 'other' into this object.
+     * The hash function of each must be the same.
+     *
+     * @param[in] other FixedHyperLogLog instance to be merged
+     *
+     * @exception std::invalid_argument hash function doesn't match.
+     */
+    void merge(const FixedHyperLogLog& other) throw (std::invalid_argument) {
+        if (hash_ != other.hash_) {
+            std::stringstream ss;
+            ss << "hash function doesn't match: " << hash_ << " != " << other.hash_;
+            throw std::invalid_argument(ss.str().c_str());
+        }
+        CacheRaise raise(*this);
+        simd::maxBytes(&M_[0], &other.M_[0], registerSize(), raise);
+    }
+
+    /**
+     * Clears all internal registers.
+     */
+    void clear() {
+        M_.fill(0);
+        sum_ = RegisterSum();
+        sum_.hi = uint64_t(registerSize()) << 32;
+        zeros_ = registerSize();
+    }
+
+    /**
+     * Returns size of register.
+     *
+     * @return Register size
+     */
+    static constexpr uint32_t registerSize() {
+        return uint32_t(1) << B;
+    }
+
+    /**
+     * Returns the hash function of the counter.
+     *
+     * @return Hash function
+     */
+    HashType hashType() const {
+        return hash_;
+    }
+
+    /**
+     * Dump the current status to a stream in the format of HyperLogLog::dump()
+     * of a dense counter.
+     *
+     * @param[out] os The output stream where the data is saved
+     *
+     * @exception std::runtime_error When failed to dump.
+     */
+    void dump(std::ostream& os) const throw(std::runtime_error){
+        const uint8_t header = B | (hash_ << 6);
+        os.write((const char*)&header, sizeof(header));
+        os.write((const char*)&M_[0], registerSize());
+        if(os.fail()){
+            throw std::runtime_error("Failed to dump");
+        }
+    }
+
+    /**
+     * Restore the status from a stream written by dump() or by
+     * HyperLogLog::dump() of a counter with the same bit width.
+     *
+     * @param[in] is The input stream where the status is saved
+     *
+     * @exception std::runtime_error When failed to restore.
+     */
+    void restore(std::istream& is) throw(std::runtime_error){
+        HyperLogLog hll;
+        hll.restore(is);
+        if (hll.registerSize() != registerSize()) {
+            throw std::runtime_error("Failed to restore");
+        }
+        // filled in place: a temporary would put 2^B bytes on the stack
+        assign(hll);
+    }
+
+private:
+    /**
+     * Copies the registers of a HyperLogLog counter with 2^B registers.
+     */
+    void assign(const HyperLogLog& other) {
+        hash_ = other.hash_;
+        M_.fill(0);
+        if (other.M_.empty()) {
+            for (size_t i = 0; i < other.sparse_.size(); ++i) {
+                M_[other.sparse_[i] >> 6] = other.sparse_[i] & 0x3F;
+            }
+        } else {
+            std::copy(other.M_.begin(), other.M_.end(), M_.begin());
+        }
+        sum_ = other.sum_;
+        zeros_ = other.zeros_;
+    }
+
+    /**
+     * Passes register raises found by simd::maxBytes() to the cached sum.
+     */
+    struct CacheRaise {
+        explicit CacheRaise(FixedHyperLogLog& hll) : hll_(hll) {
+        }
+        void operator()(uint8_t old, uint8_t rank) {
+            hll_.raiseCache(old, rank);
+        }
+        FixedHyperLogLog& hll_;
+    };
+
+    void updateRegister(uint32_t index, uint8_t rank) {
+        if (rank > M_[index]) {
+            raiseCache(M_[index], rank);
+            M_[index] = rank;
+        }
+    }
+
+    void raiseCache(uint8_t old, uint8_t rank) {
+        sum_.sub(old);
+        sum_.add(rank);
+        if (old == 0) {
+            zeros_--;
+        }
+    }
+
+    HashType hash_; ///< hash function
+    RegisterSum sum_; ///< sum of 2^-M[i], kept up to date by every register change
+    uint32_t zeros_; ///< number of registers equal to 0
+    std::array<uint8_t, (size_t(1) << B)> M_; ///< registers
+};
+
+} // namespace hll
+
+#endif // !defined(HYPERLOGLOG_FIXED_HPP)
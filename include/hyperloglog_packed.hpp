@@ -0,0 +1,408 @@
+#if !defined(HYPERLOGLOG_PACKED_HPP)
+#define HYPERLOGLOG_PACKED_HPP
+
+/**
+ * @file hyperloglog_packed.hpp
+ * @brief HyperLogLog counter with bit-packed registers
+ */
+
+#include "hyperloglog.hpp"
+
+#define HLL_PACKED_UNPACK_WORDS 64 ///< words unpacked at a time by PackedHyperLogLog::estimate()
+
+namespace hll {
+
+/**
+ * Adds the register sum of up to HLL_PACKED_UNPACK_WORDS packed words,
+ * unpacking them into bytes for the register sum kernel.
+ *
+ * @param[in] words packed registers
+ * @param[in] n number of words
+ * @param[in] registers number of registers left from the first word on
+ * @param[in] width register width in bits (5 or 6)
+ * @param[in,out] sum register sum
+ * @param[in,out] zeros number of registers equal to 0
+ */
+inline void packedRegisterSum(const uint64_t* words, size_t n, uint32_t registers, uint8_t width,
+        RegisterSum& sum, uint32_t& zeros) {
+    uint8_t buf[HLL_PACKED_UNPACK_WORDS * 12];
+    const uint32_t perWord = 60 / width;
+    const uint8_t fieldMask = (1 << width) - 1;
+    size_t cnt = 0;
+    for (size_t k = 0; k < n; ++k) {
+        uint64_t word = words[k];
+        for (uint32_t j = 0; j < perWord && cnt < registers; ++j) {
+            buf[cnt++] = word & fieldMask;
+            word >>= width;
+        }
+    }
+    simd::registerSum(buf, cnt, sum.hi, sum.lo, zeros);
+}
+
+/** @class PackedHyperLogLog
+ *  @brief HyperLogLog counter storing its registers bit-packed in 64 bit words.
+ *
+ * A register never exceeds 64 - b + 1, so 5 bits are enough with the 32 bit
+ * hash and 6 bits with the 64 bit hash. Registers are packed 12 (5 bit) or
+ * 10 (6 bit) to a word so that no register spans two words; the top 4 bits
+ * of every word are unused. This takes 2/3 (5 bit) or 4/5 (6 bit) of the
+ * memory and dump size of HyperLogLog, and estimate() returns exactly the
+ * same value as HyperLogLog for the same registers.
+ */
+class PackedHyperLogLog {
+    friend class ConcurrentHyperLogLog;
+public:
+
+    /**
+     * Constructor
+     *
+     * @param[in] b bit width (register size will be 2 to the b power).
+     *            This value must be in the range[4,30].Default value is 4.
+     * @param[in] hash hash function
+     *
+     * @exception std::invalid_argument the argument is out of range.
+     */
+    PackedHyperLogLog(uint8_t b = 4, HashType hash = HASH_MURMUR3_X86_32) throw (std::invalid_argument) :
+            b_(b), m_(1 << b), hash_(hash) {
+        init();
+    }
+
+    /**
+     * Packs the registers of a HyperLogLog counter.
+     *
+     * @param[in] other HyperLogLog instance to be packed
+     */
+    explicit PackedHyperLogLog(const HyperLogLog& other) :
+            b_(other.b_), m_(other.m_), hash_(other.hash_) {
+        init();
+        if (other.M_.empty()) {
+            for (size_t i = 0; i < other.sparse_.size(); ++i) {
+                setMax(other.sparse_[i] >> 6, other.sparse_[i] & 0x3F);
+            }
+        } else {
+            for (uint32_t i = 0; i < m_; ++i) {
+                setMax(i, other.M_[i]);
+            }
+        }
+    }
+
+    /**
+     * Unpacks the registers into a HyperLogLog counter.
+     *
+     * @return HyperLogLog instance with the same registers
+     */
+    HyperLogLog toHyperLogLog() const {
+        HyperLogLog hll(b_, hash_);
+        for (uint32_t i = 0; i < m_; ++i) {
+            hll.M_[i] = getRegister(i);
+        }
+        hll.recomputeCache();
+        return hll;
+    }
+
+    /**
+     * Adds element to the estimator
+     *
+     * @param[in] str string to add
+     * @param[in] len length of string
+     */
+    void add(const char* str, uint32_t len) {
+        uint32_t index;
+        uint8_t rank;
+        indexRank(hash_, b_, str, len, index, rank);
+        setMax(index, rank);
+    }
+
+    /**
+     * Adds a batch of elements to the estimator.
+     *
+     * @param[in] strs strings to add
+     * @param[in] lens lengths of the strings
+     * @param[in] n number of strings
+     */
+    void addBatch(const char* const* strs, const uint32_t* lens, size_t n) {
+        uint32_t index[HLL_BATCH_SIZE];
+        uint8_t rank[HLL_BATCH_SIZE];
+        for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+            const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+            indexRankBatch(hash_, b_, strs + off, lens + off, cnt, index, rank);
+            for (size_t i = 0; i < cnt; ++i) {
+                setMax(index[i], rank[i]);
+            }
+        }
+    }
+
+    /**
+     * Adds a batch of fixed-width elements stored back to back.
+     *
+     * @param[in] keys pointer to the first element
+     * @param[in] len length of each element
+     * @param[in] n number of elements
+     */
+    void addBatch(const char* keys, uint32_t len, size_t n) {
+        uint32_t index[HLL_BATCH_SIZE];
+        uint8_t rank[HLL_BATCH_SIZE];
+        for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+            const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+            indexRankBatch(hash_, b_, keys + off * len, len, cnt, index, rank);
+            for (size_t i = 0; i < cnt; ++i) {
+                setMax(index[i], rank[i]);
+            }
+        }
+    }
+
+    /**
+     * Adds an element by its hash value, skipping the hash function.
+     * The value must be that of the hash function of the counter, see
+     * hashElement(); with HASH_PREHASHED_64 any well mixed 64 bit hash.
+     *
+     * @param[in] value hash value of the element
+     */
+    void addHash(uint64_t value) {
+        uint32_t index;
+        uint8_t rank;
+        indexRankHash(hash_, b_, value, index, rank);
+        setMax(index, rank);
+    }
+
+    /**
+     * Adds a batch of elements by their hash values.
+     * The registers end up exactly as if addHash() was called for each of them.
+     *
+     * @param[in] values hash values of the elements
+     * @param[in] n number of hash values
+     */
+    void addHashes(const uint64_t* values, size_t n) {
+        uint32_t index[HLL_BATCH_SIZE];
+        uint8_t rank[HLL_BATCH_SIZE];
+        for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+            const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+            indexRankHashes(hash_, b_, values + off, cnt, index, rank);
+            for (size_t i = 0; i < cnt; ++i) {
+                setMax(index[i], rank[i]);
+            }
+        }
+    }
+
+    /**
+     * Returns the value of a register.
+     *
+     * @param[in] index register index
+     *
+     * @return Register value
+     */
+    uint8_t getRegister(uint32_t index) const {
+        const uint32_t word = wordOf(index);
+        const uint32_t shift = (index - word * perWord_) * width_;
+        return (words_[word] >> shift) & fieldMask_;
+    }
+
+    /**
+     * Raises a register to 'rank' if it is lower.
+     *
+     * @param[in] index register index
+     * @param[in] rank new register value
+     *
+     * @return true if the register changed
+     */
+    bool setMax(uint32_t index, uint8_t rank) {
+        const uint32_t word = wordOf(index);
+        const uint32_t shift = (index - word * perWord_) * width_;
+        const uint8_t old = (words_[word] >> shift) & fieldMask_;
+        if (rank <= old) {
+            return false;
+        }
+        words_[word] += uint64_t(rank - old) << shift;
+        return true;
+    }
+
+    /**
+     * Estimates cardinality value.
+     *
+     * @return Estimated cardinality value.
+     */
+    double estimate() const {
+        RegisterSum sum;
+        uint32_t zeros = 0;
+        for (size_t w = 0; w < words_.size(); w += HLL_PACKED_UNPACK_WORDS) {
+            const size_t n = std::min(words_.size() - w, (size_t) HLL_PACKED_UNPACK_WORDS);
+            packedRegisterSum(&words_[w], n, m_ - w * perWord_, width_, sum, zeros);
+        }
+        return estimateFromSum(hash_, m_, alphaMM_, sum.value(), zeros);
+    }
+
+    /**
+     * Merges the estimate from 'other' into this object, returning the estimate of their union.
+     * The registers are merged word by word without unpacking them.
+     * The number of registers and the hash function of each must be the same.
+     *
+     * @param[in] other PackedHyperLogLog instance to be merged
+     *
+     * @exception std::invalid_argument number of registers or hash function doesn't match.
+     */
+    void merge(const PackedHyperLogLog& other) throw (std::invalid_argument) {
+        if (m_ != other.m_) {
+            std::stringstream ss;
+            ss << "number of registers doesn't match: " << m_ << " != " << other.m_;
+            throw std::invalid_argument(ss.str().c_str());
+        }
+        if (hash_ != other.hash_) {
+            std::stringstream ss;
+            ss << "hash function doesn't match: " << hash_ << " != " << other.hash_;
+            throw std::invalid_argument(ss.str().c_str());
+        }
+        simd::maxPacked(&words_[0], &other.words_[0], words_.size(), width_);
+    }
+
+    /**
+     * Clears all internal registers.
+     */
+    void clear() {
+        std::fill(words_.begin(), words_.end(), 0);
+    }
+
+    /**
+     * Returns size of register.
+     *
+     * @return Register size
+     */
+    uint32_t registerSize() const {
+        return m_;
+    }
+
+    /**
+     * Returns the hash function of the counter.
+     *
+     * @return Hash function
+     */
+    HashType hashType() const {
+        return hash_;
+    }
+
+    /**
+     * Returns the heap memory held by the registers.
+     *
+     * @return Size in bytes
+     */
+    size_t memoryUsage() const {
+        return words_.capacity() * sizeof(words_[0]);
+    }
+
+    /**
+     * Exchanges the content of the instance
+     *
+     * @param[in,out] rhs Another PackedHyperLogLog instance
+     */
+    void swap(PackedHyperLogLog& rhs) {
+        std::swap(b_, rhs.b_);
+        std::swap(m_, rhs.m_);
+        std::swap(hash_, rhs.hash_);
+        std::swap(width_, rhs.width_);
+        std::swap(perWord_, rhs.perWord_);
+        std::swap(fieldMask_, rhs.fieldMask_);
+        std::swap(divMagic_, rhs.divMagic_);
+        std::swap(alphaMM_, rhs.alphaMM_);
+        words_.swap(rhs.words_);
+    }
+
+    /**
+     * Dump the current status to a stream
+     *
+     * @param[out] os The output stream where the data is saved
+     *
+     * @exception std::runtime_error When failed to dump.
+     */
+    void dump(std::ostream& os) const throw(std::runtime_error){
+        const uint8_t header = b_ | (hash_ << 6);
+        os.write((const char*)&header, sizeof(header));
+        os.write((const char*)&words_[0], sizeof(words_[0]) * words_.size());
+        if(os.fail()){
+            throw std::runtime_error("Failed to dump");
+        }
+    }
+
+    /**
+     * Restore the status from a stream
+     *
+     * @param[in] is The input stream where the status is saved
+     *
+     * @exception std::runtime_error When failed to restore.
+     */
+    void restore(std::istream& is) throw(std::runtime_error){
+        uint8_t header = 0;
+        is.read((char*)&header, sizeof(header));
+        const uint8_t b = header & 0x1F;
+        const uint8_t hash = header >> 6;
+        if (is.fail() || b < 4 || 30 < b || !isHashType(hash) || (header & 0x20)) {
+            throw std::runtime_error("Failed to restore");
+        }
+        PackedHyperLogLog tempHLL(b, static_cast<HashType>(hash));
+        is.read((char*)&(tempHLL.words_[0]), sizeof(words_[0]) * tempHLL.words_.size());
+        if(is.fail()){
+           throw std::runtime_error("Failed to restore");
+        }
+        swap(tempHLL);
+    }
+
+private:
+    /**
+     * Packing of the registers for a bit width and a hash function.
+     */
+    struct Layout {
+        uint8_t width; ///< bits per register
+        uint32_t perWord; ///< registers per word
+        uint8_t fieldMask; ///< (1 << width) - 1
+        uint64_t divMagic; ///< reciprocal of perWord scaled by 2^35
+        size_t words; ///< number of words
+    };
+
+    /**
+     * Validates the arguments and computes the packing, without allocating.
+     *
+     * @exception std::invalid_argument the argument is out of range.
+     */
+    static Layout layout(uint8_t b, HashType hash) throw (std::invalid_argument) {
+        if (b < 4 || 30 < b) {
+            throw std::invalid_argument("bit width must be in the range [4,30]");
+        }
+        if (!isHashType(hash)) {
+            throw std::invalid_argument("unknown hash type");
+        }
+        Layout l;
+        l.width = hashBits(hash) == 32 ? 5 : 6;
+        l.perWord = 60 / l.width;
+        l.fieldMask = (1 << l.width) - 1;
+        // (index * divMagic) >> 35 == index / perWord for every 32 bit index
+        l.divMagic = l.perWord == 12 ? 0xAAAAAAABULL : 0xCCCCCCCDULL;
+        l.words = ((size_t(1) << b) + l.perWord - 1) / l.perWord;
+        return l;
+    }
+
+    void init() {
+        const Layout l = layout(b_, hash_);
+        width_ = l.width;
+        perWord_ = l.perWord;
+        fieldMask_ = l.fieldMask;
+        divMagic_ = l.divMagic;
+        alphaMM_ = alphaMM(m_);
+        words_.assign(l.words, 0);
+    }
+
+    uint32_t wordOf(uint32_t index) const {
+        return (uint32_t) ((index * divMagic_) >> 35);
+    }
+
+    uint8_t b_; ///< register bit width
+    uint32_t m_; ///< register size
+    HashType hash_; ///< hash function
+    uint8_t width_; ///< bits per register
+    uint32_t perWord_; ///< registers per word
+    uint8_t fieldMask_; ///< (1 << width_) - 1
+    uint64_t divMagic_; ///< reciprocal of perWord_ scaled by 2^35
+    double alphaMM_; ///< alpha * m^2
+    std::vector<uint64_t> words_; ///< packed registers
+};
+
+} // namespace hll
+
+#endif // !defined(HYPERLOGLOG_PACKED_HPP)
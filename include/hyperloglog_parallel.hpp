@@ -0,0 +1,405 @@
+#if !defined(HYPERLOGLOG_PARALLEL_HPP)
+#define HYPERLOGLOG_PARALLEL_HPP
+
+/**
+ * @file hyperloglog_parallel.hpp
+ * @brief Multi-threaded merge, estimate and clear of large HyperLogLog counters
+ *
+ * The registers are split into chunks of HLL_PARALLEL_CHUNK registers whose
+ * boundaries fall on 64 byte cache lines, so no two tasks write to the same
+ * line. Each chunk produces a partial result (register sum, zero count,
+ * histogram) that is combined in chunk order after all tasks finished. The
+ * partial results are integers, so the outcome is the same as that of the
+ * serial functions whatever the executor and the number of threads.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "hyperloglog.hpp"
+
+#define HLL_PARALLEL_CHUNK (1 << 18) ///< registers per task, a multiple of the cache line size
+
+namespace hll {
+
+/**
+ * Runs task(0), ..., task(n - 1), possibly in parallel, and returns when
+ * all of them have finished. Tasks don't throw.
+ * A C++17 caller can pass e.g.
+ * [](size_t n, const std::function<void(size_t)>& task) {
+ *     std::vector<size_t> ids(n); std::iota(ids.begin(), ids.end(), 0);
+ *     std::for_each(std::execution::par, ids.begin(), ids.end(), task); }
+ */
+typedef std::function<void(size_t, const std::function<void(size_t)>&)> Executor;
+
+/**
+ * Executor running the tasks one after another on the calling thread.
+ */
+inline void serialExecutor(size_t n, const std::function<void(size_t)>& task) {
+    for (size_t i = 0; i < n; ++i) {
+        task(i);
+    }
+}
+
+/** @class ThreadPool
+ *  @brief Fixed set of worker threads usable as an Executor.
+ *
+ * The calling thread works on the tasks too, so a pool of N threads starts
+ * N - 1 workers. Calls from several threads are run one after another.
+ */
+class ThreadPool {
+public:
+
+    /**
+     * Constructor
+     *
+     * @param[in] threads number of threads running the tasks, including the caller.
+     *            Default is the number of hardware threads.
+     */
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency()) :
+            stop_(false), generation_(0), active_(0), task_(0), n_(0), next_(0), done_(0) {
+        for (size_t i = 1; i < threads; ++i) {
+            workers_.push_back(std::thread(&ThreadPool::work, this));
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            workers_[i].join();
+        }
+    }
+
+    /**
+     * Runs task(0), ..., task(n - 1) on the pool and waits for them.
+     *
+     * @param[in] n number of tasks
+     * @param[in] task task to run
+     */
+    void operator()(size_t n, const std::function<void(size_t)>& task) {
+        std::lock_guard<std::mutex> call(call_);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            task_ = &task;
+            n_ = n;
+            next_.store(0);
+            done_.store(0);
+            generation_++;
+        }
+        wake_.notify_all();
+        run();
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (done_.load() != n_ || active_ != 0) {
+            finished_.wait(lock);
+        }
+        task_ = 0;
+    }
+
+    /**
+     * Returns the number of threads running tasks, including the caller.
+     *
+     * @return Number of threads
+     */
+    size_t size() const {
+        return workers_.size() + 1;
+    }
+
+private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    // takes tasks until there are none left
+    void run() {
+        for (;;) {
+            const size_t i = next_.fetch_add(1);
+            if (i >= n_) {
+                return;
+            }
+            (*task_)(i);
+            if (done_.fetch_add(1) + 1 == n_) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                finished_.notify_all();
+            }
+        }
+    }
+
+    void work() {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            while (!stop_ && (generation_ == seen || task_ == 0)) {
+                wake_.wait(lock);
+            }
+            if (stop_) {
+                return;
+            }
+            seen = generation_;
+            active_++;
+            lock.unlock();
+            run();
+            lock.lock();
+            if (--active_ == 0) {
+                finished_.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex call_; ///< serializes calls
+    std::mutex mutex_;
+    std::condition_variable wake_; ///< a call started or the pool stops
+    std::condition_variable finished_; ///< the last task finished or a worker left the call
+    bool stop_;
+    uint64_t generation_; ///< number of calls so far
+    size_t active_; ///< workers inside run()
+    const std::function<void(size_t)>* task_; ///< task of the current call
+    size_t n_; ///< number of tasks of the current call
+    std::atomic<size_t> next_; ///< next task to take
+    std::atomic<size_t> done_; ///< tasks finished
+};
+
+/** @class HyperLogLogParallel
+ *  @brief Register scans of dense HyperLogLog counters split across an Executor.
+ *
+ * Sparse counters, and merges of counters of different bit widths, are
+ * handled by the serial member functions. HyperLogLogHIP::merge() stays
+ * serial: every raised register updates the HIP estimate with the
+ * probability left by the raises before it.
+ */
+class HyperLogLogParallel {
+public:
+
+    /**
+     * Merges 'src' into 'dst'. Same as dst.merge(src).
+     *
+     * @param[in,out] dst counter to merge into
+     * @param[in] src counter to merge
+     * @param[in] executor executor running the chunks
+     *
+     * @exception std::invalid_argument hash function doesn't match.
+     */
+    static void merge(HyperLogLog& dst, const HyperLogLog& src, const Executor& executor)
+            throw (std::invalid_argument) {
+        if (src.M_.empty() || src.b_ != dst.b_) {
+            dst.merge(src);
+            return;
+        }
+        dst.checkHash(src.hash_);
+        HLL_STATS_SCOPE(OP_MERGE);
+        dst.toDense();
+        std::vector<uint32_t> bounds;
+        chunks(&dst.M_[0], dst.m_, bounds);
+        std::vector<ChunkRaise> partial(bounds.size() - 1, ChunkRaise(!dst.hist_.empty()));
+        uint8_t* M = &dst.M_[0];
+        const uint8_t* S = &src.M_[0];
+        executor(partial.size(), [&](size_t k) {
+            simd::maxBytes(M + bounds[k], S + bounds[k], bounds[k + 1] - bounds[k], partial[k]);
+        });
+        for (size_t k = 0; k < partial.size(); ++k) {
+            const ChunkRaise& p = partial[k];
+            dst.sum_.hi += p.sum.hi;
+            dst.sum_.lo += p.sum.lo;
+            dst.zeros_ -= p.filled;
+            for (size_t r = 0; r < dst.hist_.size(); ++r) {
+                dst.hist_[r] += p.hist[r];
+            }
+            HLL_STATS_COUNT(mergeRaises, p.raises);
+        }
+    }
+
+    /**
+     * Merges 'src' into 'dst' serially. Same as dst.merge(src): the HIP
+     * estimate depends on the order in which registers are raised, so the
+     * executor is not used.
+     *
+     * @param[in,out] dst counter to merge into
+     * @param[in] src counter to merge
+     *
+     * @exception std::invalid_argument hash function doesn't match.
+     */
+    static void merge(HyperLogLogHIP& dst, const HyperLogLogHIP& src, const Executor& /* executor */)
+            throw (std::invalid_argument) {
+        dst.merge(src);
+    }
+
+    /**
+     * Not available: a HyperLogLogHIP merges only other HyperLogLogHIP counters.
+     */
+    static void merge(HyperLogLogHIP& dst, const HyperLogLog& src, const Executor& executor) = delete;
+
+    /**
+     * Clears all registers. Same as hll.clear().
+     *
+     * @param[in,out] hll counter
+     * @param[in] executor executor running the chunks
+     */
+    static void clear(HyperLogLog& hll, const Executor& executor) {
+        if (!hll.M_.empty()) {
+            std::vector<uint32_t> bounds;
+            chunks(&hll.M_[0], hll.m_, bounds);
+            uint8_t* M = &hll.M_[0];
+            executor(bounds.size() - 1, [&](size_t k) {
+                std::memset(M + bounds[k], 0, bounds[k + 1] - bounds[k]);
+            });
+        }
+        hll.sparse_.clear();
+        hll.resetCache();
+    }
+
+    /**
+     * Clears all registers and the HIP estimate. Same as hll.clear().
+     *
+     * @param[in,out] hll counter
+     * @param[in] executor executor running the chunks
+     */
+    static void clear(HyperLogLogHIP& hll, const Executor& executor) {
+        clear(static_cast<HyperLogLog&>(hll), executor);
+        hll.c_ = 0.0;
+        hll.p_ = hll.m_;
+    }
+
+    /**
+     * Estimates the cardinality from the registers. Same as hll.estimateExact().
+     *
+     * @param[in] hll counter
+     * @param[in] executor executor running the chunks
+     *
+     * @return Estimated cardinality value.
+     */
+    static double estimateExact(const HyperLogLog& hll, const Executor& executor) {
+        if (hll.M_.empty()) {
+            return hll.estimateExact();
+        }
+        HLL_STATS_SCOPE(OP_ESTIMATE);
+        std::vector<uint32_t> bounds;
+        chunks(&hll.M_[0], hll.m_, bounds);
+        std::vector<ChunkSum> partial(bounds.size() - 1);
+        const uint8_t* M = &hll.M_[0];
+        executor(partial.size(), [&](size_t k) {
+            simd::registerSum(M + bounds[k], bounds[k + 1] - bounds[k], partial[k].sum.hi, partial[k].sum.lo,
+                    partial[k].zeros);
+        });
+        RegisterSum sum;
+        uint32_t zeros = 0;
+        for (size_t k = 0; k < partial.size(); ++k) {
+            sum.hi += partial[k].sum.hi;
+            sum.lo += partial[k].sum.lo;
+            zeros += partial[k].zeros;
+        }
+        return estimateFromSum(hll.hash_, hll.m_, hll.alphaMM_, sum.value(), zeros);
+    }
+
+    /**
+     * Returns the number of registers of each value. Same as hll.histogram().
+     *
+     * @param[in] hll counter
+     * @param[in] executor executor running the chunks
+     *
+     * @return Register histogram
+     */
+    static std::vector<uint32_t> histogram(const HyperLogLog& hll, const Executor& executor) {
+        uint32_t hist[64];
+        fillHistogram(hll, executor, hist);
+        return std::vector<uint32_t>(hist, hist + hashBits(hll.hash_) - hll.b_ + 2);
+    }
+
+    /**
+     * Estimates the cardinality with the given estimator. Same as
+     * hll.estimate(estimator) for a HyperLogLog; for a HyperLogLogHIP the
+     * estimate of its registers, not the HIP estimate.
+     *
+     * @param[in] hll counter
+     * @param[in] estimator estimator to use
+     * @param[in] executor executor running the chunks
+     *
+     * @return Estimated cardinality value.
+     */
+    static double estimate(const HyperLogLog& hll, EstimatorType estimator, const Executor& executor) {
+        if (estimator == ESTIMATOR_CLASSIC) {
+            return hll.HyperLogLog::estimate();
+        }
+        HLL_STATS_SCOPE(OP_ESTIMATE);
+        uint32_t hist[64];
+        fillHistogram(hll, executor, hist);
+        return estimateFromHistogram(estimator, hll.hash_, hll.b_, hist);
+    }
+
+private:
+    /**
+     * Register sum of one chunk.
+     */
+    struct ChunkSum {
+        ChunkSum() : zeros(0) {
+        }
+        RegisterSum sum;
+        uint32_t zeros;
+    };
+
+    /**
+     * Changes of the cached sum, zero count and histogram made by the merge
+     * of one chunk. The sums wrap around, so adding them afterwards is exact.
+     */
+    struct ChunkRaise {
+        explicit ChunkRaise(bool track) : filled(0), raises(0), track(track) {
+            std::fill(hist, hist + 64, 0);
+        }
+        void operator()(uint8_t old, uint8_t rank) {
+            sum.sub(old);
+            sum.add(rank);
+            raises++;
+            if (old == 0) {
+                filled++;
+            }
+            if (track) {
+                hist[old]--;
+                hist[rank]++;
+            }
+        }
+        RegisterSum sum;
+        uint32_t filled; ///< registers raised from 0
+        uint64_t raises;
+        bool track; ///< the destination tracks its histogram
+        uint32_t hist[64];
+    };
+
+    /**
+     * Splits m registers starting at 'base' into chunks whose inner
+     * boundaries are cache line aligned; chunk k is [bounds[k], bounds[k + 1]).
+     */
+    static void chunks(const uint8_t* base, uint32_t m, std::vector<uint32_t>& bounds) {
+        bounds.assign(1, 0);
+        const uint32_t head = (64 - (uint32_t)(reinterpret_cast<uintptr_t>(base) & 63)) & 63;
+        for (uint64_t off = head + (uint64_t) HLL_PARALLEL_CHUNK; off < m; off += HLL_PARALLEL_CHUNK) {
+            bounds.push_back((uint32_t) off);
+        }
+        bounds.push_back(m);
+    }
+
+    static void fillHistogram(const HyperLogLog& hll, const Executor& executor, uint32_t* hist) {
+        if (hll.M_.empty() || !hll.hist_.empty()) {
+            hll.fillHistogram(hist);
+            return;
+        }
+        std::vector<uint32_t> bounds;
+        chunks(&hll.M_[0], hll.m_, bounds);
+        std::vector<uint32_t> partial((bounds.size() - 1) * 64, 0);
+        const uint8_t* M = &hll.M_[0];
+        executor(bounds.size() - 1, [&](size_t k) {
+            simd::registerHistogram(M + bounds[k], bounds[k + 1] - bounds[k], &partial[k * 64]);
+        });
+        std::fill(hist, hist + 64, 0);
+        for (size_t i = 0; i < partial.size(); ++i) {
+            hist[i % 64] += partial[i];
+        }
+    }
+};
+
+} // namespace hll
+
+#endif // !defined(HYPERLOGLOG_PARALLEL_HPP)
@@ -0,0 +1,385 @@
+#if !defined(HYPERLOGLOG_ROLLUP_HPP)
+#define HYPERLOGLOG_ROLLUP_HPP
+
+/**
+ * @file hyperloglog_rollup.hpp
+ * @brief Time-partitioned pyramid of HyperLogLog counters answering distinct counts over time ranges
+ */
+
+#include <map>
+#include "hyperloglog.hpp"
+
+#define HLL_ROLLUP_MAX_LEVELS 16
+
+namespace hll {
+
+/** @class RollupHyperLogLog
+ *  @brief HyperLogLog counters per time bucket, rolled up into coarser levels.
+ *
+ * Level 0 has one counter per bucket (e.g. a minute); a node of level l + 1
+ * is the union of fanouts[l] consecutive nodes of level l (by default 60
+ * minutes make an hour, 24 hours a day and 30 days a month). Nodes are
+ * created on first use and stay sparse while they hold few registers.
+ *
+ * Elements and sealed bucket counters are applied to their bucket and to
+ * every ancestor right away, so each level is always complete: add() costs
+ * one hash and one register update per level, insert() one merge per level.
+ * A range query merges the largest aligned nodes covering the range, at most
+ * 2 * (fanouts[l] - 1) per level plus the top level nodes inside the range,
+ * instead of one counter per bucket.
+ */
+class RollupHyperLogLog {
+public:
+
+    /**
+     * Constructor
+     *
+     * @param[in] b bit width (register size will be 2 to the b power), in the range [4,30]
+     * @param[in] hash hash function
+     * @param[in] fanouts number of nodes of each level that make one node of the next
+     *            level, each at least 2; at most HLL_ROLLUP_MAX_LEVELS - 1 of them
+     *
+     * @exception std::invalid_argument the argument is out of range.
+     */
+    RollupHyperLogLog(uint8_t b, HashType hash = HASH_MURMUR3_X86_32,
+            const std::vector<uint32_t>& fanouts = std::vector<uint32_t>{60, 24, 30}) throw (std::invalid_argument) :
+            b_(b), hash_(hash), span_(1, 1) {
+        if (b < 4 || 30 < b) {
+            throw std::invalid_argument("bit width must be in the range [4,30]");
+        }
+        if (!isHashType(hash)) {
+            throw std::invalid_argument("unknown hash type");
+        }
+        if (fanouts.size() >= HLL_ROLLUP_MAX_LEVELS) {
+            throw std::invalid_argument("too many levels");
+        }
+        for (size_t l = 0; l < fanouts.size(); ++l) {
+            if (fanouts[l] < 2) {
+                throw std::invalid_argument("fan-out must be at least 2");
+            }
+            if (span_.back() > std::numeric_limits<uint64_t>::max() / fanouts[l]) {
+                throw std::invalid_argument("levels span more than 2^64 buckets");
+            }
+            span_.push_back(span_.back() * fanouts[l]);
+        }
+        levels_.resize(span_.size());
+    }
+
+    /**
+     * Adds element to the counters of a bucket and its ancestors
+     *
+     * @param[in] str string to add
+     * @param[in] len length of string
+     * @param[in] bucket time bucket of the element
+     */
+    void add(const char* str, uint32_t len, uint64_t bucket) {
+        addHash(hashElement(hash_, str, len), bucket);
+    }
+
+    /**
+     * Adds an element by its hash value, skipping the hash function.
+     * The value must be that of the hash function of the counter, see hashElement().
+     *
+     * @param[in] value hash value of the element
+     * @param[in] bucket time bucket of the element
+     */
+    void addHash(uint64_t value, uint64_t bucket) {
+        for (size_t l = 0; l < levels_.size(); ++l) {
+            node(l, bucket / span_[l]).addHash(value);
+        }
+    }
+
+    /**
+     * Seals the counter of a bucket: merges it into the bucket and its ancestors.
+     * Inserting into a bucket that already has elements adds to them.
+     *
+     * @param[in] sketch counter of the elements of the bucket, with the same
+     *            hash function and a bit width at least b
+     * @param[in] bucket time bucket
+     *
+     * @exception std::invalid_argument hash function or bit width doesn't match.
+     */
+    void insert(const HyperLogLog& sketch, uint64_t bucket) throw (std::invalid_argument) {
+        if (sketch.hashType() != hash_ || sketch.registerSize() < (uint32_t(1) << b_)) {
+            throw std::invalid_argument("hash function or bit width doesn't match");
+        }
+        for (size_t l = 0; l < levels_.size(); ++l) {
+            node(l, bucket / span_[l]).merge(sketch);
+        }
+    }
+
+    /**
+     * Collects the nodes covering the buckets [from, to): at each step the
+     * largest node that starts at the next uncovered bucket and ends within
+     * the range. Nodes without elements are left out.
+     *
+     * @param[in] from first bucket
+     * @param[in] to bucket after the last one
+     * @param[out] nodes covering nodes
+     */
+    void cover(uint64_t from, uint64_t to, std::vector<const HyperLogLog*>& nodes) const {
+        nodes.clear();
+        const size_t top = levels_.size() - 1;
+        const uint64_t span = span_[top];
+        // top level nodes inside the range are taken from the map, so the
+        // cost doesn't grow with the length of the range
+        const uint64_t first = from / span + (from % span != 0);
+        const uint64_t last = to / span;
+        if (from >= to || first >= last) {
+            coverBelow(from, to, top, nodes);
+            return;
+        }
+        coverBelow(from, first * span, top, nodes);
+        const std::map<uint64_t, HyperLogLog>& level = levels_[top];
+        for (std::map<uint64_t, HyperLogLog>::const_iterator it = level.lower_bound(first);
+                it != level.end() && it->first < last; ++it) {
+            nodes.push_back(&it->second);
+        }
+        coverBelow(last * span, to, top, nodes);
+    }
+
+    /**
+     * Returns the union of the buckets [from, to).
+     *
+     * @param[in] from first bucket
+     * @param[in] to bucket after the last one
+     *
+     * @return Counter of the elements of the range
+     */
+    HyperLogLog merged(uint64_t from, uint64_t to) const {
+        std::vector<const HyperLogLog*> nodes;
+        cover(from, to, nodes);
+        HyperLogLog result(b_, hash_, true);
+        if (!nodes.empty()) {
+            result.mergeMany(&nodes[0], nodes.size());
+        }
+        return result;
+    }
+
+    /**
+     * Estimates the number of distinct elements in the buckets [from, to).
+     *
+     * @param[in] from first bucket
+     * @param[in] to bucket after the last one
+     * @param[in] estimator estimator to use
+     *
+     * @return Estimated cardinality value.
+     */
+    double estimate(uint64_t from, uint64_t to, EstimatorType estimator = ESTIMATOR_CLASSIC) const {
+        return merged(from, to).estimate(estimator);
+    }
+
+    /**
+     * Drops every node that ends at or before bucket 'before'.
+     *
+     * @param[in] before first bucket to keep
+     */
+    void expire(uint64_t before) {
+        for (size_t l = 0; l < levels_.size(); ++l) {
+            // node i ends at (i + 1) * span; keep those with i >= before / span
+            std::map<uint64_t, HyperLogLog>& level = levels_[l];
+            level.erase(level.begin(), level.lower_bound(before / span_[l]));
+        }
+    }
+
+    /**
+     * Removes all nodes.
+     */
+    void clear() {
+        for (size_t l = 0; l < levels_.size(); ++l) {
+            levels_[l].clear();
+        }
+    }
+
+    /**
+     * Returns the number of levels, including the bucket level.
+     *
+     * @return Number of levels
+     */
+    size_t levels() const {
+        return levels_.size();
+    }
+
+    /**
+     * Returns the number of buckets a node of a level spans.
+     *
+     * @param[in] level level, less than levels()
+     *
+     * @return Number of buckets
+     */
+    uint64_t span(size_t level) const {
+        return span_[level];
+    }
+
+    /**
+     * Returns the number of nodes of a level.
+     *
+     * @param[in] level level, less than levels()
+     *
+     * @return Number of nodes
+     */
+    size_t nodeCount(size_t level) const {
+        return levels_[level].size();
+    }
+
+    /**
+     * Returns the heap memory held by the registers of all nodes.
+     *
+     * @return Size in bytes
+     */
+    size_t memoryUsage() const {
+        size_t bytes = 0;
+        for (size_t l = 0; l < levels_.size(); ++l) {
+            for (std::map<uint64_t, HyperLogLog>::const_iterator it = levels_[l].begin(); it != levels_[l].end(); ++it) {
+                bytes += it->second.memoryUsage();
+            }
+        }
+        return bytes;
+    }
+
+    /**
+     * Returns size of register of each node.
+     *
+     * @return Register size
+     */
+    uint32_t registerSize() const {
+        return uint32_t(1) << b_;
+    }
+
+    /**
+     * Returns the hash function of the counters.
+     *
+     * @return Hash function
+     */
+    HashType hashType() const {
+        return hash_;
+    }
+
+    /**
+     * Exchanges the content of the instance
+     *
+     * @param[in,out] rhs Another RollupHyperLogLog instance
+     */
+    void swap(RollupHyperLogLog& rhs) {
+        std::swap(b_, rhs.b_);
+        std::swap(hash_, rhs.hash_);
+        span_.swap(rhs.span_);
+        levels_.swap(rhs.levels_);
+    }
+
+    /**
+     * Dump the current status to a stream: the bit width, hash function and
+     * fan-outs, then the level, index and dump() of every node.
+     *
+     * @param[out] os The output stream where the data is saved
+     *
+     * @exception std::runtime_error When failed to dump.
+     */
+    void dump(std::ostream& os) const throw(std::runtime_error) {
+        const uint8_t header[3] = {b_, (uint8_t) hash_, (uint8_t) levels_.size()};
+        os.write((const char*) header, sizeof(header));
+        for (size_t l = 1; l < span_.size(); ++l) {
+            const uint32_t fanout = span_[l] / span_[l - 1];
+            os.write((const char*) &fanout, sizeof(fanout));
+        }
+        uint64_t n = 0;
+        for (size_t l = 0; l < levels_.size(); ++l) {
+            n += levels_[l].size();
+        }
+        os.write((const char*) &n, sizeof(n));
+        for (size_t l = 0; l < levels_.size(); ++l) {
+            const uint8_t level = l;
+            for (std::map<uint64_t, HyperLogLog>::const_iterator it = levels_[l].begin(); it != levels_[l].end(); ++it) {
+                os.write((const char*) &level, sizeof(level));
+                os.write((const char*) &it->first, sizeof(it->first));
+                it->second.dump(os);
+            }
+        }
+        if (os.fail()) {
+            throw std::runtime_error("Failed to dump");
+        }
+    }
+
+    /**
+     * Restore the status from a stream
+     *
+     * @param[in] is The input stream where the status is saved
+     *
+     * @exception std::runtime_error When failed to restore.
+     */
+    void restore(std::istream& is) throw(std::runtime_error) {
+        uint8_t header[3] = {0, 0, 0};
+        is.read((char*) header, sizeof(header));
+        if (is.fail() || header[2] == 0 || header[2] > HLL_ROLLUP_MAX_LEVELS) {
+            throw std::runtime_error("Failed to restore");
+        }
+        std::vector<uint32_t> fanouts(header[2] - 1);
+        if (!fanouts.empty()) {
+            is.read((char*) &fanouts[0], sizeof(fanouts[0]) * fanouts.size());
+        }
+        uint64_t n = 0;
+        is.read((char*) &n, sizeof(n));
+        if (is.fail()) {
+            throw std::runtime_error("Failed to restore");
+        }
+        try {
+            RollupHyperLogLog temp(header[0], static_cast<HashType>(header[1]), fanouts);
+            for (uint64_t i = 0; i < n; ++i) {
+                uint8_t level = 0;
+                uint64_t index = 0;
+                is.read((char*) &level, sizeof(level));
+                is.read((char*) &index, sizeof(index));
+                if (is.fail() || level >= temp.levels_.size()) {
+                    throw std::runtime_error("Failed to restore");
+                }
+                HyperLogLog& node = temp.levels_[level][index];
+                node.restore(is);
+                if (node.registerSize() != temp.registerSize() || node.hashType() != temp.hash_) {
+                    throw std::runtime_error("Failed to restore");
+                }
+            }
+            swap(temp);
+        } catch (const std::invalid_argument&) {
+            throw std::runtime_error("Failed to restore");
+        }
+    }
+
+private:
+    /**
+     * Appends the greedy cover of [from, to) with nodes of the levels below
+     * 'top'; the range spans less than two nodes of level 'top'.
+     */
+    void coverBelow(uint64_t from, uint64_t to, size_t top, std::vector<const HyperLogLog*>& nodes) const {
+        while (from < to) {
+            size_t l = top - 1;
+            while (l > 0 && (from % span_[l] != 0 || to - from < span_[l])) {
+                l--;
+            }
+            const std::map<uint64_t, HyperLogLog>::const_iterator it = levels_[l].find(from / span_[l]);
+            if (it != levels_[l].end()) {
+                nodes.push_back(&it->second);
+            }
+            from += span_[l];
+        }
+    }
+
+    /**
+     * Returns node 'index' of level 'l', creating it if needed.
+     */
+    HyperLogLog& node(size_t l, uint64_t index) {
+        std::map<uint64_t, HyperLogLog>::iterator it = levels_[l].lower_bound(index);
+        if (it == levels_[l].end() || it->first != index) {
+            it = levels_[l].insert(it, std::make_pair(index, HyperLogLog(b_, hash_, true)));
+        }
+        return it->second;
+    }
+
+    uint8_t b_; ///< register bit width of every node
+    HashType hash_; ///< hash function
+    std::vector<uint64_t> span_; ///< buckets spanned by a node of each level
+    std::vector<std::map<uint64_t, HyperLogLog> > levels_; ///< nodes of each level by index
+};
+
+} // namespace hll
+
+#endif // !defined(HYPERLOGLOG_ROLLUP_HPP)
@@ -0,0 +1,528 @@
+#if !defined(HYPERLOGLOG_SETOPS_HPP)
+#define HYPERLOGLOG_SETOPS_HPP
+
+/**
+ * @file hyperloglog_setops.hpp
+ * @brief Union, intersection and Jaccard estimates over HyperLogLog counters
+ *        without building merged counters
+ *
+ * Every operation walks the registers of its counters once, a chunk of
+ * HLL_SETOPS_CHUNK registers at a time: the register-wise maximum (or the
+ * register comparison of the joint estimator) of a chunk goes into a small
+ * buffer on the stack and is counted with the vectorized histogram kernel,
+ * and the estimate is computed from the histograms. Sparse counters are
+ * expanded one chunk at a time.
+ */
+
+#include "hyperloglog.hpp"
+
+#define HLL_SETOPS_CHUNK 2048 ///< registers processed at a time
+#define HLL_SETOPS_TILE 8 ///< counters per side of a tile of the pairwise matrix
+
+namespace hll {
+
+/**
+ * Results of the pairwise matrix.
+ */
+enum SetOperation {
+    SET_UNION = 0, ///< |A u B|
+    SET_INTERSECTION = 1, ///< |A n B| by inclusion-exclusion
+    SET_JACCARD = 2 ///< |A n B| / |A u B|
+};
+
+/**
+ * Cardinality estimates of the parts of two sets.
+ */
+struct SetEstimate {
+    double onlyA; ///< |A \ B|
+    double onlyB; ///< |B \ A|
+    double both; ///< |A n B|
+
+    /**
+     * Returns |A u B|.
+     */
+    double unionSize() const {
+        return onlyA + onlyB + both;
+    }
+
+    /**
+     * Returns the Jaccard index |A n B| / |A u B| (0 for two empty sets).
+     */
+    double jaccard() const {
+        const double u = unionSize();
+        return u > 0 ? both / u : 0.0;
+    }
+};
+
+/** @class HyperLogLogSetOps
+ *  @brief Set operations on the registers of HyperLogLog counters.
+ *
+ * All counters passed to one call must have the same number of registers and
+ * hash function.
+ */
+class HyperLogLogSetOps {
+public:
+
+    /**
+     * Estimates the cardinality of the union of two counters.
+     * Equal to copying 'a', merging 'b' into it and calling estimate(estimator).
+     *
+     * @param[in] a counter
+     * @param[in] b counter
+     * @param[in] estimator estimator to use
+     *
+     * @return Estimated cardinality of the union
+     *
+     * @exception std::invalid_argument number of registers or hash function doesn't match.
+     */
+    static double unionEstimate(const HyperLogLog& a, const HyperLogLog& b, EstimatorType estimator = ESTIMATOR_CLASSIC)
+            throw (std::invalid_argument) {
+        const HyperLogLog* counters[] = {&a, &b};
+        return unionEstimate(counters, 2, estimator);
+    }
+
+    /**
+     * Estimates the cardinality of the union of n counters.
+     * Equal to merging all of them into one counter and calling estimate(estimator).
+     *
+     * @param[in] counters counters (at least one)
+     * @param[in] n number of counters
+     * @param[in] estimator estimator to use
+     *
+     * @return Estimated cardinality of the union
+     *
+     * @exception std::invalid_argument no counters, or number of registers or hash function doesn't match.
+     */
+    static double unionEstimate(const HyperLogLog* const* counters, size_t n, EstimatorType estimator = ESTIMATOR_CLASSIC)
+            throw (std::invalid_argument) {
+        if (n == 0) {
+            throw std::invalid_argument("no counters");
+        }
+        const HyperLogLog& first = *counters[0];
+        for (size_t i = 1; i < n; ++i) {
+            first.checkCompatible(*counters[i]);
+        }
+        uint32_t hist[64] = {0};
+        std::vector<size_t> cursor(n, 0);
+        uint8_t chunk[HLL_SETOPS_CHUNK];
+        uint8_t buf[HLL_SETOPS_CHUNK];
+        for (uint32_t begin = 0; begin < first.m_; begin += HLL_SETOPS_CHUNK) {
+            const uint32_t len = std::min(first.m_ - begin, (uint32_t) HLL_SETOPS_CHUNK);
+            const uint8_t* r = registers(first, begin, len, cursor[0], chunk);
+            if (r != chunk) {
+                std::copy(r, r + len, chunk);
+            }
+            for (size_t i = 1; i < n; ++i) {
+                maxInto(chunk, registers(*counters[i], begin, len, cursor[i], buf), len);
+            }
+            simd::registerHistogram(chunk, len, hist);
+        }
+        return estimateFromHistogram(estimator, first.hash_, first.b_, hist);
+    }
+
+    /**
+     * Estimates the cardinality of the intersection of two counters by
+     * inclusion-exclusion, |A| + |B| - |A u B|, clamped at 0. Its error is
+     * that of the union, so it is only useful when the intersection is not
+     * much smaller than the union; see jointEstimate().
+     *
+     * @param[in] a counter
+     * @param[in] b counter
+     * @param[in] estimator estimator to use
+     *
+     * @return Estimated cardinality of the intersection
+     *
+     * @exception std::invalid_argument number of registers or hash function doesn't match.
+     */
+    static double intersectionEstimate(const HyperLogLog& a, const HyperLogLog& b, EstimatorType estimator = ESTIMATOR_CLASSIC)
+            throw (std::invalid_argument) {
+        const Marginals e = marginals(a, b, estimator);
+        return std::max(0.0, e.a + e.b - e.u);
+    }
+
+    /**
+     * Estimates the Jaccard index |A n B| / |A u B| of two counters by
+     * inclusion-exclusion.
+     *
+     * @param[in] a counter
+     * @param[in] b counter
+     * @param[in] estimator estimator to use
+     *
+     * @return Estimated Jaccard index in [0,1] (0 for two empty counters)
+     *
+     * @exception std::invalid_argument number of registers or hash function doesn't match.
+     */
+    static double jaccard(const HyperLogLog& a, const HyperLogLog& b, EstimatorType estimator = ESTIMATOR_CLASSIC)
+            throw (std::invalid_argument) {
+        const Marginals e = marginals(a, b, estimator);
+        return e.u > 0 ? std::min(1.0, std::max(0.0, e.a + e.b - e.u) / e.u) : 0.0;
+    }
+
+    /**
+     * Estimates |A \ B|, |B \ A| and |A n B| jointly by maximum likelihood
+     * (Ertl, "New cardinality estimation methods for HyperLogLog sketches",
+     * 2017). Besides the register values it uses which of each pair of
+     * registers is larger, so the intersection is much more accurate than
+     * by inclusion-exclusion when it is small compared to the union.
+     *
+     * @param[in] a counter
+     * @param[in] b counter
+     *
+     * @return Estimated cardinalities of the parts
+     *
+     * @exception std::invalid_argument number of registers or hash function doesn't match.
+     */
+    static SetEstimate jointEstimate(const HyperLogLog& a, const HyperLogLog& b) throw (std::invalid_argument) {
+        a.checkCompatible(b);
+        JointHistogram h;
+        size_t cursorA = 0;
+        size_t cursorB = 0;
+        uint8_t bufA[HLL_SETOPS_CHUNK];
+        uint8_t bufB[HLL_SETOPS_CHUNK];
+        uint8_t sel[HLL_SETOPS_CHUNK];
+        for (uint32_t begin = 0; begin < a.m_; begin += HLL_SETOPS_CHUNK) {
+            const uint32_t len = std::min(a.m_ - begin, (uint32_t) HLL_SETOPS_CHUNK);
+            const uint8_t* ra = registers(a, begin, len, cursorA, bufA);
+            const uint8_t* rb = registers(b, begin, len, cursorB, bufB);
+            // registers that don't belong to a histogram are counted at 63, which no register reaches
+            for (uint32_t i = 0; i < len; ++i) {
+                sel[i] = ra[i] < rb[i] ? ra[i] : 63;
+            }
+            simd::registerHistogram(sel, len, h.aLess);
+            for (uint32_t i = 0; i < len; ++i) {
+                sel[i] = ra[i] < rb[i] ? rb[i] : 63;
+            }
+            simd::registerHistogram(sel, len, h.bGreater);
+            for (uint32_t i = 0; i < len; ++i) {
+                sel[i] = ra[i] > rb[i] ? ra[i] : 63;
+            }
+            simd::registerHistogram(sel, len, h.aGreater);
+            for (uint32_t i = 0; i < len; ++i) {
+                sel[i] = ra[i] > rb[i] ? rb[i] : 63;
+            }
+            simd::registerHistogram(sel, len, h.bLess);
+            for (uint32_t i = 0; i < len; ++i) {
+                sel[i] = ra[i] == rb[i] ? ra[i] : 63;
+            }
+            simd::registerHistogram(sel, len, h.equal);
+        }
+        return maximizeJoint(h, a.m_, hashBits(a.hash_) - a.b_, a, b);
+    }
+
+    /**
+     * Computes a set operation for every pair of n counters into the n x n
+     * row-major matrix 'out'; the diagonal holds the estimate of each
+     * counter (SET_UNION, SET_INTERSECTION) or 1 (SET_JACCARD). The pairs
+     * are processed in tiles of HLL_SETOPS_TILE x HLL_SETOPS_TILE counters
+     * so that each chunk of registers is read once per tile rather than
+     * once per pair. Each entry is equal to the corresponding pairwise call.
+     *
+     * @param[in] counters counters
+     * @param[in] n number of counters
+     * @param[in] op set operation
+     * @param[out] out n * n results
+     * @param[in] estimator estimator to use
+     *
+     * @exception std::invalid_argument number of registers or hash function doesn't match.
+     */
+    static void pairwise(const HyperLogLog* const* counters, size_t n, SetOperation op, double* out,
+            EstimatorType estimator = ESTIMATOR_CLASSIC) throw (std::invalid_argument) {
+        if (n == 0) {
+            return;
+        }
+        const HyperLogLog& first = *counters[0];
+        for (size_t i = 1; i < n; ++i) {
+            first.checkCompatible(*counters[i]);
+        }
+        std::vector<double> single(n);
+        for (size_t i = 0; i < n; ++i) {
+            single[i] = counters[i]->estimate(estimator);
+            out[i * n + i] = op == SET_JACCARD ? 1.0 : single[i];
+        }
+        const size_t T = HLL_SETOPS_TILE;
+        std::vector<uint32_t> hist(T * T * 64);
+        std::vector<uint8_t> rows(T * HLL_SETOPS_CHUNK);
+        std::vector<uint8_t> cols(T * HLL_SETOPS_CHUNK);
+        std::vector<size_t> cursor(2 * T);
+        uint8_t chunk[HLL_SETOPS_CHUNK];
+        for (size_t ti = 0; ti < n; ti += T) {
+            const size_t ni = std::min(n - ti, T);
+            for (size_t tj = ti; tj < n; tj += T) {
+                const size_t nj = std::min(n - tj, T);
+                std::fill(hist.begin(), hist.end(), 0);
+                std::fill(cursor.begin(), cursor.end(), 0);
+                for (uint32_t begin = 0; begin < first.m_; begin += HLL_SETOPS_CHUNK) {
+                    const uint32_t len = std::min(first.m_ - begin, (uint32_t) HLL_SETOPS_CHUNK);
+                    const uint8_t* ri[HLL_SETOPS_TILE];
+                    const uint8_t* rj[HLL_SETOPS_TILE];
+                    for (size_t i = 0; i < ni; ++i) {
+                        ri[i] = registers(*counters[ti + i], begin, len, cursor[i], &rows[i * HLL_SETOPS_CHUNK]);
+                    }
+                    for (size_t j = 0; j < nj; ++j) {
+                        rj[j] = registers(*counters[tj + j], begin, len, cursor[T + j], &cols[j * HLL_SETOPS_CHUNK]);
+                    }
+                    for (size_t i = 0; i < ni; ++i) {
+                        for (size_t j = tj == ti ? i + 1 : 0; j < nj; ++j) {
+                            maxOf(ri[i], rj[j], chunk, len);
+                            simd::registerHistogram(chunk, len, &hist[(i * T + j) * 64]);
+                        }
+                    }
+                }
+                for (size_t i = 0; i < ni; ++i) {
+                    for (size_t j = tj == ti ? i + 1 : 0; j < nj; ++j) {
+                        const size_t r = ti + i;
+                        const size_t c = tj + j;
+                        const double u = estimateFromHistogram(estimator, first.hash_, first.b_, &hist[(i * T + j) * 64]);
+                        double v = u;
+                        if (op == SET_INTERSECTION) {
+                            v = std::max(0.0, single[r] + single[c] - u);
+                        } else if (op == SET_JACCARD) {
+                            v = u > 0 ? std::min(1.0, std::max(0.0, single[r] + single[c] - u) / u) : 0.0;
+                        }
+                        out[r * n + c] = v;
+                        out[c * n + r] = v;
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    /**
+     * Estimates of |A|, |B| and |A u B|.
+     */
+    struct Marginals {
+        double a;
+        double b;
+        double u;
+    };
+
+    /**
+     * Histograms of the register pairs of two counters: of the smaller and
+     * the larger value where they differ, split by which one is larger, and
+     * of the value where they are equal.
+     */
+    struct JointHistogram {
+        uint32_t aLess[64]; ///< a[i] where a[i] < b[i]
+        uint32_t bGreater[64]; ///< b[i] where a[i] < b[i]
+        uint32_t aGreater[64]; ///< a[i] where a[i] > b[i]
+        uint32_t bLess[64]; ///< b[i] where a[i] > b[i]
+        uint32_t equal[64]; ///< a[i] where a[i] == b[i]
+
+        JointHistogram() {
+            std::fill(aLess, aLess + 64, 0);
+            std::fill(bGreater, bGreater + 64, 0);
+            std::fill(aGreater, aGreater + 64, 0);
+            std::fill(bLess, bLess + 64, 0);
+            std::fill(equal, equal + 64, 0);
+        }
+    };
+
+    /**
+     * Returns registers [begin, begin + len) of a counter: a pointer into the
+     * dense registers, or 'buf' filled from the sparse entries. 'cursor' is
+     * the position in the sparse entries, starting at 0 for the first chunk.
+     */
+    static const uint8_t* registers(const HyperLogLog& hll, uint32_t begin, uint32_t len, size_t& cursor, uint8_t* buf) {
+        if (!hll.M_.empty()) {
+            return &hll.M_[begin];
+        }
+        std::fill(buf, buf + len, 0);
+        const std::vector<uint32_t>& entries = hll.sparse_;
+        for (; cursor < entries.size() && (entries[cursor] >> 6) < begin + len; ++cursor) {
+            buf[(entries[cursor] >> 6) - begin] = entries[cursor] & 0x3F;
+        }
+        return buf;
+    }
+
+    /**
+     * dst[i] = max(a[i], b[i]); the compiler vectorizes the loop.
+     */
+    static void maxOf(const uint8_t* a, const uint8_t* b, uint8_t* dst, uint32_t len) {
+        for (uint32_t i = 0; i < len; ++i) {
+            dst[i] = std::max(a[i], b[i]);
+        }
+    }
+
+    /**
+     * dst[i] = max(dst[i], src[i]); the compiler vectorizes the loop.
+     */
+    static void maxInto(uint8_t* dst, const uint8_t* src, uint32_t len) {
+        for (uint32_t i = 0; i < len; ++i) {
+            dst[i] = std::max(dst[i], src[i]);
+        }
+    }
+
+    static Marginals marginals(const HyperLogLog& a, const HyperLogLog& b, EstimatorType estimator) {
+        Marginals e;
+        e.u = unionEstimate(a, b, estimator);
+        e.a = a.estimate(estimator);
+        e.b = b.estimate(estimator);
+        return e;
+    }
+
+    /**
+     * log of P(K <= k) - P(K <= k - 1) for the maximum K of Poisson(rate)
+     * hashes on a register; w[k] is 2^-k for k <= q and 0 for k = q + 1.
+     */
+    static double logStep(double rate, const double* w, int k) {
+        if (k == 0) {
+            return -rate;
+        }
+        return -rate * w[k] + std::log(-std::expm1(-rate * (w[k - 1] - w[k])));
+    }
+
+    /**
+     * Log-likelihood of the joint histogram for the per-register rates
+     * exp(t[0]) of A \ B, exp(t[1]) of B \ A and exp(t[2]) of A n B.
+     */
+    static double logLikelihood(const JointHistogram& h, int q, const double* w, const double* t) {
+        const double ra = std::exp(t[0]);
+        const double rb = std::exp(t[1]);
+        const double rx = std::exp(t[2]);
+        double ll = 0.0;
+        for (int k = 0; k <= q + 1; ++k) {
+            // a register of A is below the one of B: B's value came from B \ A alone
+            if (h.aLess[k] != 0) {
+                ll += h.aLess[k] * logStep(ra + rx, w, k);
+            }
+            if (h.bGreater[k] != 0) {
+                ll += h.bGreater[k] * logStep(rb, w, k);
+            }
+            if (h.aGreater[k] != 0) {
+                ll += h.aGreater[k] * logStep(ra, w, k);
+            }
+            if (h.bLess[k] != 0) {
+                ll += h.bLess[k] * logStep(rb + rx, w, k);
+            }
+            if (h.equal[k] != 0) {
+                // P(K1 = K2 = k) = F_a F_b (F_x - F_x') + F_x' (F_a - F_a')(F_b - F_b'),
+                // both terms non-negative so there is no cancellation
+                double p;
+                if (k == 0) {
+                    p = std::exp(-(ra + rb + rx));
+                } else {
+                    const double first = std::exp(-(ra + rb) * w[k] + logStep(rx, w, k));
+                    const double second = std::exp(-rx * w[k - 1] + logStep(ra, w, k) + logStep(rb, w, k));
+                    p = first + second;
+                }
+                ll += h.equal[k] * std::log(p);
+            }
+        }
+        return ll;
+    }
+
+    /**
+     * Maximizes the log-likelihood over the log rates with the Nelder-Mead
+     * simplex method, starting from the inclusion-exclusion estimates.
+     */
+    static SetEstimate maximizeJoint(const JointHistogram& h, uint32_t m, int q, const HyperLogLog& a,
+            const HyperLogLog& b) {
+        double w[64];
+        for (int k = 0; k <= q; ++k) {
+            w[k] = std::ldexp(1.0, -k);
+        }
+        w[q + 1] = 0.0;
+        const uint32_t zerosA = h.equal[0] + h.aLess[0];
+        const uint32_t zerosB = h.equal[0] + h.bLess[0];
+        SetEstimate result;
+        if (zerosA == m && zerosB == m) {
+            result.onlyA = result.onlyB = result.both = 0.0;
+            return result;
+        }
+        // start from inclusion-exclusion, keeping every part away from 0 so its log is finite
+        const double ea = a.estimate(ESTIMATOR_ML);
+        const double eb = b.estimate(ESTIMATOR_ML);
+        const double eu = unionEstimate(a, b, ESTIMATOR_ML);
+        const double floor = 0.5 / m;
+        const double start[3] = {
+            std::log(std::max(eu - eb, 0.0) / m + floor),
+            std::log(std::max(eu - ea, 0.0) / m + floor),
+            std::log(std::max(ea + eb - eu, 0.0) / m + floor)
+        };
+        double simplex[4][3];
+        double value[4];
+        for (int v = 0; v < 4; ++v) {
+            for (int d = 0; d < 3; ++d) {
+                simplex[v][d] = start[d] + (v == d + 1 ? 1.0 : 0.0);
+            }
+            value[v] = -logLikelihood(h, q, w, simplex[v]);
+        }
+        for (int iter = 0; iter < 1000; ++iter) {
+            // order the vertices from best (lowest negative log-likelihood) to worst
+            for (int i = 1; i < 4; ++i) {
+                for (int j = i; j > 0 && value[j] < value[j - 1]; --j) {
+                    std::swap(value[j], value[j - 1]);
+                    for (int d = 0; d < 3; ++d) {
+                        std::swap(simplex[j][d], simplex[j - 1][d]);
+                    }
+                }
+            }
+            double size = 0.0;
+            for (int v = 1; v < 4; ++v) {
+                for (int d = 0; d < 3; ++d) {
+                    size = std::max(size, std::abs(simplex[v][d] - simplex[0][d]));
+                }
+            }
+            // a part that is empty drifts towards a rate of 0, where the likelihood is flat
+            if (size < 1e-6 || value[3] - value[0] <= 1e-12 * std::abs(value[0])) {
+                break;
+            }
+            double centroid[3];
+            for (int d = 0; d < 3; ++d) {
+                centroid[d] = (simplex[0][d] + simplex[1][d] + simplex[2][d]) / 3.0;
+            }
+            double reflected[3];
+            for (int d = 0; d < 3; ++d) {
+                reflected[d] = centroid[d] + (centroid[d] - simplex[3][d]);
+            }
+            const double fr = -logLikelihood(h, q, w, reflected);
+            if (fr < value[0]) {
+                double expanded[3];
+                for (int d = 0; d < 3; ++d) {
+                    expanded[d] = centroid[d] + 2.0 * (centroid[d] - simplex[3][d]);
+                }
+                const double fe = -logLikelihood(h, q, w, expanded);
+                replace(simplex[3], value[3], fe < fr ? expanded : reflected, std::min(fe, fr));
+            } else if (fr < value[2]) {
+                replace(simplex[3], value[3], reflected, fr);
+            } else {
+                double contracted[3];
+                for (int d = 0; d < 3; ++d) {
+                    contracted[d] = centroid[d] + 0.5 * (simplex[3][d] - centroid[d]);
+                }
+                const double fc = -logLikelihood(h, q, w, contracted);
+                if (fc < value[3]) {
+                    replace(simplex[3], value[3], contracted, fc);
+                } else {
+                    // shrink towards the best vertex
+                    for (int v = 1; v < 4; ++v) {
+                        for (int d = 0; d < 3; ++d) {
+                            simplex[v][d] = simplex[0][d] + 0.5 * (simplex[v][d] - simplex[0][d]);
+                        }
+                        value[v] = -logLikelihood(h, q, w, simplex[v]);
+                    }
+                }
+            }
+        }
+        int best = 0;
+        for (int v = 1; v < 4; ++v) {
+            if (value[v] < value[best]) {
+                best = v;
+            }
+        }
+        result.onlyA = m * std::exp(simplex[best][0]);
+        result.onlyB = m * std::exp(simplex[best][1]);
+        result.both = m * std::exp(simplex[best][2]);
+        return result;
+    }
+
+    static void replace(double* vertex, double& value, const double* point, double pointValue) {
+        std::copy(point, point + 3, vertex);
+        value = pointValue;
+    }
+};
+
+} // namespace hll
+
+#endif // !defined(HYPERLOGLOG_SETOPS_HPP)
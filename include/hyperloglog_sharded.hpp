@@ -0,0 +1,356 @@
+#if !defined(HYPERLOGLOG_SHARDED_HPP)
+#define HYPERLOGLOG_SHARDED_HPP
+
+/**
+ * @file hyperloglog_sharded.hpp
+ * @brief HIP estimator fed by per-thread shards
+ */
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include "hyperloglog.hpp"
+
+#define HLL_SHARD_PUBLISH_INTERVAL 4096 ///< default number of adds between two publishes of a shard
+
+namespace hll {
+
+/**
+ * Staleness and merge cost of a ShardedHyperLogLogHIP.
+ */
+struct ShardedHIPStats {
+    uint64_t epoch; ///< number of collect() calls so far
+    uint64_t added; ///< elements added to all shards
+    uint64_t collected; ///< elements reflected in estimate()
+    uint64_t pending; ///< added - collected: how far estimate() lags behind ingest
+    uint64_t publishes; ///< shard publishes into their mailbox
+    uint64_t publishesDeferred; ///< publishes put off because a collect() was reading the mailbox
+    uint64_t shardsMerged; ///< non-empty shard mailboxes replayed by collect()
+    uint64_t raisesMerged; ///< register raises replayed by collect()
+    uint64_t lastCollectNanos; ///< duration of the last collect()
+    uint64_t totalCollectNanos; ///< duration of all collect() calls
+};
+
+/** @class ShardedHyperLogLogHIP
+ *  @brief HIP counter that many threads add to through their own shards.
+ *
+ * Each writer thread gets a Shard from shard() and adds to it without any
+ * synchronization. A shard keeps its own registers and logs every register
+ * it raises. Every 'publishInterval' adds it moves the log into a mailbox,
+ * taking the mailbox lock with try_lock() so that it never waits; a
+ * deferred publish is retried on the next add. collect(), called
+ * periodically by a collector thread, replays the published logs into the
+ * global HyperLogLogHIP and publishes its estimate. estimate() only reads
+ * that published value, so readers never block writers or the collector.
+ *
+ * Replaying the raises in shard order gives exactly the HIP estimate of
+ * one interleaving of the shard streams. Merging whole shard registers with
+ * HyperLogLogHIP::merge() would count several raises of a register between
+ * two collections as one and underestimate.
+ *
+ * estimate() is stale by at most the elements added since the last
+ * collect() plus 'publishInterval' per shard; stats() reports the exact lag.
+ */
+class ShardedHyperLogLogHIP {
+public:
+
+    /**
+     * Per-thread part of the counter. Must be used by one thread at a time.
+     */
+    class Shard {
+        friend class ShardedHyperLogLogHIP;
+    public:
+
+        /**
+         * Adds element to the shard
+         *
+         * @param[in] str string to add
+         * @param[in] len length of string
+         */
+        void add(const char* str, uint32_t len) {
+            uint32_t index;
+            uint8_t rank;
+            indexRank(hash_, b_, str, len, index, rank);
+            update(index, rank);
+            added(1);
+        }
+
+        /**
+         * Adds a batch of elements to the shard.
+         *
+         * @param[in] strs strings to add
+         * @param[in] lens lengths of the strings
+         * @param[in] n number of strings
+         */
+        void addBatch(const char* const* strs, const uint32_t* lens, size_t n) {
+            uint32_t index[HLL_BATCH_SIZE];
+            uint8_t rank[HLL_BATCH_SIZE];
+            for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+                const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+                indexRankBatch(hash_, b_, strs + off, lens + off, cnt, index, rank);
+                for (size_t i = 0; i < cnt; ++i) {
+                    update(index[i], rank[i]);
+                }
+                added(cnt);
+            }
+        }
+
+        /**
+         * Adds a batch of fixed-width elements stored back to back.
+         *
+         * @param[in] keys pointer to the first element
+         * @param[in] len length of each element
+         * @param[in] n number of elements
+         */
+        void addBatch(const char* keys, uint32_t len, size_t n) {
+            uint32_t index[HLL_BATCH_SIZE];
+            uint8_t rank[HLL_BATCH_SIZE];
+            for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+                const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+                indexRankBatch(hash_, b_, keys + off * len, len, cnt, index, rank);
+                for (size_t i = 0; i < cnt; ++i) {
+                    update(index[i], rank[i]);
+                }
+                added(cnt);
+            }
+        }
+
+        /**
+         * Adds an element to the shard by its hash value (see HyperLogLog::addHash()).
+         *
+         * @param[in] value hash value of the element
+         */
+        void addHash(uint64_t value) {
+            uint32_t index;
+            uint8_t rank;
+            indexRankHash(hash_, b_, value, index, rank);
+            update(index, rank);
+            added(1);
+        }
+
+        /**
+         * Adds a batch of elements to the shard by their hash values.
+         *
+         * @param[in] values hash values of the elements
+         * @param[in] n number of hash values
+         */
+        void addHashes(const uint64_t* values, size_t n) {
+            uint32_t index[HLL_BATCH_SIZE];
+            uint8_t rank[HLL_BATCH_SIZE];
+            for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+                const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+                indexRankHashes(hash_, b_, values + off, cnt, index, rank);
+                for (size_t i = 0; i < cnt; ++i) {
+                    update(index[i], rank[i]);
+                }
+                added(cnt);
+            }
+        }
+
+        /**
+         * Publishes everything added so far, waiting for a running collect()
+         * if necessary. Call it when the writer is done.
+         */
+        void flush() {
+            std::lock_guard<std::mutex> lock(mailboxLock_);
+            publishLocked();
+        }
+
+    private:
+        Shard(uint8_t b, HashType hash, uint32_t publishInterval, ShardedHyperLogLogHIP& owner) :
+                b_(b), hash_(hash), M_(uint32_t(1) << b, 0), publishInterval_(publishInterval), sincePublish_(0),
+                added_(0), publishedAdds_(0), owner_(owner) {
+        }
+        Shard(const Shard&);
+        Shard& operator=(const Shard&);
+
+        void update(uint32_t index, uint8_t rank) {
+            if (rank > M_[index]) {
+                M_[index] = rank;
+                log_.push_back((index << 6) | rank);
+            }
+        }
+
+        void added(size_t n) {
+            added_ += n;
+            owner_.added_.fetch_add(n, std::memory_order_relaxed);
+            sincePublish_ += n;
+            if (sincePublish_ < publishInterval_) {
+                return;
+            }
+            if (mailboxLock_.try_lock()) {
+                publishLocked();
+                mailboxLock_.unlock();
+            } else {
+                owner_.publishesDeferred_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        void publishLocked() {
+            if (mailbox_.empty()) {
+                mailbox_.swap(log_);
+            } else {
+                mailbox_.insert(mailbox_.end(), log_.begin(), log_.end());
+                log_.clear();
+            }
+            publishedAdds_ = added_;
+            sincePublish_ = 0;
+            owner_.publishes_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        uint8_t b_; ///< register bit width
+        HashType hash_; ///< hash function
+        std::vector<uint8_t> M_; ///< registers of this shard
+        std::vector<uint32_t> log_; ///< (index << 6 | rank) of the raises since the last publish
+        std::vector<uint32_t> mailbox_; ///< published raises not collected yet
+        std::mutex mailboxLock_; ///< guards mailbox_ and publishedAdds_
+        uint32_t publishInterval_; ///< adds between two publishes
+        uint64_t sincePublish_; ///< adds since the last publish
+        uint64_t added_; ///< adds to this shard
+        uint64_t publishedAdds_; ///< added_ at the last publish
+        ShardedHyperLogLogHIP& owner_;
+    };
+
+    /**
+     * Constructor
+     *
+     * @param[in] b bit width (register size will be 2 to the b power).
+     *            This value must be in the range[4,30].Default value is 4.
+     * @param[in] hash hash function
+     * @param[in] publishInterval number of adds after which a shard publishes its register raises
+     *
+     * @exception std::invalid_argument the argument is out of range.
+     */
+    ShardedHyperLogLogHIP(uint8_t b = 4, HashType hash = HASH_MURMUR3_X86_32,
+            uint32_t publishInterval = HLL_SHARD_PUBLISH_INTERVAL) throw (std::invalid_argument) :
+            b_(b), hash_(hash), publishInterval_(std::max(publishInterval, (uint32_t) 1)), total_(b, hash),
+            estimate_(0.0), epoch_(0), added_(0), collected_(0), publishes_(0), publishesDeferred_(0),
+            shardsMerged_(0), raisesMerged_(0), lastCollectNanos_(0), totalCollectNanos_(0) {
+    }
+
+    /**
+     * Creates a shard for the calling thread.
+     * The shard stays valid as long as this object.
+     *
+     * @return New shard
+     */
+    Shard& shard() {
+        std::lock_guard<std::mutex> lock(shardsLock_);
+        shards_.push_back(std::unique_ptr<Shard>(new Shard(b_, hash_, publishInterval_, *this)));
+        return *shards_.back();
+    }
+
+    /**
+     * Replays the register raises published by the shards since the last call
+     * into the global counter and publishes the new estimate. Meant to be
+     * called periodically from one collector thread; concurrent calls are
+     * serialized. A mailbox is locked only while its log is taken out.
+     */
+    void collect() {
+        std::lock_guard<std::mutex> collectLock(collectLock_);
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        size_t n;
+        {
+            std::lock_guard<std::mutex> lock(shardsLock_);
+            n = shards_.size();
+        }
+        uint64_t collected = 0;
+        for (size_t i = 0; i < n; ++i) {
+            Shard* s;
+            {
+                std::lock_guard<std::mutex> lock(shardsLock_);
+                s = shards_[i].get();
+            }
+            {
+                std::lock_guard<std::mutex> lock(s->mailboxLock_);
+                replay_.swap(s->mailbox_);
+                collected += s->publishedAdds_;
+            }
+            if (replay_.empty()) {
+                continue;
+            }
+            for (size_t j = 0; j < replay_.size(); ++j) {
+                total_.update(replay_[j] >> 6, replay_[j] & 0x3F);
+            }
+            shardsMerged_.fetch_add(1, std::memory_order_relaxed);
+            raisesMerged_.fetch_add(replay_.size(), std::memory_order_relaxed);
+            replay_.clear();
+        }
+        collected_.store(collected, std::memory_order_relaxed);
+        estimate_.store(total_.estimate(), std::memory_order_release);
+        epoch_.fetch_add(1, std::memory_order_release);
+        const uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        lastCollectNanos_.store(nanos, std::memory_order_relaxed);
+        totalCollectNanos_.fetch_add(nanos, std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns the estimate published by the last collect().
+     * Never blocks.
+     *
+     * @return Estimated cardinality value.
+     */
+    double estimate() const {
+        return estimate_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Returns the staleness and merge cost counters.
+     * Never blocks; the counters are read one by one.
+     *
+     * @return Counters
+     */
+    ShardedHIPStats stats() const {
+        ShardedHIPStats st;
+        st.epoch = epoch_.load(std::memory_order_acquire);
+        st.collected = collected_.load(std::memory_order_relaxed);
+        st.added = added_.load(std::memory_order_relaxed);
+        st.pending = st.added > st.collected ? st.added - st.collected : 0;
+        st.publishes = publishes_.load(std::memory_order_relaxed);
+        st.publishesDeferred = publishesDeferred_.load(std::memory_order_relaxed);
+        st.shardsMerged = shardsMerged_.load(std::memory_order_relaxed);
+        st.raisesMerged = raisesMerged_.load(std::memory_order_relaxed);
+        st.lastCollectNanos = lastCollectNanos_.load(std::memory_order_relaxed);
+        st.totalCollectNanos = totalCollectNanos_.load(std::memory_order_relaxed);
+        return st;
+    }
+
+    /**
+     * Returns a copy of the global counter as of the last collect().
+     *
+     * @return HyperLogLogHIP instance
+     */
+    HyperLogLogHIP snapshot() const {
+        std::lock_guard<std::mutex> lock(collectLock_);
+        return total_;
+    }
+
+private:
+    ShardedHyperLogLogHIP(const ShardedHyperLogLogHIP&);
+    ShardedHyperLogLogHIP& operator=(const ShardedHyperLogLogHIP&);
+
+    uint8_t b_; ///< register bit width
+    HashType hash_; ///< hash function
+    uint32_t publishInterval_; ///< adds between two publishes of a shard
+    std::vector<std::unique_ptr<Shard> > shards_; ///< shards handed out by shard()
+    std::mutex shardsLock_; ///< guards shards_
+    mutable std::mutex collectLock_; ///< serializes collect() and guards total_
+    HyperLogLogHIP total_; ///< all published raises
+    std::vector<uint32_t> replay_; ///< log being replayed by collect()
+    std::atomic<double> estimate_; ///< total_.estimate() as of the last collect()
+    std::atomic<uint64_t> epoch_;
+    std::atomic<uint64_t> added_;
+    std::atomic<uint64_t> collected_;
+    std::atomic<uint64_t> publishes_;
+    std::atomic<uint64_t> publishesDeferred_;
+    std::atomic<uint64_t> shardsMerged_;
+    std::atomic<uint64_t> raisesMerged_;
+    std::atomic<uint64_t> lastCollectNanos_;
+    std::atomic<uint64_t> totalCollectNanos_;
+};
+
+} // namespace hll
+
+#endif // !defined(HYPERLOGLOG_SHARDED_HPP)
@@ -0,0 +1,898 @@
+#if !defined(HYPERLOGLOG_SIMD_HPP)
+#define HYPERLOGLOG_SIMD_HPP
+
+/**
+ * @file hyperloglog_simd.hpp
+ * @brief SIMD kernels and runtime CPU dispatch used by the HyperLogLog counters
+ *
+ * Every kernel has a scalar fallback that produces exactly the same output,
+ * so the selected instruction set never changes the contents of a sketch.
+ * Define HLL_NO_SIMD to build the scalar paths only.
+ *
+ * This header is included by hyperloglog.hpp; include that instead.
+ */
+
+#include <stddef.h>
+#include <algorithm>
+#include "murmur3.h"
+
+#if !defined(HLL_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) \
+    && (defined(__x86_64__) || defined(__i386__))
+#define HLL_SIMD_X86 1
+#include <immintrin.h>
+#define HLL_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace hll {
+namespace simd {
+
+/**
+ * Instruction set levels used by the kernels.
+ */
+enum Isa {
+    ISA_SCALAR = 0, ///< portable C++
+    ISA_AVX2 = 1,   ///< AVX2
+    ISA_AVX512 = 2  ///< AVX-512 F/CD/BW
+};
+
+/**
+ * Detects the best instruction set supported by the running CPU.
+ *
+ * @return Detected instruction set level
+ */
+inline Isa detectIsa() {
+#if defined(HLL_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512cd")
+            && __builtin_cpu_supports("avx512bw")) {
+        return ISA_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return ISA_AVX2;
+    }
+#endif
+    return ISA_SCALAR;
+}
+
+inline Isa& activeIsa() {
+    static Isa level = detectIsa();
+    return level;
+}
+
+/**
+ * Returns the instruction set level the kernels dispatch to.
+ *
+ * @return Active instruction set level
+ */
+inline Isa isa() {
+    return activeIsa();
+}
+
+/**
+ * Restricts the kernels to the given instruction set level.
+ * A level above what the CPU supports is clamped to the detected one.
+ *
+ * @param[in] level Highest instruction set level to use
+ */
+inline void setIsa(Isa level) {
+    activeIsa() = std::min(level, detectIsa());
+}
+
+/**
+ * Scalar index/rank extraction of a 32 bit hash value.
+ */
+inline void indexRank32(uint32_t hash, uint8_t b, uint32_t& index, uint8_t& rank) {
+    index = hash >> (32 - b);
+    rank = _GET_CLZ((hash << b), 32 - b);
+}
+
+/**
+ * Scalar index/rank extraction of a 64 bit hash value.
+ */
+inline void indexRank64(uint64_t hash, uint8_t b, uint32_t& index, uint8_t& rank) {
+    index = (uint32_t) (hash >> (64 - b));
+    rank = _GET_CLZ64((hash << b), 64 - b);
+}
+
+/**
+ * Computes the masks used to compare registers packed 'width' bits each
+ * into the low 60 bits of a word: the even numbered fields and the bit
+ * right above each of them. The odd fields are handled by shifting them
+ * down onto the even positions, so every field has a free guard bit.
+ *
+ * @param[in] width register width in bits (5 or 6)
+ * @param[out] even mask of the even numbered fields
+ * @param[out] guard mask of the guard bits
+ */
+inline void packedMasks(uint8_t width, uint64_t& even, uint64_t& guard) {
+    const uint64_t field = (uint64_t(1) << width) - 1;
+    even = 0;
+    guard = 0;
+    for (uint32_t pos = 0; pos + width <= 60; pos += 2 * width) {
+        even |= field << pos;
+        guard |= uint64_t(1) << (pos + width);
+    }
+}
+
+/**
+ * Field-wise maximum of two words of packed registers (SWAR).
+ */
+inline uint64_t maxPacked(uint64_t a, uint64_t b, uint8_t width, uint64_t even, uint64_t guard) {
+    const uint64_t ae = a & even;
+    const uint64_t be = b & even;
+    uint64_t ge = ((ae | guard) - be) & guard; // guard bit survives where a >= b
+    ge -= ge >> width;
+    const uint64_t ao = (a >> width) & even;
+    const uint64_t bo = (b >> width) & even;
+    uint64_t go = ((ao | guard) - bo) & guard;
+    go -= go >> width;
+    return (ae & ge) | (be & ~ge) | (((ao & go) | (bo & ~go)) << width);
+}
+
+#if defined(HLL_SIMD_X86)
+
+#if defined(__GNUC__) && !defined(__clang__)
+// GCC reports the undefined source operand of the AVX-512 set1/cvt intrinsics.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+HLL_TARGET("avx2")
+inline __m256i rotl32Avx2(__m256i x, int r) {
+    return _mm256_or_si256(_mm256_slli_epi32(x, r), _mm256_srli_epi32(x, 32 - r));
+}
+
+HLL_TARGET("avx2")
+inline __m256i mixK1Avx2(__m256i k1) {
+    k1 = _mm256_mullo_epi32(k1, _mm256_set1_epi32(0xcc9e2d51));
+    k1 = rotl32Avx2(k1, 15);
+    return _mm256_mullo_epi32(k1, _mm256_set1_epi32(0x1b873593));
+}
+
+/**
+ * MurmurHash3_x86_32 of 8 fixed-width keys per iteration.
+ *
+ * @return Number of keys hashed
+ */
+HLL_TARGET("avx2")
+inline size_t murmur3FixedAvx2(const char* keys, uint32_t len, size_t n, uint32_t seed, uint32_t* out) {
+    const uint32_t nblocks = len / 4;
+    const uint32_t tailShift = 8 * (4 - (len & 3));
+    const __m256i vindex = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+            _mm256_set1_epi32(len));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const char* base = keys + i * len;
+        __m256i h1 = _mm256_set1_epi32(seed);
+        for (uint32_t blk = 0; blk < nblocks; ++blk) {
+            __m256i k1 = _mm256_i32gather_epi32((const int*) (base + blk * 4), vindex, 1);
+            h1 = _mm256_xor_si256(h1, mixK1Avx2(k1));
+            h1 = rotl32Avx2(h1, 13);
+            h1 = _mm256_add_epi32(_mm256_mullo_epi32(h1, _mm256_set1_epi32(5)),
+                    _mm256_set1_epi32(0xe6546b64));
+        }
+        if (len & 3) {
+            // The last 4 bytes of each key shifted down leave exactly the tail bytes.
+            __m256i k1 = _mm256_i32gather_epi32((const int*) (base + len - 4), vindex, 1);
+            k1 = _mm256_srl_epi32(k1, _mm_cvtsi32_si128(tailShift));
+            h1 = _mm256_xor_si256(h1, mixK1Avx2(k1));
+        }
+        h1 = _mm256_xor_si256(h1, _mm256_set1_epi32(len));
+        h1 = _mm256_xor_si256(h1, _mm256_srli_epi32(h1, 16));
+        h1 = _mm256_mullo_epi32(h1, _mm256_set1_epi32(0x85ebca6b));
+        h1 = _mm256_xor_si256(h1, _mm256_srli_epi32(h1, 13));
+        h1 = _mm256_mullo_epi32(h1, _mm256_set1_epi32(0xc2b2ae35));
+        h1 = _mm256_xor_si256(h1, _mm256_srli_epi32(h1, 16));
+        _mm256_storeu_si256((__m256i*) (out + i), h1);
+    }
+    return i;
+}
+
+HLL_TARGET("avx512f")
+inline __m512i mixK1Avx512(__m512i k1) {
+    k1 = _mm512_mullo_epi32(k1, _mm512_set1_epi32(0xcc9e2d51));
+    k1 = _mm512_rol_epi32(k1, 15);
+    return _mm512_mullo_epi32(k1, _mm512_set1_epi32(0x1b873593));
+}
+
+/**
+ * MurmurHash3_x86_32 of 16 fixed-width keys per iteration.
+ *
+ * @return Number of keys hashed
+ */
+HLL_TARGET("avx512f")
+inline size_t murmur3FixedAvx512(const char* keys, uint32_t len, size_t n, uint32_t seed, uint32_t* out) {
+    const uint32_t nblocks = len / 4;
+    const uint32_t tailShift = 8 * (4 - (len & 3));
+    const __m512i vindex = _mm512_mullo_epi32(
+            _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+            _mm512_set1_epi32(len));
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const char* base = keys + i * len;
+        __m512i h1 = _mm512_set1_epi32(seed);
+        for (uint32_t blk = 0; blk < nblocks; ++blk) {
+            __m512i k1 = _mm512_i32gather_epi32(vindex, (const void*) (base + blk * 4), 1);
+            h1 = _mm512_xor_si512(h1, mixK1Avx512(k1));
+            h1 = _mm512_rol_epi32(h1, 13);
+            h1 = _mm512_add_epi32(_mm512_mullo_epi32(h1, _mm512_set1_epi32(5)),
+                    _mm512_set1_epi32(0xe6546b64));
+        }
+        if (len & 3) {
+            __m512i k1 = _mm512_i32gather_epi32(vindex, (const void*) (base + len - 4), 1);
+            k1 = _mm512_srl_epi32(k1, _mm_cvtsi32_si128(tailShift));
+            h1 = _mm512_xor_si512(h1, mixK1Avx512(k1));
+        }
+        h1 = _mm512_xor_si512(h1, _mm512_set1_epi32(len));
+        h1 = _mm512_xor_si512(h1, _mm512_srli_epi32(h1, 16));
+        h1 = _mm512_mullo_epi32(h1, _mm512_set1_epi32(0x85ebca6b));
+        h1 = _mm512_xor_si512(h1, _mm512_srli_epi32(h1, 13));
+        h1 = _mm512_mullo_epi32(h1, _mm512_set1_epi32(0xc2b2ae35));
+        h1 = _mm512_xor_si512(h1, _mm512_srli_epi32(h1, 16));
+        _mm512_storeu_si512((void*) (out + i), h1);
+    }
+    return i;
+}
+
+/**
+ * Index/rank extraction of 8 hash values per iteration.
+ * AVX2 has no lzcnt, so the leading zero count is read from the exponent of
+ * a float conversion. Clearing every bit right below a set bit keeps the
+ * conversion from rounding up into the next power of two.
+ *
+ * @return Number of hash values processed
+ */
+HLL_TARGET("avx2")
+inline size_t indexRank32Avx2(const uint32_t* hashes, size_t n, uint8_t b, uint32_t* index, uint8_t* rank) {
+    const __m128i indexShift = _mm_cvtsi32_si128(32 - b);
+    const __m128i valueShift = _mm_cvtsi32_si128(b);
+    const __m256i limit = _mm256_set1_epi32(32 - b);
+    const __m256i bias = _mm256_set1_epi32(157);
+    const __m256i expMask = _mm256_set1_epi32(0xFF);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i pickLowBytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i joinLanes = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256i h = _mm256_loadu_si256((const __m256i*) (hashes + i));
+        _mm256_storeu_si256((__m256i*) (index + i), _mm256_srl_epi32(h, indexShift));
+        const __m256i w = _mm256_sll_epi32(h, valueShift);
+        // Top set bit of w moves to bit (p - 1) so the value stays positive as int32.
+        const __m256i x = _mm256_srli_epi32(_mm256_andnot_si256(_mm256_srli_epi32(w, 1), w), 1);
+        const __m256i e = _mm256_and_si256(
+                _mm256_srli_epi32(_mm256_castps_si256(_mm256_cvtepi32_ps(x)), 23), expMask);
+        // w == 0 gives e == 0 and a count above the limit, which the min clamps.
+        const __m256i lz = _mm256_sub_epi32(bias, e);
+        const __m256i r = _mm256_add_epi32(_mm256_min_epu32(lz, limit), one);
+        const __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(r, pickLowBytes), joinLanes);
+        _mm_storel_epi64((__m128i*) (rank + i), _mm256_castsi256_si128(packed));
+    }
+    return i;
+}
+
+/**
+ * Index/rank extraction of 16 hash values per iteration.
+ *
+ * @return Number of hash values processed
+ */
+HLL_TARGET("avx512f,avx512cd")
+inline size_t indexRank32Avx512(const uint32_t* hashes, size_t n, uint8_t b, uint32_t* index, uint8_t* rank) {
+    const __m128i indexShift = _mm_cvtsi32_si128(32 - b);
+    const __m128i valueShift = _mm_cvtsi32_si128(b);
+    const __m512i limit = _mm512_set1_epi32(32 - b);
+    const __m512i one = _mm512_set1_epi32(1);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m512i h = _mm512_loadu_si512((const void*) (hashes + i));
+        _mm512_storeu_si512((void*) (index + i), _mm512_srl_epi32(h, indexShift));
+        const __m512i lz = _mm512_lzcnt_epi32(_mm512_sll_epi32(h, valueShift));
+        const __m512i r = _mm512_add_epi32(_mm512_min_epu32(lz, limit), one);
+        _mm_storeu_si128((__m128i*) (rank + i), _mm512_cvtepi32_epi8(r));
+    }
+    return i;
+}
+
+/**
+ * Index/rank extraction of 8 64 bit hash values per iteration.
+ * AVX2 has neither lzcnt nor 64 bit integer conversions, so only AVX-512 is vectorized.
+ *
+ * @return Number of hash values processed
+ */
+HLL_TARGET("avx512f,avx512cd")
+inline size_t indexRank64Avx512(const uint64_t* hashes, size_t n, uint8_t b, uint32_t* index, uint8_t* rank) {
+    const __m128i indexShift = _mm_cvtsi32_si128(64 - b);
+    const __m128i valueShift = _mm_cvtsi32_si128(b);
+    const __m512i limit = _mm512_set1_epi64(64 - b);
+    const __m512i one = _mm512_set1_epi64(1);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m512i h = _mm512_loadu_si512((const void*) (hashes + i));
+        _mm256_storeu_si256((__m256i*) (index + i), _mm512_cvtepi64_epi32(_mm512_srl_epi64(h, indexShift)));
+        const __m512i lz = _mm512_lzcnt_epi64(_mm512_sll_epi64(h, valueShift));
+        const __m512i r = _mm512_add_epi64(_mm512_min_epu64(lz, limit), one);
+        _mm_storel_epi64((__m128i*) (rank + i), _mm512_cvtepi64_epi8(r));
+    }
+    return i;
+}
+
+HLL_TARGET("avx2")
+inline __m256i maxPackedHalfAvx2(__m256i a, __m256i b, __m256i guard, __m128i width) {
+    __m256i ge = _mm256_and_si256(_mm256_sub_epi64(_mm256_or_si256(a, guard), b), guard);
+    ge = _mm256_sub_epi64(ge, _mm256_srl_epi64(ge, width));
+    return _mm256_or_si256(_mm256_and_si256(a, ge), _mm256_andnot_si256(ge, b));
+}
+
+/**
+ * Field-wise maximum of 4 words of packed registers per iteration.
+ *
+ * @return Number of words processed
+ */
+HLL_TARGET("avx2")
+inline size_t maxPackedAvx2(uint64_t* dst, const uint64_t* src, size_t n, uint8_t width, uint64_t even, uint64_t guard) {
+    const __m256i evenMask = _mm256_set1_epi64x(even);
+    const __m256i guardMask = _mm256_set1_epi64x(guard);
+    const __m128i shift = _mm_cvtsi32_si128(width);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m256i a = _mm256_loadu_si256((const __m256i*) (dst + i));
+        const __m256i b = _mm256_loadu_si256((const __m256i*) (src + i));
+        const __m256i lo = maxPackedHalfAvx2(_mm256_and_si256(a, evenMask), _mm256_and_si256(b, evenMask),
+                guardMask, shift);
+        const __m256i hi = maxPackedHalfAvx2(_mm256_and_si256(_mm256_srl_epi64(a, shift), evenMask),
+                _mm256_and_si256(_mm256_srl_epi64(b, shift), evenMask), guardMask, shift);
+        _mm256_storeu_si256((__m256i*) (dst + i), _mm256_or_si256(lo, _mm256_sll_epi64(hi, shift)));
+    }
+    return i;
+}
+
+HLL_TARGET("avx512f")
+inline __m512i maxPackedHalfAvx512(__m512i a, __m512i b, __m512i guard, __m128i width) {
+    __m512i ge = _mm512_and_si512(_mm512_sub_epi64(_mm512_or_si512(a, guard), b), guard);
+    ge = _mm512_sub_epi64(ge, _mm512_srl_epi64(ge, width));
+    return _mm512_or_si512(_mm512_and_si512(a, ge), _mm512_andnot_si512(ge, b));
+}
+
+/**
+ * Field-wise maximum of 8 words of packed registers per iteration.
+ *
+ * @return Number of words processed
+ */
+HLL_TARGET("avx512f")
+inline size_t maxPackedAvx512(uint64_t* dst, const uint64_t* src, size_t n, uint8_t width, uint64_t even, uint64_t guard) {
+    const __m512i evenMask = _mm512_set1_epi64(even);
+    const __m512i guardMask = _mm512_set1_epi64(guard);
+    const __m128i shift = _mm_cvtsi32_si128(width);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m512i a = _mm512_loadu_si512((const void*) (dst + i));
+        const __m512i b = _mm512_loadu_si512((const void*) (src + i));
+        const __m512i lo = maxPackedHalfAvx512(_mm512_and_si512(a, evenMask), _mm512_and_si512(b, evenMask),
+                guardMask, shift);
+        const __m512i hi = maxPackedHalfAvx512(_mm512_and_si512(_mm512_srl_epi64(a, shift), evenMask),
+                _mm512_and_si512(_mm512_srl_epi64(b, shift), evenMask), guardMask, shift);
+        _mm512_storeu_si512((void*) (dst + i), _mm512_or_si512(lo, _mm512_sll_epi64(hi, shift)));
+    }
+    return i;
+}
+
+/**
+ * Byte-wise maximum of 32 registers per iteration. raise(old, value) is
+ * called for every register that grows, before it is stored.
+ *
+ * @return Number of registers processed
+ */
+template<typename Raise>
+HLL_TARGET("avx2")
+inline size_t maxBytesAvx2(uint8_t* dst, const uint8_t* src, size_t n, Raise& raise) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i a = _mm256_loadu_si256((const __m256i*) (dst + i));
+        const __m256i mx = _mm256_max_epu8(a, _mm256_loadu_si256((const __m256i*) (src + i)));
+        uint32_t changed = ~(uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(mx, a));
+        if (changed == 0) {
+            continue;
+        }
+        while (changed != 0) {
+            const uint32_t j = __builtin_ctz(changed);
+            raise(dst[i + j], src[i + j]);
+            changed &= changed - 1;
+        }
+        _mm256_storeu_si256((__m256i*) (dst + i), mx);
+    }
+    return i;
+}
+
+/**
+ * Byte-wise maximum of 64 registers per iteration. raise(old, value) is
+ * called for every register that grows, before it is stored.
+ *
+ * @return Number of registers processed
+ */
+template<typename Raise>
+HLL_TARGET("avx512f,avx512bw")
+inline size_t maxBytesAvx512(uint8_t* dst, const uint8_t* src, size_t n, Raise& raise) {
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        const __m512i a = _mm512_loadu_si512((const void*) (dst + i));
+        const __m512i b = _mm512_loadu_si512((const void*) (src + i));
+        uint64_t changed = _mm512_cmpgt_epu8_mask(b, a);
+        if (changed == 0) {
+            continue;
+        }
+        while (changed != 0) {
+            const uint32_t j = __builtin_ctzll(changed);
+            raise(dst[i + j], src[i + j]);
+            changed &= changed - 1;
+        }
+        _mm512_storeu_si512((void*) (dst + i), _mm512_max_epu8(a, b));
+    }
+    return i;
+}
+
+/**
+ * Largest of 32 registers per iteration, accumulated into 'mx'.
+ *
+ * @return Number of registers processed
+ */
+HLL_TARGET("avx2")
+inline size_t maxByteAvx2(const uint8_t* M, size_t n, uint8_t& mx) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc = _mm256_max_epu8(acc, _mm256_loadu_si256((const __m256i*) (M + i)));
+    }
+    uint8_t lanes[32];
+    _mm256_storeu_si256((__m256i*) lanes, acc);
+    mx = std::max(mx, *std::max_element(lanes, lanes + 32));
+    return i;
+}
+
+/**
+ * Largest of 64 registers per iteration, accumulated into 'mx'.
+ *
+ * @return Number of registers processed
+ */
+HLL_TARGET("avx512f,avx512bw")
+inline size_t maxByteAvx512(const uint8_t* M, size_t n, uint8_t& mx) {
+    __m512i acc = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        acc = _mm512_max_epu8(acc, _mm512_loadu_si512((const void*) (M + i)));
+    }
+    uint8_t lanes[64];
+    _mm512_storeu_si512((void*) lanes, acc);
+    mx = std::max(mx, *std::max_element(lanes, lanes + 64));
+    return i;
+}
+
+/**
+ * Register sum of 32 registers per iteration. 2^(32 - r) and 2^(64 - r)
+ * are built with variable shifts in 64 bit lanes; shift counts of 64 or
+ * more give 0, which drops the terms that belong to the other part.
+ *
+ * @return Number of registers processed
+ */
+HLL_TARGET("avx2")
+inline size_t registerSumAvx2(const uint8_t* M, size_t n, uint64_t& hi, uint64_t& lo, uint32_t& zeros) {
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i c32 = _mm256_set1_epi64x(32);
+    const __m256i c64 = _mm256_set1_epi64x(64);
+    __m256i hiAcc = _mm256_setzero_si256();
+    __m256i loAcc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*) (M + i));
+        zeros += __builtin_popcount((uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256())));
+        for (size_t j = 0; j < 32; j += 4) {
+            int32_t bytes;
+            __builtin_memcpy(&bytes, M + i + j, sizeof(bytes));
+            const __m256i r = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(bytes));
+            hiAcc = _mm256_add_epi64(hiAcc, _mm256_sllv_epi64(one, _mm256_sub_epi64(c32, r)));
+            const __m256i high = _mm256_cmpgt_epi64(r, c32);
+            loAcc = _mm256_add_epi64(loAcc, _mm256_and_si256(high, _mm256_sllv_epi64(one, _mm256_sub_epi64(c64, r))));
+        }
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*) lanes, hiAcc);
+    hi += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm256_storeu_si256((__m256i*) lanes, loAcc);
+    lo += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return i;
+}
+
+/**
+ * Sum of the eight 64 bit lanes, through memory as in the AVX2 path:
+ * GCC warns about _mm512_reduce_add_epi64 (-Wuninitialized in its headers).
+ */
+HLL_TARGET("avx512f")
+inline uint64_t sumLanesAvx512(__m512i v) {
+    uint64_t lanes[8];
+    _mm512_storeu_si512((void*) lanes, v);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+}
+
+/**
+ * Register sum of 64 registers per iteration.
+ *
+ * @return Number of registers processed
+ */
+HLL_TARGET("avx512f,avx512bw")
+inline size_t registerSumAvx512(const uint8_t* M, size_t n, uint64_t& hi, uint64_t& lo, uint32_t& zeros) {
+    const __m512i one = _mm512_set1_epi64(1);
+    const __m512i c32 = _mm512_set1_epi64(32);
+    const __m512i c64 = _mm512_set1_epi64(64);
+    __m512i hiAcc = _mm512_setzero_si512();
+    __m512i loAcc = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        const __m512i v = _mm512_loadu_si512((const void*) (M + i));
+        zeros += __builtin_popcountll(_mm512_cmpeq_epu8_mask(v, _mm512_setzero_si512()));
+        for (size_t j = 0; j < 64; j += 8) {
+            const __m512i r = _mm512_cvtepu8_epi64(_mm_loadl_epi64((const __m128i*) (M + i + j)));
+            hiAcc = _mm512_add_epi64(hiAcc, _mm512_sllv_epi64(one, _mm512_sub_epi64(c32, r)));
+            loAcc = _mm512_add_epi64(loAcc, _mm512_maskz_sllv_epi64(_mm512_cmpgt_epu64_mask(r, c32), one,
+                    _mm512_sub_epi64(c64, r)));
+        }
+    }
+    hi += sumLanesAvx512(hiAcc);
+    lo += sumLanesAvx512(loAcc);
+    return i;
+}
+
+/**
+ * Register histogram of blocks of 255 * 32 registers. Each value between
+ * the smallest and the largest of a block is counted with one compare and
+ * subtract per 32 registers into byte counters, which can't overflow
+ * within a block, and the counters are summed with SAD. Four values are
+ * counted per pass over the block.
+ *
+ * @return Number of registers processed
+ */
+HLL_TARGET("avx2")
+inline size_t registerHistogramAvx2(const uint8_t* M, size_t n, uint32_t* hist) {
+    size_t i = 0;
+    while (i + 32 <= n) {
+        const size_t len = std::min(n - i, (size_t) 255 * 32) & ~(size_t) 31;
+        __m256i lo = _mm256_set1_epi8((char) 0xFF);
+        __m256i hi = _mm256_setzero_si256();
+        for (size_t j = 0; j < len; j += 32) {
+            const __m256i v = _mm256_loadu_si256((const __m256i*) (M + i + j));
+            lo = _mm256_min_epu8(lo, v);
+            hi = _mm256_max_epu8(hi, v);
+        }
+        uint8_t los[32];
+        uint8_t his[32];
+        _mm256_storeu_si256((__m256i*) los, lo);
+        _mm256_storeu_si256((__m256i*) his, hi);
+        const uint8_t first = *std::min_element(los, los + 32);
+        const uint8_t last = *std::max_element(his, his + 32);
+        // four values per pass over the block; values above 'last' count nothing
+        for (uint32_t value = first; value <= last; value += 4) {
+            __m256i target[4];
+            __m256i count[4];
+            for (int k = 0; k < 4; ++k) {
+                target[k] = _mm256_set1_epi8((char) (value + k));
+                count[k] = _mm256_setzero_si256();
+            }
+            for (size_t j = 0; j < len; j += 32) {
+                const __m256i v = _mm256_loadu_si256((const __m256i*) (M + i + j));
+                for (int k = 0; k < 4; ++k) {
+                    count[k] = _mm256_sub_epi8(count[k], _mm256_cmpeq_epi8(v, target[k]));
+                }
+            }
+            for (uint32_t k = 0; k < 4 && value + k <= last; ++k) {
+                uint64_t lanes[4];
+                _mm256_storeu_si256((__m256i*) lanes, _mm256_sad_epu8(count[k], _mm256_setzero_si256()));
+                hist[value + k] += (uint32_t) (lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+            }
+        }
+        i += len;
+    }
+    return i;
+}
+
+/**
+ * Register histogram of blocks of 255 * 64 registers, as registerHistogramAvx2().
+ *
+ * @return Number of registers processed
+ */
+HLL_TARGET("avx512f,avx512bw")
+inline size_t registerHistogramAvx512(const uint8_t* M, size_t n, uint32_t* hist) {
+    size_t i = 0;
+    while (i + 64 <= n) {
+        const size_t len = std::min(n - i, (size_t) 255 * 64) & ~(size_t) 63;
+        __m512i lo = _mm512_set1_epi8((char) 0xFF);
+        __m512i hi = _mm512_setzero_si512();
+        for (size_t j = 0; j < len; j += 64) {
+            const __m512i v = _mm512_loadu_si512((const void*) (M + i + j));
+            lo = _mm512_min_epu8(lo, v);
+            hi = _mm512_max_epu8(hi, v);
+        }
+        uint8_t los[64];
+        uint8_t his[64];
+        _mm512_storeu_si512((void*) los, lo);
+        _mm512_storeu_si512((void*) his, hi);
+        const uint8_t first = *std::min_element(los, los + 64);
+        const uint8_t last = *std::max_element(his, his + 64);
+        for (uint32_t value = first; value <= last; value += 4) {
+            __m512i target[4];
+            __m512i count[4];
+            for (int k = 0; k < 4; ++k) {
+                target[k] = _mm512_set1_epi8((char) (value + k));
+                count[k] = _mm512_setzero_si512();
+            }
+            for (size_t j = 0; j < len; j += 64) {
+                const __m512i v = _mm512_loadu_si512((const void*) (M + i + j));
+                for (int k = 0; k < 4; ++k) {
+                    count[k] = _mm512_mask_sub_epi8(count[k], _mm512_cmpeq_epu8_mask(v, target[k]), count[k],
+                            _mm512_set1_epi8(-1));
+                }
+            }
+            for (uint32_t k = 0; k < 4 && value + k <= last; ++k) {
+                hist[value + k] += (uint32_t) sumLanesAvx512(_mm512_sad_epu8(count[k], _mm512_setzero_si512()));
+            }
+        }
+        i += len;
+    }
+    return i;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif /* defined(HLL_SIMD_X86) */
+
+/**
+ * Computes MurmurHash3_x86_32 of n fixed-width keys stored back to back.
+ *
+ * @param[in] keys Pointer to the first key
+ * @param[in] len Length of each key in bytes
+ * @param[in] n Number of keys
+ * @param[in] seed Hash seed
+ * @param[out] out Hash values (n elements)
+ */
+inline void murmur3Fixed(const char* keys, uint32_t len, size_t n, uint32_t seed, uint32_t* out) {
+    size_t i = 0;
+#if defined(HLL_SIMD_X86)
+    // Keys shorter than one block would make the tail gather read past the last key.
+    if (len >= 4 && len < (1U << 26)) {
+        switch (isa()) {
+            case ISA_AVX512:
+                i = murmur3FixedAvx512(keys, len, n, seed, out);
+                break;
+            case ISA_AVX2:
+                i = murmur3FixedAvx2(keys, len, n, seed, out);
+                break;
+            default:
+                break;
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        MurmurHash3_x86_32(keys + i * len, len, seed, (void*) &out[i]);
+    }
+}
+
+/**
+ * Splits n 32 bit hash values into register index and rank.
+ *
+ * @param[in] hashes Hash values
+ * @param[in] n Number of hash values
+ * @param[in] b Register bit width
+ * @param[out] index Register indexes (n elements)
+ * @param[out] rank Ranks (n elements)
+ */
+inline void indexRank32(const uint32_t* hashes, size_t n, uint8_t b, uint32_t* index, uint8_t* rank) {
+    size_t i = 0;
+#if defined(HLL_SIMD_X86)
+    switch (isa()) {
+        case ISA_AVX512:
+            i = indexRank32Avx512(hashes, n, b, index, rank);
+            break;
+        case ISA_AVX2:
+            i = indexRank32Avx2(hashes, n, b, index, rank);
+            break;
+        default:
+            break;
+    }
+#endif
+    for (; i < n; ++i) {
+        indexRank32(hashes[i], b, index[i], rank[i]);
+    }
+}
+
+/**
+ * Splits n 64 bit hash values into register index and rank.
+ *
+ * @param[in] hashes Hash values
+ * @param[in] n Number of hash values
+ * @param[in] b Register bit width
+ * @param[out] index Register indexes (n elements)
+ * @param[out] rank Ranks (n elements)
+ */
+inline void indexRank64(const uint64_t* hashes, size_t n, uint8_t b, uint32_t* index, uint8_t* rank) {
+    size_t i = 0;
+#if defined(HLL_SIMD_X86)
+    if (isa() == ISA_AVX512) {
+        i = indexRank64Avx512(hashes, n, b, index, rank);
+    }
+#endif
+    for (; i < n; ++i) {
+        indexRank64(hashes[i], b, index[i], rank[i]);
+    }
+}
+
+/**
+ * Stores the field-wise maximum of two arrays of packed registers into dst.
+ *
+ * @param[in,out] dst Packed registers to update
+ * @param[in] src Packed registers to merge
+ * @param[in] n Number of words
+ * @param[in] width Register width in bits (5 or 6)
+ */
+inline void maxPacked(uint64_t* dst, const uint64_t* src, size_t n, uint8_t width) {
+    uint64_t even;
+    uint64_t guard;
+    packedMasks(width, even, guard);
+    size_t i = 0;
+#if defined(HLL_SIMD_X86)
+    switch (isa()) {
+        case ISA_AVX512:
+            i = maxPackedAvx512(dst, src, n, width, even, guard);
+            break;
+        case ISA_AVX2:
+            i = maxPackedAvx2(dst, src, n, width, even, guard);
+            break;
+        default:
+            break;
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = maxPacked(dst[i], src[i], width, even, guard);
+    }
+}
+
+/**
+ * Stores the byte-wise maximum of two register arrays into dst.
+ * raise(old, value) is called for every register of dst that grows,
+ * in no particular order, before the new value is stored.
+ *
+ * @param[in,out] dst Registers to update
+ * @param[in] src Registers to merge
+ * @param[in] n Number of registers
+ * @param[in,out] raise Callback taking the old and new register value
+ */
+template<typename Raise>
+inline void maxBytes(uint8_t* dst, const uint8_t* src, size_t n, Raise& raise) {
+    size_t i = 0;
+#if defined(HLL_SIMD_X86)
+    switch (isa()) {
+        case ISA_AVX512:
+            i = maxBytesAvx512(dst, src, n, raise);
+            break;
+        case ISA_AVX2:
+            i = maxBytesAvx2(dst, src, n, raise);
+            break;
+        default:
+            break;
+    }
+#endif
+    for (; i < n; ++i) {
+        if (dst[i] < src[i]) {
+            raise(dst[i], src[i]);
+            dst[i] = src[i];
+        }
+    }
+}
+
+/**
+ * Adds the fixed point register sum of n registers to hi (units of 2^-32,
+ * ranks up to 32) and lo (units of 2^-64, higher ranks), and counts the
+ * zero registers. The sums are integers, so every instruction set gives
+ * exactly the same result.
+ *
+ * @param[in] M Registers
+ * @param[in] n Number of registers
+ * @param[in,out] hi Sum of 2^(32 - M[i]) for M[i] <= 32
+ * @param[in,out] lo Sum of 2^(64 - M[i]) for M[i] > 32
+ * @param[in,out] zeros Number of registers equal to 0
+ */
+inline void registerSum(const uint8_t* M, size_t n, uint64_t& hi, uint64_t& lo, uint32_t& zeros) {
+    size_t i = 0;
+#if defined(HLL_SIMD_X86)
+    switch (isa()) {
+        case ISA_AVX512:
+            i = registerSumAvx512(M, n, hi, lo, zeros);
+            break;
+        case ISA_AVX2:
+            i = registerSumAvx2(M, n, hi, lo, zeros);
+            break;
+        default:
+            break;
+    }
+#endif
+    for (; i < n; ++i) {
+        if (M[i] <= 32) {
+            hi += uint64_t(1) << (32 - M[i]);
+        } else {
+            lo += uint64_t(1) << (64 - M[i]);
+        }
+        if (M[i] == 0) {
+            zeros++;
+        }
+    }
+}
+
+/**
+ * Returns the largest register.
+ *
+ * @param[in] M Registers
+ * @param[in] n Number of registers
+ *
+ * @return Largest value, 0 if n is 0
+ */
+inline uint8_t maxByte(const uint8_t* M, size_t n) {
+    uint8_t mx = 0;
+    size_t i = 0;
+#if defined(HLL_SIMD_X86)
+    switch (isa()) {
+        case ISA_AVX512:
+            i = maxByteAvx512(M, n, mx);
+            break;
+        case ISA_AVX2:
+            i = maxByteAvx2(M, n, mx);
+            break;
+        default:
+            break;
+    }
+#endif
+    for (; i < n; ++i) {
+        mx = std::max(mx, M[i]);
+    }
+    return mx;
+}
+
+/**
+ * Adds the number of registers of each value to hist.
+ *
+ * @param[in] M Registers, each below 64
+ * @param[in] n Number of registers
+ * @param[in,out] hist Counts of the register values (64 elements)
+ */
+inline void registerHistogram(const uint8_t* M, size_t n, uint32_t* hist) {
+    size_t i = 0;
+#if defined(HLL_SIMD_X86)
+    switch (isa()) {
+        case ISA_AVX512:
+            i = registerHistogramAvx512(M, n, hist);
+            break;
+        case ISA_AVX2:
+            i = registerHistogramAvx2(M, n, hist);
+            break;
+        default:
+            break;
+    }
+#endif
+    // four tables keep runs of equal values from waiting on the previous
+    // increment of the same counter
+    uint32_t part[4][64] = {{0}};
+    for (; i + 4 <= n; i += 4) {
+        part[0][M[i]]++;
+        part[1][M[i + 1]]++;
+        part[2][M[i + 2]]++;
+        part[3][M[i + 3]]++;
+    }
+    for (; i < n; ++i) {
+        part[0][M[i]]++;
+    }
+    for (int v = 0; v < 64; ++v) {
+        hist[v] += part[0][v] + part[1][v] + part[2][v] + part[3][v];
+    }
+}
+
+} // namespace simd
+} // namespace hll
+
+#endif // !defined(HYPERLOGLOG_SIMD_HPP)
@@ -0,0 +1,537 @@
+#if !defined(HYPERLOGLOG_SLIDING_HPP)
+#define HYPERLOGLOG_SLIDING_HPP
+
+/**
+ * @file hyperloglog_sliding.hpp
+ * @brief Sliding window HyperLogLog counter
+ */
+
+#include <cstring>
+#include <map>
+#include "hyperloglog.hpp"
+
+#define HLL_SLIDING_MAX_TIMESTAMP ((uint64_t(1) << 58) - 1) ///< timestamps are stored in 58 bits
+#define HLL_SLIDING_SLOT 10 ///< pairs stored in place per register, filling a 64-byte slot
+#define HLL_SLIDING_SPILLED 0xFF ///< size of a slot whose list is in the spill map
+
+namespace hll {
+
+/** @class SlidingHyperLogLog
+ *  @brief HyperLogLog counter that estimates the number of distinct elements
+ *         added within any window of time up to a maximum.
+ *
+ * Sliding HyperLogLog (Chabchoub and Hebrail, 2010): each register keeps a
+ * list of future possible maxima (LPFM), the (timestamp, rank) pairs that
+ * are the maximum rank of the register for some window ending now. A pair
+ * is dropped when a later pair with a rank at least as large arrives, or
+ * when it falls out of the maximum window, so the timestamps of a list
+ * increase, its ranks decrease and it holds at most q + 1 pairs
+ * (q = hashBits(hash) - b); in practice a few. The registers of a window
+ * are the ranks of the oldest pair of each list inside it, which are
+ * exactly the registers of a HyperLogLog counter fed with the elements of
+ * that window.
+ *
+ * The lists are stored in place, up to HLL_SLIDING_SLOT pairs per register
+ * in a 64-byte slot: the oldest timestamp, 32-bit offsets of the others from
+ * it and the ranks, which are 0 past the end of the list. add() touches one
+ * slot and finds the pairs a new one replaces by comparing all its rank
+ * bytes at once instead of walking the list. The rare list that grows longer
+ * than a slot, or spans more than 2^32 timestamp units, moves to a map.
+ *
+ * Timestamps are caller-defined units (e.g. seconds or microseconds since
+ * some epoch) up to HLL_SLIDING_MAX_TIMESTAMP. They should mostly arrive in
+ * order; late elements are handled at a higher cost.
+ */
+class SlidingHyperLogLog {
+public:
+
+    /**
+     * Constructor
+     *
+     * @param[in] b bit width (register size will be 2 to the b power), in the range [4,30]
+     * @param[in] maxWindow longest window that can be queried, in timestamp units, at least 1
+     * @param[in] hash hash function
+     *
+     * @exception std::invalid_argument the argument is out of range.
+     */
+    SlidingHyperLogLog(uint8_t b, uint64_t maxWindow, HashType hash = HASH_MURMUR3_X86_32) throw (std::invalid_argument) :
+            b_(b), m_(1 << b), hash_(hash), maxWindow_(maxWindow), slots_(), spill_() {
+        if (b < 4 || 30 < b) {
+            throw std::invalid_argument("bit width must be in the range [4,30]");
+        }
+        if (!isHashType(hash)) {
+            throw std::invalid_argument("unknown hash type");
+        }
+        if (maxWindow == 0) {
+            throw std::invalid_argument("maximum window must be positive");
+        }
+        slots_.resize(m_);
+    }
+
+    /**
+     * Adds element to the estimator
+     *
+     * @param[in] str string to add
+     * @param[in] len length of string
+     * @param[in] timestamp time of the element
+     *
+     * @exception std::invalid_argument timestamp is greater than HLL_SLIDING_MAX_TIMESTAMP.
+     */
+    void add(const char* str, uint32_t len, uint64_t timestamp) throw (std::invalid_argument) {
+        addHash(hashElement(hash_, str, len), timestamp);
+    }
+
+    /**
+     * Adds an element by its hash value, skipping the hash function
+     * (see HyperLogLog::addHash()).
+     *
+     * @param[in] value hash value of the element
+     * @param[in] timestamp time of the element
+     *
+     * @exception std::invalid_argument timestamp is greater than HLL_SLIDING_MAX_TIMESTAMP.
+     */
+    void addHash(uint64_t value, uint64_t timestamp) throw (std::invalid_argument) {
+        if (timestamp > HLL_SLIDING_MAX_TIMESTAMP) {
+            throw std::invalid_argument("timestamp is out of range");
+        }
+        uint32_t index;
+        uint8_t rank;
+        indexRankHash(hash_, b_, value, index, rank);
+        Slot& slot = slots_[index];
+        if (slot.size == HLL_SLIDING_SPILLED) {
+            insertSlow(index, (timestamp << 6) | rank);
+            return;
+        }
+        if (slot.size != 0) {
+            const uint64_t newest = slot.base + slot.offset[slot.size - 1];
+            if (timestamp < newest) {
+                insertSlow(index, (timestamp << 6) | rank);
+                return;
+            }
+            // the newest pair has the smallest rank; at the same timestamp it covers the new one
+            if (timestamp == newest && slot.rank[slot.size - 1] >= rank) {
+                return;
+            }
+            // pairs older than the maximum window can't be the maximum of any window
+            if (timestamp > maxWindow_ && slot.base <= timestamp - maxWindow_) {
+                expireSlot(slot, timestamp - maxWindow_);
+            }
+        }
+        // the ranks decrease along the slot and are 0 past its end, so the
+        // pairs that stay are the ones with a rank above the new one; count
+        // them eight bytes at a time (ranks are below 0x80, so setting the
+        // top bit of each byte keeps the subtraction from borrowing across
+        // bytes, and the multiplication sums the bytes into the top one)
+        const uint64_t ones = 0x0101010101010101ULL;
+        const uint64_t tops = ones << 7;
+        uint64_t lo = 0;
+        uint64_t hi = 0;
+        std::memcpy(&lo, slot.rank, 8);
+        std::memcpy(&hi, slot.rank + 8, HLL_SLIDING_SLOT - 8);
+        const uint64_t above = ((((lo | tops) - ones * (rank + 1)) & tops) >> 7)
+                + ((((hi | tops) - ones * (rank + 1)) & tops) >> 7);
+        const uint32_t keep = (above * ones) >> 56;
+        // a new pair that replaces the whole list becomes its base
+        slot.base = keep == 0 ? timestamp : slot.base;
+        if (timestamp - slot.base > 0xFFFFFFFFULL) {
+            insertSlow(index, (timestamp << 6) | rank);
+            return;
+        }
+        const uint32_t offset = timestamp - slot.base;
+        // the new pair is redundant if a larger rank has the same timestamp
+        const uint32_t dominated = (keep != 0) & (slot.offset[keep - (keep != 0)] == offset);
+        if (keep == HLL_SLIDING_SLOT) {
+            if (!dominated) {
+                insertSlow(index, (timestamp << 6) | rank);
+            }
+            return;
+        }
+        // keep the first 'keep' ranks, put the new one after them and zero
+        // the rest; shifts are split in two so that shifting by 64 or more
+        // bits is defined and yields 0
+        const uint64_t newRank = dominated ? 0 : rank;
+        const uint32_t keepHi = keep > 8 ? keep - 8 : 0;
+        const uint32_t newHi = keep >= 8 ? keep - 8 : 8;
+        lo = (lo & ~((~uint64_t(0) << (keep * 4)) << (keep * 4))) | ((newRank << (keep * 4)) << (keep * 4));
+        hi = (hi & ~((~uint64_t(0) << (keepHi * 4)) << (keepHi * 4))) | ((newRank << (newHi * 4)) << (newHi * 4));
+        std::memcpy(slot.rank, &lo, 8);
+        std::memcpy(slot.rank + 8, &hi, HLL_SLIDING_SLOT - 8);
+        slot.offset[keep] = offset;
+        slot.size = keep + 1 - dominated;
+    }
+
+    /**
+     * Estimates the number of distinct elements with timestamps in (now - window, now].
+     * Elements with timestamps after 'now' are counted as well. 'now' should
+     * not be before the latest timestamp added, whose maximum window has
+     * already been dropped.
+     *
+     * @param[in] window length of the window, at most the maximum window
+     * @param[in] now end of the window
+     * @param[in] estimator estimator to use
+     *
+     * @return Estimated cardinality value.
+     *
+     * @exception std::invalid_argument window is longer than the maximum window.
+     */
+    double estimate(uint64_t window, uint64_t now, EstimatorType estimator = ESTIMATOR_CLASSIC) const
+            throw (std::invalid_argument) {
+        uint32_t hist[64] = {0};
+        const uint64_t start = windowStart(window, now);
+        for (uint32_t i = 0; i < m_; ++i) {
+            hist[windowRank(i, start)]++;
+        }
+        return estimateFromHistogram(estimator, hash_, b_, hist);
+    }
+
+    /**
+     * Returns the registers of a window as a HyperLogLog counter, e.g. to
+     * merge it with other counters. They are equal to those of a counter
+     * fed with the elements of the window.
+     *
+     * @param[in] window length of the window, at most the maximum window
+     * @param[in] now end of the window
+     *
+     * @return HyperLogLog instance
+     *
+     * @exception std::invalid_argument window is longer than the maximum window.
+     */
+    HyperLogLog toHyperLogLog(uint64_t window, uint64_t now) const throw (std::invalid_argument) {
+        const uint64_t start = windowStart(window, now);
+        HyperLogLog hll(b_, hash_);
+        for (uint32_t i = 0; i < m_; ++i) {
+            hll.M_[i] = windowRank(i, start);
+        }
+        hll.recomputeCache();
+        return hll;
+    }
+
+    /**
+     * Merges the lists of 'other' into this object, as if all elements
+     * added to 'other' were added to this one.
+     * The number of registers and the hash function of each must be the same.
+     *
+     * @param[in] other SlidingHyperLogLog instance to be merged
+     *
+     * @exception std::invalid_argument number of registers or hash function doesn't match.
+     */
+    void merge(const SlidingHyperLogLog& other) throw (std::invalid_argument) {
+        if (m_ != other.m_) {
+            std::stringstream ss;
+            ss << "number of registers doesn't match: " << m_ << " != " << other.m_;
+            throw std::invalid_argument(ss.str().c_str());
+        }
+        if (hash_ != other.hash_) {
+            std::stringstream ss;
+            ss << "hash function doesn't match: " << hash_ << " != " << other.hash_;
+            throw std::invalid_argument(ss.str().c_str());
+        }
+        std::vector<uint64_t> src;
+        std::vector<uint64_t> list;
+        for (uint32_t i = 0; i < m_; ++i) {
+            if (other.slots_[i].size != 0) {
+                other.load(i, src);
+                load(i, list);
+                mergeList(list, &src[0], &src[0] + src.size());
+                store(i, list);
+            }
+        }
+    }
+
+    /**
+     * Drops the pairs that fell out of the maximum window ending at 'now'.
+     * add() drops them only from the list it touches, so call this
+     * periodically on a stream that slows down to reclaim memory.
+     *
+     * @param[in] now current time
+     */
+    void expire(uint64_t now) {
+        if (now <= maxWindow_) {
+            return;
+        }
+        const uint64_t cutoff = now - maxWindow_;
+        for (uint32_t i = 0; i < m_; ++i) {
+            if (slots_[i].size == HLL_SLIDING_SPILLED) {
+                std::vector<uint64_t> list;
+                load(i, list);
+                list.resize(expirePairs(&list[0], list.size(), cutoff));
+                store(i, list);
+            } else if (slots_[i].size != 0) {
+                expireSlot(slots_[i], cutoff);
+            }
+        }
+    }
+
+    /**
+     * Clears all lists.
+     */
+    void clear() {
+        std::fill(slots_.begin(), slots_.end(), Slot());
+        spill_.clear();
+    }
+
+    /**
+     * Returns the number of (timestamp, rank) pairs held.
+     *
+     * @return Number of pairs
+     */
+    size_t entryCount() const {
+        size_t n = 0;
+        for (uint32_t i = 0; i < m_; ++i) {
+            if (slots_[i].size != HLL_SLIDING_SPILLED) {
+                n += slots_[i].size;
+            }
+        }
+        for (SpillMap::const_iterator it = spill_.begin(); it != spill_.end(); ++it) {
+            n += it->second.size();
+        }
+        return n;
+    }
+
+    /**
+     * Returns the heap memory held by the lists: m 64-byte slots, plus the
+     * spilled lists of at most q + 1 pairs each.
+     *
+     * @return Size in bytes
+     */
+    size_t memoryUsage() const {
+        size_t bytes = slots_.capacity() * sizeof(Slot);
+        for (SpillMap::const_iterator it = spill_.begin(); it != spill_.end(); ++it) {
+            // the map node holds the key and the vector
+            bytes += 4 * sizeof(void*) + sizeof(*it) + it->second.capacity() * sizeof(uint64_t);
+        }
+        return bytes;
+    }
+
+    /**
+     * Returns size of register.
+     *
+     * @return Register size
+     */
+    uint32_t registerSize() const {
+        return m_;
+    }
+
+    /**
+     * Returns the longest window that can be queried.
+     *
+     * @return Maximum window
+     */
+    uint64_t maxWindow() const {
+        return maxWindow_;
+    }
+
+    /**
+     * Returns the hash function of the counter.
+     *
+     * @return Hash function
+     */
+    HashType hashType() const {
+        return hash_;
+    }
+
+private:
+    /**
+     * Returns the earliest timestamp inside a window.
+     */
+    uint64_t windowStart(uint64_t window, uint64_t now) const throw (std::invalid_argument) {
+        if (window > maxWindow_) {
+            std::stringstream ss;
+            ss << "window is longer than the maximum window: " << window << " > " << maxWindow_;
+            throw std::invalid_argument(ss.str().c_str());
+        }
+        return now >= window ? now - window + 1 : 0;
+    }
+
+    /**
+     * Up to HLL_SLIDING_SLOT pairs of a register, oldest first.
+     */
+    struct Slot {
+        uint64_t base; ///< timestamp of the oldest pair
+        uint32_t offset[HLL_SLIDING_SLOT]; ///< timestamps minus base
+        uint8_t rank[HLL_SLIDING_SLOT]; ///< ranks, 0 past the end of the list
+        uint8_t size; ///< number of pairs, or HLL_SLIDING_SPILLED
+        uint8_t padding[64 - 8 - HLL_SLIDING_SLOT * 5 - 1];
+
+        Slot() : base(0), offset(), rank(), size(0), padding() {
+        }
+    };
+    static_assert(sizeof(Slot) == 64, "a slot must fill a cache line");
+
+    typedef std::map<uint32_t, std::vector<uint64_t> > SpillMap;
+
+    /**
+     * Copies the pairs of register i into 'list' as (timestamp << 6 | rank).
+     */
+    void load(uint32_t i, std::vector<uint64_t>& list) const {
+        const Slot& slot = slots_[i];
+        if (slot.size == HLL_SLIDING_SPILLED) {
+            list = spill_.find(i)->second;
+            return;
+        }
+        list.resize(slot.size);
+        for (size_t j = 0; j < list.size(); ++j) {
+            list[j] = ((slot.base + slot.offset[j]) << 6) | slot.rank[j];
+        }
+    }
+
+    /**
+     * Makes 'list' the pairs of register i, in its slot if they fit.
+     */
+    void store(uint32_t i, std::vector<uint64_t>& list) {
+        Slot& slot = slots_[i];
+        if (slot.size == HLL_SLIDING_SPILLED) {
+            spill_.erase(i);
+        }
+        slot = Slot();
+        if (list.empty()) {
+            return;
+        }
+        const uint64_t base = list.front() >> 6;
+        if (list.size() <= HLL_SLIDING_SLOT && (list.back() >> 6) - base <= 0xFFFFFFFFULL) {
+            slot.base = base;
+            for (size_t j = 0; j < list.size(); ++j) {
+                slot.offset[j] = (list[j] >> 6) - base;
+                slot.rank[j] = list[j] & 0x3F;
+            }
+            slot.size = list.size();
+        } else {
+            spill_[i].swap(list);
+            slot.size = HLL_SLIDING_SPILLED;
+        }
+    }
+
+    /**
+     * Inserts a pair that arrived late or doesn't fit in the slot.
+     */
+    void insertSlow(uint32_t i, uint64_t entry) {
+        if (slots_[i].size == HLL_SLIDING_SPILLED) {
+            std::vector<uint64_t>& spilled = spill_.find(i)->second;
+            if ((spilled.back() >> 6) <= (entry >> 6)) {
+                appendPair(spilled, entry);
+                // move back in place with room to spare, so a list doesn't flap
+                if (spilled.size() < HLL_SLIDING_SLOT) {
+                    std::vector<uint64_t> list;
+                    list.swap(spilled);
+                    store(i, list);
+                }
+                return;
+            }
+        }
+        std::vector<uint64_t> list;
+        load(i, list);
+        mergeList(list, &entry, &entry + 1);
+        store(i, list);
+    }
+
+    /**
+     * Drops the pairs at or before 'cutoff' from the front of a slot and
+     * makes the oldest pair left its base.
+     */
+    static void expireSlot(Slot& slot, uint64_t cutoff) {
+        const uint32_t n = slot.size;
+        uint32_t k = 0;
+        while (k < n && slot.base + slot.offset[k] <= cutoff) {
+            k++;
+        }
+        if (k == 0) {
+            return;
+        }
+        const uint32_t shift = k < n ? slot.offset[k] : 0;
+        for (uint32_t j = 0; j + k < n; ++j) {
+            slot.offset[j] = slot.offset[j + k] - shift;
+            slot.rank[j] = slot.rank[j + k];
+        }
+        std::fill(slot.rank + n - k, slot.rank + n, 0);
+        slot.base += shift;
+        slot.size = n - k;
+    }
+
+    /**
+     * Returns the largest rank of register i from 'start' on: that of its
+     * oldest pair from then on, since the ranks decrease.
+     */
+    uint8_t windowRank(uint32_t i, uint64_t start) const {
+        const Slot& slot = slots_[i];
+        if (slot.size == HLL_SLIDING_SPILLED) {
+            const std::vector<uint64_t>& list = spill_.find(i)->second;
+            for (size_t j = 0; j < list.size(); ++j) {
+                if ((list[j] >> 6) >= start) {
+                    return list[j] & 0x3F;
+                }
+            }
+            return 0;
+        }
+        for (uint32_t j = 0; j < slot.size; ++j) {
+            if (slot.base + slot.offset[j] >= start) {
+                return slot.rank[j];
+            }
+        }
+        return 0;
+    }
+
+    /**
+     * Drops the pairs at or before 'cutoff' from the front of the n pairs at
+     * 'p' and returns the number left.
+     */
+    static size_t expirePairs(uint64_t* p, size_t n, uint64_t cutoff) {
+        size_t k = 0;
+        while (k < n && (p[k] >> 6) <= cutoff) {
+            k++;
+        }
+        std::copy(p + k, p + n, p);
+        return n - k;
+    }
+
+    /**
+     * Adds a pair no older than the newest one of a list in place.
+     */
+    void appendPair(std::vector<uint64_t>& list, uint64_t entry) const {
+        const uint8_t rank = entry & 0x3F;
+        while (!list.empty() && (list.back() & 0x3F) <= rank) {
+            list.pop_back();
+        }
+        if (list.empty() || (list.back() >> 6) != (entry >> 6)) {
+            list.push_back(entry);
+        }
+        const uint64_t newest = entry >> 6;
+        if (newest > maxWindow_ && (list.front() >> 6) <= newest - maxWindow_) {
+            list.resize(expirePairs(&list[0], list.size(), newest - maxWindow_));
+        }
+    }
+
+    /**
+     * Merges the sorted pairs [first, last) into a list, keeping only the
+     * pairs with a rank above those of all later pairs.
+     */
+    void mergeList(std::vector<uint64_t>& list, const uint64_t* first, const uint64_t* last) {
+        std::vector<uint64_t> all(list.size() + (last - first));
+        // timestamps are the high bits, so pairs sort by timestamp, then rank
+        std::merge(list.begin(), list.end(), first, last, all.begin());
+        list.clear();
+        uint8_t later = 0;
+        for (size_t j = all.size(); j-- > 0;) {
+            const uint8_t rank = all[j] & 0x3F;
+            if (rank > later) {
+                list.push_back(all[j]);
+                later = rank;
+            }
+        }
+        std::reverse(list.begin(), list.end());
+        const uint64_t newest = list.back() >> 6;
+        if (newest > maxWindow_) {
+            list.resize(expirePairs(&list[0], list.size(), newest - maxWindow_));
+        }
+    }
+
+    uint8_t b_; ///< register bit width
+    uint32_t m_; ///< register size
+    HashType hash_; ///< hash function
+    uint64_t maxWindow_; ///< longest window that can be queried
+    std::vector<Slot> slots_; ///< lists of the registers
+    SpillMap spill_; ///< lists longer than a slot
+};
+
+} // namespace hll
+
+#endif // !defined(HYPERLOGLOG_SLIDING_HPP)
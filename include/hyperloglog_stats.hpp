@@ -0,0 +1,323 @@
+#if !defined(HYPERLOGLOG_STATS_HPP)
+#define HYPERLOGLOG_STATS_HPP
+
+/**
+ * @file hyperloglog_stats.hpp
+ * @brief Optional operation counters and latency histograms of HyperLogLog and HyperLogLogHIP
+ *
+ * Define HLL_STATS before including hyperloglog.hpp to count, per thread,
+ * the elements added, the registers they raised, the merges and the
+ * registers raised by them (for HyperLogLogHIP the updates of the estimate),
+ * the conversions from sparse to dense, and the estimates, plus log2
+ * histograms of the latency of merge() and estimate(). stats::snapshot()
+ * sums the counters of all threads.
+ *
+ * Without HLL_STATS the hooks expand to nothing and snapshot() returns zeros.
+ *
+ * This header is included by hyperloglog.hpp; include that instead.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+
+#if defined(HLL_STATS)
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#endif
+
+#define HLL_STATS_LATENCY_BUCKETS 32 ///< latency bucket k counts calls taking [2^k, 2^(k+1)) ns
+
+namespace hll {
+namespace stats {
+
+/**
+ * Counter values at one point in time.
+ * Take the difference of two snapshots to count an interval.
+ */
+struct Snapshot {
+    uint64_t adds; ///< elements added by add(), addHash() and the batch variants
+    uint64_t addRaises; ///< registers raised by those elements
+    uint64_t merges; ///< calls of merge() and mergeMany()
+    uint64_t mergeRaises; ///< registers raised by merges; HIP estimate updates for HyperLogLogHIP
+    uint64_t denseConversions; ///< sparse counters converted to dense
+    uint64_t estimates; ///< calls of estimate()
+    uint64_t mergeLatency[HLL_STATS_LATENCY_BUCKETS]; ///< merge latency histogram
+    uint64_t estimateLatency[HLL_STATS_LATENCY_BUCKETS]; ///< estimate latency histogram
+
+    Snapshot() :
+            adds(0), addRaises(0), merges(0), mergeRaises(0), denseConversions(0), estimates(0) {
+        std::fill(mergeLatency, mergeLatency + HLL_STATS_LATENCY_BUCKETS, 0);
+        std::fill(estimateLatency, estimateLatency + HLL_STATS_LATENCY_BUCKETS, 0);
+    }
+
+    Snapshot& operator+=(const Snapshot& rhs) {
+        adds += rhs.adds;
+        addRaises += rhs.addRaises;
+        merges += rhs.merges;
+        mergeRaises += rhs.mergeRaises;
+        denseConversions += rhs.denseConversions;
+        estimates += rhs.estimates;
+        for (size_t k = 0; k < HLL_STATS_LATENCY_BUCKETS; ++k) {
+            mergeLatency[k] += rhs.mergeLatency[k];
+            estimateLatency[k] += rhs.estimateLatency[k];
+        }
+        return *this;
+    }
+
+    Snapshot& operator-=(const Snapshot& rhs) {
+        adds -= rhs.adds;
+        addRaises -= rhs.addRaises;
+        merges -= rhs.merges;
+        mergeRaises -= rhs.mergeRaises;
+        denseConversions -= rhs.denseConversions;
+        estimates -= rhs.estimates;
+        for (size_t k = 0; k < HLL_STATS_LATENCY_BUCKETS; ++k) {
+            mergeLatency[k] -= rhs.mergeLatency[k];
+            estimateLatency[k] -= rhs.estimateLatency[k];
+        }
+        return *this;
+    }
+
+    /**
+     * Returns the fraction of added elements that raised a register.
+     * Close to 0 means the counter is saturated for its workload.
+     *
+     * @return addRaises / adds, 0 without adds
+     */
+    double raiseRatio() const {
+        return adds == 0 ? 0.0 : double(addRaises) / adds;
+    }
+
+    /**
+     * Returns an upper bound of the given quantile of a latency histogram.
+     *
+     * @param[in] hist mergeLatency or estimateLatency
+     * @param[in] q quantile in [0, 1]
+     *
+     * @return Latency in nanoseconds, 0 for an empty histogram
+     */
+    static uint64_t latencyQuantile(const uint64_t* hist, double q) {
+        uint64_t total = 0;
+        for (size_t k = 0; k < HLL_STATS_LATENCY_BUCKETS; ++k) {
+            total += hist[k];
+        }
+        uint64_t seen = 0;
+        for (size_t k = 0; k < HLL_STATS_LATENCY_BUCKETS && total != 0; ++k) {
+            seen += hist[k];
+            if (seen >= q * total) {
+                return uint64_t(2) << k;
+            }
+        }
+        return 0;
+    }
+};
+
+inline Snapshot operator-(Snapshot lhs, const Snapshot& rhs) {
+    lhs -= rhs;
+    return lhs;
+}
+
+/**
+ * Operations timed by Scope.
+ */
+enum Operation {
+    OP_MERGE = 0,
+    OP_ESTIMATE = 1
+};
+
+#if defined(HLL_STATS)
+
+/**
+ * Counters of one thread. Only the owning thread writes them, with relaxed
+ * loads and stores instead of read-modify-write instructions, so other
+ * threads can read them for a snapshot without a data race.
+ */
+struct ThreadCounters {
+    std::atomic<uint64_t> adds;
+    std::atomic<uint64_t> addRaises;
+    std::atomic<uint64_t> merges;
+    std::atomic<uint64_t> mergeRaises;
+    std::atomic<uint64_t> denseConversions;
+    std::atomic<uint64_t> estimates;
+    std::atomic<uint64_t> mergeLatency[HLL_STATS_LATENCY_BUCKETS];
+    std::atomic<uint64_t> estimateLatency[HLL_STATS_LATENCY_BUCKETS];
+
+    ThreadCounters();
+    ~ThreadCounters();
+
+    static void bump(std::atomic<uint64_t>& c, uint64_t n) {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    Snapshot read() const {
+        Snapshot s;
+        s.adds = adds.load(std::memory_order_relaxed);
+        s.addRaises = addRaises.load(std::memory_order_relaxed);
+        s.merges = merges.load(std::memory_order_relaxed);
+        s.mergeRaises = mergeRaises.load(std::memory_order_relaxed);
+        s.denseConversions = denseConversions.load(std::memory_order_relaxed);
+        s.estimates = estimates.load(std::memory_order_relaxed);
+        for (size_t k = 0; k < HLL_STATS_LATENCY_BUCKETS; ++k) {
+            s.mergeLatency[k] = mergeLatency[k].load(std::memory_order_relaxed);
+            s.estimateLatency[k] = estimateLatency[k].load(std::memory_order_relaxed);
+        }
+        return s;
+    }
+};
+
+/**
+ * Counters of the running threads, and the sum of those of exited threads.
+ * Never destroyed, so threads exiting during static destruction can still
+ * retire their counters.
+ */
+struct Registry {
+    std::mutex mutex;
+    std::vector<ThreadCounters*> live;
+    Snapshot retired;
+};
+
+inline Registry& registry() {
+    static Registry* r = new Registry();
+    return *r;
+}
+
+inline ThreadCounters::ThreadCounters() :
+        adds(0), addRaises(0), merges(0), mergeRaises(0), denseConversions(0), estimates(0) {
+    for (size_t k = 0; k < HLL_STATS_LATENCY_BUCKETS; ++k) {
+        mergeLatency[k].store(0, std::memory_order_relaxed);
+        estimateLatency[k].store(0, std::memory_order_relaxed);
+    }
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.live.push_back(this);
+}
+
+inline ThreadCounters::~ThreadCounters() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.retired += read();
+    r.live.erase(std::find(r.live.begin(), r.live.end(), this));
+}
+
+/**
+ * Returns the counters of the calling thread.
+ */
+inline ThreadCounters& local() {
+    static thread_local ThreadCounters counters;
+    return counters;
+}
+
+/**
+ * Counts and times one merge or estimate. Registers raised during a merge
+ * are moved from addRaises to mergeRaises, since both go through the
+ * same register update. Nested scopes count only once.
+ */
+class Scope {
+public:
+    explicit Scope(Operation op) :
+            counters_(local()), op_(op), outer_(depth()++ == 0), raises_(counters_.addRaises.load(std::memory_order_relaxed)),
+            start_(outer_ ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point()) {
+    }
+
+    ~Scope() {
+        depth()--;
+        if (!outer_) {
+            return;
+        }
+        const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start_).count();
+        size_t bucket = 0;
+        while (bucket + 1 < HLL_STATS_LATENCY_BUCKETS && (ns >> (bucket + 1)) != 0) {
+            bucket++;
+        }
+        if (op_ == OP_MERGE) {
+            const uint64_t raised = counters_.addRaises.load(std::memory_order_relaxed) - raises_;
+            counters_.addRaises.store(raises_, std::memory_order_relaxed);
+            ThreadCounters::bump(counters_.mergeRaises, raised);
+            ThreadCounters::bump(counters_.merges, 1);
+            ThreadCounters::bump(counters_.mergeLatency[bucket], 1);
+        } else {
+            ThreadCounters::bump(counters_.estimates, 1);
+            ThreadCounters::bump(counters_.estimateLatency[bucket], 1);
+        }
+    }
+
+private:
+    Scope(const Scope&);
+    Scope& operator=(const Scope&);
+
+    static int& depth() {
+        static thread_local int d = 0;
+        return d;
+    }
+
+    ThreadCounters& counters_;
+    Operation op_;
+    bool outer_;
+    uint64_t raises_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+#define HLL_STATS_COUNT(field, n) ::hll::stats::ThreadCounters::bump(::hll::stats::local().field, (n))
+#define HLL_STATS_SCOPE(op) ::hll::stats::Scope hllStatsScope_(::hll::stats::op)
+
+#else
+
+#define HLL_STATS_COUNT(field, n)
+#define HLL_STATS_SCOPE(op)
+
+#endif // defined(HLL_STATS)
+
+/**
+ * Returns whether the counters are compiled in (HLL_STATS is defined).
+ *
+ * @return true if counting
+ */
+inline bool enabled() {
+#if defined(HLL_STATS)
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Returns the counters of the calling thread.
+ *
+ * @return Counters since the thread started, zeros without HLL_STATS
+ */
+inline Snapshot threadSnapshot() {
+#if defined(HLL_STATS)
+    return local().read();
+#else
+    return Snapshot();
+#endif
+}
+
+/**
+ * Returns the counters summed over all threads, including those that have
+ * exited. Counters of running threads are read while they may still change,
+ * each one at a value it had during the call.
+ *
+ * @return Counters since the process started, zeros without HLL_STATS
+ */
+inline Snapshot snapshot() {
+    Snapshot s;
+#if defined(HLL_STATS)
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    s = r.retired;
+    for (size_t i = 0; i < r.live.size(); ++i) {
+        s += r.live[i]->read();
+    }
+#endif
+    return s;
+}
+
+} // namespace stats
+} // namespace hll
+
+#endif // !defined(HYPERLOGLOG_STATS_HPP)
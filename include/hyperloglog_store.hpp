@@ -0,0 +1,607 @@
+#if !defined(HYPERLOGLOG_STORE_HPP)
+#define HYPERLOGLOG_STORE_HPP
+
+/**
+ * @file hyperloglog_store.hpp
+ * @brief Hash map from keys to HyperLogLog counters with arena allocated registers
+ */
+
+#include <functional>
+#include "hyperloglog.hpp"
+
+#define HLL_STORE_PAGE_SIZE (1 << 16) ///< bytes of the arena pages blocks are carved from
+#define HLL_STORE_MIN_SPARSE 4 ///< sparse entries of the smallest block
+#define HLL_STORE_DENSE 0xFFFFFFFFU ///< size of a sketch whose registers are dense
+
+// HLL_PREFETCH(addr, rw): hint that addr is about to be read (rw = 0) or written (rw = 1)
+#if defined(__GNUC__) || defined(__clang__)
+#define HLL_PREFETCH(addr, rw) __builtin_prefetch((addr), (rw))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define HLL_PREFETCH(addr, rw) _mm_prefetch((const char*) (addr), _MM_HINT_T0)
+#else
+#define HLL_PREFETCH(addr, rw) ((void) 0)
+#endif
+
+namespace hll {
+
+/** @class SketchStore
+ *  @brief Distinct counters for many keys, e.g. one per user or per URL.
+ *
+ * A std::map or std::unordered_map of HyperLogLog costs a heap allocation,
+ * a vector header and the cached estimate per key. The store keeps the keys
+ * in one open addressing table (linear probing) and the registers of all
+ * keys in blocks carved from HLL_STORE_PAGE_SIZE pages, with a free list per
+ * block size, so a key costs its table entry and its block.
+ *
+ * A sketch starts sparse, as the sorted (index << 6 | rank) entries of its
+ * non-zero registers in a block of HLL_STORE_MIN_SPARSE entries that doubles
+ * as it fills, and turns dense at the same size as a sparse HyperLogLog.
+ * Estimates and registers are the same as those of a HyperLogLog counter
+ * fed with the elements of the key.
+ *
+ * Blocks are addressed by (page << 32 | offset), so the store can be copied.
+ * Keys can't be removed one by one; clear() drops all of them.
+ *
+ * @tparam Key key type, default constructible, copyable and comparable with ==
+ * @tparam KeyHash hash function object of Key
+ */
+template<typename Key, typename KeyHash = std::hash<Key> >
+class SketchStore {
+    struct Entry;
+public:
+
+    /** @class Sketch
+     *  @brief Read-only reference to the counter of a key, valid until the store is modified.
+     */
+    class Sketch {
+        friend class SketchStore;
+    public:
+
+        /**
+         * Estimates cardinality value.
+         *
+         * @param[in] estimator estimator to use
+         *
+         * @return Estimated cardinality value.
+         */
+        double estimate(EstimatorType estimator = ESTIMATOR_CLASSIC) const {
+            return store_->estimateOf(entry_, estimator);
+        }
+
+        /**
+         * Returns whether the registers are in the sparse representation.
+         *
+         * @return true if sparse
+         */
+        bool isSparse() const {
+            return entry_ == 0 || entry_->size != HLL_STORE_DENSE;
+        }
+
+        /**
+         * Copies the registers into a HyperLogLog counter, e.g. to merge it
+         * with other counters. A sparse sketch gives a sparse counter.
+         *
+         * @return HyperLogLog instance with the same registers
+         */
+        HyperLogLog toHyperLogLog() const {
+            return store_->hyperLogLogOf(entry_);
+        }
+
+    private:
+        Sketch(const SketchStore* store, const Entry* entry) :
+                store_(store), entry_(entry) {
+        }
+
+        const SketchStore* store_; ///< store the sketch is in
+        const Entry* entry_; ///< entry of the key, or null for a missing key
+    };
+
+    /**
+     * Constructor
+     *
+     * @param[in] b bit width (register size will be 2 to the b power), in the range [4,30]
+     * @param[in] hash hash function of the elements
+     * @param[in] sparse start sketches sparse; ignored when b is greater than 26
+     *
+     * @exception std::invalid_argument the argument is out of range.
+     */
+    SketchStore(uint8_t b, HashType hash = HASH_MURMUR3_X86_32, bool sparse = true) throw (std::invalid_argument) :
+            b_(b), m_(1 << b), hash_(hash), sparse_(sparse && b <= HLL_SPARSE_MAX_BIT_WIDTH), size_(0),
+            table_(), pages_(), pageLive_(), classes_() {
+        if (b < 4 || 30 < b) {
+            throw std::invalid_argument("bit width must be in the range [4,30]");
+        }
+        if (!isHashType(hash)) {
+            throw std::invalid_argument("unknown hash type");
+        }
+        // sparse blocks of 4, 8, 16, ... entries up to the dense threshold, then the dense block
+        const uint32_t limit = std::min(m_ / 8, (uint32_t) HLL_SPARSE_MAX_ENTRIES);
+        if (sparse_) {
+            for (uint32_t n = HLL_STORE_MIN_SPARSE; ; n *= 2) {
+                classes_.push_back(SizeClass(std::min(n, limit) * sizeof(uint32_t)));
+                if (n >= limit) {
+                    break;
+                }
+            }
+        }
+        classes_.push_back(SizeClass(m_));
+        table_.resize(16);
+    }
+
+    /**
+     * Adds element to the counter of a key, creating it if needed.
+     *
+     * @param[in] key key
+     * @param[in] str string to add
+     * @param[in] len length of string
+     */
+    void add(const Key& key, const char* str, uint32_t len) {
+        uint32_t index;
+        uint8_t rank;
+        indexRank(hash_, b_, str, len, index, rank);
+        reserve(size_ + 1);
+        update(table_[findOrInsert(key, keyHash(key))], index, rank);
+    }
+
+    /**
+     * Adds an element by its hash value to the counter of a key
+     * (see HyperLogLog::addHash()).
+     *
+     * @param[in] key key
+     * @param[in] value hash value of the element
+     */
+    void addHash(const Key& key, uint64_t value) {
+        uint32_t index;
+        uint8_t rank;
+        indexRankHash(hash_, b_, value, index, rank);
+        reserve(size_ + 1);
+        update(table_[findOrInsert(key, keyHash(key))], index, rank);
+    }
+
+    /**
+     * Adds a batch of (key, element) pairs; the counters end up exactly as if
+     * add() was called for each pair. The table slots, then the registers,
+     * of a whole batch are prefetched before it is applied, which hides most
+     * cache misses once the store is larger than the cache.
+     *
+     * @param[in] keys keys
+     * @param[in] strs strings to add
+     * @param[in] lens lengths of the strings
+     * @param[in] n number of pairs
+     */
+    void addBatch(const Key* keys, const char* const* strs, const uint32_t* lens, size_t n) {
+        uint32_t index[HLL_BATCH_SIZE];
+        uint8_t rank[HLL_BATCH_SIZE];
+        for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+            const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+            indexRankBatch(hash_, b_, strs + off, lens + off, cnt, index, rank);
+            updateBatch(keys + off, cnt, index, rank);
+        }
+    }
+
+    /**
+     * addHash() of a batch of (key, hash value) pairs, as addBatch().
+     *
+     * @param[in] keys keys
+     * @param[in] values hash values of the elements
+     * @param[in] n number of pairs
+     */
+    void addHashes(const Key* keys, const uint64_t* values, size_t n) {
+        uint32_t index[HLL_BATCH_SIZE];
+        uint8_t rank[HLL_BATCH_SIZE];
+        for (size_t off = 0; off < n; off += HLL_BATCH_SIZE) {
+            const size_t cnt = std::min(n - off, (size_t) HLL_BATCH_SIZE);
+            indexRankHashes(hash_, b_, values + off, cnt, index, rank);
+            updateBatch(keys + off, cnt, index, rank);
+        }
+    }
+
+    /**
+     * Returns the counter of a key; that of a missing key is empty.
+     *
+     * @param[in] key key
+     *
+     * @return Sketch of the key
+     */
+    Sketch find(const Key& key) const {
+        const size_t slot = lookup(key, keyHash(key));
+        return Sketch(this, slot == table_.size() ? 0 : &table_[slot]);
+    }
+
+    /**
+     * Estimates the cardinality of a key; 0 for a missing key.
+     *
+     * @param[in] key key
+     * @param[in] estimator estimator to use
+     *
+     * @return Estimated cardinality value.
+     */
+    double estimate(const Key& key, EstimatorType estimator = ESTIMATOR_CLASSIC) const {
+        return find(key).estimate(estimator);
+    }
+
+    /**
+     * Returns whether a key has a counter.
+     *
+     * @param[in] key key
+     *
+     * @return true if it has
+     */
+    bool contains(const Key& key) const {
+        return lookup(key, keyHash(key)) != table_.size();
+    }
+
+    /**
+     * Calls f(key, sketch) for every key, in no particular order.
+     * The store must not be modified meanwhile.
+     *
+     * @param[in] f function object taking (const Key&, const Sketch&)
+     */
+    template<typename F>
+    void forEach(F f) const {
+        for (size_t i = 0; i < table_.size(); ++i) {
+            if (table_[i].used) {
+                f(table_[i].key, Sketch(this, &table_[i]));
+            }
+        }
+    }
+
+    /**
+     * Makes room for n keys without growing the table.
+     *
+     * @param[in] n number of keys
+     */
+    void reserve(size_t n) {
+        if (n * 4 <= table_.size() * 3) {
+            return;
+        }
+        size_t capacity = table_.size();
+        while (n * 4 > capacity * 3) {
+            capacity *= 2;
+        }
+        std::vector<Entry> old;
+        old.swap(table_);
+        table_.resize(capacity);
+        for (size_t i = 0; i < old.size(); ++i) {
+            if (old[i].used) {
+                size_t slot = keyHash(old[i].key) & (table_.size() - 1);
+                while (table_[slot].used) {
+                    slot = (slot + 1) & (table_.size() - 1);
+                }
+                table_[slot] = old[i];
+            }
+        }
+    }
+
+    /**
+     * Removes all keys and releases the arena.
+     */
+    void clear() {
+        std::vector<Entry>(16).swap(table_);
+        std::vector<std::vector<uint8_t> >().swap(pages_);
+        std::vector<uint32_t>().swap(pageLive_);
+        for (size_t c = 0; c < classes_.size(); ++c) {
+            classes_[c] = SizeClass(classes_[c].blockSize);
+        }
+        size_ = 0;
+    }
+
+    /**
+     * Returns the number of keys.
+     *
+     * @return Number of keys
+     */
+    size_t size() const {
+        return size_;
+    }
+
+    /**
+     * Returns the number of keys whose registers are dense.
+     *
+     * @return Number of dense sketches
+     */
+    size_t denseCount() const {
+        return classes_.back().live;
+    }
+
+    /**
+     * Returns the heap memory held by the table and the arena.
+     *
+     * @return Size in bytes
+     */
+    size_t memoryUsage() const {
+        size_t bytes = table_.capacity() * sizeof(Entry) + pages_.capacity() * sizeof(pages_[0])
+                + pageLive_.capacity() * sizeof(uint32_t);
+        for (size_t p = 0; p < pages_.size(); ++p) {
+            bytes += pages_[p].capacity();
+        }
+        for (size_t c = 0; c < classes_.size(); ++c) {
+            bytes += classes_[c].freeList.capacity() * sizeof(uint64_t);
+        }
+        return bytes;
+    }
+
+    /**
+     * Returns size of register.
+     *
+     * @return Register size
+     */
+    uint32_t registerSize() const {
+        return m_;
+    }
+
+    /**
+     * Returns the hash function of the elements.
+     *
+     * @return Hash function
+     */
+    HashType hashType() const {
+        return hash_;
+    }
+
+private:
+    /**
+     * Table slot of a key.
+     */
+    struct Entry {
+        Key key; ///< key
+        uint64_t block; ///< (page << 32 | offset) of the registers
+        uint32_t size; ///< number of sparse entries, or HLL_STORE_DENSE
+        uint8_t sizeClass; ///< size class of the block
+        bool used; ///< the slot holds a key
+
+        Entry() : key(), block(0), size(0), sizeClass(0), used(false) {
+        }
+    };
+
+    /**
+     * Blocks of one size.
+     */
+    struct SizeClass {
+        uint32_t blockSize; ///< bytes per block
+        uint64_t next; ///< next block never handed out
+        uint64_t end; ///< end of the page 'next' is in
+        size_t live; ///< blocks in use
+        std::vector<uint64_t> freeList; ///< freed blocks, possibly of released pages
+
+        explicit SizeClass(uint32_t size) : blockSize(size), next(0), end(0), live(0), freeList() {
+        }
+    };
+
+    /**
+     * Estimate of the sketch of an entry, or of an empty one for null.
+     */
+    double estimateOf(const Entry* e, EstimatorType estimator) const {
+        uint32_t hist[64] = {0};
+        if (e == 0) {
+            hist[0] = m_;
+        } else if (e->size == HLL_STORE_DENSE) {
+            simd::registerHistogram(block(e->block), m_, hist);
+        } else {
+            const uint32_t* entries = sparseEntries(*e);
+            hist[0] = m_ - e->size;
+            for (uint32_t i = 0; i < e->size; ++i) {
+                hist[entries[i] & 0x3F]++;
+            }
+        }
+        return estimateFromHistogram(estimator, hash_, b_, hist);
+    }
+
+    /**
+     * Copy of the sketch of an entry as a HyperLogLog counter, or an empty one for null.
+     */
+    HyperLogLog hyperLogLogOf(const Entry* e) const {
+        HyperLogLog hll(b_, hash_, e == 0 || e->size != HLL_STORE_DENSE);
+        if (e != 0) {
+            if (e->size == HLL_STORE_DENSE) {
+                const uint8_t* registers = block(e->block);
+                hll.M_.assign(registers, registers + m_);
+            } else {
+                const uint32_t* entries = sparseEntries(*e);
+                hll.sparse_.assign(entries, entries + e->size);
+            }
+            hll.recomputeCache();
+        }
+        return hll;
+    }
+
+    /**
+     * Hash value of a key, mixed so that the low bits pick the slot.
+     */
+    size_t keyHash(const Key& key) const {
+        return (size_t) fmix64((uint64_t) KeyHash()(key));
+    }
+
+    /**
+     * Returns the slot of a key, or table_.size() if it's missing.
+     */
+    size_t lookup(const Key& key, size_t hash) const {
+        const size_t mask = table_.size() - 1;
+        for (size_t slot = hash & mask; table_[slot].used; slot = (slot + 1) & mask) {
+            if (table_[slot].key == key) {
+                return slot;
+            }
+        }
+        return table_.size();
+    }
+
+    /**
+     * Returns the slot of a key, inserting it with an empty sketch if it's
+     * missing. The table must have room for it (see reserve()).
+     */
+    size_t findOrInsert(const Key& key, size_t hash) {
+        const size_t mask = table_.size() - 1;
+        size_t slot = hash & mask;
+        for (; table_[slot].used; slot = (slot + 1) & mask) {
+            if (table_[slot].key == key) {
+                return slot;
+            }
+        }
+        Entry& e = table_[slot];
+        e.key = key;
+        e.used = true;
+        e.sizeClass = 0;
+        e.block = allocate(0);
+        e.size = sparse_ ? 0 : HLL_STORE_DENSE;
+        size_++;
+        return slot;
+    }
+
+    /**
+     * Looks up the keys of a batch and raises their registers, prefetching
+     * the table slots of all keys, then their registers, before the updates.
+     */
+    void updateBatch(const Key* keys, size_t n, const uint32_t* index, const uint8_t* rank) {
+        size_t hashes[HLL_BATCH_SIZE];
+        size_t slots[HLL_BATCH_SIZE];
+        // no rehash within the batch, so the slots stay put
+        reserve(size_ + n);
+        const size_t mask = table_.size() - 1;
+        for (size_t i = 0; i < n; ++i) {
+            hashes[i] = keyHash(keys[i]);
+            HLL_PREFETCH(&table_[hashes[i] & mask], 0);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            slots[i] = findOrInsert(keys[i], hashes[i]);
+            const Entry& e = table_[slots[i]];
+            HLL_PREFETCH(block(e.block) + (e.size == HLL_STORE_DENSE ? index[i] : 0), 1);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            update(table_[slots[i]], index[i], rank[i]);
+        }
+    }
+
+    /**
+     * Raises register 'index' of a sketch to 'rank'.
+     */
+    void update(Entry& e, uint32_t index, uint8_t rank) {
+        if (e.size == HLL_STORE_DENSE) {
+            uint8_t* registers = block(e.block);
+            if (rank > registers[index]) {
+                registers[index] = rank;
+            }
+            return;
+        }
+        uint32_t* entries = sparseEntries(e);
+        const uint32_t entry = (index << 6) | rank;
+        uint32_t* it = std::lower_bound(entries, entries + e.size, index << 6);
+        if (it != entries + e.size && (*it >> 6) == index) {
+            if (entry > *it) {
+                *it = entry;
+            }
+            return;
+        }
+        if (e.size * sizeof(uint32_t) == classes_[e.sizeClass].blockSize) {
+            if (e.sizeClass + 2u == classes_.size()) {
+                // full at the dense threshold
+                toDense(e);
+                block(e.block)[index] = rank;
+                return;
+            }
+            const size_t pos = it - entries;
+            const uint64_t grown = allocate(e.sizeClass + 1);
+            std::memcpy(block(grown), entries, e.size * sizeof(uint32_t));
+            release(e.sizeClass, e.block);
+            e.block = grown;
+            e.sizeClass++;
+            entries = sparseEntries(e);
+            it = entries + pos;
+        }
+        std::copy_backward(it, entries + e.size, entries + e.size + 1);
+        *it = entry;
+        e.size++;
+    }
+
+    /**
+     * Moves a sparse sketch into a dense block.
+     */
+    void toDense(Entry& e) {
+        const uint64_t dense = allocate(classes_.size() - 1);
+        uint8_t* registers = block(dense);
+        const uint32_t* entries = sparseEntries(e);
+        for (uint32_t i = 0; i < e.size; ++i) {
+            registers[entries[i] >> 6] = entries[i] & 0x3F;
+        }
+        release(e.sizeClass, e.block);
+        e.block = dense;
+        e.sizeClass = classes_.size() - 1;
+        e.size = HLL_STORE_DENSE;
+    }
+
+    /**
+     * Returns a zeroed block of a size class.
+     */
+    uint64_t allocate(size_t sizeClass) {
+        SizeClass& c = classes_[sizeClass];
+        c.live++;
+        while (!c.freeList.empty()) {
+            const uint64_t handle = c.freeList.back();
+            c.freeList.pop_back();
+            if (!pages_[handle >> 32].empty()) {
+                pageLive_[handle >> 32]++;
+                std::memset(block(handle), 0, c.blockSize);
+                return handle;
+            }
+        }
+        if (c.next == c.end) {
+            const size_t blocks = std::max((size_t) 1, (size_t) HLL_STORE_PAGE_SIZE / c.blockSize);
+            pages_.push_back(std::vector<uint8_t>(blocks * c.blockSize));
+            pageLive_.push_back(0);
+            c.next = uint64_t(pages_.size() - 1) << 32;
+            c.end = c.next + blocks * c.blockSize;
+        }
+        const uint64_t handle = c.next;
+        c.next += c.blockSize;
+        pageLive_[handle >> 32]++;
+        return handle;
+    }
+
+    /**
+     * Returns a block to its size class. A page left without blocks in use
+     * is released; its blocks in the free list are dropped when they come up.
+     */
+    void release(size_t sizeClass, uint64_t handle) {
+        SizeClass& c = classes_[sizeClass];
+        c.live--;
+        const uint64_t page = handle >> 32;
+        if (--pageLive_[page] == 0) {
+            std::vector<uint8_t>().swap(pages_[page]);
+            if (c.next != c.end && (c.next >> 32) == page) {
+                c.next = c.end;
+            }
+        } else {
+            c.freeList.push_back(handle);
+        }
+    }
+
+    uint8_t* block(uint64_t handle) {
+        return &pages_[handle >> 32][handle & 0xFFFFFFFFU];
+    }
+
+    const uint8_t* block(uint64_t handle) const {
+        return &pages_[handle >> 32][handle & 0xFFFFFFFFU];
+    }
+
+    uint32_t* sparseEntries(const Entry& e) {
+        return reinterpret_cast<uint32_t*>(block(e.block));
+    }
+
+    const uint32_t* sparseEntries(const Entry& e) const {
+        return reinterpret_cast<const uint32_t*>(block(e.block));
+    }
+
+    uint8_t b_; ///< register bit width
+    uint32_t m_; ///< register size
+    HashType hash_; ///< hash function of the elements
+    bool sparse_; ///< new sketches start sparse
+    size_t size_; ///< number of keys
+    std::vector<Entry> table_; ///< open addressing table, a power of two in size
+    std::vector<std::vector<uint8_t> > pages_; ///< arena pages, empty once released
+    std::vector<uint32_t> pageLive_; ///< blocks in use in each page
+    std::vector<SizeClass> classes_; ///< sparse block sizes in increasing order, then the dense one
+};
+
+} // namespace hll
+
+#endif // !defined(HYPERLOGLOG_STORE_HPP)
@@ -0,0 +1,329 @@
+#if !defined(HYPERLOGLOG_VIEW_HPP)
+#define HYPERLOGLOG_VIEW_HPP
+
+/**
+ * @file hyperloglog_view.hpp
+ * @brief Memory image format of HyperLogLog registers and a read-only view on it
+ *
+ * An image is a 64 byte header followed by the 2^b registers, one byte each,
+ * padded with zeros to a multiple of 64 bytes. Images can be stored back to
+ * back in a file and read in place through mmap (see MappedFile) without
+ * copying or parsing the registers.
+ *
+ * Header fields are stored in the byte order of the writer; the endianness
+ * marker lets a reader on a different byte order reject the image.
+ */
+
+#include <cstring>
+#include "hyperloglog.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HLL_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define HLL_IMAGE_MAGIC 0x494C4C48U ///< "HLLI" in little endian
+#define HLL_IMAGE_VERSION 1
+#define HLL_IMAGE_ENDIAN 0x01020304U
+#define HLL_IMAGE_ALIGNMENT 64 ///< header size, register offset and image size granularity
+
+namespace hll {
+
+/**
+ * Header of a register image.
+ */
+struct ImageHeader {
+    uint32_t magic; ///< HLL_IMAGE_MAGIC
+    uint16_t version; ///< HLL_IMAGE_VERSION
+    uint8_t b; ///< register bit width
+    uint8_t hash; ///< HashType
+    uint32_t endian; ///< HLL_IMAGE_ENDIAN in the byte order of the writer
+    uint32_t registerOffset; ///< offset of the registers from the start of the header
+    uint64_t registerCount; ///< 2^b
+    uint64_t checksum; ///< lower 64 bits of MurmurHash3_x64_128 of the registers
+    uint8_t reserved[32]; ///< zero
+};
+
+static_assert(sizeof(ImageHeader) == HLL_IMAGE_ALIGNMENT, "the registers must start at an aligned offset");
+
+/**
+ * Checksum of the registers stored in an image.
+ */
+inline uint64_t imageChecksum(const uint8_t* registers, uint32_t m) {
+    uint64_t value[2];
+    MurmurHash3_x64_128(registers, m, HLL_HASH_SEED, (void*) value);
+    return value[0];
+}
+
+/** @class HyperLogLogView
+ *  @brief Read-only HyperLogLog counter on registers stored in an image.
+ *
+ * The view only points at the image; it must stay valid and unchanged
+ * while the view is used.
+ */
+class HyperLogLogView {
+public:
+
+    /**
+     * Returns the size of the image of a counter.
+     *
+     * @param[in] b register bit width
+     *
+     * @return Size in bytes, a multiple of HLL_IMAGE_ALIGNMENT
+     */
+    static size_t imageSize(uint8_t b) {
+        const size_t size = sizeof(ImageHeader) + (size_t(1) << b);
+        return (size + HLL_IMAGE_ALIGNMENT - 1) / HLL_IMAGE_ALIGNMENT * HLL_IMAGE_ALIGNMENT;
+    }
+
+    /**
+     * Writes the image of a counter into a buffer.
+     * A sparse counter is written with all of its registers.
+     *
+     * @param[in] hll counter to write
+     * @param[out] buf destination, preferably aligned to HLL_IMAGE_ALIGNMENT
+     * @param[in] size size of buf
+     *
+     * @return Number of bytes written (imageSize(b))
+     *
+     * @exception std::invalid_argument buf is too small.
+     */
+    static size_t writeImage(const HyperLogLog& hll, void* buf, size_t size) throw (std::invalid_argument) {
+        const size_t needed = imageSize(hll.b_);
+        if (size < needed) {
+            std::stringstream ss;
+            ss << "buffer too small for the image: " << size << " < " << needed;
+            throw std::invalid_argument(ss.str().c_str());
+        }
+        uint8_t* out = static_cast<uint8_t*>(buf);
+        std::memset(out, 0, needed);
+        uint8_t* registers = out + sizeof(ImageHeader);
+        if (hll.M_.empty()) {
+            for (size_t i = 0; i < hll.sparse_.size(); ++i) {
+                registers[hll.sparse_[i] >> 6] = hll.sparse_[i] & 0x3F;
+            }
+        } else {
+            std::memcpy(registers, &hll.M_[0], hll.m_);
+        }
+        ImageHeader header;
+        std::memset(&header, 0, sizeof(header));
+        header.magic = HLL_IMAGE_MAGIC;
+        header.version = HLL_IMAGE_VERSION;
+        header.b = hll.b_;
+        header.hash = hll.hash_;
+        header.endian = HLL_IMAGE_ENDIAN;
+        header.registerOffset = sizeof(ImageHeader);
+        header.registerCount = hll.m_;
+        header.checksum = imageChecksum(registers, hll.m_);
+        std::memcpy(out, &header, sizeof(header));
+        return needed;
+    }
+
+    /**
+     * Constructor
+     * Checks the header and that no register exceeds the largest rank of the
+     * bit width and hash function, which reads the registers once; the
+     * checksum of the registers is checked by verify().
+     *
+     * @param[in] data start of the image
+     * @param[in] size bytes available from data on
+     *
+     * @exception std::runtime_error the data is not a valid image.
+     */
+    HyperLogLogView(const void* data, size_t size) throw (std::runtime_error) {
+        if (size < sizeof(ImageHeader)) {
+            throw std::runtime_error("image too small");
+        }
+        std::memcpy(&header_, data, sizeof(header_));
+        if (header_.magic != HLL_IMAGE_MAGIC) {
+            throw std::runtime_error("not a HyperLogLog image");
+        }
+        if (header_.endian != HLL_IMAGE_ENDIAN) {
+            throw std::runtime_error("image endianness doesn't match");
+        }
+        if (header_.version != HLL_IMAGE_VERSION) {
+            std::stringstream ss;
+            ss << "unsupported image version: " << header_.version;
+            throw std::runtime_error(ss.str().c_str());
+        }
+        if (header_.b < 4 || 30 < header_.b || !isHashType(header_.hash) || header_.registerCount != (uint64_t(1) << header_.b)
+                || header_.registerOffset < sizeof(ImageHeader)
+                || size < header_.registerOffset + header_.registerCount) {
+            throw std::runtime_error("broken image header");
+        }
+        registers_ = static_cast<const uint8_t*>(data) + header_.registerOffset;
+        if (simd::maxByte(registers_, registerSize()) > maxRank(header_.b, hashType())) {
+            throw std::runtime_error("broken image registers");
+        }
+        alphaMM_ = alphaMM(registerSize());
+    }
+
+    /**
+     * Checks the registers against the checksum in the header.
+     *
+     * @return true if they match
+     */
+    bool verify() const {
+        return imageChecksum(registers_, registerSize()) == header_.checksum;
+    }
+
+    /**
+     * Estimates cardinality value.
+     *
+     * @return Estimated cardinality value.
+     */
+    double estimate() const {
+        RegisterSum sum;
+        uint32_t zeros = 0;
+        simd::registerSum(registers_, registerSize(), sum.hi, sum.lo, zeros);
+        return estimateFromSum(hashType(), registerSize(), alphaMM_, sum.value(), zeros);
+    }
+
+    /**
+     * Returns the value of a register.
+     *
+     * @param[in] index register index
+     *
+     * @return Register value
+     */
+    uint8_t getRegister(uint32_t index) const {
+        return registers_[index];
+    }
+
+    /**
+     * Returns the registers in the image.
+     *
+     * @return Pointer to registerSize() registers
+     */
+    const uint8_t* registers() const {
+        return registers_;
+    }
+
+    /**
+     * Returns size of register.
+     *
+     * @return Register size
+     */
+    uint32_t registerSize() const {
+        return (uint32_t) header_.registerCount;
+    }
+
+    /**
+     * Returns the hash function of the counter.
+     *
+     * @return Hash function
+     */
+    HashType hashType() const {
+        return static_cast<HashType>(header_.hash);
+    }
+
+    /**
+     * Returns the size of the image this view points at; the next image of
+     * a file of images stored back to back starts that many bytes later.
+     *
+     * @return Size in bytes
+     */
+    size_t imageSize() const {
+        return imageSize(header_.b);
+    }
+
+    /**
+     * Copies the registers into a writable HyperLogLog counter.
+     *
+     * @return HyperLogLog instance with the same registers
+     */
+    HyperLogLog toHyperLogLog() const {
+        HyperLogLog hll(header_.b, hashType());
+        hll.mergeDense(registers_);
+        return hll;
+    }
+
+private:
+    ImageHeader header_; ///< copy of the image header
+    const uint8_t* registers_; ///< registers in the image
+    double alphaMM_; ///< alpha * m^2
+};
+
+inline void HyperLogLog::merge(const HyperLogLogView& view) throw (std::invalid_argument) {
+    checkCompatible(view.registerSize(), view.hashType());
+    HLL_STATS_SCOPE(OP_MERGE);
+    mergeDense(view.registers());
+}
+
+#if defined(HLL_HAS_MMAP)
+
+/** @class MappedFile
+ *  @brief Read-only memory mapping of a whole file, e.g. a file of images.
+ */
+class MappedFile {
+public:
+
+    /**
+     * Maps a file.
+     *
+     * @param[in] path file to map
+     *
+     * @exception std::runtime_error When failed to open or map the file.
+     */
+    explicit MappedFile(const char* path) throw (std::runtime_error) : data_(0), size_(0) {
+        const int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open");
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Failed to open");
+        }
+        size_ = st.st_size;
+        if (size_ != 0) {
+            void* p = ::mmap(0, size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Failed to map");
+            }
+            data_ = p;
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile() {
+        if (data_ != 0) {
+            ::munmap(data_, size_);
+        }
+    }
+
+    /**
+     * Returns the start of the mapping.
+     *
+     * @return Pointer to the file contents
+     */
+    const void* data() const {
+        return data_;
+    }
+
+    /**
+     * Returns the size of the file.
+     *
+     * @return Size in bytes
+     */
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    void* data_;
+    size_t size_;
+};
+
+#endif // defined(HLL_HAS_MMAP)
+
+} // namespace hll
+
+#endif // !defined(HYPERLOGLOG_VIEW_HPP)
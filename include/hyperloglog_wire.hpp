@@ -0,0 +1,526 @@
+#if !defined(HYPERLOGLOG_WIRE_HPP)
+#define HYPERLOGLOG_WIRE_HPP
+
+/**
+ * @file hyperloglog_wire.hpp
+ * @brief Compact serialization of HyperLogLog counters into caller buffers
+ *
+ * A message is an 8 byte frame followed by the payload:
+ *
+ *   byte 0     HLL_WIRE_MAGIC
+ *   byte 1     WireEncoding of the payload
+ *   byte 2     b
+ *   byte 3     HashType
+ *   bytes 4-7  payload length, little endian
+ *
+ * Payloads (varints are LEB128, all multi-byte values little endian):
+ *
+ * - WIRE_SPARSE: varint number of non-zero registers, then for each of them
+ *   in index order varint((index - previous index) << 6 | value).
+ * - WIRE_PACKED: all registers as a bit stream of 5 (32 bit hash) or 6
+ *   (64 bit hash) bits each, least significant bits first.
+ * - WIRE_NIBBLE: base byte, varint number of exceptions, then all registers
+ *   as 4 bit codes (low nibble first), then the exceptions like the sparse
+ *   entries. A code below 15 stands for base + code; 15 stands for 0 unless
+ *   the register is listed as an exception. Register values cluster around
+ *   log2(n/m), so nearly all of them fit in the 15 values above the base.
+ */
+
+#include "hyperloglog.hpp"
+
+#define HLL_WIRE_MAGIC 0x57 ///< 'W'
+#define HLL_WIRE_HEADER_SIZE 8
+#define HLL_WIRE_CHUNK 1024 ///< registers decoded at a time before merging
+
+namespace hll {
+
+/**
+ * Payload encodings of a wire message.
+ */
+enum WireEncoding {
+    WIRE_AUTO = 0, ///< the smallest of the encodings below (encoder only)
+    WIRE_SPARSE = 1, ///< list of the non-zero registers
+    WIRE_PACKED = 2, ///< 5 or 6 bits per register
+    WIRE_NIBBLE = 3 ///< 4 bit offset from a base value, with exceptions
+};
+
+/** @class HyperLogLogWire
+ *  @brief Encoder and merging decoder of wire messages.
+ */
+class HyperLogLogWire {
+public:
+
+    /**
+     * Returns the largest size of a message encoded with WIRE_AUTO.
+     *
+     * @param[in] b register bit width
+     *
+     * @return Size in bytes
+     */
+    static size_t maxEncodedSize(uint8_t b) {
+        return HLL_WIRE_HEADER_SIZE + ((size_t(1) << b) * 6 + 7) / 8;
+    }
+
+    /**
+     * Returns the exact size of the message encode() would write.
+     *
+     * @param[in] hll counter to encode
+     * @param[in] encoding payload encoding
+     *
+     * @return Size in bytes
+     */
+    static size_t encodedSize(const HyperLogLog& hll, WireEncoding encoding = WIRE_AUTO) {
+        return HLL_WIRE_HEADER_SIZE + plan(hll, encoding).payload;
+    }
+
+    /**
+     * Encodes a counter into a buffer.
+     * A sparse counter is always sent as WIRE_SPARSE. With WIRE_AUTO a
+     * dense counter is sent with the smallest encoding.
+     *
+     * @param[in] hll counter to encode
+     * @param[out] buf destination
+     * @param[in] size size of buf; maxEncodedSize(b) is always enough for WIRE_AUTO
+     * @param[in] encoding payload encoding
+     *
+     * @return Number of bytes written
+     *
+     * @exception std::invalid_argument buf is too small.
+     */
+    static size_t encode(const HyperLogLog& hll, uint8_t* buf, size_t size, WireEncoding encoding = WIRE_AUTO)
+            throw (std::invalid_argument) {
+        const Plan p = plan(hll, encoding);
+        if (size < HLL_WIRE_HEADER_SIZE + p.payload) {
+            std::stringstream ss;
+            ss << "buffer too small for the message: " << size << " < " << HLL_WIRE_HEADER_SIZE + p.payload;
+            throw std::invalid_argument(ss.str().c_str());
+        }
+        buf[0] = HLL_WIRE_MAGIC;
+        buf[1] = p.encoding;
+        buf[2] = hll.b_;
+        buf[3] = hll.hash_;
+        for (int i = 0; i < 4; ++i) {
+            buf[4 + i] = (uint8_t) (p.payload >> (8 * i));
+        }
+        uint8_t* out = buf + HLL_WIRE_HEADER_SIZE;
+        switch (p.encoding) {
+            case WIRE_SPARSE:
+                out = writeVarint(out, p.entries);
+                out = writeEntries(hll, out, 1, 0);
+                break;
+            case WIRE_PACKED:
+                out = writePacked(hll, out);
+                break;
+            default:
+                *out++ = p.base;
+                out = writeVarint(out, p.entries);
+                out = writeNibbles(hll, out, p.base);
+                out = writeEntries(hll, out, p.base, p.base + 15);
+                break;
+        }
+        return out - buf;
+    }
+
+    /**
+     * Merges the counter encoded in a message into 'dst' without building
+     * a temporary counter. The result is the same as decoding the message
+     * and calling dst.merge() with it.
+     *
+     * @param[in] buf message
+     * @param[in] size bytes available in buf
+     * @param[in,out] dst counter to merge into
+     *
+     * @return Number of bytes of the message
+     *
+     * @exception std::invalid_argument number of registers or hash function doesn't match.
+     * @exception std::runtime_error the message is broken. Registers merged
+     *            before the broken part was found stay merged.
+     */
+    static size_t decodeMerge(const uint8_t* buf, size_t size, HyperLogLog& dst)
+            throw (std::invalid_argument, std::runtime_error) {
+        uint8_t b;
+        HashType hash;
+        WireEncoding encoding;
+        size_t payload;
+        readHeader(buf, size, b, hash, encoding, payload);
+        dst.checkCompatible(uint32_t(1) << b, hash);
+        Reader in(buf + HLL_WIRE_HEADER_SIZE, payload, maxRank(b, hash));
+        switch (encoding) {
+            case WIRE_SPARSE:
+                readEntries(in, in.varint(), dst, 1, 0);
+                break;
+            case WIRE_PACKED:
+                readPacked(in, dst);
+                break;
+            default: {
+                const uint8_t base = in.byte();
+                const uint64_t exceptions = in.varint();
+                readNibbles(in, dst, base);
+                readEntries(in, exceptions, dst, base, base + 15);
+                break;
+            }
+        }
+        if (in.pos != in.end) {
+            throw std::runtime_error("Failed to decode");
+        }
+        return HLL_WIRE_HEADER_SIZE + payload;
+    }
+
+    /**
+     * Not available: registers written into a HyperLogLogHIP would leave its
+     * estimate behind. Decode the message and merge it into a HyperLogLog.
+     */
+    static size_t decodeMerge(const uint8_t* buf, size_t size, HyperLogLogHIP& dst) = delete;
+
+    /**
+     * Decodes a message into a new counter.
+     *
+     * @param[in] buf message
+     * @param[in] size bytes available in buf
+     *
+     * @return HyperLogLog instance
+     *
+     * @exception std::runtime_error the message is broken.
+     */
+    static HyperLogLog decode(const uint8_t* buf, size_t size) throw (std::runtime_error) {
+        uint8_t b;
+        HashType hash;
+        WireEncoding encoding;
+        size_t payload;
+        readHeader(buf, size, b, hash, encoding, payload);
+        HyperLogLog hll(b, hash, encoding == WIRE_SPARSE);
+        decodeMerge(buf, size, hll);
+        return hll;
+    }
+
+private:
+    struct Plan {
+        WireEncoding encoding;
+        size_t payload; ///< payload size in bytes
+        uint64_t entries; ///< sparse entries or nibble exceptions
+        uint8_t base; ///< nibble base
+    };
+
+    /**
+     * Bounds checked reader of a payload.
+     */
+    struct Reader {
+        Reader(const uint8_t* p, size_t n, uint8_t maxValue) : pos(p), end(p + n), maxValue(maxValue) {
+        }
+        uint8_t byte() {
+            if (pos == end) {
+                throw std::runtime_error("Failed to decode");
+            }
+            return *pos++;
+        }
+        uint64_t varint() {
+            uint64_t v = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                const uint8_t c = byte();
+                v |= uint64_t(c & 0x7F) << shift;
+                if (!(c & 0x80)) {
+                    return v;
+                }
+            }
+            throw std::runtime_error("Failed to decode");
+        }
+        const uint8_t* pos;
+        const uint8_t* end;
+        uint8_t maxValue; ///< largest valid register value
+    };
+
+    static uint8_t packedWidth(HashType hash) {
+        return hashBits(hash) == 32 ? 5 : 6;
+    }
+
+    static size_t varintSize(uint64_t v) {
+        size_t n = 1;
+        for (int shift = 7; shift < 64; shift += 7) {
+            n += v >= (uint64_t(1) << shift);
+        }
+        return n;
+    }
+
+    static uint8_t* writeVarint(uint8_t* out, uint64_t v) {
+        while (v >= 0x80) {
+            *out++ = (uint8_t) (v | 0x80);
+            v >>= 7;
+        }
+        *out++ = (uint8_t) v;
+        return out;
+    }
+
+    static void readHeader(const uint8_t* buf, size_t size, uint8_t& b, HashType& hash, WireEncoding& encoding,
+            size_t& payload) throw (std::runtime_error) {
+        if (size < HLL_WIRE_HEADER_SIZE || buf[0] != HLL_WIRE_MAGIC || buf[1] < WIRE_SPARSE || WIRE_NIBBLE < buf[1]
+                || buf[2] < 4 || 30 < buf[2] || !isHashType(buf[3])) {
+            throw std::runtime_error("Failed to decode");
+        }
+        encoding = static_cast<WireEncoding>(buf[1]);
+        b = buf[2];
+        hash = static_cast<HashType>(buf[3]);
+        payload = 0;
+        for (int i = 0; i < 4; ++i) {
+            payload |= size_t(buf[4 + i]) << (8 * i);
+        }
+        if (size - HLL_WIRE_HEADER_SIZE < payload) {
+            throw std::runtime_error("Failed to decode");
+        }
+    }
+
+    /**
+     * True if 'value' is written as a sparse entry or nibble exception.
+     */
+    static bool isEntry(uint8_t value, uint8_t lo, uint8_t hi) {
+        return (value != 0) & ((value < lo) | (hi <= value));
+    }
+
+    /**
+     * Stores the indexes of the entries among n registers into 'index'.
+     * Groups without entries, the common case of nibble exceptions, are
+     * skipped after a check the compiler vectorizes; the indexes of the
+     * others are stored without branching on the register values, which
+     * follow no pattern.
+     *
+     * @return Number of entries
+     */
+    static uint32_t collectEntries(const uint8_t* M, uint32_t n, uint8_t lo, uint8_t hi, uint32_t* index) {
+        uint32_t count = 0;
+        for (uint32_t g = 0; g < n; g += 32) {
+            const uint32_t end = std::min(n, g + 32);
+            uint8_t any = 0;
+            for (uint32_t i = g; i < end; ++i) {
+                any |= isEntry(M[i], lo, hi);
+            }
+            if (any == 0) {
+                continue;
+            }
+            for (uint32_t i = g; i < end; ++i) {
+                index[count] = i;
+                count += isEntry(M[i], lo, hi);
+            }
+        }
+        return count;
+    }
+
+    /**
+     * Computes the payload size of every encoding and picks one.
+     */
+    static Plan plan(const HyperLogLog& hll, WireEncoding encoding) {
+        const uint32_t m = hll.m_;
+        Plan packed = {WIRE_PACKED, (m * (size_t) packedWidth(hll.hash_) + 7) / 8, 0, 0};
+        if (encoding == WIRE_PACKED && !hll.M_.empty()) {
+            return packed;
+        }
+        if (hll.M_.empty() || encoding == WIRE_SPARSE) {
+            return sparsePlan(hll);
+        }
+        // base of the 15 value window holding most of the non-zero registers
+        uint32_t hist[64];
+        hll.fillHistogram(hist);
+        uint8_t base = 1;
+        uint32_t best = 0;
+        for (uint8_t lo = 1; lo + 15 <= 64; ++lo) {
+            uint32_t covered = 0;
+            for (uint8_t v = lo; v < lo + 15; ++v) {
+                covered += hist[v];
+            }
+            if (covered > best) {
+                best = covered;
+                base = lo;
+            }
+        }
+        // every entry takes at least 1 byte (a delta of 1 with a rank below 64
+        // fits in one varint byte); that bound rules encodings out without a scan
+        if (encoding == WIRE_AUTO && (m - hist[0] - best) + m / 2 >= packed.payload) {
+            if (m - hist[0] <= packed.payload) {
+                const Plan sparse = sparsePlan(hll);
+                if (sparse.payload <= packed.payload) {
+                    return sparse;
+                }
+            }
+            return packed;
+        }
+        Plan nibble = {WIRE_NIBBLE, 0, 0, base};
+        nibble.payload = 1 + m / 2 + entriesSize(hll, base, base + 15, nibble.entries);
+        nibble.payload += varintSize(nibble.entries);
+        if (encoding == WIRE_NIBBLE) {
+            return nibble;
+        }
+        const Plan& best2 = nibble.payload < packed.payload ? nibble : packed;
+        if (m - hist[0] <= best2.payload) {
+            const Plan sparse = sparsePlan(hll);
+            if (sparse.payload <= best2.payload) {
+                return sparse;
+            }
+        }
+        return best2;
+    }
+
+    static Plan sparsePlan(const HyperLogLog& hll) {
+        Plan sparse = {WIRE_SPARSE, 0, 0, 0};
+        sparse.payload = entriesSize(hll, 1, 0, sparse.entries);
+        sparse.payload += varintSize(sparse.entries);
+        return sparse;
+    }
+
+    /**
+     * Size of the entries of the registers outside [lo, hi), and their number.
+     */
+    static size_t entriesSize(const HyperLogLog& hll, uint8_t lo, uint8_t hi, uint64_t& count) {
+        size_t size = 0;
+        count = 0;
+        uint32_t prev = 0;
+        if (hll.M_.empty()) {
+            for (size_t i = 0; i < hll.sparse_.size(); ++i) {
+                const uint32_t index = hll.sparse_[i] >> 6;
+                size += varintSize((uint64_t(index - prev) << 6) | (hll.sparse_[i] & 0x3F));
+                prev = index;
+            }
+            count = hll.sparse_.size();
+            return size;
+        }
+        uint32_t index[HLL_WIRE_CHUNK];
+        for (uint32_t off = 0; off < hll.m_; off += HLL_WIRE_CHUNK) {
+            const uint32_t n = std::min(hll.m_ - off, (uint32_t) HLL_WIRE_CHUNK);
+            const uint32_t found = collectEntries(&hll.M_[off], n, lo, hi, index);
+            for (uint32_t k = 0; k < found; ++k) {
+                const uint32_t i = off + index[k];
+                size += varintSize((uint64_t(i - prev) << 6) | hll.M_[i]);
+                prev = i;
+            }
+            count += found;
+        }
+        return size;
+    }
+
+    static uint8_t* writeEntries(const HyperLogLog& hll, uint8_t* out, uint8_t lo, uint8_t hi) {
+        uint32_t prev = 0;
+        if (hll.M_.empty()) {
+            for (size_t i = 0; i < hll.sparse_.size(); ++i) {
+                const uint32_t index = hll.sparse_[i] >> 6;
+                out = writeVarint(out, (uint64_t(index - prev) << 6) | (hll.sparse_[i] & 0x3F));
+                prev = index;
+            }
+            return out;
+        }
+        uint32_t index[HLL_WIRE_CHUNK];
+        for (uint32_t off = 0; off < hll.m_; off += HLL_WIRE_CHUNK) {
+            const uint32_t n = std::min(hll.m_ - off, (uint32_t) HLL_WIRE_CHUNK);
+            const uint32_t found = collectEntries(&hll.M_[off], n, lo, hi, index);
+            for (uint32_t k = 0; k < found; ++k) {
+                const uint32_t i = off + index[k];
+                out = writeVarint(out, (uint64_t(i - prev) << 6) | hll.M_[i]);
+                prev = i;
+            }
+        }
+        return out;
+    }
+
+    static uint8_t* writePacked(const HyperLogLog& hll, uint8_t* out) {
+        const uint8_t width = packedWidth(hll.hash_);
+        uint64_t acc = 0;
+        uint32_t bits = 0;
+        for (uint32_t i = 0; i < hll.m_; ++i) {
+            acc |= uint64_t(hll.M_[i]) << bits;
+            bits += width;
+            while (bits >= 8) {
+                *out++ = (uint8_t) acc;
+                acc >>= 8;
+                bits -= 8;
+            }
+        }
+        if (bits != 0) {
+            *out++ = (uint8_t) acc;
+        }
+        return out;
+    }
+
+    static uint8_t* writeNibbles(const HyperLogLog& hll, uint8_t* out, uint8_t base) {
+        uint8_t code[64];
+        for (uint8_t v = 0; v < 64; ++v) {
+            code[v] = (v >= base && v < base + 15) ? v - base : 15;
+        }
+        const uint8_t* M = &hll.M_[0];
+        for (uint32_t i = 0; i < hll.m_; i += 2) {
+            *out++ = code[M[i]] | (code[M[i + 1]] << 4);
+        }
+        return out;
+    }
+
+    static void readEntries(Reader& in, uint64_t count, HyperLogLog& dst, uint8_t lo, uint8_t hi) {
+        uint64_t index = 0;
+        for (uint64_t i = 0; i < count; ++i) {
+            const uint64_t v = in.varint();
+            const uint8_t value = v & 0x3F;
+            index += v >> 6;
+            if (index >= dst.m_ || value > in.maxValue || !isEntry(value, lo, hi)) {
+                throw std::runtime_error("Failed to decode");
+            }
+            dst.updateRegister((uint32_t) index, value);
+        }
+    }
+
+    /**
+     * Merges one chunk of decoded dense registers.
+     */
+    static void mergeChunk(HyperLogLog& dst, uint32_t off, const uint8_t* chunk, uint32_t n, uint8_t maxValue) {
+        for (uint32_t i = 0; i < n; ++i) {
+            if (chunk[i] > maxValue) {
+                throw std::runtime_error("Failed to decode");
+            }
+        }
+        HyperLogLog::CacheRaise raise(dst);
+        simd::maxBytes(&dst.M_[off], chunk, n, raise);
+    }
+
+    static void readPacked(Reader& in, HyperLogLog& dst) {
+        const uint8_t width = packedWidth(dst.hash_);
+        if ((size_t) (in.end - in.pos) != (dst.m_ * (size_t) width + 7) / 8) {
+            throw std::runtime_error("Failed to decode");
+        }
+        dst.toDense();
+        const uint8_t mask = (1 << width) - 1;
+        uint8_t chunk[HLL_WIRE_CHUNK];
+        uint64_t acc = 0;
+        uint32_t bits = 0;
+        for (uint32_t off = 0; off < dst.m_; off += HLL_WIRE_CHUNK) {
+            const uint32_t n = std::min(dst.m_ - off, (uint32_t) HLL_WIRE_CHUNK);
+            for (uint32_t i = 0; i < n; ++i) {
+                if (bits < width) {
+                    acc |= uint64_t(*in.pos++) << bits;
+                    bits += 8;
+                }
+                chunk[i] = acc & mask;
+                acc >>= width;
+                bits -= width;
+            }
+            mergeChunk(dst, off, chunk, n, in.maxValue);
+        }
+    }
+
+    static void readNibbles(Reader& in, HyperLogLog& dst, uint8_t base) {
+        if ((size_t) (in.end - in.pos) < dst.m_ / 2 || base == 0 || base + 15 > 64) {
+            throw std::runtime_error("Failed to decode");
+        }
+        dst.toDense();
+        uint8_t value[16];
+        for (uint8_t c = 0; c < 16; ++c) {
+            value[c] = c == 15 ? 0 : base + c;
+        }
+        uint8_t chunk[HLL_WIRE_CHUNK];
+        for (uint32_t off = 0; off < dst.m_; off += HLL_WIRE_CHUNK) {
+            const uint32_t n = std::min(dst.m_ - off, (uint32_t) HLL_WIRE_CHUNK);
+            for (uint32_t i = 0; i < n; i += 2) {
+                const uint8_t c = *in.pos++;
+                chunk[i] = value[c & 0xF];
+                chunk[i + 1] = value[c >> 4];
+            }
+            mergeChunk(dst, off, chunk, n, in.maxValue);
+        }
+    }
+};
+
+} // namespace hll
+
+#endif // !defined(HYPERLOGLOG_WIRE_HPP)
@@ -29,6 +29,8 @@ typedef unsigned __int64 uint64_t;
 
 #endif // !defined(_MSC_VER)
 
+#include <string.h>
+
 #define FORCE_INLINE __attribute__((always_inline))
 
 inline uint32_t rotl32 ( uint32_t x, uint8_t r )
@@ -38,6 +40,13 @@ inline uint32_t rotl32 ( uint32_t x, uint8_t r )
 
 #define ROTL32(x,y) rotl32(x,y)
 
+inline uint64_t rotl64 ( uint64_t x, int8_t r )
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+#define ROTL64(x,y) rotl64(x,y)
+
 #define BIG_CONSTANT(x) (x##LLU)
 
 /* NO-OP for little-endian platforms */
@@ -66,16 +75,47 @@ inline uint32_t rotl32 ( uint32_t x, uint8_t r )
          |(((x)&0x00FF0000)>>8)    )
 #endif
 
+/* 64 bit variant of BYTESWAP */
+#if (defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) \
+        && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) \
+  ||  defined(__i386)  || defined(__x86_64) \
+  ||  defined(__alpha) || defined(__vax)
+# define BYTESWAP64(x) (x)
+#elif defined(__GNUC__) || defined(__clang__)
+# define BYTESWAP64(x) __builtin_bswap64(x)
+#else
+# define BYTESWAP64(x) ((((uint64_t)BYTESWAP((uint32_t)(x))) << 32) \
+         | BYTESWAP((uint32_t)((x) >> 32)))
+#endif
+
 //-----------------------------------------------------------------------------
 // Block read - if your platform needs to do endian-swapping or can only
 // handle aligned reads, do the conversion here
 
-#define getblock(p, i) BYTESWAP(p[i])
+// memcpy keeps the reads legal for keys of any type and alignment; through
+// a uint32_t/uint64_t pointer the compiler may move them above the stores
+// that wrote the key (strict aliasing).
+
+inline uint32_t getblock32( const uint32_t * p, int i )
+{
+  uint32_t v;
+  memcpy(&v, (const uint8_t *)p + i * 4, sizeof(v));
+  return BYTESWAP(v);
+}
+
+inline uint64_t getblock64( const uint64_t * p, int i )
+{
+  uint64_t v;
+  memcpy(&v, (const uint8_t *)p + i * 8, sizeof(v));
+  return BYTESWAP64(v);
+}
+
+#define getblock(p, i) getblock32(p, i)
 
 //-----------------------------------------------------------------------------
 // Finalization mix - force all bits of a hash block to avalanche
 
-uint32_t fmix32( uint32_t h )
+inline uint32_t fmix32( uint32_t h )
 {
   h ^= h >> 16;
   h *= 0x85ebca6b;
@@ -86,10 +126,23 @@ uint32_t fmix32( uint32_t h )
   return h;
 }
 
+//----------
+
+inline uint64_t fmix64( uint64_t k )
+{
+  k ^= k >> 33;
+  k *= BIG_CONSTANT(0xff51afd7ed558ccd);
+  k ^= k >> 33;
+  k *= BIG_CONSTANT(0xc4ceb9fe1a85ec53);
+  k ^= k >> 33;
+
+  return k;
+}
+
 //-----------------------------------------------------------------------------
 
 #ifdef __cplusplus
-extern "C"
+extern "C" inline
 #else
 extern
 #endif
@@ -148,4 +201,90 @@ void MurmurHash3_x86_32( const void * key, int len, uint32_t seed, void * out )
   *(uint32_t*)out = h1;
 }
 
+//-----------------------------------------------------------------------------
+
+#ifdef __cplusplus
+extern "C" inline
+#else
+extern
+#endif
+void MurmurHash3_x64_128( const void * key, const int len, const uint32_t seed, void * out )
+{
+  const uint8_t * data = (const uint8_t*)key;
+  const int nblocks = len / 16;
+  int i;
+
+  uint64_t h1 = seed;
+  uint64_t h2 = seed;
+
+  uint64_t c1 = BIG_CONSTANT(0x87c37b91114253d5);
+  uint64_t c2 = BIG_CONSTANT(0x4cf5ad432745937f);
+
+  //----------
+  // body
+
+  const uint64_t * blocks = (const uint64_t *)(data);
+
+  for(i = 0; i < nblocks; i++)
+  {
+    uint64_t k1 = getblock64(blocks,i*2+0);
+    uint64_t k2 = getblock64(blocks,i*2+1);
+
+    k1 *= c1; k1  = ROTL64(k1,31); k1 *= c2; h1 ^= k1;
+
+    h1 = ROTL64(h1,27); h1 += h2; h1 = h1*5+0x52dce729;
+
+    k2 *= c2; k2  = ROTL64(k2,33); k2 *= c1; h2 ^= k2;
+
+    h2 = ROTL64(h2,31); h2 += h1; h2 = h2*5+0x38495ab5;
+  }
+
+  //----------
+  // tail
+
+  const uint8_t * tail = (const uint8_t*)(data + nblocks*16);
+
+  uint64_t k1 = 0;
+  uint64_t k2 = 0;
+
+  switch(len & 15)
+  {
+  case 15: k2 ^= (uint64_t)(tail[14]) << 48;
+  case 14: k2 ^= (uint64_t)(tail[13]) << 40;
+  case 13: k2 ^= (uint64_t)(tail[12]) << 32;
+  case 12: k2 ^= (uint64_t)(tail[11]) << 24;
+  case 11: k2 ^= (uint64_t)(tail[10]) << 16;
+  case 10: k2 ^= (uint64_t)(tail[ 9]) << 8;
+  case  9: k2 ^= (uint64_t)(tail[ 8]) << 0;
+           k2 *= c2; k2  = ROTL64(k2,33); k2 *= c1; h2 ^= k2;
+
+  case  8: k1 ^= (uint64_t)(tail[ 7]) << 56;
+  case  7: k1 ^= (uint64_t)(tail[ 6]) << 48;
+  case  6: k1 ^= (uint64_t)(tail[ 5]) << 40;
+  case  5: k1 ^= (uint64_t)(tail[ 4]) << 32;
+  case  4: k1 ^= (uint64_t)(tail[ 3]) << 24;
+  case  3: k1 ^= (uint64_t)(tail[ 2]) << 16;
+  case  2: k1 ^= (uint64_t)(tail[ 1]) << 8;
+  case  1: k1 ^= (uint64_t)(tail[ 0]) << 0;
+           k1 *= c1; k1  = ROTL64(k1,31); k1 *= c2; h1 ^= k1;
+  };
+
+  //----------
+  // finalization
+
+  h1 ^= len; h2 ^= len;
+
+  h1 += h2;
+  h2 += h1;
+
+  h1 = fmix64(h1);
+  h2 = fmix64(h2);
+
+  h1 += h2;
+  h2 += h1;
+
+  ((uint64_t*)out)[0] = h1;
+  ((uint64_t*)out)[1] = h2;
+}
+
 #endif
@@ -0,0 +1,110 @@
+#ifndef WYHASH_H
+#define WYHASH_H
+
+//-----------------------------------------------------------------------------
+// wyhash (final version 4) was written by Wang Yi and is released into the
+// public domain. This is a portable rewrite of the 64 bit hash with the
+// default secret; it gives the same values as the reference implementation.
+
+#include <string.h>
+#include "murmur3.h"
+
+//-----------------------------------------------------------------------------
+// 64x64 -> 128 bit multiplication
+
+inline void wymum( uint64_t * A, uint64_t * B )
+{
+#if defined(__SIZEOF_INT128__)
+  __uint128_t r = *A;
+  r *= *B;
+  *A = (uint64_t)r;
+  *B = (uint64_t)(r >> 64);
+#else
+  uint64_t ha = *A >> 32, hb = *B >> 32, la = (uint32_t)*A, lb = (uint32_t)*B;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32), c = t < rl;
+  uint64_t lo = t + (rm1 << 32);
+  c += lo < t;
+  uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+  *A = lo;
+  *B = hi;
+#endif
+}
+
+inline uint64_t wymix( uint64_t A, uint64_t B )
+{
+  wymum(&A, &B);
+  return A ^ B;
+}
+
+//-----------------------------------------------------------------------------
+// Little endian reads of 8, 4 and 1-3 bytes
+
+inline uint64_t wyr8( const uint8_t * p )
+{
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return BYTESWAP64(v);
+}
+
+inline uint64_t wyr4( const uint8_t * p )
+{
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return BYTESWAP(v);
+}
+
+inline uint64_t wyr3( const uint8_t * p, size_t k )
+{
+  return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+
+//-----------------------------------------------------------------------------
+
+inline uint64_t wyhash64( const void * key, size_t len, uint64_t seed )
+{
+  static const uint64_t secret[4] = {
+    BIG_CONSTANT(0x2d358dccaa6c78a5), BIG_CONSTANT(0x8bb84b93962eacc9),
+    BIG_CONSTANT(0x4b33a62ed433d4a3), BIG_CONSTANT(0x4d5a2da51de1aa47)
+  };
+  const uint8_t * p = (const uint8_t *)key;
+  seed ^= wymix(seed ^ secret[0], secret[1]);
+  uint64_t a, b;
+  if(len <= 16) {
+    if(len >= 4) {
+      a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+      b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+    } else if(len > 0) {
+      a = wyr3(p, len);
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    if(i > 48) {
+      uint64_t see1 = seed, see2 = seed;
+      do {
+        seed = wymix(wyr8(p) ^ secret[1], wyr8(p + 8) ^ seed);
+        see1 = wymix(wyr8(p + 16) ^ secret[2], wyr8(p + 24) ^ see1);
+        see2 = wymix(wyr8(p + 32) ^ secret[3], wyr8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while(i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while(i > 16) {
+      seed = wymix(wyr8(p) ^ secret[1], wyr8(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = wyr8(p + i - 16);
+    b = wyr8(p + i - 8);
+  }
+  a ^= secret[1];
+  b ^= seed;
+  wymum(&a, &b);
+  return wymix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+#endif // WYHASH_H
@@ -0,0 +1,114 @@
+#include <igloo/igloo_alt.h>
+#include <igloo/TapTestListener.h>
+#include "hyperloglog_concurrent.hpp"
+#include "TestUtil.hpp"
+#include <string>
+#include <sstream>
+#include <thread>
+#include <vector>
+using namespace igloo;
+using namespace hll;
+
+Describe(hll_ConcurrentHyperLogLog) {
+    Describe(create_instance) {
+        It(pass_out_of_range_argument_min) {
+            AssertThrows(std::invalid_argument, ConcurrentHyperLogLog(3));
+            Assert::That(LastException<std::invalid_argument>().what(),
+                    Is().Containing("bit width must be in the range [4,30]"));
+        }
+
+        It(pass_out_of_range_argument_max) {
+            AssertThrows(std::invalid_argument, ConcurrentHyperLogLog(31));
+            Assert::That(LastException<std::invalid_argument>().what(),
+                    Is().Containing("bit width must be in the range [4,30]"));
+        }
+    };
+
+    It(matches_packed_registers) {
+        const HashType hashes[] = {HASH_MURMUR3_X86_32, HASH_MURMUR3_X64_128};
+        for (size_t h = 0; h < 2; ++h) {
+            ConcurrentHyperLogLog hll(12, hashes[h]);
+            PackedHyperLogLog packed(12, hashes[h]);
+            for (size_t i = 0; i < 50000; ++i) {
+                hll.add((const char*)&i, sizeof(i));
+                packed.add((const char*)&i, sizeof(i));
+            }
+            Assert::That(hll.estimate(), Equals(packed.estimate()));
+            Assert::That(dumpOf(hll.toPacked()) == dumpOf(packed));
+            Assert::That(hll.getRegister(7), Equals(packed.getRegister(7)));
+            Assert::That(!hll.setMax(7, hll.getRegister(7)));
+        }
+    }
+
+    It(concurrent_adds_match_sequential_adds) {
+        const size_t threads = 4;
+        const size_t perThread = 100000;
+        ConcurrentHyperLogLog hll(14);
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; ++t) {
+            workers.push_back(std::thread(addRange<ConcurrentHyperLogLog>, std::ref(hll), t * perThread, (t + 1) * perThread));
+        }
+        // estimates taken while the writers run must not disturb them
+        double last = 0.0;
+        for (size_t i = 0; i < 100; ++i) {
+            last = hll.estimate();
+        }
+        for (size_t t = 0; t < threads; ++t) {
+            workers[t].join();
+        }
+        Assert::That(last, IsLessThan(hll.estimate() + 1.0));
+
+        PackedHyperLogLog expect(14);
+        for (size_t i = 0; i < threads * perThread; ++i) {
+            expect.add((const char*)&i, sizeof(i));
+        }
+        Assert::That(dumpOf(hll.toPacked()) == dumpOf(expect));
+    }
+
+    Describe(merge) {
+        It(merge_registers) {
+            ConcurrentHyperLogLog hll(12);
+            ConcurrentHyperLogLog other(12);
+            PackedHyperLogLog packed(12);
+            PackedHyperLogLog expect(12);
+            for (size_t i = 0; i < 30000; ++i) {
+                expect.add((const char*)&i, sizeof(i));
+                if (i < 10000) {
+                    hll.add((const char*)&i, sizeof(i));
+                } else if (i < 20000) {
+                    other.add((const char*)&i, sizeof(i));
+                } else {
+                    packed.add((const char*)&i, sizeof(i));
+                }
+            }
+            hll.merge(other);
+            hll.merge(packed);
+            Assert::That(dumpOf(hll.toPacked()) == dumpOf(expect));
+        }
+
+        It(merge_hash_unmatched) {
+            ConcurrentHyperLogLog hll(12);
+            PackedHyperLogLog packed(12, HASH_MURMUR3_X64_128);
+            AssertThrows(std::invalid_argument, hll.merge(packed));
+            Assert::That(LastException<std::invalid_argument>().what(),
+                    Is().Containing("hash function doesn't match:"));
+        }
+    };
+
+    It(clear_register) {
+        ConcurrentHyperLogLog hll(10);
+        addRange(hll, 0, 1000);
+        hll.clear();
+        Assert::That(hll.estimate(), Equals(0.0));
+    }
+};
+
+int main() {
+    DefaultTestResultsOutput output;
+    TestRunner runner(output);
+
+    TapTestListener listener;
+    runner.AddListener(&listener);
+
+    return runner.Run();
+}
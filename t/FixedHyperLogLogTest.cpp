@@ -0,0 +1,147 @@
+#include <igloo/igloo_alt.h>
+#include <igloo/TapTestListener.h>
+#include "hyperloglog_fixed.hpp"
+#include "TestUtil.hpp"
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace igloo;
+using namespace hll;
+
+namespace {
+// Test utilities
+
+static_assert(FixedHyperLogLog<14>::registerSize() == 16384, "register size is a constant");
+static_assert(alphaMM(16) == 0.673 * 16 * 16, "alpha is a constant");
+
+}
+
+Describe(hll_FixedHyperLogLog) {
+    It(matches_runtime_bit_width) {
+        const HashType hashes[] = {HASH_MURMUR3_X86_32, HASH_MURMUR3_X64_128};
+        for (size_t h = 0; h < 2; ++h) {
+            std::unique_ptr<FixedHyperLogLog<14> > fixed(new FixedHyperLogLog<14>(hashes[h]));
+            HyperLogLog hll(14, hashes[h]);
+            for (size_t i = 0; i < 100000; ++i) {
+                fixed->add((const char*)&i, sizeof(i));
+                hll.add((const char*)&i, sizeof(i));
+            }
+            Assert::That(dumpOf(*fixed) == dumpOf(hll));
+            Assert::That(fixed->estimate(), Equals(hll.estimate()));
+            Assert::That(fixed->estimateExact(), Equals(fixed->estimate()));
+            Assert::That(fixed->estimate(ESTIMATOR_IMPROVED), Equals(hll.estimate(ESTIMATOR_IMPROVED)));
+            Assert::That(fixed->estimate(ESTIMATOR_ML), Equals(hll.estimate(ESTIMATOR_ML)));
+            Assert::That(fixed->histogram() == hll.histogram());
+        }
+    }
+
+    It(add_batch_matches_add) {
+        const size_t dataNum = 10000;
+        std::vector<uint64_t> keys(dataNum);
+        FixedHyperLogLog<10> hll;
+        for (size_t i = 0; i < dataNum; ++i) {
+            keys[i] = i * 2654435761ULL;
+            hll.add((const char*)&keys[i], sizeof(keys[i]));
+        }
+        FixedHyperLogLog<10> hll2;
+        hll2.addBatch((const char*)&keys[0], sizeof(keys[0]), dataNum);
+        Assert::That(dumpOf(hll2) == dumpOf(hll));
+    }
+
+    Describe(conversion) {
+        It(round_trip) {
+            HyperLogLog hll(12, HASH_MURMUR3_X86_32, true);
+            for (size_t i = 0; i < 300; ++i) {
+                hll.add((const char*)&i, sizeof(i));
+            }
+            Assert::That(hll.isSparse());
+            FixedHyperLogLog<12> fixed(hll);
+            Assert::That(fixed.estimate(), Equals(hll.estimate()));
+            for (size_t i = 300; i < 20000; ++i) {
+                hll.add((const char*)&i, sizeof(i));
+                fixed.add((const char*)&i, sizeof(i));
+            }
+            const HyperLogLog back = fixed.toHyperLogLog();
+            Assert::That(dumpOf(back) == dumpOf(hll));
+            Assert::That(back.estimate(), Equals(back.estimateExact()));
+        }
+
+        It(size_unmatched) {
+            HyperLogLog hll(10);
+            AssertThrows(std::invalid_argument, FixedHyperLogLog<12> fixed(hll));
+            Assert::That(LastException<std::invalid_argument>().what(),
+                    Is().Containing("number of registers doesn't match:"));
+        }
+
+        It(restore_runtime_dump) {
+            HyperLogLog hll(8, HASH_MURMUR3_X64_128, true);
+            for (size_t i = 0; i < 10; ++i) {
+                hll.add((const char*)&i, sizeof(i));
+            }
+            std::stringstream ss;
+            hll.dump(ss);
+            FixedHyperLogLog<8> fixed;
+            fixed.restore(ss);
+            Assert::That(fixed.hashType(), Equals(HASH_MURMUR3_X64_128));
+            Assert::That(fixed.estimate(), Equals(hll.estimate()));
+
+            std::stringstream ss2;
+            HyperLogLog(9).dump(ss2);
+            AssertThrows(std::runtime_error, fixed.restore(ss2));
+        }
+
+        It(restore_large_on_heap) {
+            // 2^24 bytes of registers: more than the stack holds
+            const bool sparse[] = {false, true};
+            for (size_t s = 0; s < 2; ++s) {
+                const HyperLogLog hll = filled(24, 0, 100000, HASH_WYHASH_64, sparse[s]);
+                std::stringstream ss;
+                hll.dump(ss);
+                std::unique_ptr<FixedHyperLogLog<24> > fixed(new FixedHyperLogLog<24>());
+                fixed->restore(ss);
+                Assert::That(fixed->hashType(), Equals(HASH_WYHASH_64));
+                Assert::That(fixed->estimate(), Equals(hll.estimate()));
+                Assert::That(dumpOf(*fixed) == denseDumpOf(hll));
+            }
+        }
+    };
+
+    Describe(merge) {
+        It(matches_runtime_merge) {
+            FixedHyperLogLog<10> a, b;
+            HyperLogLog ra(10), rb(10);
+            for (size_t i = 0; i < 5000; ++i) {
+                const size_t j = i + 3000;
+                a.add((const char*)&i, sizeof(i));
+                ra.add((const char*)&i, sizeof(i));
+                b.add((const char*)&j, sizeof(j));
+                rb.add((const char*)&j, sizeof(j));
+            }
+            a.merge(b);
+            ra.merge(rb);
+            Assert::That(dumpOf(a) == dumpOf(ra));
+            Assert::That(a.estimate(), Equals(a.estimateExact()));
+            a.clear();
+            Assert::That(a.estimate(), Equals(0.0));
+        }
+
+        It(hash_unmatched) {
+            FixedHyperLogLog<10> a;
+            FixedHyperLogLog<10> b(HASH_MURMUR3_X64_128);
+            AssertThrows(std::invalid_argument, a.merge(b));
+            Assert::That(LastException<std::invalid_argument>().what(),
+                    Is().Containing("hash function doesn't match:"));
+        }
+    };
+};
+
+int main() {
+    DefaultTestResultsOutput output;
+    TestRunner runner(output);
+
+    TapTestListener listener;
+    runner.AddListener(&listener);
+
+    return runner.Run();
+}
@@ -1,14 +1,17 @@
 #include <igloo/igloo_alt.h>
 #include <igloo/TapTestListener.h>
 #include "hyperloglog.hpp"
+#include "KeyStream.hpp"
+#include "TestUtil.hpp"
 #include <map>
 #include <string>
 #include <cstdlib>
-#include <ctime>
 #include <cmath>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <sstream>
+#include <vector>
 using namespace igloo;
 using namespace hll;
 
@@ -22,40 +25,20 @@ static const char alphanum[] = "0123456789"
 
 static const int alphanumSize = sizeof(alphanum) - 1;
 
-static void genRandomString(size_t len, std::string& str) {
-    srand(time(0));
-    for (size_t i = 0; i < len; ++i) {
-        char c = alphanum[rand() % alphanumSize];
-        str.append(&c, 1);
-    }
-}
-
-static std::map<std::string, bool> GEN_STRINGS;
+// Key number n mixed bijectively, then padded to 'len' characters:
+// unique and reproducible without remembering the keys handed out
+static uint64_t KEY_NUMBER = 0;
 static void getUniqueString(size_t len, std::string& str) {
-    do {
-        genRandomString(len, str);
-    } while (GEN_STRINGS.find(str) != GEN_STRINGS.end());
-    GEN_STRINGS.insert(std::make_pair(str, true));
+    uint64_t word = KeyStream::mix(++KEY_NUMBER);
+    str.assign((const char*)&word, sizeof(word));
+    while (str.size() < len) {
+        word = KeyStream::mix(word + str.size());
+        str.push_back(alphanum[word % alphanumSize]);
+    }
 }
 
 }
 
-class ScopedFile {
-public:
-    ScopedFile(std::string& filename) : filename_(filename) {
-    }
-
-    ~ScopedFile() {
-        remove(filename_.c_str());   
-    }
-
-    const std::string& getFileName() const {
-        return filename_;
-    }
-private:
-    std::string filename_;
-};
-
 Describe(hll_HyperLogLogHIP) {
     Describe(create_instance) {
         It(pass_minimum_arugment_in_range) {
@@ -102,7 +85,6 @@ Describe(hll_HyperLogLogHIP) {
         size_t execNum = 10;
         for (size_t n = 0; n < execNum; ++n) {
             HyperLogLogHIP hll(k);
-            std::map<std::string, bool>().swap(GEN_STRINGS);
             for (size_t i = 1; i < dataNum; ++i) {
                 std::string str((const char*)&i, sizeof(i));
                 hll.add(str.c_str(), str.size());
@@ -152,6 +134,160 @@ Describe(hll_HyperLogLogHIP) {
         Assert::That(hll.estimate(), Equals(0.0f));
     }
     
+    Describe(add_batch) {
+        It(fixed_width_keys_match_add) {
+            const uint32_t lens[] = {1, 3, 4, 7, 8, 13, 16};
+            for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); ++l) {
+                const uint32_t len = lens[l];
+                const size_t dataNum = 10000;
+                std::string keys;
+                for (size_t i = 0; i < dataNum; ++i) {
+                    std::string str((const char*)&i, sizeof(i));
+                    str.resize(len, 'x');
+                    keys.append(str);
+                }
+                HyperLogLogHIP hll(12);
+                for (size_t i = 0; i < dataNum; ++i) {
+                    hll.add(keys.data() + i * len, len);
+                }
+                HyperLogLogHIP hll2(12);
+                hll2.addBatch(keys.data(), len, dataNum);
+                std::stringstream expect, actual;
+                hll.dump(expect);
+                hll2.dump(actual);
+                Assert::That(actual.str() == expect.str());
+            }
+        }
+
+        It(string_keys_match_add) {
+            const size_t dataNum = 10000;
+            std::vector<std::string> strs(dataNum);
+            std::vector<const char*> ptrs(dataNum);
+            std::vector<uint32_t> lens(dataNum);
+            HyperLogLogHIP hll(12);
+            for (size_t i = 0; i < dataNum; ++i) {
+                std::stringstream ss;
+                ss << i << ':' << std::string(i % 30, 'z');
+                strs[i] = ss.str();
+                ptrs[i] = strs[i].c_str();
+                lens[i] = strs[i].size();
+                hll.add(ptrs[i], lens[i]);
+            }
+            HyperLogLogHIP hll2(12);
+            hll2.addBatch(&ptrs[0], &lens[0], dataNum);
+            Assert::That(hll2.estimate(), Equals(hll.estimate()));
+        }
+
+        It(every_isa_gives_identical_registers) {
+            const size_t dataNum = 100000;
+            const uint32_t len = 11;
+            std::string keys;
+            for (size_t i = 0; i < dataNum; ++i) {
+                std::string str((const char*)&i, sizeof(i));
+                str.resize(len, 'y');
+                keys.append(str);
+            }
+            const simd::Isa saved = simd::isa();
+            simd::setIsa(simd::ISA_SCALAR);
+            HyperLogLogHIP hll(4);
+            hll.addBatch(keys.data(), len, dataNum);
+            std::stringstream expect;
+            hll.dump(expect);
+            const simd::Isa levels[] = {simd::ISA_AVX2, simd::ISA_AVX512};
+            for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+                simd::setIsa(levels[l]);
+                HyperLogLogHIP hll2(4);
+                hll2.addBatch(keys.data(), len, dataNum);
+                std::stringstream actual;
+                hll2.dump(actual);
+                Assert::That(actual.str() == expect.str());
+            }
+            simd::setIsa(saved);
+        }
+    };
+
+    Describe(hash_64bit) {
+        It(estimate_cardinality) {
+            uint32_t k = 14;
+            double expectRatio = 3 * 1.04 / sqrt((double)(1UL << k));
+            size_t dataNum = size_t(1) << 20;
+            HyperLogLogHIP hll(k, HASH_MURMUR3_X64_128);
+            for (size_t i = 0; i < dataNum; ++i) {
+                hll.add((const char*)&i, sizeof(i));
+            }
+            double errorRatio = std::abs(hll.estimate() - (double)dataNum) / dataNum;
+            Assert::That(errorRatio, IsLessThan(expectRatio));
+        }
+
+        It(add_batch_matches_add) {
+            const size_t dataNum = 10000;
+            std::vector<uint64_t> keys(dataNum);
+            HyperLogLogHIP hll(12, HASH_MURMUR3_X64_128);
+            for (size_t i = 0; i < dataNum; ++i) {
+                keys[i] = i * 2654435761ULL;
+                hll.add((const char*)&keys[i], sizeof(keys[i]));
+            }
+            HyperLogLogHIP hll2(12, HASH_MURMUR3_X64_128);
+            hll2.addBatch((const char*)&keys[0], sizeof(keys[0]), dataNum);
+            std::stringstream expect, actual;
+            hll.dump(expect);
+            hll2.dump(actual);
+            Assert::That(actual.str() == expect.str());
+        }
+
+        It(dump_and_restore_keep_hash_type) {
+            HyperLogLogHIP hll(10, HASH_MURMUR3_X64_128);
+            for (size_t i = 0; i < 1000; ++i) {
+                hll.add((const char*)&i, sizeof(i));
+            }
+            std::stringstream ss;
+            hll.dump(ss);
+            HyperLogLogHIP hll2;
+            hll2.restore(ss);
+            Assert::That(hll2.hashType(), Equals(HASH_MURMUR3_X64_128));
+            Assert::That(hll2.estimate(), Equals(hll.estimate()));
+        }
+
+        It(add_hashes_match_add) {
+            const size_t dataNum = 10000;
+            std::vector<uint64_t> values(dataNum);
+            HyperLogLogHIP hll(12, HASH_WYHASH_64);
+            for (size_t i = 0; i < dataNum; ++i) {
+                hll.add((const char*)&i, sizeof(i));
+                values[i] = hashElement(HASH_WYHASH_64, (const char*)&i, sizeof(i));
+            }
+            HyperLogLogHIP hll2(12, HASH_WYHASH_64);
+            hll2.addHashes(&values[0], dataNum);
+            Assert::That(hll2.estimate(), Equals(hll.estimate()));
+        }
+
+        It(merge_hash_unmatched) {
+            HyperLogLogHIP hll(10);
+            HyperLogLogHIP hll2(10, HASH_MURMUR3_X64_128);
+            AssertThrows(std::invalid_argument, hll.merge(hll2));
+            Assert::That(LastException<std::invalid_argument>().what(),
+                    Is().Containing("hash function doesn't match:"));
+        }
+    };
+
+    Describe(estimate_cache) {
+        It(register_sum_follows_hip_updates) {
+            HyperLogLogHIP hip(10);
+            HyperLogLogHIP other(10);
+            for (size_t i = 0; i < 20000; ++i) {
+                hip.add((const char*)&i, sizeof(i));
+                const size_t j = i + 10000;
+                other.add((const char*)&j, sizeof(j));
+            }
+            const HyperLogLog& base = hip;
+            Assert::That(base.estimate(), Equals(base.estimateExact()));
+            hip.merge(other);
+            Assert::That(base.estimate(), Equals(base.estimateExact()));
+            hip.clear();
+            Assert::That(base.estimate(), Equals(0.0));
+        }
+    };
+
     Describe(merge) {
         It(merge_registers) {
             uint32_t k = 16;
@@ -163,7 +299,6 @@ Describe(hll_HyperLogLogHIP) {
             double error = 0.0;
             for (size_t i = 0; i < execNum; ++i) {
                 HyperLogLogHIP hll(k);
-                std::map<std::string, bool>().swap(GEN_STRINGS);
                 for (size_t i = 1; i < dataNum; ++i) {
                     std::string str;
                     getUniqueString((i % 100) + 10, str);
@@ -186,12 +321,70 @@ Describe(hll_HyperLogLogHIP) {
             Assert::That(errorRatio, IsLessThan(expectRatio));
         }
 
-        It(merge_size_unmatched_registers) {
+        It(merge_mixed_bit_widths_folds_down) {
+            HyperLogLogHIP wide(16);
+            HyperLogLogHIP narrow(10);
+            HyperLogLog expect(10);
+            const size_t dataNum = 100000;
+            for (size_t i = 0; i < dataNum; ++i) {
+                const size_t j = i + dataNum / 2;
+                wide.add((const char*)&i, sizeof(i));
+                narrow.add((const char*)&j, sizeof(j));
+                expect.add((const char*)&i, sizeof(i));
+                expect.add((const char*)&j, sizeof(j));
+            }
+            HyperLogLogHIP wideFirst(wide);
+            wideFirst.merge(narrow);
+            HyperLogLogHIP narrowFirst(narrow);
+            narrowFirst.merge(wide);
+            Assert::That(wideFirst.registerSize(), Equals(1U << 10));
+            Assert::That(narrowFirst.registerSize(), Equals(1U << 10));
+            Assert::That(wideFirst.histogram()[1], Equals(expect.histogram()[1]));
+            Assert::That(narrowFirst.estimateExact(), Equals(expect.estimate()));
+            Assert::That(std::abs(wideFirst.estimate() - 1.5 * dataNum) / (1.5 * dataNum), IsLessThan(0.1));
+            Assert::That(std::abs(narrowFirst.estimate() - 1.5 * dataNum) / (1.5 * dataNum), IsLessThan(0.1));
+        }
+
+        It(merge_many_updates_the_estimate) {
+            HyperLogLogHIP a(12);
+            HyperLogLogHIP b(12);
+            HyperLogLogHIP c(10);
+            addRange(a, 0, 5000);
+            addRange(b, 2500, 7500);
+            addRange(c, 10000, 12000);
+            HyperLogLogHIP expect(a);
+            expect.merge(b);
+            expect.merge(c);
+            HyperLogLogHIP actual(a);
+            const HyperLogLogHIP* others[] = {&b, &c};
+            actual.mergeMany(others, 2);
+            Assert::That(actual.estimate(), Equals(expect.estimate()));
+            Assert::That(std::abs(actual.estimate() - 9500.0) / 9500.0, IsLessThan(0.1));
+
+            HyperLogLogHIP other(12, HASH_WYHASH_64);
+            const HyperLogLogHIP* mixed[] = {&a, &other};
+            HyperLogLogHIP untouched;
+            AssertThrows(std::invalid_argument, untouched.mergeMany(mixed, 2));
+            Assert::That(untouched.estimate(), Equals(0.0));
+        }
+
+        It(fold_keeps_the_estimate) {
             HyperLogLogHIP hll(16);
-            HyperLogLogHIP hll2(10);
-            AssertThrows(std::invalid_argument, hll.merge(hll2));
-            Assert::That(LastException<std::invalid_argument>().what(),
-                    Is().Containing("number of registers doesn't match:"));
+            HyperLogLog expect(10);
+            for (size_t i = 0; i < 50000; ++i) {
+                hll.add((const char*)&i, sizeof(i));
+                expect.add((const char*)&i, sizeof(i));
+            }
+            const double before = hll.estimate();
+            hll.fold(10);
+            Assert::That(hll.registerSize(), Equals(1U << 10));
+            Assert::That(hll.estimate(), Equals(before));
+            Assert::That(hll.estimateExact(), Equals(expect.estimate()));
+            // later adds keep counting at the new width
+            for (size_t i = 50000; i < 100000; ++i) {
+                hll.add((const char*)&i, sizeof(i));
+            }
+            Assert::That(std::abs(hll.estimate() - 100000.0) / 100000.0, IsLessThan(0.1));
         }
     };
 };
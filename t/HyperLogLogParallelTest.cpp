@@ -0,0 +1,139 @@
+#include <igloo/igloo_alt.h>
+#include <igloo/TapTestListener.h>
+#include "hyperloglog_parallel.hpp"
+#include "TestUtil.hpp"
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace igloo;
+using namespace hll;
+
+namespace {
+// Test utilities
+
+// runs the tasks last to first, to check that the result doesn't depend on the order
+static void reverseExecutor(size_t n, const std::function<void(size_t)>& task) {
+    for (size_t i = n; i > 0; --i) {
+        task(i - 1);
+    }
+}
+
+}
+
+Describe(hll_HyperLogLogParallel) {
+    It(matches_serial_functions) {
+        ThreadPool pool(4);
+        const Executor executors[] = {Executor(serialExecutor), Executor(reverseExecutor), Executor(std::ref(pool))};
+        HyperLogLog a(20, HASH_WYHASH_64);
+        HyperLogLog b(20, HASH_WYHASH_64);
+        addRange(a, 0, 2000000);
+        addRange(b, 1000000, 4000000);
+        HyperLogLog expect(a);
+        expect.merge(b);
+        for (size_t e = 0; e < 3; ++e) {
+            for (size_t track = 0; track < 2; ++track) {
+                HyperLogLog actual(a);
+                actual.trackHistogram(track != 0);
+                HyperLogLogParallel::merge(actual, b, executors[e]);
+                Assert::That(dumpOf(actual) == dumpOf(expect));
+                Assert::That(actual.estimate(), Equals(expect.estimate()));
+                Assert::That(actual.estimate(), Equals(actual.estimateExact()));
+                Assert::That(HyperLogLogParallel::estimateExact(actual, executors[e]), Equals(expect.estimateExact()));
+                Assert::That(HyperLogLogParallel::estimate(actual, ESTIMATOR_ML, executors[e]),
+                        Equals(expect.estimate(ESTIMATOR_ML)));
+                const std::vector<uint32_t> hist = HyperLogLogParallel::histogram(actual, executors[e]);
+                const std::vector<uint32_t> expectHist = expect.histogram();
+                Assert::That(hist.size(), Equals(expectHist.size()));
+                for (size_t r = 0; r < hist.size(); ++r) {
+                    Assert::That(hist[r], Equals(expectHist[r]));
+                }
+                if (track) {
+                    const std::vector<uint32_t> tracked = actual.histogram();
+                    actual.trackHistogram(false);
+                    for (size_t r = 0; r < tracked.size(); ++r) {
+                        Assert::That(tracked[r], Equals(expectHist[r]));
+                    }
+                }
+                HyperLogLogParallel::clear(actual, executors[e]);
+                Assert::That(actual.estimate(), Equals(0.0));
+                Assert::That(dumpOf(actual) == dumpOf(HyperLogLog(20, HASH_WYHASH_64)));
+            }
+        }
+    }
+
+    It(falls_back_to_serial_merge) {
+        ThreadPool pool(2);
+        HyperLogLog sparse(16, HASH_MURMUR3_X86_32, true);
+        HyperLogLog narrow(12);
+        HyperLogLog dense(16);
+        addRange(sparse, 0, 100);
+        addRange(narrow, 0, 10000);
+        addRange(dense, 50, 50000);
+        HyperLogLog expect(dense);
+        expect.merge(sparse);
+        expect.merge(narrow);
+        HyperLogLog actual(dense);
+        HyperLogLogParallel::merge(actual, sparse, std::ref(pool));
+        HyperLogLogParallel::merge(actual, narrow, std::ref(pool));
+        Assert::That(dumpOf(actual) == dumpOf(expect));
+
+        HyperLogLog other(16, HASH_WYHASH_64);
+        AssertThrows(std::invalid_argument, HyperLogLogParallel::merge(actual, other, std::ref(pool)));
+        Assert::That(LastException<std::invalid_argument>().what(), Is().Containing("hash function doesn't match:"));
+    }
+
+    It(merges_hip_serially) {
+        ThreadPool pool(3);
+        HyperLogLogHIP a(18);
+        HyperLogLogHIP b(18);
+        addRange(a, 0, 100000);
+        addRange(b, 50000, 150000);
+        HyperLogLogHIP expect(a);
+        expect.merge(b);
+        HyperLogLogParallel::merge(a, b, std::ref(pool));
+        Assert::That(a.estimate(), Equals(expect.estimate()));
+        Assert::That(dumpOf(a) == dumpOf(expect));
+    }
+
+    It(clears_hip_estimate) {
+        ThreadPool pool(3);
+        HyperLogLogHIP hll(18);
+        for (uint64_t v = 0; v < 100000; ++v) {
+            hll.add((const char*)&v, sizeof(v));
+        }
+        HyperLogLogParallel::clear(hll, std::ref(pool));
+        Assert::That(hll.estimate(), Equals(0.0));
+        for (uint64_t v = 0; v < 1000; ++v) {
+            hll.add((const char*)&v, sizeof(v));
+        }
+        HyperLogLogHIP expect(18);
+        for (uint64_t v = 0; v < 1000; ++v) {
+            expect.add((const char*)&v, sizeof(v));
+        }
+        Assert::That(hll.estimate(), Equals(expect.estimate()));
+    }
+
+    It(pool_runs_every_task_once) {
+        ThreadPool pool(4);
+        Assert::That(pool.size(), Equals((size_t) 4));
+        for (size_t round = 0; round < 100; ++round) {
+            std::vector<int> runs(round, 0);
+            pool(round, [&](size_t i) {
+                runs[i]++;
+            });
+            for (size_t i = 0; i < round; ++i) {
+                Assert::That(runs[i], Equals(1));
+            }
+        }
+    }
+};
+
+int main() {
+    DefaultTestResultsOutput output;
+    TestRunner runner(output);
+
+    TapTestListener listener;
+    runner.AddListener(&listener);
+
+    return runner.Run();
+}
@@ -0,0 +1,130 @@
+#include <igloo/igloo_alt.h>
+#include <igloo/TapTestListener.h>
+#include "hyperloglog_setops.hpp"
+#include "TestUtil.hpp"
+#include <cmath>
+#include <vector>
+using namespace igloo;
+using namespace hll;
+
+namespace {
+// Test utilities
+
+static double merged(const HyperLogLog* const* counters, size_t n, EstimatorType estimator) {
+    HyperLogLog hll(*counters[0]);
+    for (size_t i = 1; i < n; ++i) {
+        hll.merge(*counters[i]);
+    }
+    return hll.estimate(estimator);
+}
+
+}
+
+Describe(hll_HyperLogLogSetOps) {
+    Describe(union_estimate) {
+        It(matches_merge) {
+            // dense and sparse, sizes that are and aren't a multiple of the chunk
+            const uint8_t bits[] = {6, 12, 14};
+            const EstimatorType estimators[] = {ESTIMATOR_CLASSIC, ESTIMATOR_IMPROVED, ESTIMATOR_ML};
+            for (size_t k = 0; k < 3; ++k) {
+                const HyperLogLog a = filled(bits[k], 0, 300, HASH_WYHASH_64, true);
+                const HyperLogLog b = filled(bits[k], 200, 50000, HASH_WYHASH_64);
+                const HyperLogLog c = filled(bits[k], 40000, 41000, HASH_WYHASH_64, true);
+                const HyperLogLog* counters[] = {&a, &b, &c};
+                const HyperLogLog* sparseFirst[] = {&c, &a};
+                for (size_t e = 0; e < 3; ++e) {
+                    Assert::That(HyperLogLogSetOps::unionEstimate(a, b, estimators[e]), Equals(merged(counters, 2, estimators[e])));
+                    Assert::That(HyperLogLogSetOps::unionEstimate(c, a, estimators[e]), Equals(merged(sparseFirst, 2, estimators[e])));
+                    Assert::That(HyperLogLogSetOps::unionEstimate(counters, 3, estimators[e]), Equals(merged(counters, 3, estimators[e])));
+                }
+            }
+        }
+
+        It(unmatched_counters) {
+            const HyperLogLog a(12);
+            const HyperLogLog b(13);
+            const HyperLogLog c(12, HASH_MURMUR3_X64_128);
+            AssertThrows(std::invalid_argument, HyperLogLogSetOps::unionEstimate(a, b));
+            AssertThrows(std::invalid_argument, HyperLogLogSetOps::unionEstimate(a, c));
+            const HyperLogLog* none[] = {&a};
+            AssertThrows(std::invalid_argument, HyperLogLogSetOps::unionEstimate(none, 0));
+        }
+    };
+
+    Describe(intersection) {
+        It(inclusion_exclusion) {
+            const HyperLogLog a = filled(14, 0, 60000, HASH_WYHASH_64);
+            const HyperLogLog b = filled(14, 30000, 90000, HASH_WYHASH_64);
+            const double inter = HyperLogLogSetOps::intersectionEstimate(a, b, ESTIMATOR_ML);
+            Assert::That(std::abs(inter - 30000) / 30000, IsLessThan(0.1));
+            const double j = HyperLogLogSetOps::jaccard(a, b, ESTIMATOR_ML);
+            Assert::That(std::abs(j - 1.0 / 3), IsLessThan(0.03));
+
+            const HyperLogLog empty(14, HASH_WYHASH_64);
+            Assert::That(HyperLogLogSetOps::jaccard(empty, empty), Equals(0.0));
+            Assert::That(HyperLogLogSetOps::intersectionEstimate(a, empty), Equals(0.0));
+        }
+
+        It(joint_estimate) {
+            const HyperLogLog a = filled(12, 0, 60000, HASH_WYHASH_64);
+            const HyperLogLog b = filled(12, 50000, 150000, HASH_WYHASH_64);
+            const SetEstimate e = HyperLogLogSetOps::jointEstimate(a, b);
+            Assert::That(std::abs(e.both - 10000) / 10000, IsLessThan(0.2));
+            Assert::That(std::abs(e.onlyA - 50000) / 50000, IsLessThan(0.1));
+            Assert::That(std::abs(e.onlyB - 90000) / 90000, IsLessThan(0.1));
+            Assert::That(std::abs(e.unionSize() - 150000) / 150000, IsLessThan(0.05));
+
+            const SetEstimate same = HyperLogLogSetOps::jointEstimate(a, a);
+            Assert::That(std::abs(same.both - 60000) / 60000, IsLessThan(0.05));
+            Assert::That(same.onlyA + same.onlyB, IsLessThan(600.0));
+            Assert::That(same.jaccard(), IsGreaterThan(0.99));
+
+            const HyperLogLog c = filled(12, 200000, 260000, HASH_WYHASH_64);
+            const SetEstimate disjoint = HyperLogLogSetOps::jointEstimate(a, c);
+            Assert::That(disjoint.both, IsLessThan(600.0));
+
+            const HyperLogLog empty(12, HASH_WYHASH_64);
+            Assert::That(HyperLogLogSetOps::jointEstimate(empty, empty).unionSize(), Equals(0.0));
+        }
+    };
+
+    Describe(pairwise) {
+        It(matches_pairwise_calls) {
+            // 11 counters: a full tile and a partial one, dense and sparse
+            std::vector<HyperLogLog> parts;
+            for (size_t p = 0; p < 11; ++p) {
+                parts.push_back(filled(12, p * 2000, p * 2000 + (p % 3 == 0 ? 200 : 5000), HASH_WYHASH_64, p % 3 == 0));
+            }
+            std::vector<const HyperLogLog*> ptrs;
+            for (size_t p = 0; p < parts.size(); ++p) {
+                ptrs.push_back(&parts[p]);
+            }
+            const size_t n = parts.size();
+            std::vector<double> u(n * n), inter(n * n), jac(n * n);
+            HyperLogLogSetOps::pairwise(&ptrs[0], n, SET_UNION, &u[0]);
+            HyperLogLogSetOps::pairwise(&ptrs[0], n, SET_INTERSECTION, &inter[0]);
+            HyperLogLogSetOps::pairwise(&ptrs[0], n, SET_JACCARD, &jac[0], ESTIMATOR_ML);
+            for (size_t i = 0; i < n; ++i) {
+                Assert::That(u[i * n + i], Equals(parts[i].estimate()));
+                Assert::That(jac[i * n + i], Equals(1.0));
+                for (size_t j = 0; j < n; ++j) {
+                    if (i != j) {
+                        Assert::That(u[i * n + j], Equals(HyperLogLogSetOps::unionEstimate(parts[i], parts[j])));
+                        Assert::That(inter[i * n + j], Equals(HyperLogLogSetOps::intersectionEstimate(parts[i], parts[j])));
+                        Assert::That(jac[i * n + j], Equals(HyperLogLogSetOps::jaccard(parts[i], parts[j], ESTIMATOR_ML)));
+                    }
+                }
+            }
+        }
+    };
+};
+
+int main() {
+    DefaultTestResultsOutput output;
+    TestRunner runner(output);
+
+    TapTestListener listener;
+    runner.AddListener(&listener);
+
+    return runner.Run();
+}
@@ -0,0 +1,118 @@
+#define HLL_STATS 1
+#include <igloo/igloo_alt.h>
+#include <igloo/TapTestListener.h>
+#include "hyperloglog.hpp"
+#include "TestUtil.hpp"
+#include <thread>
+#include <vector>
+using namespace igloo;
+using namespace hll;
+
+namespace {
+// Test utilities
+
+static uint64_t total(const uint64_t* hist) {
+    uint64_t sum = 0;
+    for (size_t k = 0; k < HLL_STATS_LATENCY_BUCKETS; ++k) {
+        sum += hist[k];
+    }
+    return sum;
+}
+
+}
+
+Describe(hll_stats) {
+    It(counts_adds_and_raised_registers) {
+        Assert::That(stats::enabled());
+        const stats::Snapshot before = stats::threadSnapshot();
+        HyperLogLog hll(10);
+        addRange(hll, 0, 1000);
+        stats::Snapshot s = stats::threadSnapshot() - before;
+        Assert::That(s.adds, Equals(1000U));
+        Assert::That(s.addRaises, IsGreaterThan(0U));
+        Assert::That(s.addRaises, IsLessThan(1000U));
+
+        // the same elements again raise nothing; 500 copies of one hash at most one register
+        addRange(hll, 0, 1000);
+        std::vector<uint64_t> hashes(500, 0x123456789ABCDEFULL);
+        hll.addHashes(&hashes[0], hashes.size());
+        const stats::Snapshot again = stats::threadSnapshot() - before;
+        Assert::That(again.adds, Equals(2500U));
+        Assert::That(again.addRaises - s.addRaises, IsLessThan(2U));
+        Assert::That(again.raiseRatio(), IsLessThan(s.raiseRatio()));
+    }
+
+    It(counts_merges_apart_from_adds) {
+        HyperLogLog a(10);
+        HyperLogLog b(10);
+        addRange(a, 0, 5000);
+        addRange(b, 2500, 7500);
+        HyperLogLogHIP c(10);
+        HyperLogLogHIP d(10);
+        for (uint64_t v = 0; v < 5000; ++v) {
+            c.add((const char*)&v, sizeof(v));
+            const uint64_t w = v + 10000;
+            d.add((const char*)&w, sizeof(w));
+        }
+        const stats::Snapshot before = stats::threadSnapshot();
+        a.merge(b);
+        c.merge(d);
+        const stats::Snapshot s = stats::threadSnapshot() - before;
+        Assert::That(s.merges, Equals(2U));
+        Assert::That(s.mergeRaises, IsGreaterThan(0U));
+        Assert::That(s.adds, Equals(0U));
+        Assert::That(s.addRaises, Equals(0U));
+        Assert::That(total(s.mergeLatency), Equals(2U));
+
+        // merging again raises nothing
+        const HyperLogLog* others[] = {&b, &b};
+        a.mergeMany(others, 2);
+        c.merge(d);
+        const stats::Snapshot t = stats::threadSnapshot() - before;
+        Assert::That(t.merges, Equals(4U));
+        Assert::That(t.mergeRaises, Equals(s.mergeRaises));
+    }
+
+    It(counts_estimates_and_dense_conversions) {
+        const stats::Snapshot before = stats::threadSnapshot();
+        HyperLogLog hll(12, HASH_MURMUR3_X86_32, true);
+        addRange(hll, 0, 10000);
+        hll.estimate();
+        hll.estimate(ESTIMATOR_CLASSIC);
+        hll.estimate(ESTIMATOR_ML);
+        const stats::Snapshot s = stats::threadSnapshot() - before;
+        Assert::That(s.denseConversions, Equals(1U));
+        Assert::That(s.estimates, Equals(3U));
+        Assert::That(total(s.estimateLatency), Equals(3U));
+        Assert::That(stats::Snapshot::latencyQuantile(s.estimateLatency, 1.0), IsGreaterThan(0U));
+        Assert::That(stats::Snapshot::latencyQuantile(s.mergeLatency, 0.5), Equals(0U));
+    }
+
+    It(snapshot_sums_all_threads) {
+        const stats::Snapshot before = stats::snapshot();
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < 4; ++t) {
+            threads.push_back(std::thread([t]() {
+                HyperLogLog hll(8);
+                addRange(hll, t * 1000, t * 1000 + 1000);
+            }));
+        }
+        for (size_t t = 0; t < threads.size(); ++t) {
+            threads[t].join();
+        }
+        HyperLogLog hll(8);
+        addRange(hll, 0, 10);
+        const stats::Snapshot s = stats::snapshot() - before;
+        Assert::That(s.adds, Equals(4010U));
+    }
+};
+
+int main() {
+    DefaultTestResultsOutput output;
+    TestRunner runner(output);
+
+    TapTestListener listener;
+    runner.AddListener(&listener);
+
+    return runner.Run();
+}
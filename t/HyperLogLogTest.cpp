@@ -1,13 +1,17 @@
 #include <igloo/igloo_alt.h>
 #include <igloo/TapTestListener.h>
 #include "hyperloglog.hpp"
+#include "KeyStream.hpp"
+#include "TestUtil.hpp"
 #include <map>
 #include <string>
 #include <cstdlib>
-#include <ctime>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <sstream>
+#include <vector>
 using namespace igloo;
 using namespace hll;
 
@@ -21,40 +25,20 @@ static const char alphanum[] = "0123456789"
 
 static const int alphanumSize = sizeof(alphanum) - 1;
 
-static void genRandomString(size_t len, std::string& str) {
-    srand(time(0));
-    for (size_t i = 0; i < len; ++i) {
-        char c = alphanum[rand() % alphanumSize];
-        str.append(&c, 1);
-    }
-}
-
-static std::map<std::string, bool> GEN_STRINGS;
+// Key number n mixed bijectively, then padded to 'len' characters:
+// unique and reproducible without remembering the keys handed out
+static uint64_t KEY_NUMBER = 0;
 static void getUniqueString(size_t len, std::string& str) {
-    do {
-        genRandomString(len, str);
-    } while (GEN_STRINGS.find(str) != GEN_STRINGS.end());
-    GEN_STRINGS.insert(std::make_pair(str, true));
+    uint64_t word = KeyStream::mix(++KEY_NUMBER);
+    str.assign((const char*)&word, sizeof(word));
+    while (str.size() < len) {
+        word = KeyStream::mix(word + str.size());
+        str.push_back(alphanum[word % alphanumSize]);
+    }
 }
 
 }
 
-class ScopedFile {
-public:
-    ScopedFile(std::string& filename) : filename_(filename) {
-    }
-
-    ~ScopedFile() {
-        remove(filename_.c_str());   
-    }
-
-    const std::string& getFileName() const {
-        return filename_;
-    }
-private:
-    std::string filename_;
-};
-
 Describe(hll_HyperLogLog) {
     Describe(create_instance) {
         It(pass_minimum_arugment_in_range) {
@@ -153,6 +137,535 @@ Describe(hll_HyperLogLog) {
         Assert::That(hll.estimate(), Equals(0.0f));
     }
     
+    Describe(add_batch) {
+        It(fixed_width_keys_match_add) {
+            const uint32_t lens[] = {1, 3, 4, 7, 8, 13, 16};
+            for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); ++l) {
+                const uint32_t len = lens[l];
+                const size_t dataNum = 10000;
+                std::string keys;
+                for (size_t i = 0; i < dataNum; ++i) {
+                    std::string str((const char*)&i, sizeof(i));
+                    str.resize(len, 'x');
+                    keys.append(str);
+                }
+                HyperLogLog hll(12);
+                for (size_t i = 0; i < dataNum; ++i) {
+                    hll.add(keys.data() + i * len, len);
+                }
+                HyperLogLog hll2(12);
+                hll2.addBatch(keys.data(), len, dataNum);
+                std::stringstream expect, actual;
+                hll.dump(expect);
+                hll2.dump(actual);
+                Assert::That(actual.str() == expect.str());
+            }
+        }
+
+        It(string_keys_match_add) {
+            const size_t dataNum = 10000;
+            std::vector<std::string> strs(dataNum);
+            std::vector<const char*> ptrs(dataNum);
+            std::vector<uint32_t> lens(dataNum);
+            HyperLogLog hll(12);
+            for (size_t i = 0; i < dataNum; ++i) {
+                std::stringstream ss;
+                ss << i << ':' << std::string(i % 30, 'z');
+                strs[i] = ss.str();
+                ptrs[i] = strs[i].c_str();
+                lens[i] = strs[i].size();
+                hll.add(ptrs[i], lens[i]);
+            }
+            HyperLogLog hll2(12);
+            hll2.addBatch(&ptrs[0], &lens[0], dataNum);
+            Assert::That(hll2.estimate(), Equals(hll.estimate()));
+        }
+
+        It(every_isa_gives_identical_registers) {
+            const size_t dataNum = 100000;
+            const uint32_t len = 11;
+            std::string keys;
+            for (size_t i = 0; i < dataNum; ++i) {
+                std::string str((const char*)&i, sizeof(i));
+                str.resize(len, 'y');
+                keys.append(str);
+            }
+            const simd::Isa saved = simd::isa();
+            simd::setIsa(simd::ISA_SCALAR);
+            HyperLogLog hll(4);
+            hll.addBatch(keys.data(), len, dataNum);
+            std::stringstream expect;
+            hll.dump(expect);
+            const simd::Isa levels[] = {simd::ISA_AVX2, simd::ISA_AVX512};
+            for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+                simd::setIsa(levels[l]);
+                HyperLogLog hll2(4);
+                hll2.addBatch(keys.data(), len, dataNum);
+                std::stringstream actual;
+                hll2.dump(actual);
+                Assert::That(actual.str() == expect.str());
+            }
+            simd::setIsa(saved);
+        }
+    };
+
+    Describe(hash_64bit) {
+        It(estimate_cardinality) {
+            uint32_t k = 14;
+            double expectRatio = 3 * 1.04 / sqrt((double)(1UL << k));
+            size_t dataNum = size_t(1) << 20;
+            HyperLogLog hll(k, HASH_MURMUR3_X64_128);
+            for (size_t i = 0; i < dataNum; ++i) {
+                hll.add((const char*)&i, sizeof(i));
+            }
+            double errorRatio = std::abs(hll.estimate() - (double)dataNum) / dataNum;
+            Assert::That(errorRatio, IsLessThan(expectRatio));
+        }
+
+        It(add_batch_matches_add) {
+            const size_t dataNum = 10000;
+            std::vector<uint64_t> keys(dataNum);
+            HyperLogLog hll(12, HASH_MURMUR3_X64_128);
+            for (size_t i = 0; i < dataNum; ++i) {
+                keys[i] = i * 2654435761ULL;
+                hll.add((const char*)&keys[i], sizeof(keys[i]));
+            }
+            HyperLogLog hll2(12, HASH_MURMUR3_X64_128);
+            hll2.addBatch((const char*)&keys[0], sizeof(keys[0]), dataNum);
+            std::stringstream expect, actual;
+            hll.dump(expect);
+            hll2.dump(actual);
+            Assert::That(actual.str() == expect.str());
+        }
+
+        It(dump_and_restore_keep_hash_type) {
+            HyperLogLog hll(10, HASH_MURMUR3_X64_128);
+            for (size_t i = 0; i < 1000; ++i) {
+                hll.add((const char*)&i, sizeof(i));
+            }
+            std::stringstream ss;
+            hll.dump(ss);
+            HyperLogLog hll2;
+            hll2.restore(ss);
+            Assert::That(hll2.hashType(), Equals(HASH_MURMUR3_X64_128));
+            Assert::That(hll2.estimate(), Equals(hll.estimate()));
+        }
+
+        It(merge_hash_unmatched) {
+            HyperLogLog hll(10);
+            HyperLogLog hll2(10, HASH_MURMUR3_X64_128);
+            AssertThrows(std::invalid_argument, hll.merge(hll2));
+            Assert::That(LastException<std::invalid_argument>().what(),
+                    Is().Containing("hash function doesn't match:"));
+        }
+
+        It(restore_dump_without_hash_type) {
+            std::string dump(1 + (1 << 10), '\0');
+            dump[0] = 10;
+            dump[1] = 3;
+            std::stringstream ss(dump);
+            HyperLogLog hll(12, HASH_MURMUR3_X64_128);
+            hll.restore(ss);
+            Assert::That(hll.hashType(), Equals(HASH_MURMUR3_X86_32));
+            Assert::That(hll.registerSize(), Equals(1UL << 10));
+        }
+    };
+
+    Describe(hash_policy) {
+        It(wyhash_reference_values) {
+            const char* messages[] = {"", "a", "abc", "message digest", "abcdefghijklmnopqrstuvwxyz",
+                    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+                    "12345678901234567890123456789012345678901234567890123456789012345678901234567890"};
+            const uint64_t expect[] = {0x93228a4de0eec5a2ULL, 0xc5bac3db178713c4ULL, 0xa97f2f7b1d9b3314ULL,
+                    0x786d1f1df3801df4ULL, 0xdca5a8138ad37c87ULL, 0xb9e734f117cfaf70ULL, 0x6cc5eab49a92d617ULL};
+            for (size_t i = 0; i < 7; ++i) {
+                Assert::That(wyhash64(messages[i], strlen(messages[i]), i), Equals(expect[i]));
+            }
+        }
+
+        It(add_hash_matches_add) {
+            const HashType hashes[] = {HASH_MURMUR3_X86_32, HASH_MURMUR3_X64_128, HASH_WYHASH_64, HASH_PREHASHED_64};
+            for (size_t h = 0; h < 4; ++h) {
+                const size_t dataNum = 20000;
+                std::vector<uint64_t> values(dataNum);
+                HyperLogLog hll(12, hashes[h]);
+                HyperLogLog hll2(12, hashes[h]);
+                HyperLogLog hll3(12, hashes[h]);
+                for (size_t i = 0; i < dataNum; ++i) {
+                    const uint64_t key = i * 0x9E3779B97F4A7C15ULL;
+                    hll.add((const char*)&key, sizeof(key));
+                    values[i] = hashElement(hashes[h], (const char*)&key, sizeof(key));
+                    hll2.addHash(values[i]);
+                }
+                hll3.addHashes(&values[0], dataNum);
+                std::stringstream expect, actual, actual2;
+                hll.dump(expect);
+                hll2.dump(actual);
+                hll3.dump(actual2);
+                Assert::That(actual.str() == expect.str());
+                Assert::That(actual2.str() == expect.str());
+            }
+        }
+
+        It(estimate_cardinality) {
+            uint32_t k = 14;
+            double expectRatio = 3 * 1.04 / sqrt((double)(1UL << k));
+            size_t dataNum = size_t(1) << 20;
+            HyperLogLog wy(k, HASH_WYHASH_64);
+            HyperLogLog pre(k, HASH_PREHASHED_64);
+            for (size_t i = 0; i < dataNum; ++i) {
+                wy.add((const char*)&i, sizeof(i));
+                pre.addHash(wyhash64(&i, sizeof(i), 1));
+            }
+            Assert::That(std::abs(wy.estimate() - (double)dataNum) / dataNum, IsLessThan(expectRatio));
+            Assert::That(std::abs(pre.estimate() - (double)dataNum) / dataNum, IsLessThan(expectRatio));
+        }
+
+        It(dump_and_restore_keep_hash_type) {
+            const HashType hashes[] = {HASH_WYHASH_64, HASH_PREHASHED_64};
+            for (size_t h = 0; h < 2; ++h) {
+                HyperLogLog hll(10, hashes[h]);
+                for (size_t i = 0; i < 1000; ++i) {
+                    hll.addHash(wyhash64(&i, sizeof(i), 0));
+                }
+                std::stringstream ss;
+                hll.dump(ss);
+                HyperLogLog hll2;
+                hll2.restore(ss);
+                Assert::That(hll2.hashType(), Equals(hashes[h]));
+                Assert::That(hll2.estimate(), Equals(hll.estimate()));
+            }
+        }
+
+        It(merge_hash_unmatched) {
+            HyperLogLog hll(10, HASH_WYHASH_64);
+            HyperLogLog hll2(10, HASH_PREHASHED_64);
+            AssertThrows(std::invalid_argument, hll.merge(hll2));
+            Assert::That(LastException<std::invalid_argument>().what(),
+                    Is().Containing("hash function doesn't match:"));
+        }
+
+        It(unknown_hash_type) {
+            AssertThrows(std::invalid_argument, HyperLogLog(10, static_cast<HashType>(4)));
+            Assert::That(LastException<std::invalid_argument>().what(), Is().Containing("unknown hash type"));
+        }
+    };
+
+    Describe(sparse) {
+        It(stays_sparse_at_low_cardinality) {
+            HyperLogLog hll(14, HASH_MURMUR3_X86_32, true);
+            Assert::That(hll.isSparse());
+            for (size_t i = 0; i < 100; ++i) {
+                hll.add((const char*)&i, sizeof(i));
+            }
+            Assert::That(hll.isSparse());
+            Assert::That(hll.memoryUsage(), IsLessThan((size_t)1024));
+            for (size_t i = 100; i < 10000; ++i) {
+                hll.add((const char*)&i, sizeof(i));
+            }
+            Assert::That(!hll.isSparse());
+            Assert::That(hll.memoryUsage(), Equals((size_t)1 << 14));
+        }
+
+        It(estimates_match_dense) {
+            const size_t counts[] = {1, 10, 1000, 2000, 5000};
+            for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+                HyperLogLog dense(14);
+                HyperLogLog sparse(14, HASH_MURMUR3_X86_32, true);
+                for (size_t i = 0; i < counts[c]; ++i) {
+                    dense.add((const char*)&i, sizeof(i));
+                    sparse.add((const char*)&i, sizeof(i));
+                }
+                Assert::That(sparse.estimate(), Equals(dense.estimate()));
+                sparse.toDense();
+                std::stringstream expect, actual;
+                dense.dump(expect);
+                sparse.dump(actual);
+                Assert::That(actual.str() == expect.str());
+            }
+        }
+
+        It(merge_across_representations) {
+            HyperLogLog expect(12);
+            HyperLogLog small1(12, HASH_MURMUR3_X86_32, true);
+            HyperLogLog small2(12, HASH_MURMUR3_X86_32, true);
+            HyperLogLog large(12);
+            for (size_t i = 0; i < 20000; ++i) {
+                expect.add((const char*)&i, sizeof(i));
+                if (i < 200) {
+                    small1.add((const char*)&i, sizeof(i));
+                } else if (i < 400) {
+                    small2.add((const char*)&i, sizeof(i));
+                } else {
+                    large.add((const char*)&i, sizeof(i));
+                }
+            }
+            HyperLogLog sparseFirst(small1);
+            sparseFirst.merge(small2);
+            Assert::That(sparseFirst.isSparse());
+            sparseFirst.merge(large);
+            Assert::That(!sparseFirst.isSparse());
+            Assert::That(sparseFirst.estimate(), Equals(expect.estimate()));
+
+            HyperLogLog denseFirst(large);
+            denseFirst.merge(small1);
+            denseFirst.merge(small2);
+            Assert::That(denseFirst.estimate(), Equals(expect.estimate()));
+        }
+
+        It(dump_and_restore) {
+            HyperLogLog hll(16, HASH_MURMUR3_X64_128, true);
+            for (size_t i = 0; i < 300; ++i) {
+                hll.add((const char*)&i, sizeof(i));
+            }
+            std::stringstream ss;
+            hll.dump(ss);
+            Assert::That(ss.str().size(), IsLessThan((size_t)2048));
+            HyperLogLog hll2;
+            hll2.restore(ss);
+            Assert::That(hll2.isSparse());
+            Assert::That(hll2.hashType(), Equals(HASH_MURMUR3_X64_128));
+            Assert::That(hll2.estimate(), Equals(hll.estimate()));
+        }
+
+        It(clear_keeps_representation) {
+            HyperLogLog hll(14, HASH_MURMUR3_X86_32, true);
+            for (size_t i = 0; i < 10; ++i) {
+                hll.add((const char*)&i, sizeof(i));
+            }
+            hll.clear();
+            Assert::That(hll.isSparse());
+            Assert::That(hll.estimate(), Equals(0.0));
+        }
+    };
+
+    Describe(estimate_cache) {
+        It(matches_full_scan_after_add) {
+            const HashType hashes[] = {HASH_MURMUR3_X86_32, HASH_MURMUR3_X64_128};
+            for (size_t h = 0; h < 2; ++h) {
+                HyperLogLog dense(10, hashes[h]);
+                HyperLogLog sparse(10, hashes[h], true);
+                for (size_t i = 0; i < 100000; ++i) {
+                    dense.add((const char*)&i, sizeof(i));
+                    sparse.add((const char*)&i, sizeof(i));
+                    if (i % 997 == 0) {
+                        Assert::That(dense.estimate(), Equals(dense.estimateExact()));
+                        Assert::That(sparse.estimate(), Equals(sparse.estimateExact()));
+                    }
+                }
+                Assert::That(dense.estimate(), Equals(dense.estimateExact()));
+                Assert::That(sparse.estimate(), Equals(dense.estimate()));
+            }
+        }
+
+        It(matches_full_scan_after_merge_and_restore) {
+            HyperLogLog hll1(12);
+            HyperLogLog hll2(12);
+            HyperLogLog small(12, HASH_MURMUR3_X86_32, true);
+            for (size_t i = 0; i < 30000; ++i) {
+                hll1.add((const char*)&i, sizeof(i));
+                const size_t j = i + 15000;
+                hll2.add((const char*)&j, sizeof(j));
+            }
+            for (size_t i = 50000; i < 50100; ++i) {
+                small.add((const char*)&i, sizeof(i));
+            }
+            hll1.merge(hll2);
+            Assert::That(hll1.estimate(), Equals(hll1.estimateExact()));
+            small.merge(hll1);
+            Assert::That(small.estimate(), Equals(small.estimateExact()));
+
+            std::stringstream ss;
+            small.dump(ss);
+            HyperLogLog restored;
+            restored.restore(ss);
+            Assert::That(restored.estimate(), Equals(small.estimate()));
+
+            restored.clear();
+            Assert::That(restored.estimate(), Equals(0.0));
+            Assert::That(restored.estimateExact(), Equals(0.0));
+        }
+
+        It(every_isa_gives_identical_sum) {
+            // every register value up to the 64 bit hash maximum, including ranks above 32
+            const uint8_t b = 10;
+            const uint32_t m = 1 << b;
+            std::string image(1, (char)(b | (HASH_MURMUR3_X64_128 << 6)));
+            RegisterSum expectSum;
+            uint32_t zeros = 0;
+            for (uint32_t i = 0; i < m; ++i) {
+                const uint8_t r = (i * 7) % (64 - b + 2);
+                image.push_back((char)r);
+                expectSum.add(r);
+                zeros += r == 0;
+            }
+            const double expect = estimateFromSum(HASH_MURMUR3_X64_128, m, alphaMM(m), expectSum.value(), zeros);
+            const simd::Isa saved = simd::isa();
+            const simd::Isa levels[] = {simd::ISA_SCALAR, simd::ISA_AVX2, simd::ISA_AVX512};
+            for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+                simd::setIsa(levels[l]);
+                std::stringstream ss(image);
+                HyperLogLog hll;
+                hll.restore(ss);
+                Assert::That(hll.estimate(), Equals(expect));
+                Assert::That(hll.estimateExact(), Equals(expect));
+            }
+            simd::setIsa(saved);
+        }
+    };
+
+    Describe(estimators) {
+        It(accurate_across_cardinalities) {
+            // standard error at b = 12 is about 1.6%; includes the range around 2.5m
+            const size_t points[] = {100, 1000, 5000, 10000, 12000, 50000, 500000};
+            HyperLogLog hll(12, HASH_WYHASH_64);
+            size_t n = 0;
+            for (size_t p = 0; p < sizeof(points) / sizeof(points[0]); ++p) {
+                for (; n < points[p]; ++n) {
+                    hll.add((const char*)&n, sizeof(n));
+                }
+                const double improved = hll.estimate(ESTIMATOR_IMPROVED);
+                const double ml = hll.estimate(ESTIMATOR_ML);
+                Assert::That(std::abs(improved - n) / n, IsLessThan(0.06));
+                Assert::That(std::abs(ml - n) / n, IsLessThan(0.06));
+                Assert::That(std::abs(ml - improved) / improved, IsLessThan(0.01));
+                Assert::That(hll.estimate(ESTIMATOR_CLASSIC), Equals(hll.estimate()));
+            }
+        }
+
+        It(empty_counter) {
+            HyperLogLog hll(10);
+            Assert::That(hll.estimate(ESTIMATOR_IMPROVED), Equals(0.0));
+            Assert::That(hll.estimate(ESTIMATOR_ML), Equals(0.0));
+        }
+
+        It(sparse_matches_dense) {
+            HyperLogLog dense(12);
+            HyperLogLog sparse(12, HASH_MURMUR3_X86_32, true);
+            for (size_t i = 0; i < 300; ++i) {
+                dense.add((const char*)&i, sizeof(i));
+                sparse.add((const char*)&i, sizeof(i));
+            }
+            Assert::That(sparse.estimate(ESTIMATOR_IMPROVED), Equals(dense.estimate(ESTIMATOR_IMPROVED)));
+            Assert::That(sparse.estimate(ESTIMATOR_ML), Equals(dense.estimate(ESTIMATOR_ML)));
+        }
+
+        It(every_isa_gives_identical_histogram) {
+            // lengths around the vector widths and the 255 block limit of the byte counters
+            const size_t lens[] = {1, 31, 64, 100, 255 * 32 + 7, 255 * 64 * 2 + 33};
+            std::vector<uint8_t> M(lens[5]);
+            for (size_t i = 0; i < M.size(); ++i) {
+                M[i] = (i * 2654435761u >> 7) % 56;
+            }
+            const simd::Isa saved = simd::isa();
+            const simd::Isa levels[] = {simd::ISA_SCALAR, simd::ISA_AVX2, simd::ISA_AVX512};
+            for (size_t k = 0; k < sizeof(lens) / sizeof(lens[0]); ++k) {
+                uint32_t expect[64] = {0};
+                for (size_t i = 0; i < lens[k]; ++i) {
+                    expect[M[i]]++;
+                }
+                for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+                    simd::setIsa(levels[l]);
+                    uint32_t hist[64] = {0};
+                    simd::registerHistogram(&M[0], lens[k], hist);
+                    for (size_t v = 0; v < 64; ++v) {
+                        Assert::That(hist[v], Equals(expect[v]));
+                    }
+                }
+            }
+            simd::setIsa(saved);
+        }
+    };
+
+    Describe(histogram) {
+        It(counts_registers) {
+            const HashType hashes[] = {HASH_MURMUR3_X86_32, HASH_MURMUR3_X64_128};
+            for (size_t h = 0; h < 2; ++h) {
+                HyperLogLog hll(10, hashes[h]);
+                for (size_t i = 0; i < 20000; ++i) {
+                    hll.add((const char*)&i, sizeof(i));
+                }
+                std::stringstream ss;
+                hll.dump(ss);
+                const std::string image = ss.str();
+                std::vector<uint32_t> expect(hashBits(hashes[h]) - 10 + 2, 0);
+                for (size_t i = 1; i < image.size(); ++i) {
+                    expect[(uint8_t) image[i]]++;
+                }
+                const std::vector<uint32_t> hist = hll.histogram();
+                Assert::That(hist.size(), Equals(expect.size()));
+                for (size_t v = 0; v < hist.size(); ++v) {
+                    Assert::That(hist[v], Equals(expect[v]));
+                }
+
+                HyperLogLog sparse(10, hashes[h], true);
+                for (size_t i = 0; i < 50; ++i) {
+                    sparse.add((const char*)&i, sizeof(i));
+                }
+                Assert::That(sparse.isSparse());
+                uint32_t total = 0;
+                const std::vector<uint32_t> sparseHist = sparse.histogram();
+                for (size_t v = 0; v < sparseHist.size(); ++v) {
+                    total += sparseHist[v];
+                }
+                Assert::That(total, Equals(sparse.registerSize()));
+                Assert::That(sparseHist[0], IsGreaterThan(sparse.registerSize() - 51));
+            }
+        }
+
+        It(tracked_matches_scan) {
+            HyperLogLog tracked(12, HASH_MURMUR3_X86_32, true);
+            HyperLogLog plain(12, HASH_MURMUR3_X86_32, true);
+            tracked.trackHistogram(true);
+            Assert::That(tracked.tracksHistogram());
+            HyperLogLog other(12);
+            for (size_t i = 0; i < 50000; ++i) {
+                const size_t v = i + 30000;
+                other.add((const char*)&v, sizeof(v));
+            }
+            for (size_t step = 0; step < 6; ++step) {
+                switch (step) {
+                    case 0:
+                    case 1:
+                        // sparse, then past the switch to dense
+                        for (size_t i = step * 100; i < (step + 1) * 100 + step * 40000; ++i) {
+                            tracked.add((const char*)&i, sizeof(i));
+                            plain.add((const char*)&i, sizeof(i));
+                        }
+                        break;
+                    case 2:
+                        tracked.merge(other);
+                        plain.merge(other);
+                        break;
+                    case 3: {
+                        std::stringstream ss;
+                        other.dump(ss);
+                        tracked.restore(ss);
+                        plain = other;
+                        break;
+                    }
+                    case 4:
+                        tracked.swap(plain);
+                        tracked.swap(plain);
+                        break;
+                    default:
+                        tracked.clear();
+                        plain.clear();
+                        break;
+                }
+                Assert::That(tracked.tracksHistogram());
+                const std::vector<uint32_t> expect = plain.histogram();
+                const std::vector<uint32_t> hist = tracked.histogram();
+                for (size_t v = 0; v < hist.size(); ++v) {
+                    Assert::That(hist[v], Equals(expect[v]));
+                }
+                Assert::That(tracked.estimate(ESTIMATOR_ML), Equals(plain.estimate(ESTIMATOR_ML)));
+            }
+            tracked.trackHistogram(false);
+            Assert::That(!tracked.tracksHistogram());
+        }
+    };
+
     Describe(merge) {
         It(merge_registers) {
             uint32_t k = 16;
@@ -164,7 +677,6 @@ Describe(hll_HyperLogLog) {
             double error = 0.0;
             for (size_t i = 0; i < execNum; ++i) {
                 HyperLogLog hll(k);
-                std::map<std::string, bool>().swap(GEN_STRINGS);
                 for (size_t i = 1; i < dataNum; ++i) {
                     std::string str;
                     getUniqueString((i%100) + 10, str);
@@ -187,12 +699,158 @@ Describe(hll_HyperLogLog) {
             Assert::That(errorRatio, IsLessThan(expectRatio));
         }
 
-        It(merge_size_unmatched_registers) {
-            HyperLogLog hll(16);
-            HyperLogLog hll2(10);
-            AssertThrows(std::invalid_argument, hll.merge(hll2));
+        It(merge_mixed_bit_widths_folds_down) {
+            const size_t nums[] = {60, 50000};
+            for (size_t k = 0; k < 2; ++k) {
+                HyperLogLog wide(14, HASH_MURMUR3_X86_32, true);
+                HyperLogLog narrow(10, HASH_MURMUR3_X86_32, true);
+                HyperLogLog expect(10);
+                for (size_t i = 0; i < nums[k]; ++i) {
+                    const size_t j = i + nums[k] / 2;
+                    wide.add((const char*)&i, sizeof(i));
+                    narrow.add((const char*)&j, sizeof(j));
+                    expect.add((const char*)&i, sizeof(i));
+                    expect.add((const char*)&j, sizeof(j));
+                }
+                HyperLogLog wideFirst(wide);
+                wideFirst.merge(narrow);
+                HyperLogLog narrowFirst(narrow);
+                narrowFirst.merge(wide);
+                HyperLogLog many(narrow);
+                const HyperLogLog* ptrs[] = {&wide, &wide};
+                many.mergeMany(ptrs, 2);
+                HyperLogLog* results[] = {&wideFirst, &narrowFirst, &many};
+                for (size_t r = 0; r < 3; ++r) {
+                    Assert::That(results[r]->registerSize(), Equals(1U << 10));
+                    results[r]->toDense();
+                    std::stringstream actualDump;
+                    results[r]->dump(actualDump);
+                    std::stringstream expectDump;
+                    expect.dump(expectDump);
+                    Assert::That(actualDump.str() == expectDump.str());
+                    Assert::That(results[r]->estimate(), Equals(results[r]->estimateExact()));
+                }
+            }
+        }
+
+        It(every_isa_gives_identical_registers) {
+            HyperLogLog hll1(14);
+            HyperLogLog hll2(14);
+            for (size_t i = 0; i < 50000; ++i) {
+                hll1.add((const char*)&i, sizeof(i));
+                const size_t j = i + 25000;
+                hll2.add((const char*)&j, sizeof(j));
+            }
+            const simd::Isa saved = simd::isa();
+            simd::setIsa(simd::ISA_SCALAR);
+            HyperLogLog expect(hll1);
+            expect.merge(hll2);
+            std::stringstream expectDump;
+            expect.dump(expectDump);
+            const simd::Isa levels[] = {simd::ISA_AVX2, simd::ISA_AVX512};
+            for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+                simd::setIsa(levels[l]);
+                HyperLogLog actual(hll1);
+                actual.merge(hll2);
+                std::stringstream actualDump;
+                actual.dump(actualDump);
+                Assert::That(actualDump.str() == expectDump.str());
+                Assert::That(actual.estimate(), Equals(expect.estimate()));
+                Assert::That(actual.estimate(), Equals(actual.estimateExact()));
+            }
+            simd::setIsa(saved);
+        }
+    };
+
+    Describe(fold) {
+        It(matches_adding_at_the_lower_width) {
+            const HashType hashes[] = {HASH_MURMUR3_X86_32, HASH_WYHASH_64};
+            const size_t nums[] = {100, 3000, 200000};
+            for (size_t h = 0; h < 2; ++h) {
+                for (size_t k = 0; k < 3; ++k) {
+                    HyperLogLog folded(16, hashes[h], true);
+                    HyperLogLog expect(11, hashes[h]);
+                    for (size_t i = 0; i < nums[k]; ++i) {
+                        folded.add((const char*)&i, sizeof(i));
+                        expect.add((const char*)&i, sizeof(i));
+                    }
+                    const bool wasSparse = folded.isSparse();
+                    folded.trackHistogram(true);
+                    folded.fold(11);
+                    Assert::That(folded.registerSize(), Equals(1U << 11));
+                    Assert::That(folded.isSparse(), Equals(wasSparse && nums[k] <= 256));
+                    Assert::That(folded.estimate(), Equals(folded.estimateExact()));
+                    const std::vector<uint32_t> hist = folded.histogram();
+                    const std::vector<uint32_t> expectHist = expect.histogram();
+                    Assert::That(hist.size(), Equals(expectHist.size()));
+                    for (size_t r = 0; r < hist.size(); ++r) {
+                        Assert::That(hist[r], Equals(expectHist[r]));
+                    }
+                    folded.toDense();
+                    std::stringstream actualDump;
+                    folded.dump(actualDump);
+                    std::stringstream expectDump;
+                    expect.dump(expectDump);
+                    Assert::That(actualDump.str() == expectDump.str());
+                }
+            }
+        }
+
+        It(checks_the_bit_width) {
+            HyperLogLog hll(12);
+            AssertThrows(std::invalid_argument, hll.fold(13));
+            Assert::That(LastException<std::invalid_argument>().what(),
+                    Is().Containing("bit width must be in the range [4,12]"));
+            AssertThrows(std::invalid_argument, hll.fold(3));
+            hll.fold(12);
+            Assert::That(hll.registerSize(), Equals(1U << 12));
+        }
+    };
+
+    Describe(merge_many) {
+        It(matches_repeated_merge) {
+            std::vector<HyperLogLog> parts;
+            for (size_t p = 0; p < 24; ++p) {
+                // the first few stay sparse
+                parts.push_back(HyperLogLog(14, HASH_MURMUR3_X86_32, true));
+                const size_t num = p < 4 ? 50 : 5000;
+                for (size_t i = 0; i < num; ++i) {
+                    const size_t v = p * 3000 + i;
+                    parts[p].add((const char*)&v, sizeof(v));
+                }
+            }
+            std::vector<const HyperLogLog*> ptrs;
+            HyperLogLog expect(14);
+            for (size_t p = 0; p < parts.size(); ++p) {
+                ptrs.push_back(&parts[p]);
+                expect.merge(parts[p]);
+            }
+            HyperLogLog actual(14, HASH_MURMUR3_X86_32, true);
+            actual.mergeMany(&ptrs[0], ptrs.size());
+            std::stringstream expectDump, actualDump;
+            expect.dump(expectDump);
+            actual.dump(actualDump);
+            Assert::That(actualDump.str() == expectDump.str());
+            Assert::That(actual.estimate(), Equals(actual.estimateExact()));
+
+            HyperLogLog sparseOnly(14, HASH_MURMUR3_X86_32, true);
+            sparseOnly.mergeMany(&ptrs[0], 4);
+            Assert::That(sparseOnly.isSparse());
+            Assert::That(sparseOnly.estimate(), Equals(sparseOnly.estimateExact()));
+        }
+
+        It(unmatched_counter_merges_nothing) {
+            HyperLogLog hll(12);
+            HyperLogLog hll2(12);
+            HyperLogLog hll3(12, HASH_MURMUR3_X64_128);
+            for (size_t i = 0; i < 1000; ++i) {
+                hll2.add((const char*)&i, sizeof(i));
+            }
+            const HyperLogLog* ptrs[] = {&hll2, &hll3};
+            AssertThrows(std::invalid_argument, hll.mergeMany(ptrs, 2));
             Assert::That(LastException<std::invalid_argument>().what(),
-                    Is().Containing("number of registers doesn't match:"));
+                    Is().Containing("hash function doesn't match:"));
+            Assert::That(hll.estimate(), Equals(0.0));
         }
     };
 };
@@ -0,0 +1,166 @@
+#include <igloo/igloo_alt.h>
+#include <igloo/TapTestListener.h>
+#include "hyperloglog_view.hpp"
+#include "TestUtil.hpp"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace igloo;
+using namespace hll;
+
+Describe(hll_HyperLogLogView) {
+    It(image_is_aligned) {
+        Assert::That(HyperLogLogView::imageSize(4), Equals((size_t)128));
+        Assert::That(HyperLogLogView::imageSize(14), Equals((size_t)64 + (1 << 14)));
+    }
+
+    It(estimate_matches_counter) {
+        const HashType hashes[] = {HASH_MURMUR3_X86_32, HASH_MURMUR3_X64_128};
+        for (size_t h = 0; h < 2; ++h) {
+            const HyperLogLog hll = filled(14, 0, 100000, hashes[h]);
+            std::vector<char> buf(HyperLogLogView::imageSize(14));
+            Assert::That(HyperLogLogView::writeImage(hll, &buf[0], buf.size()), Equals(buf.size()));
+            const HyperLogLogView view(&buf[0], buf.size());
+            Assert::That(view.verify());
+            Assert::That(view.hashType(), Equals(hashes[h]));
+            Assert::That(view.registerSize(), Equals((uint32_t)1 << 14));
+            Assert::That(view.estimate(), Equals(hll.estimate()));
+            Assert::That(dumpOf(view.toHyperLogLog()) == dumpOf(hll));
+        }
+    }
+
+    It(sparse_counter_written_dense) {
+        HyperLogLog hll(12, HASH_MURMUR3_X86_32, true);
+        for (size_t i = 0; i < 100; ++i) {
+            hll.add((const char*)&i, sizeof(i));
+        }
+        std::vector<char> buf(HyperLogLogView::imageSize(12));
+        HyperLogLogView::writeImage(hll, &buf[0], buf.size());
+        const HyperLogLogView view(&buf[0], buf.size());
+        Assert::That(view.estimate(), Equals(hll.estimate()));
+    }
+
+    It(merge_from_view) {
+        const HyperLogLog src = filled(12, 0, 20000);
+        std::vector<char> buf(HyperLogLogView::imageSize(12));
+        HyperLogLogView::writeImage(src, &buf[0], buf.size());
+        const HyperLogLogView view(&buf[0], buf.size());
+
+        HyperLogLog expect = filled(12, 10000, 30000);
+        HyperLogLog actual(expect);
+        expect.merge(src);
+        actual.merge(view);
+        Assert::That(dumpOf(actual) == dumpOf(expect));
+        Assert::That(actual.estimate(), Equals(expect.estimate()));
+
+        HyperLogLog other(13);
+        AssertThrows(std::invalid_argument, other.merge(view));
+        Assert::That(LastException<std::invalid_argument>().what(),
+                Is().Containing("number of registers doesn't match:"));
+    }
+
+    It(mapped_file_of_images) {
+        std::string path = "./t/hll_test.img";
+        ScopedFile sf(path);
+        {
+            std::ofstream ofs(path.c_str(), std::ios::binary);
+            for (size_t k = 0; k < 3; ++k) {
+                std::vector<char> buf(HyperLogLogView::imageSize(10));
+                HyperLogLogView::writeImage(filled(10, 0, 1000 * (k + 1)), &buf[0], buf.size());
+                ofs.write(&buf[0], buf.size());
+            }
+        }
+        const MappedFile file(path.c_str());
+        const char* p = static_cast<const char*>(file.data());
+        size_t off = 0;
+        for (size_t k = 0; k < 3; ++k) {
+            const HyperLogLogView view(p + off, file.size() - off);
+            Assert::That(view.estimate(), Equals(filled(10, 0, 1000 * (k + 1)).estimate()));
+            off += view.imageSize();
+        }
+        Assert::That(off, Equals(file.size()));
+    }
+
+    Describe(broken_image) {
+        It(detects_bad_header) {
+            std::vector<char> buf(HyperLogLogView::imageSize(8));
+            HyperLogLogView::writeImage(filled(8, 0, 100), &buf[0], buf.size());
+
+            std::vector<char> bad(buf);
+            bad[0] = 'X';
+            AssertThrows(std::runtime_error, HyperLogLogView(&bad[0], bad.size()));
+            Assert::That(LastException<std::runtime_error>().what(), Is().Containing("not a HyperLogLog image"));
+
+            bad = buf;
+            std::swap(bad[8], bad[11]);
+            AssertThrows(std::runtime_error, HyperLogLogView(&bad[0], bad.size()));
+            Assert::That(LastException<std::runtime_error>().what(), Is().Containing("endianness doesn't match"));
+
+            bad = buf;
+            bad[4] = 2;
+            AssertThrows(std::runtime_error, HyperLogLogView(&bad[0], bad.size()));
+            Assert::That(LastException<std::runtime_error>().what(), Is().Containing("unsupported image version"));
+
+            AssertThrows(std::runtime_error, HyperLogLogView(&buf[0], buf.size() - 100));
+        }
+
+        It(detects_bad_registers) {
+            std::vector<char> buf(HyperLogLogView::imageSize(8));
+            HyperLogLogView::writeImage(filled(8, 0, 100), &buf[0], buf.size());
+            buf[64 + 17] ^= 1;
+            const HyperLogLogView view(&buf[0], buf.size());
+            Assert::That(!view.verify());
+        }
+
+        It(rejects_out_of_range_registers) {
+            const simd::Isa saved = simd::isa();
+            const simd::Isa levels[] = {simd::ISA_SCALAR, simd::ISA_AVX2, simd::ISA_AVX512};
+            for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+                simd::setIsa(levels[l]);
+                const HashType hashes[] = {HASH_MURMUR3_X86_32, HASH_WYHASH_64};
+                for (size_t h = 0; h < 2; ++h) {
+                    std::vector<char> buf(HyperLogLogView::imageSize(12));
+                    HyperLogLogView::writeImage(filled(12, 0, 1000, hashes[h]), &buf[0], buf.size());
+                    const uint8_t top = maxRank(12, hashes[h]);
+                    // inside a vector block and in the last registers
+                    const size_t positions[] = {64 + 100, 64 + 4095};
+                    for (size_t p = 0; p < 2; ++p) {
+                        std::vector<char> bad(buf);
+                        bad[positions[p]] = (char) 200;
+                        AssertThrows(std::runtime_error, HyperLogLogView(&bad[0], bad.size()));
+                        Assert::That(LastException<std::runtime_error>().what(), Is().Containing("broken image registers"));
+                        bad[positions[p]] = top + 1;
+                        AssertThrows(std::runtime_error, HyperLogLogView(&bad[0], bad.size()));
+
+                        // the largest rank is valid and merges like any other register
+                        bad[positions[p]] = top;
+                        const HyperLogLogView view(&bad[0], bad.size());
+                        HyperLogLog hll(12, hashes[h]);
+                        hll.trackHistogram(true);
+                        hll.merge(view);
+                        Assert::That(hll.histogram()[top], Equals(1U));
+                        Assert::That(hll.estimate(), Equals(view.estimate()));
+                    }
+                }
+            }
+            simd::setIsa(saved);
+        }
+
+        It(buffer_too_small) {
+            std::vector<char> buf(100);
+            AssertThrows(std::invalid_argument, HyperLogLogView::writeImage(filled(8, 0, 1), &buf[0], buf.size()));
+        }
+    };
+};
+
+int main() {
+    DefaultTestResultsOutput output;
+    TestRunner runner(output);
+
+    TapTestListener listener;
+    runner.AddListener(&listener);
+
+    return runner.Run();
+}
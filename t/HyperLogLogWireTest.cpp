@@ -0,0 +1,160 @@
+#include <igloo/igloo_alt.h>
+#include <igloo/TapTestListener.h>
+#include "hyperloglog_wire.hpp"
+#include "TestUtil.hpp"
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace igloo;
+using namespace hll;
+
+namespace {
+// Test utilities
+
+static std::vector<uint8_t> encoded(const HyperLogLog& hll, WireEncoding encoding = WIRE_AUTO) {
+    std::vector<uint8_t> buf(HyperLogLogWire::encodedSize(hll, encoding));
+    Assert::That(HyperLogLogWire::encode(hll, &buf[0], buf.size(), encoding), Equals(buf.size()));
+    return buf;
+}
+
+}
+
+Describe(hll_HyperLogLogWire) {
+    It(picks_smallest_encoding) {
+        const size_t counts[] = {0, 100, 5000, 100000, 10000000};
+        const WireEncoding expect[] = {WIRE_SPARSE, WIRE_SPARSE, WIRE_NIBBLE, WIRE_NIBBLE, WIRE_NIBBLE};
+        for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+            const HyperLogLog hll = filled(12, 0, counts[c]);
+            const std::vector<uint8_t> buf = encoded(hll);
+            Assert::That((WireEncoding)buf[1], Equals(expect[c]));
+            const WireEncoding all[] = {WIRE_SPARSE, WIRE_PACKED, WIRE_NIBBLE};
+            for (size_t e = 0; e < 3; ++e) {
+                Assert::That(buf.size(), IsLessThan(HyperLogLogWire::encodedSize(hll, all[e]) + 1));
+            }
+            Assert::That(buf.size(), IsLessThan(HyperLogLogWire::maxEncodedSize(12) + 1));
+        }
+    }
+
+    It(auto_is_never_larger) {
+        // registers 0..127 alternate 1 and 40: one byte entries, so sparse beats packed
+        HyperLogLog alternating(8, HASH_WYHASH_64);
+        for (uint64_t i = 0; i < 128; ++i) {
+            const uint8_t rank = (i % 2 == 0) ? 1 : 40;
+            alternating.addHash((i << 56) | (uint64_t(1) << (56 - rank)));
+        }
+        std::vector<HyperLogLog> counters(1, alternating);
+        const uint8_t bits[] = {4, 8, 12};
+        const size_t counts[] = {0, 10, 100, 1000, 100000};
+        for (size_t k = 0; k < 3; ++k) {
+            for (size_t c = 0; c < 5; ++c) {
+                counters.push_back(filled(bits[k], 0, counts[c], HASH_WYHASH_64));
+                counters.push_back(filled(bits[k], 0, counts[c]));
+            }
+        }
+        const WireEncoding all[] = {WIRE_SPARSE, WIRE_PACKED, WIRE_NIBBLE};
+        for (size_t i = 0; i < counters.size(); ++i) {
+            const size_t size = HyperLogLogWire::encodedSize(counters[i]);
+            for (size_t e = 0; e < 3; ++e) {
+                Assert::That(size, IsLessThan(HyperLogLogWire::encodedSize(counters[i], all[e]) + 1));
+            }
+            Assert::That(encoded(counters[i]).size(), Equals(size));
+        }
+        Assert::That(HyperLogLogWire::encodedSize(alternating),
+                Equals(HyperLogLogWire::encodedSize(alternating, WIRE_SPARSE)));
+    }
+
+    It(round_trip_every_encoding) {
+        const HashType hashes[] = {HASH_MURMUR3_X86_32, HASH_MURMUR3_X64_128};
+        const size_t counts[] = {0, 100, 5000, 100000};
+        const WireEncoding all[] = {WIRE_AUTO, WIRE_SPARSE, WIRE_PACKED, WIRE_NIBBLE};
+        for (size_t h = 0; h < 2; ++h) {
+            for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+                const HyperLogLog hll = filled(10, 0, counts[c], hashes[h]);
+                for (size_t e = 0; e < 4; ++e) {
+                    const std::vector<uint8_t> buf = encoded(hll, all[e]);
+                    const HyperLogLog decoded = HyperLogLogWire::decode(&buf[0], buf.size());
+                    Assert::That(denseDumpOf(decoded) == denseDumpOf(hll));
+                    Assert::That(decoded.estimate(), Equals(hll.estimate()));
+                }
+            }
+        }
+    }
+
+    It(sparse_counter_sent_sparse) {
+        HyperLogLog hll(14, HASH_MURMUR3_X86_32, true);
+        for (size_t i = 0; i < 300; ++i) {
+            hll.add((const char*)&i, sizeof(i));
+        }
+        const std::vector<uint8_t> buf = encoded(hll, WIRE_PACKED);
+        Assert::That((WireEncoding)buf[1], Equals(WIRE_SPARSE));
+        Assert::That(buf.size(), IsLessThan((size_t)1024));
+        const HyperLogLog decoded = HyperLogLogWire::decode(&buf[0], buf.size());
+        Assert::That(decoded.isSparse());
+        Assert::That(decoded.estimate(), Equals(hll.estimate()));
+    }
+
+    It(decode_merge_matches_merge) {
+        const WireEncoding all[] = {WIRE_SPARSE, WIRE_PACKED, WIRE_NIBBLE};
+        const HyperLogLog src = filled(12, 0, 20000);
+        for (size_t e = 0; e < 3; ++e) {
+            const std::vector<uint8_t> buf = encoded(src, all[e]);
+            HyperLogLog expect = filled(12, 10000, 40000);
+            HyperLogLog actual(expect);
+            expect.merge(src);
+            Assert::That(HyperLogLogWire::decodeMerge(&buf[0], buf.size(), actual), Equals(buf.size()));
+            Assert::That(denseDumpOf(actual) == denseDumpOf(expect));
+            Assert::That(actual.estimate(), Equals(actual.estimateExact()));
+        }
+        const std::vector<uint8_t> buf = encoded(src);
+        HyperLogLog other(12, HASH_MURMUR3_X64_128);
+        AssertThrows(std::invalid_argument, HyperLogLogWire::decodeMerge(&buf[0], buf.size(), other));
+        Assert::That(LastException<std::invalid_argument>().what(), Is().Containing("hash function doesn't match:"));
+    }
+
+    It(messages_back_to_back) {
+        std::vector<uint8_t> stream;
+        for (size_t k = 0; k < 3; ++k) {
+            const std::vector<uint8_t> buf = encoded(filled(10, 0, 100 * (k + 1)));
+            stream.insert(stream.end(), buf.begin(), buf.end());
+        }
+        HyperLogLog sum(10);
+        size_t off = 0;
+        while (off < stream.size()) {
+            off += HyperLogLogWire::decodeMerge(&stream[off], stream.size() - off, sum);
+        }
+        Assert::That(sum.estimate(), Equals(filled(10, 0, 300).estimate()));
+    }
+
+    Describe(broken_message) {
+        It(truncated) {
+            const std::vector<uint8_t> buf = encoded(filled(10, 0, 5000));
+            AssertThrows(std::runtime_error, HyperLogLogWire::decode(&buf[0], buf.size() - 1));
+            AssertThrows(std::runtime_error, HyperLogLogWire::decode(&buf[0], 5));
+        }
+
+        It(bad_header) {
+            std::vector<uint8_t> buf = encoded(filled(10, 0, 5000));
+            buf[0] = 0;
+            AssertThrows(std::runtime_error, HyperLogLogWire::decode(&buf[0], buf.size()));
+            buf[0] = HLL_WIRE_MAGIC;
+            buf[1] = 9;
+            AssertThrows(std::runtime_error, HyperLogLogWire::decode(&buf[0], buf.size()));
+        }
+
+        It(buffer_too_small) {
+            const HyperLogLog hll = filled(10, 0, 5000);
+            std::vector<uint8_t> buf(HyperLogLogWire::encodedSize(hll) - 1);
+            AssertThrows(std::invalid_argument, HyperLogLogWire::encode(hll, &buf[0], buf.size()));
+        }
+    };
+};
+
+int main() {
+    DefaultTestResultsOutput output;
+    TestRunner runner(output);
+
+    TapTestListener listener;
+    runner.AddListener(&listener);
+
+    return runner.Run();
+}
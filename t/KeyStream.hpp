@@ -0,0 +1,150 @@
+#if !defined(HYPERLOGLOG_KEY_STREAM_HPP)
+#define HYPERLOGLOG_KEY_STREAM_HPP
+
+/**
+ * @file KeyStream.hpp
+ * @brief Seeded key streams with a known number of distinct keys, for the tests and the regression harness
+ */
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+/**
+ * Distribution of a key stream.
+ */
+enum StreamKind {
+    STREAM_DISTINCT = 0, ///< every key is new
+    STREAM_UNIFORM = 1, ///< new keys mixed with repeats of uniformly chosen earlier keys
+    STREAM_ZIPF = 2, ///< new keys mixed with repeats of earlier keys, recent ones Zipf(1)-distributed more often
+    STREAM_ADVERSARIAL = 3 ///< every key is new, but the keys are sequential integers behind a constant prefix
+};
+
+/** @class KeyStream
+ *  @brief Reproducible stream of keys whose number of distinct keys is known exactly.
+ *
+ * Key number i (the i-th distinct key) starts with a bijective 64 bit mix of
+ * i and the seed, so keys are distinct by construction: no set of the keys
+ * seen is needed, and a stream can run to billions of keys at a few
+ * nanoseconds each. Longer keys are padded with bytes derived from i.
+ * The adversarial stream skips the mix and writes i (offset by seed << 40)
+ * after a constant prefix, which leaves all of the entropy to the hash function.
+ *
+ * Duplicate-heavy streams emit a new key with probability 1 - duplicates
+ * and otherwise repeat one of the keys emitted so far.
+ */
+class KeyStream {
+public:
+
+    /**
+     * Constructor
+     *
+     * @param[in] kind distribution of the stream
+     * @param[in] seed seed; equal seeds give equal streams
+     * @param[in] length key length in bytes, at least 8
+     * @param[in] duplicates fraction of repeated keys in duplicate-heavy streams
+     */
+    KeyStream(StreamKind kind, uint64_t seed, uint32_t length = 8, double duplicates = 0.75) :
+            kind_(kind), seed_(seed), state_(seed), length_(length < 8 ? 8 : length), key_(length_),
+            repeat_(kind == STREAM_UNIFORM || kind == STREAM_ZIPF ? duplicates : 0.0), distinct_(0), count_(0) {
+    }
+
+    /**
+     * Returns the next key, valid until the next call.
+     *
+     * @return Pointer to length() bytes
+     */
+    const char* next() {
+        count_++;
+        uint64_t id = distinct_;
+        if (distinct_ != 0 && repeat_ > 0.0 && uniform() < repeat_) {
+            if (kind_ == STREAM_UNIFORM) {
+                id = (uint64_t)(uniform() * distinct_);
+            } else {
+                // P(r) ~ 1/r over r in [1, distinct], r = 1 the latest key
+                const uint64_t r = (uint64_t) std::exp(uniform() * std::log(distinct_ + 1.0));
+                id = distinct_ - std::min(std::max(r, (uint64_t) 1), distinct_);
+            }
+        } else {
+            distinct_++;
+        }
+        write(id);
+        return &key_[0];
+    }
+
+    /**
+     * Returns the key length.
+     *
+     * @return Length in bytes
+     */
+    uint32_t length() const {
+        return length_;
+    }
+
+    /**
+     * Returns the number of distinct keys emitted so far.
+     *
+     * @return Number of distinct keys
+     */
+    uint64_t distinct() const {
+        return distinct_;
+    }
+
+    /**
+     * Returns the number of keys emitted so far.
+     *
+     * @return Number of keys
+     */
+    uint64_t count() const {
+        return count_;
+    }
+
+    /**
+     * Bijective 64 bit mix (the splitmix64 finalizer).
+     */
+    static uint64_t mix(uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+private:
+    /**
+     * Uniform double in [0, 1) from a splitmix64 sequence.
+     */
+    double uniform() {
+        state_ += 0x9E3779B97F4A7C15ULL;
+        return (mix(state_) >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    /**
+     * Writes key number 'id' into key_.
+     */
+    void write(uint64_t id) {
+        if (kind_ == STREAM_ADVERSARIAL) {
+            const uint64_t word = id + (seed_ << 40);
+            std::memset(&key_[0], 'k', length_ - 8);
+            std::memcpy(&key_[length_ - 8], &word, 8);
+            return;
+        }
+        uint64_t word = mix(id + seed_ * 0x9E3779B97F4A7C15ULL);
+        std::memcpy(&key_[0], &word, 8);
+        for (uint32_t off = 8; off < length_; off += 8) {
+            word = mix(word + off);
+            std::memcpy(&key_[off], &word, std::min(8U, length_ - off));
+        }
+    }
+
+    StreamKind kind_; ///< distribution
+    uint64_t seed_; ///< seed of the keys
+    uint64_t state_; ///< state of the random numbers choosing repeats
+    uint32_t length_; ///< key length
+    std::vector<char> key_; ///< current key
+    double repeat_; ///< probability of a repeat
+    uint64_t distinct_; ///< distinct keys so far
+    uint64_t count_; ///< keys so far
+};
+
+#endif // !defined(HYPERLOGLOG_KEY_STREAM_HPP)
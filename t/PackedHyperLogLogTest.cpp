@@ -0,0 +1,118 @@
+#include <igloo/igloo_alt.h>
+#include <igloo/TapTestListener.h>
+#include "hyperloglog_packed.hpp"
+#include "TestUtil.hpp"
+#include <string>
+#include <cmath>
+#include <sstream>
+#include <vector>
+using namespace igloo;
+using namespace hll;
+
+Describe(hll_PackedHyperLogLog) {
+    Describe(create_instance) {
+        It(pass_out_of_range_argument_min) {
+            AssertThrows(std::invalid_argument, PackedHyperLogLog(3));
+            Assert::That(LastException<std::invalid_argument>().what(),
+                    Is().Containing("bit width must be in the range [4,30]"));
+        }
+
+        It(pass_out_of_range_argument_max) {
+            AssertThrows(std::invalid_argument, PackedHyperLogLog(31));
+            Assert::That(LastException<std::invalid_argument>().what(),
+                    Is().Containing("bit width must be in the range [4,30]"));
+        }
+    };
+
+    It(uses_less_memory_than_bytes) {
+        PackedHyperLogLog hll32(14);
+        PackedHyperLogLog hll64(14, HASH_MURMUR3_X64_128);
+        Assert::That(hll32.memoryUsage(), IsLessThan((size_t)(1 << 14) * 2 / 3 + 8));
+        Assert::That(hll64.memoryUsage(), IsLessThan((size_t)(1 << 14) * 4 / 5 + 8));
+    }
+
+    It(get_and_set_registers) {
+        PackedHyperLogLog hll(6, HASH_MURMUR3_X64_128);
+        for (uint32_t i = 0; i < hll.registerSize(); ++i) {
+            Assert::That(hll.setMax(i, (i % 59) + 1));
+        }
+        Assert::That(!hll.setMax(5, 1));
+        for (uint32_t i = 0; i < hll.registerSize(); ++i) {
+            Assert::That(hll.getRegister(i), Equals((uint8_t)((i % 59) + 1)));
+        }
+    }
+
+    It(estimate_matches_byte_registers) {
+        const HashType hashes[] = {HASH_MURMUR3_X86_32, HASH_MURMUR3_X64_128};
+        const size_t counts[] = {0, 10, 1000, 100000};
+        for (size_t h = 0; h < 2; ++h) {
+            for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+                HyperLogLog hll(10, hashes[h]);
+                PackedHyperLogLog packed(10, hashes[h]);
+                for (size_t i = 0; i < counts[c]; ++i) {
+                    hll.add((const char*)&i, sizeof(i));
+                    packed.add((const char*)&i, sizeof(i));
+                }
+                Assert::That(packed.estimate(), Equals(hll.estimate()));
+                Assert::That(dumpOf(packed.toHyperLogLog()) == dumpOf(hll));
+                Assert::That(PackedHyperLogLog(hll).estimate(), Equals(hll.estimate()));
+            }
+        }
+    }
+
+    It(dump_and_restore) {
+        PackedHyperLogLog hll(16, HASH_MURMUR3_X64_128);
+        for (size_t i = 0; i < 5000; ++i) {
+            hll.add((const char*)&i, sizeof(i));
+        }
+        std::stringstream ss;
+        hll.dump(ss);
+        Assert::That(ss.str().size(), IsLessThan((size_t)(1 << 16)));
+        PackedHyperLogLog hll2;
+        hll2.restore(ss);
+        Assert::That(hll2.hashType(), Equals(HASH_MURMUR3_X64_128));
+        Assert::That(hll2.estimate(), Equals(hll.estimate()));
+    }
+
+    Describe(merge) {
+        It(merge_matches_byte_registers) {
+            const HashType hashes[] = {HASH_MURMUR3_X86_32, HASH_MURMUR3_X64_128};
+            for (size_t h = 0; h < 2; ++h) {
+                HyperLogLog hll(12, hashes[h]);
+                HyperLogLog hll2(12, hashes[h]);
+                for (size_t i = 0; i < 20000; ++i) {
+                    (i % 3 ? hll : hll2).add((const char*)&i, sizeof(i));
+                }
+                const simd::Isa saved = simd::isa();
+                const simd::Isa levels[] = {simd::ISA_SCALAR, simd::ISA_AVX2, simd::ISA_AVX512};
+                for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+                    simd::setIsa(levels[l]);
+                    PackedHyperLogLog packed(hll);
+                    packed.merge(PackedHyperLogLog(hll2));
+                    HyperLogLog expect(hll);
+                    expect.merge(hll2);
+                    Assert::That(dumpOf(packed.toHyperLogLog()) == dumpOf(expect));
+                }
+                simd::setIsa(saved);
+            }
+        }
+
+        It(merge_size_unmatched_registers) {
+            PackedHyperLogLog hll(16);
+            PackedHyperLogLog hll2(10);
+            AssertThrows(std::invalid_argument, hll.merge(hll2));
+            Assert::That(LastException<std::invalid_argument>().what(),
+                    Is().Containing("number of registers doesn't match:"));
+        }
+    };
+};
+
+int main() {
+    DefaultTestResultsOutput output;
+    TestRunner runner(output);
+
+    TapTestListener listener;
+    runner.AddListener(&listener);
+
+    return runner.Run();
+}
@@ -0,0 +1,338 @@
+/**
+ * @file RegressionHarness.cpp
+ * @brief Accuracy and throughput regression sweep of HyperLogLog and HyperLogLogHIP
+ *
+ * For every counter, bit width and key stream the harness adds keys until the
+ * number of distinct keys reaches each point of a 1-2-5 series up to --max,
+ * estimates, and records the relative error and the time spent in add().
+ * It exits with 1 when
+ *  - the RMSE of the relative error at a point exceeds --error-factor times 1.04/sqrt(m),
+ *  - the mean relative error (bias) exceeds --bias-factor times 1.04/sqrt(m * runs), or
+ *  - add() throughput of a counter/bit width/stream is below (1 - --throughput-tolerance)
+ *    times the throughput recorded in the --baseline CSV (a previous --output).
+ *
+ * The keys come from KeyStream, so runs with the same options see the same keys.
+ */
+#include "hyperloglog.hpp"
+#include "KeyStream.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace hll;
+
+namespace {
+
+static const size_t kChunk = 4096; ///< keys generated ahead of each timed run of add()
+static const uint64_t kTimedFrom = 10000; ///< checkpoints below this are too short to time
+
+struct Options {
+    Options() :
+            max(1000000000ULL), runs(8), length(8), duplicates(0.75), hash(HASH_WYHASH_64), errorFactor(3.0),
+            biasFactor(4.0), throughputTolerance(0.2) {
+        bits.push_back(12);
+        streams.push_back(STREAM_DISTINCT);
+        streams.push_back(STREAM_UNIFORM);
+        streams.push_back(STREAM_ZIPF);
+        streams.push_back(STREAM_ADVERSARIAL);
+    }
+    uint64_t max; ///< largest cardinality
+    uint32_t runs; ///< runs (seeds) per configuration
+    uint32_t length; ///< key length
+    double duplicates; ///< fraction of repeated keys in the uniform and Zipf streams
+    HashType hash; ///< hash function of the counters
+    std::vector<uint8_t> bits; ///< bit widths
+    std::vector<StreamKind> streams; ///< key streams
+    double errorFactor; ///< RMSE bound in standard errors
+    double biasFactor; ///< bias bound in standard errors of the mean
+    double throughputTolerance; ///< allowed throughput loss against the baseline
+    std::string output; ///< CSV written with the results
+    std::string baseline; ///< CSV of a previous run to compare throughput with
+};
+
+// accumulated over the runs of one configuration at one cardinality
+struct Row {
+    Row(const std::string& counter, uint8_t b, StreamKind stream, uint64_t n) :
+            counter(counter), b(b), stream(stream), n(n), runs(0), sum(0.0), sum2(0.0), keys(0), seconds(0.0) {
+    }
+    double bias() const {
+        return sum / runs;
+    }
+    double rmse() const {
+        return std::sqrt(sum2 / runs);
+    }
+    std::string counter;
+    uint8_t b;
+    StreamKind stream;
+    uint64_t n; ///< distinct keys
+    uint32_t runs;
+    double sum; ///< sum of the relative errors
+    double sum2; ///< sum of the squared relative errors
+    uint64_t keys; ///< keys added since the previous checkpoint, over all runs
+    double seconds; ///< time spent adding them
+};
+
+static const char* const kStreamNames[] = {"distinct", "uniform", "zipf", "adversarial"};
+
+static bool parseStream(const std::string& name, StreamKind& kind) {
+    for (size_t i = 0; i < sizeof(kStreamNames) / sizeof(kStreamNames[0]); ++i) {
+        if (name == kStreamNames[i]) {
+            kind = static_cast<StreamKind>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parseHash(const std::string& name, HashType& hash) {
+    if (name == "murmur3_x86_32") {
+        hash = HASH_MURMUR3_X86_32;
+    } else if (name == "murmur3_x64_128") {
+        hash = HASH_MURMUR3_X64_128;
+    } else if (name == "wyhash_64") {
+        hash = HASH_WYHASH_64;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        items.push_back(item);
+    }
+    return items;
+}
+
+static void usage() {
+    std::cerr << "usage: hll_regression [--max N] [--runs R] [--b B[,B...]] [--streams S[,S...]] [--length L]\n"
+            "                      [--duplicates F] [--hash murmur3_x86_32|murmur3_x64_128|wyhash_64]\n"
+            "                      [--error-factor F] [--bias-factor F] [--throughput-tolerance F]\n"
+            "                      [--output FILE] [--baseline FILE]\n"
+            "streams: distinct, uniform, zipf, adversarial" << std::endl;
+}
+
+static bool parseOptions(int argc, char** argv, Options& o) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 == argc) {
+            return false;
+        }
+        const std::string value = argv[++i];
+        if (arg == "--max") {
+            o.max = (uint64_t) std::strtod(value.c_str(), 0);
+        } else if (arg == "--runs") {
+            o.runs = std::strtoul(value.c_str(), 0, 10);
+        } else if (arg == "--length") {
+            o.length = std::strtoul(value.c_str(), 0, 10);
+        } else if (arg == "--duplicates") {
+            o.duplicates = std::strtod(value.c_str(), 0);
+        } else if (arg == "--error-factor") {
+            o.errorFactor = std::strtod(value.c_str(), 0);
+        } else if (arg == "--bias-factor") {
+            o.biasFactor = std::strtod(value.c_str(), 0);
+        } else if (arg == "--throughput-tolerance") {
+            o.throughputTolerance = std::strtod(value.c_str(), 0);
+        } else if (arg == "--output") {
+            o.output = value;
+        } else if (arg == "--baseline") {
+            o.baseline = value;
+        } else if (arg == "--hash") {
+            if (!parseHash(value, o.hash)) {
+                return false;
+            }
+        } else if (arg == "--b") {
+            o.bits.clear();
+            const std::vector<std::string> items = split(value);
+            for (size_t k = 0; k < items.size(); ++k) {
+                const unsigned long b = std::strtoul(items[k].c_str(), 0, 10);
+                if (b < 4 || b > 30) {
+                    return false;
+                }
+                o.bits.push_back(b);
+            }
+        } else if (arg == "--streams") {
+            o.streams.clear();
+            const std::vector<std::string> items = split(value);
+            for (size_t k = 0; k < items.size(); ++k) {
+                StreamKind kind;
+                if (!parseStream(items[k], kind)) {
+                    return false;
+                }
+                o.streams.push_back(kind);
+            }
+        } else {
+            return false;
+        }
+    }
+    return o.max > 0 && o.runs > 0 && !o.bits.empty() && !o.streams.empty();
+}
+
+// 1, 2, 5, 10, 20, 50, ... up to max
+static std::vector<uint64_t> checkpoints(uint64_t max) {
+    std::vector<uint64_t> points;
+    for (uint64_t decade = 1; decade <= max; decade *= 10) {
+        const uint64_t steps[] = {1, 2, 5};
+        for (size_t i = 0; i < 3 && decade * steps[i] <= max; ++i) {
+            points.push_back(decade * steps[i]);
+        }
+        if (decade > max / 10) {
+            break;
+        }
+    }
+    return points;
+}
+
+template<typename Counter>
+static void sweep(const std::string& name, const Options& o, uint8_t b, StreamKind kind, std::vector<Row>& rows) {
+    const std::vector<uint64_t> points = checkpoints(o.max);
+    const size_t first = rows.size();
+    for (size_t i = 0; i < points.size(); ++i) {
+        rows.push_back(Row(name, b, kind, points[i]));
+    }
+    std::vector<char> chunk(kChunk * o.length);
+    for (uint32_t run = 0; run < o.runs; ++run) {
+        KeyStream keys(kind, run + 1, o.length, o.duplicates);
+        Counter hll(b, o.hash);
+        for (size_t i = 0; i < points.size(); ++i) {
+            Row& row = rows[first + i];
+            while (keys.distinct() < points[i]) {
+                size_t count = 0;
+                while (count < kChunk && keys.distinct() < points[i]) {
+                    std::memcpy(&chunk[count * o.length], keys.next(), o.length);
+                    count++;
+                }
+                const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                for (size_t k = 0; k < count; ++k) {
+                    hll.add(&chunk[k * o.length], o.length);
+                }
+                row.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                row.keys += count;
+            }
+            const double error = (hll.estimate() - (double) points[i]) / points[i];
+            row.runs++;
+            row.sum += error;
+            row.sum2 += error * error;
+        }
+    }
+}
+
+static std::string groupOf(const std::string& counter, unsigned b, const std::string& stream) {
+    std::stringstream ss;
+    ss << counter << " b=" << b << " " << stream;
+    return ss.str();
+}
+
+// add() throughput per counter/bit width/stream, over the checkpoints worth timing
+struct Throughput {
+    Throughput() :
+            keys(0), seconds(0.0) {
+    }
+    double rate() const {
+        return seconds > 0.0 ? keys / seconds : 0.0;
+    }
+    double keys;
+    double seconds;
+};
+
+static bool readBaseline(const std::string& path, std::map<std::string, Throughput>& baseline) {
+    std::ifstream ifs(path.c_str());
+    if (!ifs) {
+        return false;
+    }
+    std::string line;
+    std::getline(ifs, line); // header
+    while (std::getline(ifs, line)) {
+        const std::vector<std::string> f = split(line);
+        if (f.size() != 9 || std::strtoull(f[3].c_str(), 0, 10) < kTimedFrom) {
+            continue;
+        }
+        Throughput& t = baseline[groupOf(f[0], std::strtoul(f[1].c_str(), 0, 10), f[2])];
+        t.keys += std::strtod(f[7].c_str(), 0);
+        t.seconds += std::strtod(f[8].c_str(), 0);
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options o;
+    if (!parseOptions(argc, argv, o)) {
+        usage();
+        return 2;
+    }
+    std::map<std::string, Throughput> baseline;
+    if (!o.baseline.empty() && !readBaseline(o.baseline, baseline)) {
+        std::cerr << "cannot read baseline: " << o.baseline << std::endl;
+        return 2;
+    }
+
+    std::vector<Row> rows;
+    for (size_t i = 0; i < o.bits.size(); ++i) {
+        for (size_t j = 0; j < o.streams.size(); ++j) {
+            sweep<HyperLogLog>("HyperLogLog", o, o.bits[i], o.streams[j], rows);
+            sweep<HyperLogLogHIP>("HyperLogLogHIP", o, o.bits[i], o.streams[j], rows);
+        }
+    }
+
+    std::ofstream csv;
+    if (!o.output.empty()) {
+        csv.open(o.output.c_str());
+        csv << "counter,b,stream,n,runs,bias,rmse,keys,seconds\n";
+        csv.precision(10);
+    }
+    bool failed = false;
+    std::map<std::string, Throughput> current;
+    std::vector<std::string> order;
+    std::printf("%-16s %3s %-12s %12s %10s %10s %10s %12s\n", "counter", "b", "stream", "n", "bias", "rmse", "bound",
+            "adds/s");
+    for (size_t i = 0; i < rows.size(); ++i) {
+        const Row& r = rows[i];
+        const std::string stream = kStreamNames[r.stream];
+        const double sigma = 1.04 / std::sqrt((double)(1ULL << r.b));
+        const double rmseBound = o.errorFactor * sigma;
+        const double biasBound = o.biasFactor * sigma / std::sqrt((double) r.runs);
+        const bool bad = r.rmse() > rmseBound || std::abs(r.bias()) > biasBound;
+        std::printf("%-16s %3u %-12s %12llu %+10.5f %10.5f %10.5f %12.4g%s\n", r.counter.c_str(), (unsigned) r.b,
+                stream.c_str(), (unsigned long long) r.n, r.bias(), r.rmse(), rmseBound,
+                r.seconds > 0.0 ? r.keys / r.seconds : 0.0, bad ? "  FAIL" : "");
+        failed = failed || bad;
+        if (csv.is_open()) {
+            csv << r.counter << "," << (unsigned) r.b << "," << stream << "," << r.n << "," << r.runs << "," << r.bias()
+                    << "," << r.rmse() << "," << r.keys << "," << r.seconds << "\n";
+        }
+        if (r.n >= kTimedFrom) {
+            const std::string group = groupOf(r.counter, r.b, stream);
+            if (current.find(group) == current.end()) {
+                order.push_back(group);
+            }
+            current[group].keys += r.keys;
+            current[group].seconds += r.seconds;
+        }
+    }
+
+    for (size_t i = 0; i < order.size() && !baseline.empty(); ++i) {
+        const std::map<std::string, Throughput>::const_iterator base = baseline.find(order[i]);
+        if (base == baseline.end() || base->second.rate() == 0.0) {
+            continue;
+        }
+        const double ratio = current[order[i]].rate() / base->second.rate();
+        const bool bad = ratio < 1.0 - o.throughputTolerance;
+        std::printf("%-40s %12.4g adds/s, baseline %12.4g (%+.1f%%)%s\n", order[i].c_str(), current[order[i]].rate(),
+                base->second.rate(), (ratio - 1.0) * 100.0, bad ? "  FAIL" : "");
+        failed = failed || bad;
+    }
+    std::printf(failed ? "FAIL\n" : "PASS\n");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,162 @@
+#include <igloo/igloo_alt.h>
+#include <igloo/TapTestListener.h>
+#include "hyperloglog_rollup.hpp"
+#include "TestUtil.hpp"
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace igloo;
+using namespace hll;
+
+namespace {
+// Test utilities
+
+// ids of bucket t: a few of its own and a few shared with the neighbouring buckets
+static HyperLogLog bucketSketch(uint64_t t) {
+    HyperLogLog hll(10, HASH_MURMUR3_X86_32, true);
+    for (uint64_t i = 0; i < 20; ++i) {
+        const uint64_t v = (i < 10) ? t * 100 + i : (t + i) / 4;
+        hll.add((const char*)&v, sizeof(v));
+    }
+    return hll;
+}
+
+// fan-outs 4, 3, 5: buckets, "hours" of 4, "days" of 12 and "months" of 60 buckets
+static RollupHyperLogLog filledRollup(uint64_t buckets) {
+    RollupHyperLogLog rollup(10, HASH_MURMUR3_X86_32, std::vector<uint32_t>{4, 3, 5});
+    for (uint64_t t = 0; t < buckets; ++t) {
+        rollup.insert(bucketSketch(t), t);
+    }
+    return rollup;
+}
+
+}
+
+Describe(hll_RollupHyperLogLog) {
+    It(range_matches_naive_merge) {
+        const uint64_t buckets = 150;
+        const RollupHyperLogLog rollup = filledRollup(buckets);
+        Assert::That(rollup.levels(), Equals((size_t) 4));
+        Assert::That(rollup.span(3), Equals(60U));
+        Assert::That(rollup.nodeCount(0), Equals((size_t) buckets));
+        Assert::That(rollup.nodeCount(3), Equals((size_t) 3));
+
+        std::vector<const HyperLogLog*> nodes;
+        uint64_t state = 1;
+        for (size_t q = 0; q < 200; ++q) {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            const uint64_t from = (state >> 33) % (buckets + 10);
+            const uint64_t to = from + (state >> 17) % (buckets + 10 - from + 1);
+            HyperLogLog expect(10, HASH_MURMUR3_X86_32, true);
+            for (uint64_t t = from; t < to && t < buckets; ++t) {
+                expect.merge(bucketSketch(t));
+            }
+            const HyperLogLog actual = rollup.merged(from, to);
+            Assert::That(denseDumpOf(actual) == denseDumpOf(expect));
+            Assert::That(rollup.estimate(from, to), Equals(expect.estimate()));
+
+            // at most 2 * (fan-out - 1) nodes per level below the top
+            rollup.cover(from, to, nodes);
+            Assert::That(nodes.size(), IsLessThan(2 * (3 + 2 + 4) + (to - from) / 60 + 1));
+        }
+        Assert::That(rollup.estimate(buckets, buckets + 100), Equals(0.0));
+        Assert::That(rollup.estimate(10, 10), Equals(0.0));
+    }
+
+    It(long_ranges_visit_only_existing_nodes) {
+        const RollupHyperLogLog rollup = filledRollup(150);
+        const uint64_t end = std::numeric_limits<uint64_t>::max();
+        std::vector<const HyperLogLog*> nodes;
+        rollup.cover(0, end, nodes);
+        Assert::That(nodes.size(), Equals((size_t) 3));
+        Assert::That(rollup.estimate(0, end), Equals(rollup.estimate(0, 150)));
+        Assert::That(rollup.estimate(7, end), Equals(rollup.estimate(7, 150)));
+        Assert::That(rollup.estimate(end - 1000, end), Equals(0.0));
+
+        RollupHyperLogLog flat(10, HASH_MURMUR3_X86_32, std::vector<uint32_t>());
+        for (uint64_t t = 0; t < 20; ++t) {
+            flat.insert(bucketSketch(t * 1000000007ULL), t * 1000000007ULL);
+        }
+        flat.cover(0, end, nodes);
+        Assert::That(nodes.size(), Equals((size_t) 20));
+        flat.cover(1, end, nodes);
+        Assert::That(nodes.size(), Equals((size_t) 19));
+    }
+
+    It(add_matches_insert) {
+        RollupHyperLogLog added(10, HASH_WYHASH_64, std::vector<uint32_t>{4, 3});
+        RollupHyperLogLog inserted(10, HASH_WYHASH_64, std::vector<uint32_t>{4, 3});
+        for (uint64_t t = 0; t < 30; ++t) {
+            HyperLogLog sketch(10, HASH_WYHASH_64, true);
+            for (uint64_t v = t * 7; v < t * 7 + 50; ++v) {
+                added.add((const char*)&v, sizeof(v), t);
+                sketch.add((const char*)&v, sizeof(v));
+            }
+            inserted.insert(sketch, t);
+        }
+        for (uint64_t from = 0; from < 30; from += 5) {
+            Assert::That(denseDumpOf(added.merged(from, 30)) == denseDumpOf(inserted.merged(from, 30)));
+        }
+        std::stringstream a, b;
+        added.dump(a);
+        inserted.dump(b);
+        Assert::That(a.str() == b.str());
+
+        HyperLogLog wider(12, HASH_WYHASH_64);
+        inserted.insert(wider, 0);
+        AssertThrows(std::invalid_argument, inserted.insert(HyperLogLog(8, HASH_WYHASH_64), 0));
+        AssertThrows(std::invalid_argument, inserted.insert(HyperLogLog(10), 0));
+    }
+
+    It(expire_drops_old_nodes) {
+        RollupHyperLogLog rollup = filledRollup(150);
+        const double recent = rollup.estimate(60, 150);
+        rollup.expire(61);
+        Assert::That(rollup.nodeCount(0), Equals((size_t) 89));
+        Assert::That(rollup.nodeCount(3), Equals((size_t) 2));
+        // the nodes around bucket 60 stay, so later ranges are unchanged
+        Assert::That(rollup.estimate(61, 150), Equals(filledRollup(150).estimate(61, 150)));
+        Assert::That(rollup.estimate(60, 150), Equals(recent));
+        rollup.clear();
+        Assert::That(rollup.memoryUsage(), Equals((size_t) 0));
+    }
+
+    It(dump_and_restore) {
+        const RollupHyperLogLog rollup = filledRollup(100);
+        std::stringstream ss;
+        rollup.dump(ss);
+        RollupHyperLogLog restored(4);
+        restored.restore(ss);
+        Assert::That(restored.levels(), Equals((size_t) 4));
+        Assert::That(restored.registerSize(), Equals(1024U));
+        for (uint64_t from = 0; from < 100; from += 7) {
+            Assert::That(restored.estimate(from, 100), Equals(rollup.estimate(from, 100)));
+        }
+        std::stringstream again;
+        restored.dump(again);
+        Assert::That(again.str() == ss.str());
+
+        std::stringstream truncated(ss.str().substr(0, ss.str().size() / 2));
+        AssertThrows(std::runtime_error, restored.restore(truncated));
+        Assert::That(LastException<std::runtime_error>().what(), Is().Containing("Failed to restore"));
+        Assert::That(restored.estimate(0, 100), Equals(rollup.estimate(0, 100)));
+    }
+
+    It(rejects_bad_arguments) {
+        AssertThrows(std::invalid_argument, RollupHyperLogLog(3));
+        AssertThrows(std::invalid_argument, RollupHyperLogLog(10, HASH_MURMUR3_X86_32, std::vector<uint32_t>{60, 1}));
+        Assert::That(LastException<std::invalid_argument>().what(), Is().Containing("fan-out must be at least 2"));
+        RollupHyperLogLog flat(10, HASH_MURMUR3_X86_32, std::vector<uint32_t>());
+        Assert::That(flat.levels(), Equals((size_t) 1));
+    }
+};
+
+int main() {
+    DefaultTestResultsOutput output;
+    TestRunner runner(output);
+
+    TapTestListener listener;
+    runner.AddListener(&listener);
+
+    return runner.Run();
+}
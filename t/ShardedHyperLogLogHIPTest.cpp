@@ -0,0 +1,112 @@
+#include <igloo/igloo_alt.h>
+#include <igloo/TapTestListener.h>
+#include "hyperloglog_sharded.hpp"
+#include <atomic>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace igloo;
+using namespace hll;
+
+namespace {
+// Test utilities
+
+static std::string registersOf(const HyperLogLog& hll) {
+    std::stringstream ss;
+    hll.dump(ss);
+    // HyperLogLogHIP::dump appends its c_ and p_ after the registers
+    return ss.str().substr(0, 1 + hll.registerSize());
+}
+
+static void ingest(ShardedHyperLogLogHIP::Shard* shard, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+        shard->add((const char*)&i, sizeof(i));
+    }
+    shard->flush();
+}
+
+}
+
+Describe(hll_ShardedHyperLogLogHIP) {
+    It(estimate_is_zero_before_collect) {
+        ShardedHyperLogLogHIP hll(10);
+        ShardedHyperLogLogHIP::Shard& shard = hll.shard();
+        for (size_t i = 0; i < 100; ++i) {
+            shard.add((const char*)&i, sizeof(i));
+        }
+        Assert::That(hll.estimate(), Equals(0.0));
+        Assert::That(hll.stats().pending, Equals((uint64_t)100));
+    }
+
+    It(publishes_every_interval) {
+        ShardedHyperLogLogHIP hll(10, HASH_MURMUR3_X86_32, 64);
+        ShardedHyperLogLogHIP::Shard& shard = hll.shard();
+        for (size_t i = 0; i < 100; ++i) {
+            shard.add((const char*)&i, sizeof(i));
+        }
+        hll.collect();
+        ShardedHIPStats st = hll.stats();
+        Assert::That(st.epoch, Equals((uint64_t)1));
+        Assert::That(st.publishes, Equals((uint64_t)1));
+        Assert::That(st.collected, Equals((uint64_t)64));
+        Assert::That(st.pending, Equals((uint64_t)36));
+        Assert::That(hll.estimate(), IsGreaterThan(0.0));
+
+        shard.flush();
+        hll.collect();
+        st = hll.stats();
+        Assert::That(st.pending, Equals((uint64_t)0));
+        Assert::That(st.shardsMerged, Equals((uint64_t)2));
+    }
+
+    It(shards_from_many_threads_merge_to_same_registers) {
+        const size_t threads = 4;
+        const size_t perThread = 50000;
+        ShardedHyperLogLogHIP hll(12);
+        std::vector<ShardedHyperLogLogHIP::Shard*> shards;
+        for (size_t t = 0; t < threads; ++t) {
+            shards.push_back(&hll.shard());
+        }
+        std::atomic<bool> done(false);
+        std::thread collector([&hll, &done]() {
+            while (!done.load()) {
+                hll.collect();
+                std::this_thread::yield();
+            }
+        });
+        std::vector<std::thread> writers;
+        for (size_t t = 0; t < threads; ++t) {
+            writers.push_back(std::thread(ingest, shards[t], t * perThread, (t + 1) * perThread));
+        }
+        for (size_t t = 0; t < threads; ++t) {
+            writers[t].join();
+        }
+        done.store(true);
+        collector.join();
+        hll.collect();
+
+        const ShardedHIPStats st = hll.stats();
+        Assert::That(st.added, Equals((uint64_t)(threads * perThread)));
+        Assert::That(st.pending, Equals((uint64_t)0));
+
+        HyperLogLog expect(12);
+        for (size_t i = 0; i < threads * perThread; ++i) {
+            expect.add((const char*)&i, sizeof(i));
+        }
+        Assert::That(registersOf(hll.snapshot()) == registersOf(expect));
+        const double error = std::abs(hll.estimate() - (double)(threads * perThread)) / (threads * perThread);
+        Assert::That(error, IsLessThan(4 * 1.04 / std::sqrt(4096.0)));
+    }
+};
+
+int main() {
+    DefaultTestResultsOutput output;
+    TestRunner runner(output);
+
+    TapTestListener listener;
+    runner.AddListener(&listener);
+
+    return runner.Run();
+}
@@ -0,0 +1,137 @@
+#include <igloo/igloo_alt.h>
+#include <igloo/TapTestListener.h>
+#include "hyperloglog_store.hpp"
+#include "TestUtil.hpp"
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace igloo;
+using namespace hll;
+
+namespace {
+// Test utilities
+
+// key k gets k * k % 5000 elements, so most sketches stay sparse and some turn dense
+static size_t elementsOf(uint64_t key) {
+    return key * key % 5000;
+}
+
+}
+
+Describe(hll_SketchStore) {
+    It(matches_per_key_counters) {
+        const uint8_t bits[] = {4, 10, 14};
+        for (size_t k = 0; k < 3; ++k) {
+            SketchStore<uint64_t> store(bits[k], HASH_WYHASH_64);
+            std::map<uint64_t, HyperLogLog> expect;
+            // interleave the keys so blocks grow and move between adds
+            for (size_t round = 0; round < 5000; ++round) {
+                for (uint64_t key = 0; key < 200; ++key) {
+                    if (round < elementsOf(key)) {
+                        const uint64_t v = key * 100000 + round;
+                        store.add(key, (const char*)&v, sizeof(v));
+                        expect.insert(std::make_pair(key, HyperLogLog(bits[k], HASH_WYHASH_64, true))).first->second.add(
+                                (const char*)&v, sizeof(v));
+                    }
+                }
+            }
+            Assert::That(store.size(), Equals(expect.size()));
+            Assert::That(store.denseCount(), IsGreaterThan(0U));
+            for (std::map<uint64_t, HyperLogLog>::const_iterator it = expect.begin(); it != expect.end(); ++it) {
+                Assert::That(store.contains(it->first));
+                Assert::That(store.find(it->first).isSparse(), Equals(it->second.isSparse()));
+                Assert::That(dumpOf(store.find(it->first).toHyperLogLog()) == dumpOf(it->second));
+                Assert::That(store.estimate(it->first), Equals(it->second.estimate()));
+                Assert::That(store.estimate(it->first, ESTIMATOR_ML), Equals(it->second.estimate(ESTIMATOR_ML)));
+            }
+            Assert::That(store.contains(1000), IsFalse());
+            Assert::That(store.estimate(1000), Equals(0.0));
+        }
+    }
+
+    It(batch_matches_single_adds) {
+        SketchStore<uint64_t> single(12);
+        SketchStore<uint64_t> batch(12);
+        SketchStore<uint64_t> hashed(12, HASH_MURMUR3_X86_32, false);
+        SketchStore<uint64_t> dense(12, HASH_MURMUR3_X86_32, false);
+        const size_t n = 100000;
+        std::vector<uint64_t> keys(n);
+        std::vector<uint64_t> values(n);
+        std::vector<const char*> strs(n);
+        std::vector<uint32_t> lens(n, sizeof(uint64_t));
+        for (size_t i = 0; i < n; ++i) {
+            keys[i] = (i * 7919) % 3000;
+            values[i] = i;
+            strs[i] = (const char*)&values[i];
+            single.add(keys[i], strs[i], lens[i]);
+            dense.addHash(keys[i], hashElement(HASH_MURMUR3_X86_32, strs[i], lens[i]));
+        }
+        batch.addBatch(&keys[0], &strs[0], &lens[0], n);
+        std::vector<uint64_t> hashes(n);
+        for (size_t i = 0; i < n; ++i) {
+            hashes[i] = hashElement(HASH_MURMUR3_X86_32, strs[i], lens[i]);
+        }
+        hashed.addHashes(&keys[0], &hashes[0], n);
+        Assert::That(batch.size(), Equals(single.size()));
+        Assert::That(dense.denseCount(), Equals(dense.size()));
+        for (uint64_t key = 0; key < 3000; ++key) {
+            const std::string expect = dumpOf(single.find(key).toHyperLogLog());
+            Assert::That(dumpOf(batch.find(key).toHyperLogLog()) == expect);
+            Assert::That(hashed.estimate(key), Equals(single.estimate(key)));
+            Assert::That(dense.estimate(key), Equals(single.estimate(key)));
+        }
+    }
+
+    It(iterates_and_clears) {
+        SketchStore<std::string> store(8);
+        for (size_t i = 0; i < 1000; ++i) {
+            std::stringstream key;
+            key << "key" << i % 100;
+            store.add(key.str(), (const char*)&i, sizeof(i));
+        }
+        struct Visit {
+            Visit(std::map<std::string, double>& seen) : seen_(seen) {
+            }
+            void operator()(const std::string& key, const SketchStore<std::string>::Sketch& sketch) {
+                seen_[key] = sketch.estimate();
+            }
+            std::map<std::string, double>& seen_;
+        };
+        std::map<std::string, double> seen;
+        store.forEach(Visit(seen));
+        Assert::That(seen.size(), Equals((size_t) 100));
+        Assert::That(seen["key7"], Equals(store.estimate("key7")));
+        Assert::That(std::abs(seen["key7"] - 10), IsLessThan(1.0));
+
+        SketchStore<std::string> copy(store);
+        store.clear();
+        Assert::That(store.size(), Equals((size_t) 0));
+        Assert::That(store.contains("key7"), IsFalse());
+        Assert::That(copy.estimate("key7"), Equals(seen["key7"]));
+
+        AssertThrows(std::invalid_argument, SketchStore<uint64_t>(3));
+    }
+
+    It(memory_per_key_is_small) {
+        // a million keys of a few elements each
+        SketchStore<uint64_t> store(14);
+        for (uint64_t i = 0; i < 3000000; ++i) {
+            store.addHash(i % 1000000, i * 0x9E3779B97F4A7C15ULL);
+        }
+        Assert::That(store.size(), Equals((size_t) 1000000));
+        Assert::That(store.denseCount(), Equals((size_t) 0));
+        // a sparse HyperLogLog alone costs its object plus a heap block
+        Assert::That(store.memoryUsage() / store.size(), IsLessThan(sizeof(HyperLogLog)));
+    }
+};
+
+int main() {
+    DefaultTestResultsOutput output;
+    TestRunner runner(output);
+
+    TapTestListener listener;
+    runner.AddListener(&listener);
+
+    return runner.Run();
+}
@@ -0,0 +1,164 @@
+#include <igloo/igloo_alt.h>
+#include <igloo/TapTestListener.h>
+#include "hyperloglog_sliding.hpp"
+#include "TestUtil.hpp"
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace igloo;
+using namespace hll;
+
+namespace {
+// Test utilities
+
+// element i arrives at time i / 10 and repeats every 'period' elements
+struct Stream {
+    explicit Stream(size_t period) : period_(period) {
+    }
+    uint64_t element(size_t i) const {
+        return i % period_;
+    }
+    uint64_t time(size_t i) const {
+        return i / 10;
+    }
+    size_t period_;
+};
+
+static HyperLogLog windowOf(const Stream& s, size_t n, uint64_t window, uint64_t now) {
+    HyperLogLog hll(10);
+    for (size_t i = 0; i < n; ++i) {
+        if (s.time(i) + window > now && s.time(i) <= now) {
+            const uint64_t v = s.element(i);
+            hll.add((const char*)&v, sizeof(v));
+        }
+    }
+    return hll;
+}
+
+}
+
+Describe(hll_SlidingHyperLogLog) {
+    It(windows_match_plain_counter) {
+        const Stream s(30000);
+        const size_t n = 100000;
+        SlidingHyperLogLog sliding(10, 5000);
+        for (size_t i = 0; i < n; ++i) {
+            const uint64_t v = s.element(i);
+            sliding.add((const char*)&v, sizeof(v), s.time(i));
+        }
+        const uint64_t now = s.time(n - 1);
+        const uint64_t windows[] = {0, 1, 10, 300, 2999, 5000};
+        for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); ++w) {
+            const HyperLogLog expect = windowOf(s, n, windows[w], now);
+            Assert::That(dumpOf(sliding.toHyperLogLog(windows[w], now)) == dumpOf(expect));
+            Assert::That(sliding.estimate(windows[w], now), Equals(expect.estimate()));
+            Assert::That(sliding.estimate(windows[w], now, ESTIMATOR_ML), Equals(expect.estimate(ESTIMATOR_ML)));
+        }
+        // windows reaching back before the first element
+        const HyperLogLog early = windowOf(s, 20000, 5000, 1999);
+        SlidingHyperLogLog fresh(10, 5000);
+        for (size_t i = 0; i < 20000; ++i) {
+            const uint64_t v = s.element(i);
+            fresh.add((const char*)&v, sizeof(v), s.time(i));
+        }
+        Assert::That(fresh.estimate(5000, 1999), Equals(early.estimate()));
+    }
+
+    It(late_elements) {
+        const Stream s(1000000);
+        const size_t n = 50000;
+        std::vector<size_t> order(n);
+        for (size_t i = 0; i < n; ++i) {
+            order[i] = i;
+        }
+        // swap neighbours within 200 elements (20 time units)
+        for (size_t i = 0; i + 200 < n; i += 3) {
+            std::swap(order[i], order[i + (i * 7919) % 200]);
+        }
+        SlidingHyperLogLog sliding(10, 2000);
+        for (size_t k = 0; k < n; ++k) {
+            const uint64_t v = s.element(order[k]);
+            sliding.add((const char*)&v, sizeof(v), s.time(order[k]));
+        }
+        const uint64_t now = s.time(n - 1);
+        const uint64_t windows[] = {5, 100, 2000};
+        for (size_t w = 0; w < 3; ++w) {
+            Assert::That(dumpOf(sliding.toHyperLogLog(windows[w], now)) == dumpOf(windowOf(s, n, windows[w], now)));
+        }
+    }
+
+    It(merge_matches_single_stream) {
+        const Stream s(40000);
+        const size_t n = 60000;
+        SlidingHyperLogLog all(10, 3000);
+        SlidingHyperLogLog even(10, 3000);
+        SlidingHyperLogLog odd(10, 3000);
+        for (size_t i = 0; i < n; ++i) {
+            const uint64_t v = s.element(i);
+            all.add((const char*)&v, sizeof(v), s.time(i));
+            (i % 2 == 0 ? even : odd).add((const char*)&v, sizeof(v), s.time(i));
+        }
+        even.merge(odd);
+        const uint64_t now = s.time(n - 1);
+        // lists untouched since the maximum window passed keep stale pairs until expire()
+        even.expire(now);
+        all.expire(now);
+        Assert::That(even.entryCount(), Equals(all.entryCount()));
+        Assert::That(dumpOf(even.toHyperLogLog(3000, now)) == dumpOf(all.toHyperLogLog(3000, now)));
+        Assert::That(dumpOf(even.toHyperLogLog(20, now)) == dumpOf(all.toHyperLogLog(20, now)));
+
+        SlidingHyperLogLog other(11, 3000);
+        AssertThrows(std::invalid_argument, even.merge(other));
+    }
+
+    It(long_lists_spill) {
+        // few registers and timestamps spanning more than 2^32 units
+        const uint64_t step = uint64_t(1) << 20;
+        const size_t n = 20000;
+        SlidingHyperLogLog sliding(4, uint64_t(1) << 40);
+        HyperLogLog all(4);
+        HyperLogLog recent(4);
+        for (uint64_t i = 0; i < n; ++i) {
+            sliding.add((const char*)&i, sizeof(i), i * step);
+            all.add((const char*)&i, sizeof(i));
+            if (i >= n - 5000) {
+                recent.add((const char*)&i, sizeof(i));
+            }
+        }
+        const uint64_t now = (n - 1) * step;
+        Assert::That(dumpOf(sliding.toHyperLogLog(uint64_t(1) << 40, now)) == dumpOf(all));
+        Assert::That(dumpOf(sliding.toHyperLogLog(5000 * step, now)) == dumpOf(recent));
+        sliding.expire(now + (uint64_t(1) << 40));
+        Assert::That(sliding.entryCount(), Equals((size_t) 0));
+    }
+
+    It(memory_is_bounded) {
+        SlidingHyperLogLog sliding(8, 100, HASH_WYHASH_64);
+        for (uint64_t i = 0; i < 200000; ++i) {
+            sliding.add((const char*)&i, sizeof(i), i / 100);
+        }
+        // at most q + 1 pairs per register, in practice a few
+        Assert::That(sliding.entryCount(), IsLessThan(sliding.registerSize() * (64 - 8 + 1)));
+        Assert::That(sliding.entryCount(), IsLessThan(sliding.registerSize() * 16));
+        Assert::That(sliding.memoryUsage(), IsGreaterThan(sliding.entryCount() * 8));
+        sliding.expire(1999 + 101);
+        Assert::That(sliding.entryCount(), Equals((size_t) 0));
+        Assert::That(sliding.estimate(100, 1999 + 101), Equals(0.0));
+        AssertThrows(std::invalid_argument, sliding.estimate(101, 2000));
+        AssertThrows(std::invalid_argument, SlidingHyperLogLog(8, 0));
+        sliding.add("a", 1, 5000);
+        sliding.clear();
+        Assert::That(sliding.entryCount(), Equals((size_t) 0));
+    }
+};
+
+int main() {
+    DefaultTestResultsOutput output;
+    TestRunner runner(output);
+
+    TapTestListener listener;
+    runner.AddListener(&listener);
+
+    return runner.Run();
+}
@@ -0,0 +1,72 @@
+#if !defined(HYPERLOGLOG_TEST_UTIL_HPP)
+#define HYPERLOGLOG_TEST_UTIL_HPP
+
+/**
+ * @file TestUtil.hpp
+ * @brief Helpers shared by the tests
+ */
+
+#include "hyperloglog.hpp"
+#include <cstdio>
+#include <sstream>
+#include <string>
+
+/**
+ * Returns the dump() of a counter, to compare registers byte for byte.
+ */
+template<typename Counter>
+inline std::string dumpOf(const Counter& hll) {
+    std::stringstream ss;
+    hll.dump(ss);
+    return ss.str();
+}
+
+/**
+ * Returns the dump() of a dense copy of a counter, so that a sparse counter
+ * and a dense one with the same registers compare equal.
+ */
+inline std::string denseDumpOf(hll::HyperLogLog hll) {
+    hll.toDense();
+    return dumpOf(hll);
+}
+
+/**
+ * Adds the integers [from, to) to a counter.
+ */
+template<typename Counter>
+inline void addRange(Counter& hll, uint64_t from, uint64_t to) {
+    for (uint64_t v = from; v < to; ++v) {
+        hll.add((const char*)&v, sizeof(v));
+    }
+}
+
+/**
+ * Returns a counter of the integers [from, to).
+ */
+inline hll::HyperLogLog filled(uint8_t b, uint64_t from, uint64_t to, hll::HashType hash = hll::HASH_MURMUR3_X86_32,
+        bool sparse = false) {
+    hll::HyperLogLog hll(b, hash, sparse);
+    addRange(hll, from, to);
+    return hll;
+}
+
+/**
+ * Removes a file when it goes out of scope.
+ */
+class ScopedFile {
+public:
+    ScopedFile(std::string& filename) : filename_(filename) {
+    }
+
+    ~ScopedFile() {
+        remove(filename_.c_str());
+    }
+
+    const std::string& getFileName() const {
+        return filename_;
+    }
+private:
+    std::string filename_;
+};
+
+#endif // !defined(HYPERLOGLOG_TEST_UTIL_HPP)
@@ -0,0 +1,378 @@
+/**
+ * @file HllCount.cpp
+ * @brief hll-count: estimates the number of distinct lines (or columns of lines) in files or stdin
+ *
+ * Regular files are mapped and split at newlines into one range per thread;
+ * stdin and other unmappable inputs are read in blocks, the next block being
+ * read while the threads hash the current one. Each thread adds the hashes of
+ * its lines to a counter of its own, and the counters are merged at the end,
+ * so the registers are the same whatever the number of threads.
+ *
+ * With --column K only the K-th field of each line is counted (fields split at
+ * --delimiter, a tab by default; with --csv at commas, where a field may be
+ * quoted with embedded commas and doubled quotes). Records are lines: a quoted
+ * field can't span lines. A trailing carriage return is ignored, and empty
+ * lines and lines without the K-th field are skipped.
+ */
+#include "hyperloglog_parallel.hpp"
+#include "hyperloglog_view.hpp"
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace hll;
+
+namespace {
+
+static const size_t kBatch = 256; ///< hashes added to a counter at once
+static const size_t kBlock = 16 << 20; ///< bytes read from a stream at once
+
+struct Options {
+    Options() :
+            b(14), hash(HASH_WYHASH_64), estimator(ESTIMATOR_CLASSIC), threads(std::thread::hardware_concurrency()),
+            column(0), delimiter('\t'), quotes(false), verbose(false) {
+    }
+    uint8_t b; ///< bit width of the counter
+    HashType hash; ///< hash function of the counter
+    EstimatorType estimator; ///< estimator of the printed value
+    size_t threads; ///< threads hashing lines
+    uint32_t column; ///< field counted, from 1; 0 is the whole line
+    char delimiter; ///< field delimiter
+    bool quotes; ///< fields may be quoted (CSV)
+    bool verbose; ///< report lines, bytes and throughput on stderr
+    std::string dump; ///< file the counter is dumped to
+    std::vector<std::string> inputs; ///< input files; none or "-" is stdin
+};
+
+// what one thread has counted
+struct Local {
+    Local(const Options& o) :
+            hll(o.b, o.hash), lines(0), bytes(0) {
+    }
+    HyperLogLog hll;
+    uint64_t lines;
+    uint64_t bytes;
+};
+
+static bool parseHash(const std::string& name, HashType& hash) {
+    if (name == "murmur3_x86_32") {
+        hash = HASH_MURMUR3_X86_32;
+    } else if (name == "murmur3_x64_128") {
+        hash = HASH_MURMUR3_X64_128;
+    } else if (name == "wyhash_64") {
+        hash = HASH_WYHASH_64;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// parses a decimal number in [min, max]; nothing but digits is accepted
+static bool parseNumber(const std::string& value, unsigned long min, unsigned long max, unsigned long& out) {
+    if (value.empty() || value[0] < '0' || value[0] > '9') {
+        return false;
+    }
+    errno = 0;
+    char* end = 0;
+    out = std::strtoul(value.c_str(), &end, 10);
+    return errno == 0 && *end == '\0' && min <= out && out <= max;
+}
+
+static void usage() {
+    std::cerr << "usage: hll-count [--b B] [--hash murmur3_x86_32|murmur3_x64_128|wyhash_64] [--estimator classic|ml]\n"
+            "                 [--threads N] [--column K] [--delimiter C | --csv] [--dump FILE] [--verbose]\n"
+            "                 [FILE...]\n"
+            "Prints the estimated number of distinct lines of the files (stdin without FILE or with \"-\")." << std::endl;
+}
+
+static bool parseOptions(int argc, char** argv, Options& o) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--csv") {
+            o.delimiter = ',';
+            o.quotes = true;
+            continue;
+        }
+        if (arg == "--verbose") {
+            o.verbose = true;
+            continue;
+        }
+        if (arg.size() < 2 || arg.compare(0, 2, "--") != 0) {
+            o.inputs.push_back(arg);
+            continue;
+        }
+        if (i + 1 == argc) {
+            return false;
+        }
+        const std::string value = argv[++i];
+        if (arg == "--b") {
+            unsigned long b;
+            if (!parseNumber(value, 4, 30, b)) {
+                return false;
+            }
+            o.b = b;
+        } else if (arg == "--hash") {
+            if (!parseHash(value, o.hash)) {
+                return false;
+            }
+        } else if (arg == "--estimator") {
+            if (value == "classic") {
+                o.estimator = ESTIMATOR_CLASSIC;
+            } else if (value == "ml") {
+                o.estimator = ESTIMATOR_ML;
+            } else {
+                return false;
+            }
+        } else if (arg == "--threads") {
+            unsigned long threads;
+            if (!parseNumber(value, 1, 1024, threads)) {
+                return false;
+            }
+            o.threads = threads;
+        } else if (arg == "--column") {
+            unsigned long column;
+            if (!parseNumber(value, 1, std::numeric_limits<uint32_t>::max(), column)) {
+                return false;
+            }
+            o.column = column;
+        } else if (arg == "--delimiter") {
+            if (value == "\\t") {
+                o.delimiter = '\t';
+            } else if (value.size() == 1) {
+                o.delimiter = value[0];
+            } else {
+                return false;
+            }
+            o.quotes = false;
+        } else if (arg == "--dump") {
+            o.dump = value;
+        } else {
+            return false;
+        }
+    }
+    if (o.threads == 0) {
+        o.threads = 1;
+    }
+    return true;
+}
+
+// finds field 'column' of the line [p, end); false when the line has fewer fields
+static bool field(const char* p, const char* end, const Options& o, const char*& key, size_t& len) {
+    for (uint32_t c = 1;; ++c) {
+        const char* start = p;
+        const char* stop = 0;
+        if (o.quotes && p < end && *p == '"') {
+            start = ++p;
+            while (p < end) {
+                if (*p == '"') {
+                    if (p + 1 < end && p[1] == '"') {
+                        p += 2;
+                        continue;
+                    }
+                    break;
+                }
+                ++p;
+            }
+            stop = p;
+            if (p < end) {
+                ++p; // closing quote
+            }
+        }
+        const char* next = (const char*) std::memchr(p, o.delimiter, end - p);
+        p = (next != 0) ? next : end;
+        if (stop == 0) {
+            stop = p; // unquoted field
+        }
+        if (c == o.column) {
+            key = start;
+            len = stop - start;
+            return true;
+        }
+        if (p == end) {
+            return false;
+        }
+        ++p;
+    }
+}
+
+// adds the lines of [p, end), which starts at a line and ends after a newline or at the end of the input
+static void countLines(const char* p, const char* end, const Options& o, Local& local) {
+    uint64_t hashes[kBatch];
+    size_t n = 0;
+    local.bytes += end - p;
+    while (p < end) {
+        const char* eol = (const char*) std::memchr(p, '\n', end - p);
+        if (eol == 0) {
+            eol = end;
+        }
+        const char* stop = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+        const char* key = p;
+        size_t len = stop - p;
+        if (len != 0 && (o.column == 0 || field(p, stop, o, key, len))) {
+            hashes[n++] = hashElement(o.hash, key, len);
+            if (n == kBatch) {
+                local.hll.addHashes(hashes, n);
+                n = 0;
+            }
+        }
+        local.lines++;
+        p = eol + 1;
+    }
+    local.hll.addHashes(hashes, n);
+}
+
+// start of the first line at or after offset 'off'
+static size_t lineStart(const char* data, size_t size, size_t off) {
+    if (off == 0 || off >= size) {
+        return std::min(off, size);
+    }
+    const char* eol = (const char*) std::memchr(data + off - 1, '\n', size - off + 1);
+    return (eol != 0) ? eol + 1 - data : size;
+}
+
+// splits [data, data + size) into one range of whole lines per local
+static void countRange(const char* data, size_t size, const Options& o, ThreadPool& pool, std::vector<Local>& locals) {
+    const size_t n = locals.size();
+    pool(n, [&](size_t i) {
+        const size_t from = lineStart(data, size, size / n * i);
+        const size_t to = (i + 1 == n) ? size : lineStart(data, size, size / n * (i + 1));
+        if (from < to) {
+            countLines(data + from, data + to, o, locals[i]);
+        }
+    });
+}
+
+// reads blocks of whole lines, counting each while the next is read
+static bool countStream(std::FILE* in, const Options& o, ThreadPool& pool, std::vector<Local>& locals) {
+    std::vector<char> cur(kBlock);
+    std::vector<char> next(kBlock);
+    size_t len = std::fread(&cur[0], 1, cur.size(), in);
+    bool eof = (len < cur.size());
+    for (;;) {
+        // the block ends after its last newline; the rest goes to the next block
+        size_t cut = len;
+        if (!eof) {
+            while (cut > 0 && cur[cut - 1] != '\n') {
+                cut--;
+            }
+            if (cut == 0) {
+                // no newline in the block: make room for a longer line
+                cur.resize(cur.size() * 2);
+                len += std::fread(&cur[len], 1, cur.size() - len, in);
+                eof = (len < cur.size());
+                continue;
+            }
+        }
+        size_t nextLen = 0;
+        bool nextEof = true;
+        std::thread reader;
+        if (!eof) {
+            if (next.size() < cur.size()) {
+                next.resize(cur.size());
+            }
+            std::memcpy(&next[0], &cur[cut], len - cut);
+            nextLen = len - cut;
+            reader = std::thread([&]() {
+                nextLen += std::fread(&next[nextLen], 1, next.size() - nextLen, in);
+                nextEof = (nextLen < next.size());
+            });
+        }
+        countRange(&cur[0], cut, o, pool, locals);
+        if (eof) {
+            break;
+        }
+        reader.join();
+        cur.swap(next);
+        len = nextLen;
+        eof = nextEof;
+    }
+    return !std::ferror(in);
+}
+
+static bool countInput(const std::string& path, const Options& o, ThreadPool& pool, std::vector<Local>& locals) {
+    if (path == "-") {
+        return countStream(stdin, o, pool, locals);
+    }
+#if defined(HLL_HAS_MMAP)
+    struct stat st;
+    if (::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+        try {
+            MappedFile file(path.c_str());
+            countRange((const char*) file.data(), file.size(), o, pool, locals);
+            return true;
+        } catch (const std::runtime_error&) {
+            // fall back to reading the file
+        }
+    }
+#endif
+    std::FILE* in = std::fopen(path.c_str(), "rb");
+    if (in == 0) {
+        return false;
+    }
+    const bool ok = countStream(in, o, pool, locals);
+    std::fclose(in);
+    return ok;
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options o;
+    if (!parseOptions(argc, argv, o)) {
+        usage();
+        return 2;
+    }
+    if (o.inputs.empty()) {
+        o.inputs.push_back("-");
+    }
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ThreadPool pool(o.threads);
+    std::vector<Local> locals(pool.size(), Local(o));
+    for (size_t i = 0; i < o.inputs.size(); ++i) {
+        if (!countInput(o.inputs[i], o, pool, locals)) {
+            std::cerr << "hll-count: cannot read " << o.inputs[i] << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<const HyperLogLog*> counters;
+    uint64_t lines = 0;
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < locals.size(); ++i) {
+        counters.push_back(&locals[i].hll);
+        lines += locals[i].lines;
+        bytes += locals[i].bytes;
+    }
+    HyperLogLog hll(o.b, o.hash);
+    hll.mergeMany(&counters[0], counters.size());
+    std::printf("%.0f\n", hll.estimate(o.estimator));
+
+    if (!o.dump.empty()) {
+        std::ofstream out(o.dump.c_str(), std::ios::binary);
+        try {
+            hll.dump(out);
+            out.close();
+            if (out.fail()) {
+                throw std::runtime_error("Failed to dump");
+            }
+        } catch (const std::runtime_error& e) {
+            std::cerr << "hll-count: " << e.what() << ": " << o.dump << std::endl;
+            return 1;
+        }
+    }
+    if (o.verbose) {
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::fprintf(stderr, "%llu lines, %llu bytes in %.3f s (%.1f MB/s, %zu threads)\n", (unsigned long long) lines,
+                (unsigned long long) bytes, seconds, bytes / seconds / 1e6, pool.size());
+    }
+    return 0;
+}